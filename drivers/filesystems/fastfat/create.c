@@ -176,6 +176,15 @@ FindFile(
             ExFreePoolWithTag(PathNameBuffer, TAG_NAME);
             return Status;
         }
+
+        /* then in the name index of large directories */
+        if (vfatNameIndexFindFile(DeviceExt, Parent, FileToFindU, DirContext, &Status))
+        {
+            DPRINT("FindFile: indexed lookup of %wZ, DirIndex %u, Status %lx\n",
+                FileToFindU, DirContext->DirIndex, Status);
+            ExFreePoolWithTag(PathNameBuffer, TAG_NAME);
+            return Status;
+        }
     }
 
     /* FsRtlIsNameInExpression need the searched string to be upcase,
@@ -0,0 +1,405 @@
+/*
+ * COPYRIGHT:        See COPYING in the top level directory
+ * PROJECT:          ReactOS kernel
+ * FILE:             drivers/filesystems/fastfat/dirindex.c
+ * PURPOSE:          Hashed index of the names of large directories
+ *
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "vfat.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* Directories smaller than this number of entries are just scanned */
+#define NAME_INDEX_MIN_ENTRIES 256
+#define NAME_INDEX_INITIAL_BUCKETS 256
+
+/* FUNCTIONS *****************************************************************/
+
+/*
+ * Case insensitive hash of a name, names equal for RtlEqualUnicodeString
+ * with CaseInSensitive set have the same hash.
+ */
+static
+ULONG
+vfatNameIndexHash(
+    PUNICODE_STRING NameU)
+{
+    ULONG Hash = 0;
+    USHORT i;
+
+    for (i = 0; i < NameU->Length / sizeof(WCHAR); i++)
+    {
+        Hash = (Hash * 31) + RtlUpcaseUnicodeChar(NameU->Buffer[i]);
+    }
+    return Hash;
+}
+
+VOID
+vfatNameIndexFree(
+    PVFATFCB DirFcb)
+{
+    PVFAT_NAME_INDEX Index = DirFcb->NameIndex;
+    PVFAT_NAME_INDEX_ENTRY Entry;
+    ULONG i;
+
+    if (Index == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < Index->BucketCount; i++)
+    {
+        while (Index->Buckets[i] != NULL)
+        {
+            Entry = Index->Buckets[i];
+            Index->Buckets[i] = Entry->Next;
+            ExFreeToPagedLookasideList(&VfatGlobalData->NameIndexLookasideList, Entry);
+        }
+    }
+
+    ExFreePoolWithTag(Index->Buckets, TAG_NAME_INDEX);
+    ExFreePoolWithTag(Index, TAG_NAME_INDEX);
+    DirFcb->NameIndex = NULL;
+}
+
+/*
+ * Doubles the number of buckets, so that the chains stay short. Failing to
+ * do so only makes the lookups slower.
+ */
+static
+VOID
+vfatNameIndexGrow(
+    PVFAT_NAME_INDEX Index)
+{
+    PVFAT_NAME_INDEX_ENTRY *Buckets;
+    PVFAT_NAME_INDEX_ENTRY Entry;
+    ULONG BucketCount, i;
+
+    BucketCount = Index->BucketCount * 2;
+    Buckets = ExAllocatePoolWithTag(PagedPool, BucketCount * sizeof(PVFAT_NAME_INDEX_ENTRY), TAG_NAME_INDEX);
+    if (Buckets == NULL)
+    {
+        return;
+    }
+    RtlZeroMemory(Buckets, BucketCount * sizeof(PVFAT_NAME_INDEX_ENTRY));
+
+    for (i = 0; i < Index->BucketCount; i++)
+    {
+        while (Index->Buckets[i] != NULL)
+        {
+            Entry = Index->Buckets[i];
+            Index->Buckets[i] = Entry->Next;
+            Entry->Next = Buckets[Entry->Hash & (BucketCount - 1)];
+            Buckets[Entry->Hash & (BucketCount - 1)] = Entry;
+        }
+    }
+
+    ExFreePoolWithTag(Index->Buckets, TAG_NAME_INDEX);
+    Index->Buckets = Buckets;
+    Index->BucketCount = BucketCount;
+}
+
+static
+BOOLEAN
+vfatNameIndexAdd(
+    PVFAT_NAME_INDEX Index,
+    PUNICODE_STRING NameU,
+    ULONG DirIndex)
+{
+    PVFAT_NAME_INDEX_ENTRY Entry;
+
+    Entry = ExAllocateFromPagedLookasideList(&VfatGlobalData->NameIndexLookasideList);
+    if (Entry == NULL)
+    {
+        return FALSE;
+    }
+
+    Entry->Hash = vfatNameIndexHash(NameU);
+    Entry->DirIndex = DirIndex;
+    Entry->Next = Index->Buckets[Entry->Hash & (Index->BucketCount - 1)];
+    Index->Buckets[Entry->Hash & (Index->BucketCount - 1)] = Entry;
+    Index->EntryCount++;
+
+    if (Index->EntryCount > 2 * Index->BucketCount)
+    {
+        vfatNameIndexGrow(Index);
+    }
+    return TRUE;
+}
+
+/*
+ * Records both names of the entry at DirIndex. The short name is skipped
+ * when the long one is the same, as for entries without long name.
+ */
+static
+BOOLEAN
+vfatNameIndexAddEntry(
+    PVFAT_NAME_INDEX Index,
+    PUNICODE_STRING LongNameU,
+    PUNICODE_STRING ShortNameU,
+    ULONG DirIndex)
+{
+    if (!vfatNameIndexAdd(Index, LongNameU, DirIndex))
+    {
+        return FALSE;
+    }
+
+    if (ShortNameU->Length != 0 && !RtlEqualUnicodeString(LongNameU, ShortNameU, TRUE))
+    {
+        return vfatNameIndexAdd(Index, ShortNameU, DirIndex);
+    }
+    return TRUE;
+}
+
+/*
+ * Reads the whole directory once to index it. On failure, the directory is
+ * left without index and will be scanned.
+ */
+static
+NTSTATUS
+vfatNameIndexBuild(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb)
+{
+    PVFAT_NAME_INDEX Index;
+    VFAT_DIRENTRY_CONTEXT DirContext;
+    WCHAR LongNameBuffer[260];
+    WCHAR ShortNameBuffer[13];
+    PVOID Context = NULL;
+    PVOID Page;
+    BOOLEAN First = TRUE;
+    NTSTATUS Status;
+
+    Index = ExAllocatePoolWithTag(PagedPool, sizeof(VFAT_NAME_INDEX), TAG_NAME_INDEX);
+    if (Index == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Index->BucketCount = NAME_INDEX_INITIAL_BUCKETS;
+    Index->EntryCount = 0;
+    Index->Buckets = ExAllocatePoolWithTag(PagedPool, Index->BucketCount * sizeof(PVFAT_NAME_INDEX_ENTRY), TAG_NAME_INDEX);
+    if (Index->Buckets == NULL)
+    {
+        ExFreePoolWithTag(Index, TAG_NAME_INDEX);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    RtlZeroMemory(Index->Buckets, Index->BucketCount * sizeof(PVFAT_NAME_INDEX_ENTRY));
+    DirFcb->NameIndex = Index;
+
+    DirContext.DirIndex = 0;
+    DirContext.DeviceExt = DeviceExt;
+    DirContext.LongNameU.Buffer = LongNameBuffer;
+    DirContext.LongNameU.MaximumLength = sizeof(LongNameBuffer);
+    DirContext.ShortNameU.Buffer = ShortNameBuffer;
+    DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
+
+    while (TRUE)
+    {
+        Status = VfatGetNextDirEntry(DeviceExt, &Context, &Page, DirFcb, &DirContext, First);
+        First = FALSE;
+        if (Status == STATUS_NO_MORE_ENTRIES)
+        {
+            Status = STATUS_SUCCESS;
+            break;
+        }
+        if (!NT_SUCCESS(Status))
+        {
+            break;
+        }
+
+        /* Same entries as the ones a scan would consider */
+        if (!ENTRY_VOLUME(FALSE, &DirContext.DirEntry) &&
+            DirContext.LongNameU.Length != 0 &&
+            DirContext.ShortNameU.Length != 0)
+        {
+            if (!vfatNameIndexAddEntry(Index, &DirContext.LongNameU, &DirContext.ShortNameU, DirContext.DirIndex))
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+        }
+        DirContext.DirIndex++;
+    }
+
+    if (Context != NULL)
+    {
+        CcUnpinData(Context);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        vfatNameIndexFree(DirFcb);
+        return Status;
+    }
+
+    DPRINT("Indexed %u names of %wZ\n", Index->EntryCount, &DirFcb->PathNameU);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Looks FileToFindU up in the name index of the directory, building the
+ * index on first use. Returns FALSE when the directory isn't indexed: it
+ * must then be scanned by the caller. Otherwise, Status is STATUS_SUCCESS
+ * and DirContext describes the first entry at or after DirContext->DirIndex
+ * with that long or short name, or Status is STATUS_NO_MORE_ENTRIES.
+ * The directory resource must be held exclusively.
+ */
+BOOLEAN
+vfatNameIndexFindFile(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext,
+    PNTSTATUS Status)
+{
+    PVFAT_NAME_INDEX_ENTRY Entry;
+    ULONG Hash, MinIndex, Candidate;
+    PVOID Context;
+    PVOID Page;
+    BOOLEAN Found;
+
+    /* FATX numbers its entries differently, it isn't indexed */
+    if (vfatVolumeIsFatX(DeviceExt))
+    {
+        return FALSE;
+    }
+
+    if (DirFcb->NameIndex == NULL)
+    {
+        if (DirFcb->RFCB.FileSize.u.LowPart / sizeof(FAT_DIR_ENTRY) < NAME_INDEX_MIN_ENTRIES)
+        {
+            return FALSE;
+        }
+
+        if (!NT_SUCCESS(vfatNameIndexBuild(DeviceExt, DirFcb)))
+        {
+            return FALSE;
+        }
+    }
+
+    Hash = vfatNameIndexHash(FileToFindU);
+    MinIndex = DirContext->DirIndex;
+
+    /* Try the candidates in directory order, the hash may collide */
+    while (TRUE)
+    {
+        Candidate = MAXULONG;
+        for (Entry = DirFcb->NameIndex->Buckets[Hash & (DirFcb->NameIndex->BucketCount - 1)];
+             Entry != NULL;
+             Entry = Entry->Next)
+        {
+            if (Entry->Hash == Hash && Entry->DirIndex >= MinIndex && Entry->DirIndex < Candidate)
+            {
+                Candidate = Entry->DirIndex;
+            }
+        }
+
+        if (Candidate == MAXULONG)
+        {
+            DirContext->DirIndex = MinIndex;
+            *Status = STATUS_NO_MORE_ENTRIES;
+            return TRUE;
+        }
+
+        Context = NULL;
+        DirContext->DirIndex = Candidate;
+        *Status = VfatGetNextDirEntry(DeviceExt, &Context, &Page, DirFcb, DirContext, TRUE);
+        if (Context != NULL)
+        {
+            CcUnpinData(Context);
+        }
+
+        if (!NT_SUCCESS(*Status) || DirContext->DirIndex != Candidate)
+        {
+            /* The index doesn't match the directory anymore, drop it */
+            DPRINT1("Stale name index for %wZ at %u\n", &DirFcb->PathNameU, Candidate);
+            vfatNameIndexFree(DirFcb);
+            DirContext->DirIndex = MinIndex;
+            return FALSE;
+        }
+
+        Found = RtlEqualUnicodeString(&DirContext->LongNameU, FileToFindU, TRUE) ||
+                RtlEqualUnicodeString(&DirContext->ShortNameU, FileToFindU, TRUE);
+        if (Found)
+        {
+            return TRUE;
+        }
+
+        MinIndex = Candidate + 1;
+    }
+}
+
+/*
+ * Records a new entry of the directory, if it is indexed.
+ */
+VOID
+vfatNameIndexInsert(
+    PVFATFCB DirFcb,
+    PVFAT_DIRENTRY_CONTEXT DirContext)
+{
+    if (DirFcb->NameIndex == NULL)
+    {
+        return;
+    }
+
+    if (!vfatNameIndexAddEntry(DirFcb->NameIndex, &DirContext->LongNameU, &DirContext->ShortNameU, DirContext->DirIndex))
+    {
+        /* It would miss the entry, scan the directory from now on */
+        vfatNameIndexFree(DirFcb);
+    }
+}
+
+static
+VOID
+vfatNameIndexRemoveName(
+    PVFAT_NAME_INDEX Index,
+    PUNICODE_STRING NameU,
+    ULONG DirIndex)
+{
+    PVFAT_NAME_INDEX_ENTRY *Link, Entry;
+    ULONG Hash;
+
+    Hash = vfatNameIndexHash(NameU);
+    Link = &Index->Buckets[Hash & (Index->BucketCount - 1)];
+    while (*Link != NULL)
+    {
+        Entry = *Link;
+        if (Entry->Hash == Hash && Entry->DirIndex == DirIndex)
+        {
+            *Link = Entry->Next;
+            Index->EntryCount--;
+            ExFreeToPagedLookasideList(&VfatGlobalData->NameIndexLookasideList, Entry);
+            return;
+        }
+        Link = &Entry->Next;
+    }
+}
+
+/*
+ * Forgets about the names of the entry of Fcb, which is being deleted from
+ * its parent directory. A name left behind isn't harmful: lookups check the
+ * entry it points to.
+ */
+VOID
+vfatNameIndexRemove(
+    PVFATFCB DirFcb,
+    PVFATFCB Fcb)
+{
+    PVFAT_NAME_INDEX Index = DirFcb->NameIndex;
+
+    if (Index == NULL)
+    {
+        return;
+    }
+
+    vfatNameIndexRemoveName(Index, &Fcb->LongNameU, Fcb->dirIndex);
+    if (Fcb->ShortNameU.Length != 0 && !RtlEqualUnicodeString(&Fcb->LongNameU, &Fcb->ShortNameU, TRUE))
+    {
+        vfatNameIndexRemoveName(Index, &Fcb->ShortNameU, Fcb->dirIndex);
+    }
+}
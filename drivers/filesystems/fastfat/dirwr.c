@@ -763,6 +763,8 @@ FATAddEntry(
     CcSetDirtyPinnedData(Context, NULL);
     CcUnpinData(Context);
 
+    vfatNameIndexInsert(ParentFcb, &DirContext);
+
     if (MoveContext != NULL)
     {
         /* We're modifying an existing FCB - likely rename/move */
@@ -977,6 +979,7 @@ FATDelEntry(
 
     DPRINT("delEntry PathName \'%wZ\'\n", &pFcb->PathNameU);
     DPRINT("delete entry: %u to %u\n", pFcb->startIndex, pFcb->dirIndex);
+    vfatNameIndexRemove(pFcb->parentFcb, pFcb);
     Offset.u.HighPart = 0;
     for (i = pFcb->startIndex; i <= pFcb->dirIndex; i++)
     {
@@ -1026,6 +1029,7 @@ FATDelEntry(
     /* In case of moving, don't delete data */
     if (MoveContext == NULL)
     {
+        vfatTruncateExtentMap(&pFcb->ExtentMap, 0);
         while (CurrentCluster && CurrentCluster != 0xffffffff)
         {
             GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
@@ -1105,6 +1109,7 @@ FATXDelEntry(
     /* In case of moving, don't delete data */
     if (MoveContext == NULL)
     {
+        vfatTruncateExtentMap(&pFcb->ExtentMap, 0);
         while (CurrentCluster && CurrentCluster != 0xffffffff)
         {
             GetNextCluster(DeviceExt, CurrentCluster, &NextCluster);
@@ -0,0 +1,298 @@
+/*
+ * COPYRIGHT:        See COPYING in the top level directory
+ * PROJECT:          ReactOS kernel
+ * FILE:             drivers/filesystems/fastfat/extent.c
+ * PURPOSE:          Per-FCB map of the cluster chain runs
+ *
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "vfat.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* Initial number of runs allocated for a map, doubled when full */
+#define EXTENT_MAP_INITIAL_SIZE 8
+
+/* FUNCTIONS *****************************************************************/
+
+VOID
+vfatInitExtentMap(
+    PVFAT_EXTENT_MAP Map)
+{
+    ExInitializeFastMutex(&Map->Mutex);
+    Map->Extents = NULL;
+    Map->ExtentCount = 0;
+    Map->MaxExtents = 0;
+    Map->ClusterCount = 0;
+    Map->Generation = 0;
+}
+
+VOID
+vfatFreeExtentMap(
+    PVFAT_EXTENT_MAP Map)
+{
+    if (Map->Extents != NULL)
+    {
+        ExFreePoolWithTag(Map->Extents, TAG_EXTENT);
+        Map->Extents = NULL;
+    }
+    Map->ExtentCount = Map->MaxExtents = Map->ClusterCount = 0;
+}
+
+/*
+ * Forget about the clusters of the chain from ClusterCount on. Must be called
+ * before the chain is changed anywhere below that point.
+ */
+VOID
+vfatTruncateExtentMap(
+    PVFAT_EXTENT_MAP Map,
+    ULONG ClusterCount)
+{
+    PVFAT_EXTENT Extent;
+
+    ExAcquireFastMutex(&Map->Mutex);
+
+    /* Walks started before this point must not record anything anymore */
+    Map->Generation++;
+
+    while (Map->ExtentCount > 0 && Map->ClusterCount > ClusterCount)
+    {
+        Extent = &Map->Extents[Map->ExtentCount - 1];
+        if (Extent->FileCluster >= ClusterCount)
+        {
+            Map->ClusterCount = Extent->FileCluster;
+            Map->ExtentCount--;
+        }
+        else
+        {
+            Extent->Count = ClusterCount - Extent->FileCluster;
+            Map->ClusterCount = ClusterCount;
+        }
+    }
+
+    ExReleaseFastMutex(&Map->Mutex);
+}
+
+/*
+ * Binary search of the run holding the given cluster of the file.
+ * The map mutex must be held.
+ */
+static
+BOOLEAN
+vfatLookupExtentMap(
+    PVFAT_EXTENT_MAP Map,
+    ULONG FileCluster,
+    PULONG Cluster)
+{
+    PVFAT_EXTENT Extent;
+    ULONG Low, High, Middle;
+
+    if (FileCluster >= Map->ClusterCount)
+    {
+        return FALSE;
+    }
+
+    Low = 0;
+    High = Map->ExtentCount;
+    while (High - Low > 1)
+    {
+        Middle = Low + (High - Low) / 2;
+        if (Map->Extents[Middle].FileCluster <= FileCluster)
+            Low = Middle;
+        else
+            High = Middle;
+    }
+
+    Extent = &Map->Extents[Low];
+    ASSERT(FileCluster >= Extent->FileCluster && FileCluster < Extent->FileCluster + Extent->Count);
+    *Cluster = Extent->DiskCluster + (FileCluster - Extent->FileCluster);
+    return TRUE;
+}
+
+/*
+ * Record the cluster following the mapped part of the chain.
+ * The map mutex must be held.
+ */
+static
+VOID
+vfatAppendExtentMap(
+    PVFAT_EXTENT_MAP Map,
+    ULONG FileCluster,
+    ULONG Cluster)
+{
+    PVFAT_EXTENT Extent, Extents;
+    ULONG MaxExtents;
+
+    /* Another walk already went past this point */
+    if (FileCluster != Map->ClusterCount)
+    {
+        return;
+    }
+
+    if (Map->ExtentCount > 0)
+    {
+        Extent = &Map->Extents[Map->ExtentCount - 1];
+        if (Extent->DiskCluster + Extent->Count == Cluster)
+        {
+            Extent->Count++;
+            Map->ClusterCount++;
+            return;
+        }
+    }
+
+    if (Map->ExtentCount == Map->MaxExtents)
+    {
+        MaxExtents = max(Map->MaxExtents * 2, EXTENT_MAP_INITIAL_SIZE);
+        Extents = ExAllocatePoolWithTag(NonPagedPool, MaxExtents * sizeof(VFAT_EXTENT), TAG_EXTENT);
+        if (Extents == NULL)
+        {
+            /* Not fatal, the rest of the chain will be walked on the FAT */
+            return;
+        }
+
+        if (Map->Extents != NULL)
+        {
+            RtlCopyMemory(Extents, Map->Extents, Map->ExtentCount * sizeof(VFAT_EXTENT));
+            ExFreePoolWithTag(Map->Extents, TAG_EXTENT);
+        }
+        Map->Extents = Extents;
+        Map->MaxExtents = MaxExtents;
+    }
+
+    Extent = &Map->Extents[Map->ExtentCount++];
+    Extent->FileCluster = FileCluster;
+    Extent->DiskCluster = Cluster;
+    Extent->Count = 1;
+    Map->ClusterCount++;
+}
+
+/*
+ * Same as OffsetToCluster without extension, but looks the cluster up in the
+ * extent map of the FCB first. Only the part of the chain past the end of the
+ * map is read from the FAT, and it is recorded for the next calls.
+ */
+NTSTATUS
+vfatFcbOffsetToCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG FileOffset,
+    PULONG Cluster)
+{
+    PVFAT_EXTENT_MAP Map = &Fcb->ExtentMap;
+    PVFAT_EXTENT Extent;
+    ULONG FileCluster, CurrentFileCluster, CurrentCluster, Generation;
+    NTSTATUS Status;
+
+    if (FirstCluster == 1)
+    {
+        /* root of FAT16 or FAT12, contiguous */
+        return OffsetToCluster(DeviceExt, FirstCluster, FileOffset, Cluster, FALSE);
+    }
+
+    if (FirstCluster == 0)
+    {
+        DbgPrint("vfatFcbOffsetToCluster is called with FirstCluster = 0!\n");
+        ASSERT(FALSE);
+    }
+
+    FileCluster = FileOffset / DeviceExt->FatInfo.BytesPerCluster;
+
+    ExAcquireFastMutex(&Map->Mutex);
+    if (vfatLookupExtentMap(Map, FileCluster, Cluster))
+    {
+        ExReleaseFastMutex(&Map->Mutex);
+        return STATUS_SUCCESS;
+    }
+
+    /* Resume the walk where the map ends */
+    Generation = Map->Generation;
+    if (Map->ExtentCount > 0)
+    {
+        Extent = &Map->Extents[Map->ExtentCount - 1];
+        CurrentFileCluster = Map->ClusterCount - 1;
+        CurrentCluster = Extent->DiskCluster + Extent->Count - 1;
+    }
+    else
+    {
+        CurrentFileCluster = 0;
+        CurrentCluster = FirstCluster;
+        vfatAppendExtentMap(Map, 0, FirstCluster);
+    }
+    ExReleaseFastMutex(&Map->Mutex);
+
+    while (CurrentFileCluster < FileCluster)
+    {
+        Status = GetNextCluster(DeviceExt, CurrentCluster, &CurrentCluster);
+        if (!NT_SUCCESS(Status))
+        {
+            return Status;
+        }
+
+        if (CurrentCluster == 0xffffffff)
+        {
+            /* The chain is shorter than the offset, let the caller handle it */
+            break;
+        }
+
+        CurrentFileCluster++;
+        ExAcquireFastMutex(&Map->Mutex);
+        if (Map->Generation == Generation)
+        {
+            vfatAppendExtentMap(Map, CurrentFileCluster, CurrentCluster);
+        }
+        ExReleaseFastMutex(&Map->Mutex);
+    }
+
+    *Cluster = CurrentCluster;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Same as NextCluster without extension, for the cluster at index FileCluster
+ * of the file. Sequential transfers read the map, or grow it.
+ */
+NTSTATUS
+vfatFcbNextCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG FileCluster,
+    PULONG CurrentCluster)
+{
+    PVFAT_EXTENT_MAP Map = &Fcb->ExtentMap;
+    ULONG Generation;
+    BOOLEAN Record;
+    NTSTATUS Status;
+
+    if (FirstCluster == 1)
+    {
+        return NextCluster(DeviceExt, FirstCluster, CurrentCluster, FALSE);
+    }
+
+    ExAcquireFastMutex(&Map->Mutex);
+    if (vfatLookupExtentMap(Map, FileCluster + 1, CurrentCluster))
+    {
+        ExReleaseFastMutex(&Map->Mutex);
+        return STATUS_SUCCESS;
+    }
+    Generation = Map->Generation;
+    Record = (Map->ClusterCount == FileCluster + 1);
+    ExReleaseFastMutex(&Map->Mutex);
+
+    Status = GetNextCluster(DeviceExt, *CurrentCluster, CurrentCluster);
+    if (NT_SUCCESS(Status) && Record && *CurrentCluster != 0xffffffff)
+    {
+        ExAcquireFastMutex(&Map->Mutex);
+        if (Map->Generation == Generation)
+        {
+            vfatAppendExtentMap(Map, FileCluster + 1, *CurrentCluster);
+        }
+        ExReleaseFastMutex(&Map->Mutex);
+    }
+
+    return Status;
+}
@@ -20,6 +20,9 @@
 #define  CACHEPAGESIZE(pDeviceExt) ((pDeviceExt)->FatInfo.BytesPerCluster > PAGE_SIZE ? \
 		   (pDeviceExt)->FatInfo.BytesPerCluster : PAGE_SIZE)
 
+/* Length of the free run a chain moves to when it can't grow in place */
+#define FREE_RUN_CLUSTERS 16
+
 /* FUNCTIONS ****************************************************************/
 
 /*
@@ -414,7 +417,11 @@ FAT12CountAvailableClusters(
         }
 
         if (Entry == 0)
+        {
             ulCount++;
+            if (DeviceExt->FreeClusterMap.Buffer != NULL)
+                RtlSetBit(&DeviceExt->FreeClusterMap, i);
+        }
     }
 
     CcUnpinData(Context);
@@ -465,7 +472,11 @@ FAT16CountAvailableClusters(
         while (Block < BlockEnd && i < FatLength)
         {
             if (*Block == 0)
+            {
                 ulCount++;
+                if (DeviceExt->FreeClusterMap.Buffer != NULL)
+                    RtlSetBit(&DeviceExt->FreeClusterMap, i);
+            }
             Block++;
             i++;
         }
@@ -521,7 +532,11 @@ FAT32CountAvailableClusters(
         while (Block < BlockEnd && i < FatLength)
         {
             if ((*Block & 0x0fffffff) == 0)
+            {
                 ulCount++;
+                if (DeviceExt->FreeClusterMap.Buffer != NULL)
+                    RtlSetBit(&DeviceExt->FreeClusterMap, i);
+            }
             Block++;
             i++;
         }
@@ -535,6 +550,34 @@ FAT32CountAvailableClusters(
     return STATUS_SUCCESS;
 }
 
+/*
+ * FUNCTION: Allocates and clears the free clusters bitmap, so that the count
+ *           of the free clusters fills it
+ */
+static
+VOID
+PrepareFreeClusterMap(
+    PDEVICE_EXTENSION DeviceExt)
+{
+    ULONG NumberOfBits;
+    PULONG Buffer;
+
+    if (DeviceExt->FreeClusterMap.Buffer == NULL)
+    {
+        NumberOfBits = DeviceExt->FatInfo.NumberOfClusters + 2;
+        Buffer = ExAllocatePoolWithTag(PagedPool, ROUND_UP(NumberOfBits, 32) / 8, TAG_BITMAP);
+        if (Buffer == NULL)
+        {
+            DPRINT1("No memory for the free clusters bitmap, allocations will scan the FAT\n");
+            return;
+        }
+
+        RtlInitializeBitMap(&DeviceExt->FreeClusterMap, Buffer, NumberOfBits);
+    }
+
+    RtlClearAllBits(&DeviceExt->FreeClusterMap);
+}
+
 NTSTATUS
 CountAvailableClusters(
     PDEVICE_EXTENSION DeviceExt,
@@ -544,6 +587,7 @@ CountAvailableClusters(
     ExAcquireResourceExclusiveLite (&DeviceExt->FatResource, TRUE);
     if (!DeviceExt->AvailableClustersValid)
     {
+        PrepareFreeClusterMap(DeviceExt);
         if (DeviceExt->FatInfo.FatType == FAT12)
             Status = FAT12CountAvailableClusters(DeviceExt);
         else if (DeviceExt->FatInfo.FatType == FAT16 || DeviceExt->FatInfo.FatType == FATX16)
@@ -710,12 +754,20 @@ WriteCluster(
 
     ExAcquireResourceExclusiveLite (&DeviceExt->FatResource, TRUE);
     Status = DeviceExt->WriteCluster(DeviceExt, ClusterToWrite, NewValue, &OldValue);
-    if (DeviceExt->AvailableClustersValid)
+    if (NT_SUCCESS(Status) && DeviceExt->AvailableClustersValid)
     {
         if (OldValue && NewValue == 0)
+        {
             InterlockedIncrement((PLONG)&DeviceExt->AvailableClusters);
+            if (DeviceExt->FreeClusterMap.Buffer != NULL)
+                RtlSetBit(&DeviceExt->FreeClusterMap, ClusterToWrite);
+        }
         else if (OldValue == 0 && NewValue)
+        {
             InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
+            if (DeviceExt->FreeClusterMap.Buffer != NULL)
+                RtlClearBit(&DeviceExt->FreeClusterMap, ClusterToWrite);
+        }
     }
     ExReleaseResourceLite(&DeviceExt->FatResource);
     return Status;
@@ -764,6 +816,58 @@ GetNextCluster(
     return Status;
 }
 
+/*
+ * FUNCTION: Finds an available cluster and marks it as end of chain. With the
+ *           free clusters bitmap, PreferredCluster is taken if it is free;
+ *           otherwise a free run is preferred to an isolated free cluster,
+ *           so that files written sequentially stay contiguous.
+ *           The FAT resource must be held exclusively.
+ */
+static
+NTSTATUS
+FindAndMarkAvailableCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    ULONG PreferredCluster,
+    PULONG Cluster)
+{
+    PRTL_BITMAP FreeMap = &DeviceExt->FreeClusterMap;
+    ULONG NewCluster, OldValue;
+    NTSTATUS Status;
+
+    if (FreeMap->Buffer == NULL || !DeviceExt->AvailableClustersValid)
+    {
+        return DeviceExt->FindAndMarkAvailableCluster(DeviceExt, Cluster);
+    }
+
+    /* Bits of the reserved clusters 0 and 1 are never set */
+    if (PreferredCluster >= 2 && PreferredCluster < FreeMap->SizeOfBitMap &&
+        RtlTestBit(FreeMap, PreferredCluster))
+    {
+        NewCluster = PreferredCluster;
+    }
+    else
+    {
+        NewCluster = RtlFindSetBits(FreeMap, FREE_RUN_CLUSTERS, DeviceExt->LastAvailableCluster);
+        if (NewCluster == 0xFFFFFFFF)
+            NewCluster = RtlFindSetBits(FreeMap, 1, DeviceExt->LastAvailableCluster);
+        if (NewCluster == 0xFFFFFFFF)
+            return STATUS_DISK_FULL;
+    }
+
+    DPRINT("Found available cluster 0x%x\n", NewCluster);
+    Status = DeviceExt->WriteCluster(DeviceExt, NewCluster, 0xffffffff, &OldValue);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    ASSERT(OldValue == 0);
+    RtlClearBit(FreeMap, NewCluster);
+    InterlockedDecrement((PLONG)&DeviceExt->AvailableClusters);
+    DeviceExt->LastAvailableCluster = *Cluster = NewCluster;
+    return STATUS_SUCCESS;
+}
+
 /*
  * FUNCTION: Retrieve the next cluster depending on the FAT type
  */
@@ -786,7 +890,7 @@ GetNextClusterExtend(
      */
     if (CurrentCluster == 0)
     {
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = FindAndMarkAvailableCluster(DeviceExt, 0, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
@@ -805,7 +909,7 @@ GetNextClusterExtend(
         /* We are after last existing cluster, we must add one to file */
         /* Firstly, find the next available open allocation unit and
            mark it as end of file */
-        Status = DeviceExt->FindAndMarkAvailableCluster(DeviceExt, &NewCluster);
+        Status = FindAndMarkAvailableCluster(DeviceExt, CurrentCluster + 1, &NewCluster);
         if (!NT_SUCCESS(Status))
         {
             ExReleaseResourceLite(&DeviceExt->FatResource);
@@ -151,7 +151,7 @@ vfatNewFCB(
     ExInitializeResourceLite(&rcFCB->PagingIoResource);
     ExInitializeResourceLite(&rcFCB->MainResource);
     FsRtlInitializeFileLock(&rcFCB->FileLock, NULL, NULL);
-    ExInitializeFastMutex(&rcFCB->LastMutex);
+    vfatInitExtentMap(&rcFCB->ExtentMap);
     rcFCB->RFCB.PagingIoResource = &rcFCB->PagingIoResource;
     rcFCB->RFCB.Resource = &rcFCB->MainResource;
     rcFCB->RFCB.IsFastIoPossible = FastIoIsNotPossible;
@@ -277,6 +277,8 @@ vfatDestroyFCB(
 #endif
 
     FsRtlUninitializeFileLock(&pFCB->FileLock);
+    vfatFreeExtentMap(&pFCB->ExtentMap);
+    vfatNameIndexFree(pFCB);
 
     if (!vfatFCBIsRoot(pFCB) &&
         !BooleanFlagOn(pFCB->Flags, FCB_IS_FAT) && !BooleanFlagOn(pFCB->Flags, FCB_IS_VOLUME))
@@ -824,6 +826,24 @@ vfatDirFindFile(
     DirContext.ShortNameU.MaximumLength = sizeof(ShortNameBuffer);
     DirContext.DeviceExt = pDeviceExt;
 
+    /* Large directories are looked up in their name index */
+    if (vfatNameIndexFindFile(pDeviceExt, pDirectoryFCB, FileToFindU, &DirContext, &status))
+    {
+        if (status == STATUS_NO_MORE_ENTRIES)
+        {
+            return STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+        if (!NT_SUCCESS(status))
+        {
+            return status;
+        }
+
+        return vfatMakeFCBFromDirEntry(pDeviceExt,
+            pDirectoryFCB,
+            &DirContext,
+            pFoundFCB);
+    }
+
     while (TRUE)
     {
         status = VfatGetNextDirEntry(pDeviceExt,
@@ -825,6 +825,8 @@ ByeBye:
             ExFreePoolWithTag(DeviceExt->SpareVPB, TAG_VPB);
         if (DeviceExt && DeviceExt->Statistics)
             ExFreePoolWithTag(DeviceExt->Statistics, TAG_STATS);
+        if (DeviceExt && DeviceExt->FreeClusterMap.Buffer)
+            ExFreePoolWithTag(DeviceExt->FreeClusterMap.Buffer, TAG_BITMAP);
         if (DeviceObject)
             IoDeleteDevice(DeviceObject);
     }
@@ -990,9 +992,9 @@ VfatGetRetrievalPointers(
     }
 
     CurrentCluster = FirstCluster = vfatDirEntryGetFirstCluster(DeviceExt, &Fcb->entry);
-    Status = OffsetToCluster(DeviceExt, FirstCluster,
-                             Vcn.u.LowPart * DeviceExt->FatInfo.BytesPerCluster,
-                             &CurrentCluster, FALSE);
+    Status = vfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                    Vcn.u.LowPart * DeviceExt->FatInfo.BytesPerCluster,
+                                    &CurrentCluster);
     if (!NT_SUCCESS(Status))
     {
         goto ByeBye;
@@ -578,6 +578,8 @@ VfatCheckForDismount(
 
         /* Release resources */
         ExFreePoolWithTag(DeviceExt->Statistics, TAG_STATS);
+        if (DeviceExt->FreeClusterMap.Buffer != NULL)
+            ExFreePoolWithTag(DeviceExt->FreeClusterMap.Buffer, TAG_BITMAP);
         ExDeleteResourceLite(&DeviceExt->DirResource);
         ExDeleteResourceLite(&DeviceExt->FatResource);
 
@@ -16,8 +16,8 @@
 #include <debug.h>
 
 /*
- * Uncomment to enable strict verification of cluster/offset pair
- * caching. If this option is enabled you lose all the benefits of
+ * Uncomment to enable strict verification of the cluster extent
+ * map. If this option is enabled you lose all the benefits of
  * the caching and the read/write operations will actually be
  * slower. It's meant only for debugging!!!
  * - Filip Navara, 26/07/2004
@@ -128,6 +128,7 @@ VfatReadFileData(
     ULONG FirstCluster;
     ULONG StartCluster;
     ULONG ClusterCount;
+    ULONG FileCluster;
     LARGE_INTEGER StartOffset;
     PDEVICE_EXTENSION DeviceExt;
     BOOLEAN First = TRUE;
@@ -136,8 +137,6 @@ VfatReadFileData(
     ULONG BytesDone;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -215,47 +214,29 @@ VfatReadFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     /* Find the cluster to start the read from */
-    if (LastCluster > 0 && ReadOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
+    FileCluster = ReadOffset.u.LowPart / BytesPerCluster;
+    Status = vfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                    ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
+                                    &CurrentCluster);
 #ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
+    /* DEBUG VERIFICATION */
+    if (NT_SUCCESS(Status))
     {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
+        ULONG CorrectCluster;
+        OffsetToCluster(DeviceExt, FirstCluster,
+                        ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster),
+                        &CorrectCluster, FALSE);
+        if (CorrectCluster != CurrentCluster)
+            KeBugCheck(FAT_FILE_SYSTEM);
     }
+#endif
 
     if (!NT_SUCCESS(Status))
     {
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (ReadOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     KeInitializeEvent(&IrpContext->Event, NotificationEvent, FALSE);
     IrpContext->RefCount = 1;
 
@@ -286,17 +267,13 @@ VfatReadFileData(
                     BytesDone = Length;
                 }
             }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
+            Status = vfatFcbNextCluster(DeviceExt, Fcb, FirstCluster, FileCluster, &CurrentCluster);
+            FileCluster++;
         }
         while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
         DPRINT("start %08x, next %08x, count %u\n",
                StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(ReadOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
-
         /* Fire up the read command */
         Status = VfatReadDiskPartial (IrpContext, &StartOffset, BytesDone, *LengthRead, FALSE);
         if (!NT_SUCCESS(Status) && Status != STATUS_PENDING)
@@ -343,14 +320,13 @@ VfatWriteFileData(
     ULONG BytesDone;
     ULONG StartCluster;
     ULONG ClusterCount;
+    ULONG FileCluster;
     NTSTATUS Status = STATUS_SUCCESS;
     BOOLEAN First = TRUE;
     ULONG BytesPerSector;
     ULONG BytesPerCluster;
     LARGE_INTEGER StartOffset;
     ULONG BufferOffset;
-    ULONG LastCluster;
-    ULONG LastOffset;
 
     /* PRECONDITION */
     ASSERT(IrpContext);
@@ -428,49 +404,31 @@ VfatWriteFileData(
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    LastCluster = Fcb->LastCluster;
-    LastOffset = Fcb->LastOffset;
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     /*
      * Find the cluster to start the write from
      */
-    if (LastCluster > 0 && WriteOffset.u.LowPart >= LastOffset)
-    {
-        Status = OffsetToCluster(DeviceExt, LastCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) -
-                                 LastOffset,
-                                 &CurrentCluster, FALSE);
+    FileCluster = WriteOffset.u.LowPart / BytesPerCluster;
+    Status = vfatFcbOffsetToCluster(DeviceExt, Fcb, FirstCluster,
+                                    ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
+                                    &CurrentCluster);
 #ifdef DEBUG_VERIFY_OFFSET_CACHING
-        /* DEBUG VERIFICATION */
-        {
-            ULONG CorrectCluster;
-            OffsetToCluster(DeviceExt, FirstCluster,
-                            ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                            &CorrectCluster, FALSE);
-            if (CorrectCluster != CurrentCluster)
-                KeBugCheck(FAT_FILE_SYSTEM);
-        }
-#endif
-    }
-    else
+    /* DEBUG VERIFICATION */
+    if (NT_SUCCESS(Status))
     {
-        Status = OffsetToCluster(DeviceExt, FirstCluster,
-                                 ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
-                                 &CurrentCluster, FALSE);
+        ULONG CorrectCluster;
+        OffsetToCluster(DeviceExt, FirstCluster,
+                        ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster),
+                        &CorrectCluster, FALSE);
+        if (CorrectCluster != CurrentCluster)
+            KeBugCheck(FAT_FILE_SYSTEM);
     }
+#endif
 
     if (!NT_SUCCESS(Status))
     {
         return Status;
     }
 
-    ExAcquireFastMutex(&Fcb->LastMutex);
-    Fcb->LastCluster = CurrentCluster;
-    Fcb->LastOffset = ROUND_DOWN (WriteOffset.u.LowPart, BytesPerCluster);
-    ExReleaseFastMutex(&Fcb->LastMutex);
-
     IrpContext->RefCount = 1;
     BufferOffset = 0;
 
@@ -501,17 +459,13 @@ VfatWriteFileData(
                     BytesDone = Length;
                 }
             }
-            Status = NextCluster(DeviceExt, FirstCluster, &CurrentCluster, FALSE);
+            Status = vfatFcbNextCluster(DeviceExt, Fcb, FirstCluster, FileCluster, &CurrentCluster);
+            FileCluster++;
         }
         while (StartCluster + ClusterCount == CurrentCluster && NT_SUCCESS(Status) && Length > BytesDone);
         DPRINT("start %08x, next %08x, count %u\n",
                StartCluster, CurrentCluster, ClusterCount);
 
-        ExAcquireFastMutex(&Fcb->LastMutex);
-        Fcb->LastCluster = StartCluster + (ClusterCount - 1);
-        Fcb->LastOffset = ROUND_DOWN(WriteOffset.u.LowPart, BytesPerCluster) + (ClusterCount - 1) * BytesPerCluster;
-        ExReleaseFastMutex(&Fcb->LastMutex);
-
         // Fire up the write command
         Status = VfatWriteDiskPartial (IrpContext, &StartOffset, BytesDone, BufferOffset, FALSE);
         if (!NT_SUCCESS(Status) && Status != STATUS_PENDING)
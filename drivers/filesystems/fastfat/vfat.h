@@ -325,6 +325,9 @@ typedef struct DEVICE_EXTENSION
     ULONG LastAvailableCluster;
     ULONG AvailableClusters;
     BOOLEAN AvailableClustersValid;
+    /* One bit per cluster, set when it is free. Built along with the free
+     * clusters count, Buffer is NULL if it couldn't be allocated */
+    RTL_BITMAP FreeClusterMap;
     ULONG Flags;
     struct _VFATFCB *VolumeFcb;
     struct _VFATFCB *RootFcb;
@@ -412,6 +415,7 @@ typedef struct
     NPAGED_LOOKASIDE_LIST CcbLookasideList;
     NPAGED_LOOKASIDE_LIST IrpContextLookasideList;
     PAGED_LOOKASIDE_LIST CloseContextLookasideList;
+    PAGED_LOOKASIDE_LIST NameIndexLookasideList;
     FAST_IO_DISPATCH FastIoDispatch;
     CACHE_MANAGER_CALLBACKS CacheMgrCallbacks;
     FAST_MUTEX CloseMutex;
@@ -438,6 +442,47 @@ extern PVFAT_GLOBAL_DATA VfatGlobalData;
 
 #define NODE_TYPE_FCB ((CSHORT)0x0502)
 
+/* Run of contiguous clusters of a file */
+typedef struct _VFAT_EXTENT
+{
+    /* index of the first cluster of the run within the file */
+    ULONG FileCluster;
+    /* first cluster of the run on the volume */
+    ULONG DiskCluster;
+    ULONG Count;
+} VFAT_EXTENT, *PVFAT_EXTENT;
+
+/* Runs of the beginning of a cluster chain, sorted by FileCluster */
+typedef struct _VFAT_EXTENT_MAP
+{
+    FAST_MUTEX Mutex;
+    PVFAT_EXTENT Extents;
+    ULONG ExtentCount;
+    ULONG MaxExtents;
+    /* number of clusters of the chain covered by the runs */
+    ULONG ClusterCount;
+    /* changed on each truncation, so that concurrent walks stop recording */
+    ULONG Generation;
+} VFAT_EXTENT_MAP, *PVFAT_EXTENT_MAP;
+
+/* Name of a directory entry, recorded in the name index */
+typedef struct _VFAT_NAME_INDEX_ENTRY
+{
+    struct _VFAT_NAME_INDEX_ENTRY *Next;
+    /* case insensitive hash of the long or short name */
+    ULONG Hash;
+    /* index of the short entry in the directory */
+    ULONG DirIndex;
+} VFAT_NAME_INDEX_ENTRY, *PVFAT_NAME_INDEX_ENTRY;
+
+/* Hash table of the names of a directory, the bucket count is a power of 2 */
+typedef struct _VFAT_NAME_INDEX
+{
+    PVFAT_NAME_INDEX_ENTRY *Buckets;
+    ULONG BucketCount;
+    ULONG EntryCount;
+} VFAT_NAME_INDEX, *PVFAT_NAME_INDEX;
+
 typedef struct _VFATFCB
 {
     /* FCB header required by ROS/NT */
@@ -514,13 +559,18 @@ typedef struct _VFATFCB
     FILE_LOCK FileLock;
 
     /*
-     * Optimization: caching of last read/write cluster+offset pair. Can't
-     * be in VFATCCB because it must be reset everytime the allocated clusters
-     * change.
+     * Optimization: map of the cluster chain runs already walked, so that
+     * random access doesn't follow the FAT from the first cluster. Can't
+     * be in VFATCCB because it must be truncated everytime the allocated
+     * clusters change.
+     */
+    VFAT_EXTENT_MAP ExtentMap;
+
+    /*
+     * Optimization: index of the names of a large directory, built on the
+     * first lookup and updated by dirwr.c. NULL if not built.
      */
-    FAST_MUTEX LastMutex;
-    ULONG LastCluster;
-    ULONG LastOffset;
+    PVFAT_NAME_INDEX NameIndex;
 
     struct _VFAT_CLOSE_CONTEXT * CloseContext;
 } VFATFCB, *PVFATFCB;
@@ -547,6 +597,9 @@ typedef struct _VFATCCB
 #define TAG_NAME 'ntaF'
 #define TAG_SEARCH 'LtaF'
 #define TAG_DIRENT 'DtaF'
+#define TAG_EXTENT 'EtaF'
+#define TAG_BITMAP 'btaF'
+#define TAG_NAME_INDEX 'HtaF'
 
 #define ENTRIES_PER_SECTOR (BLOCKSIZE / sizeof(FATDirEntry))
 
@@ -775,6 +828,30 @@ vfatDirEntryGetFirstCluster(
     PDEVICE_EXTENSION pDeviceExt,
     PDIR_ENTRY pDirEntry);
 
+/* dirindex.c */
+
+VOID
+vfatNameIndexFree(
+    PVFATFCB DirFcb);
+
+BOOLEAN
+vfatNameIndexFindFile(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB DirFcb,
+    PUNICODE_STRING FileToFindU,
+    PVFAT_DIRENTRY_CONTEXT DirContext,
+    PNTSTATUS Status);
+
+VOID
+vfatNameIndexInsert(
+    PVFATFCB DirFcb,
+    PVFAT_DIRENTRY_CONTEXT DirContext);
+
+VOID
+vfatNameIndexRemove(
+    PVFATFCB DirFcb,
+    PVFATFCB Fcb);
+
 /* dirwr.c */
 
 NTSTATUS
@@ -816,6 +893,37 @@ VfatSetExtendedAttributes(
     PVOID Ea,
     ULONG EaLength);
 
+/* extent.c */
+
+VOID
+vfatInitExtentMap(
+    PVFAT_EXTENT_MAP Map);
+
+VOID
+vfatFreeExtentMap(
+    PVFAT_EXTENT_MAP Map);
+
+VOID
+vfatTruncateExtentMap(
+    PVFAT_EXTENT_MAP Map,
+    ULONG ClusterCount);
+
+NTSTATUS
+vfatFcbOffsetToCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG FileOffset,
+    PULONG Cluster);
+
+NTSTATUS
+vfatFcbNextCluster(
+    PDEVICE_EXTENSION DeviceExt,
+    PVFATFCB Fcb,
+    ULONG FirstCluster,
+    ULONG FileCluster,
+    PULONG CurrentCluster);
+
 /* fastio.c */
 
 INIT_FUNCTION
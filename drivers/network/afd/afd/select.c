@@ -404,9 +404,12 @@ static BOOLEAN UpdatePollWithFCB( PAFD_ACTIVE_POLL Poll, PFILE_OBJECT FileObject
     return Signalled ? 1 : 0;
 }
 
+static VOID CheckPollEntry( PAFD_POLL_ENTRY Entry );
+
 VOID PollReeval( PAFD_DEVICE_EXTENSION DeviceExt, PFILE_OBJECT FileObject ) {
     PAFD_ACTIVE_POLL Poll = NULL;
     PLIST_ENTRY ThePollEnt = NULL;
+    PAFD_POLL_ENTRY Entry;
     PAFD_FCB FCB;
     KIRQL OldIrql;
     PAFD_POLL_INFO PollReq;
@@ -440,6 +443,15 @@ VOID PollReeval( PAFD_DEVICE_EXTENSION DeviceExt, PFILE_OBJECT FileObject ) {
             ThePollEnt = ThePollEnt->Flink;
     }
 
+    /* And the poll sets this socket is in, leaving the other sockets alone */
+    ThePollEnt = FCB->PollEntries.Flink;
+
+    while( ThePollEnt != &FCB->PollEntries ) {
+        Entry = CONTAINING_RECORD( ThePollEnt, AFD_POLL_ENTRY, SocketEntry );
+        ThePollEnt = ThePollEnt->Flink;
+        CheckPollEntry( Entry );
+    }
+
     KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
 
     if((FCB->EventSelect) &&
@@ -453,3 +465,518 @@ VOID PollReeval( PAFD_DEVICE_EXTENSION DeviceExt, PFILE_OBJECT FileObject ) {
 
     AFD_DbgPrint(MID_TRACE,("Leaving\n"));
 }
+
+/* * * Persistent poll sets
+ *
+ * Unlike AfdSelect, the sockets are registered once with IOCTL_AFD_POLL_CONTROL
+ * and stay in the set. Each registration is linked from its socket, so an event
+ * only queues the registrations of the socket it happened on, and
+ * IOCTL_AFD_POLL_WAIT only looks at the queued ones. A wait that pends completes
+ * like any other IRP, so it goes to the completion port of the poll set handle
+ * if there is one. * * */
+
+/* * * NOTE ALWAYS CALLED WITH THE DEVICE EXTENSION LOCK HELD * * */
+/* The IRP must not have a cancel routine anymore: either it never got one,
+ * or whoever is completing it took it back from the cancel routine */
+static VOID CompletePollWaitIrp( PIRP Irp, NTSTATUS Status, ULONG EventCount ) {
+    PAFD_POLL_WAIT_INFO WaitReq = Irp->AssociatedIrp.SystemBuffer;
+
+    AFD_DbgPrint(MID_TRACE,("Completing poll wait %p with %u events (Status %x)\n",
+                            Irp, EventCount, Status));
+
+    WaitReq->EventCount = EventCount;
+    Irp->IoStatus.Status = Status;
+    Irp->IoStatus.Information =
+        FIELD_OFFSET(AFD_POLL_WAIT_INFO, Events) + sizeof(AFD_POLL_EVENT) * EventCount;
+    IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+}
+
+/* Arms the cancel routine of a queued wait. Returns FALSE if the IRP got
+ * cancelled before that, the caller has to complete it then */
+static BOOLEAN SetPollWaitCancelRoutine( PIRP Irp ) {
+    (void)IoSetCancelRoutine(Irp, AfdCancelHandler);
+    return !( Irp->Cancel && IoSetCancelRoutine(Irp, NULL) );
+}
+
+static VOID CompletePollWait( PAFD_POLL_WAITER Wait, NTSTATUS Status, ULONG EventCount ) {
+    PIRP Irp = Wait->Irp;
+
+    RemoveEntryList( &Wait->ListEntry );
+    Wait->Irp = NULL;
+
+    /* If the timeout DPC can't be stopped anymore, it frees the wait,
+     * unless it already ran and left the IRP to the cancel routine */
+    if( Wait->TimedOut ||
+        KeCancelTimer( &Wait->Timer ) || KeRemoveQueueDpc( &Wait->TimeoutDpc ) )
+        ExFreePoolWithTag(Wait, TAG_AFD_POLL_WAITER);
+
+    CompletePollWaitIrp( Irp, Status, EventCount );
+}
+
+static KDEFERRED_ROUTINE PollWaitTimeout;
+static VOID NTAPI PollWaitTimeout( PKDPC Dpc,
+                                   PVOID DeferredContext,
+                                   PVOID SystemArgument1,
+                                   PVOID SystemArgument2 ) {
+    PAFD_POLL_WAITER Wait = DeferredContext;
+    PAFD_DEVICE_EXTENSION DeviceExt = Wait->DeviceExt;
+    KIRQL OldIrql;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+    if( Wait->Irp && !IoSetCancelRoutine(Wait->Irp, NULL) ) {
+        /* The IRP is being cancelled, the cancel routine completes it */
+        Wait->TimedOut = TRUE;
+        KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+        return;
+    }
+    if( Wait->Irp )
+        CompletePollWait( Wait, STATUS_TIMEOUT, 0 );
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    /* Either way, we are the last ones to know about it */
+    ExFreePoolWithTag(Wait, TAG_AFD_POLL_WAITER);
+}
+
+/* Moves as many ready entries as fit to the output of a wait. Entries
+ * whose events went away meanwhile are dropped, PollReeval queues them
+ * again when they come back. The others are level triggered and stay
+ * queued, behind the ones which weren't reported yet */
+static ULONG GatherPollEvents( PAFD_POLL_SET PollSet, PIRP Irp ) {
+    PIO_STACK_LOCATION IrpSp = IoGetCurrentIrpStackLocation( Irp );
+    PAFD_POLL_WAIT_INFO WaitReq = Irp->AssociatedIrp.SystemBuffer;
+    ULONG MaxEvents, EventCount = 0, Events;
+    LIST_ENTRY Reported;
+    PLIST_ENTRY ListEntry;
+    PAFD_POLL_ENTRY Entry;
+    PAFD_FCB FCB;
+
+    MaxEvents = (IrpSp->Parameters.DeviceIoControl.OutputBufferLength -
+                 FIELD_OFFSET(AFD_POLL_WAIT_INFO, Events)) / sizeof(AFD_POLL_EVENT);
+
+    InitializeListHead( &Reported );
+
+    while( EventCount < MaxEvents && !IsListEmpty( &PollSet->ReadyList ) ) {
+        ListEntry = RemoveHeadList( &PollSet->ReadyList );
+        Entry = CONTAINING_RECORD( ListEntry, AFD_POLL_ENTRY, ReadyEntry );
+        InitializeListHead( &Entry->ReadyEntry );
+
+        FCB = Entry->FileObject->FsContext;
+        Events = Entry->Events & FCB->PollState;
+        if( !Events ) continue;
+
+        WaitReq->Events[EventCount].Context = Entry->Context;
+        WaitReq->Events[EventCount].Events = Events;
+        EventCount++;
+
+        if( Entry->Flags & AFD_POLL_ONESHOT )
+            Entry->Events = 0;
+        else
+            InsertTailList( &Reported, &Entry->ReadyEntry );
+    }
+
+    while( !IsListEmpty( &Reported ) ) {
+        ListEntry = RemoveHeadList( &Reported );
+        InsertTailList( &PollSet->ReadyList, ListEntry );
+    }
+
+    return EventCount;
+}
+
+static VOID SignalPollSet( PAFD_POLL_SET PollSet ) {
+    PAFD_POLL_WAITER Wait;
+    PLIST_ENTRY ListEntry;
+    ULONG EventCount;
+
+    /* One waiter is enough, the entries stay queued for the next ones */
+    ListEntry = PollSet->Waits.Flink;
+    while( ListEntry != &PollSet->Waits && !IsListEmpty( &PollSet->ReadyList ) ) {
+        Wait = CONTAINING_RECORD( ListEntry, AFD_POLL_WAITER, ListEntry );
+        ListEntry = ListEntry->Flink;
+
+        /* Leave the waits being cancelled to the cancel routine */
+        if( !IoSetCancelRoutine(Wait->Irp, NULL) )
+            continue;
+
+        EventCount = GatherPollEvents( PollSet, Wait->Irp );
+        if( EventCount ) {
+            CompletePollWait( Wait, STATUS_SUCCESS, EventCount );
+            break;
+        }
+
+        /* Nothing left to report after all, keep waiting */
+        if( !SetPollWaitCancelRoutine( Wait->Irp ) )
+            CompletePollWait( Wait, STATUS_CANCELLED, 0 );
+    }
+}
+
+static VOID CheckPollEntry( PAFD_POLL_ENTRY Entry ) {
+    PAFD_FCB FCB = Entry->FileObject->FsContext;
+
+    if( !(Entry->Events & FCB->PollState) || !IsListEmpty( &Entry->ReadyEntry ) )
+        return;
+
+    AFD_DbgPrint(MID_TRACE,("Queueing poll entry %p of %p with %x\n",
+                            Entry, FCB, Entry->Events & FCB->PollState));
+
+    InsertTailList( &Entry->PollSet->ReadyList, &Entry->ReadyEntry );
+    SignalPollSet( Entry->PollSet );
+}
+
+static VOID UnlinkPollEntry( PAFD_POLL_ENTRY Entry ) {
+    RemoveEntryList( &Entry->SetEntry );
+    RemoveEntryList( &Entry->SocketEntry );
+    if( !IsListEmpty( &Entry->ReadyEntry ) )
+        RemoveEntryList( &Entry->ReadyEntry );
+}
+/* * * END OF DEVICE EXTENSION LOCK REQUIREMENT * * */
+
+static VOID FreePollEntries( PLIST_ENTRY FreeList ) {
+    PAFD_POLL_ENTRY Entry;
+
+    while( !IsListEmpty( FreeList ) ) {
+        Entry = CONTAINING_RECORD( RemoveHeadList( FreeList ), AFD_POLL_ENTRY, SetEntry );
+        ObDereferenceObject( Entry->FileObject );
+        ExFreePoolWithTag(Entry, TAG_AFD_POLL_ENTRY);
+    }
+}
+
+/* Called with the state lock held */
+static NTSTATUS GetPollSet( PAFD_FCB FCB, PAFD_POLL_SET *PollSet ) {
+    PAFD_POLL_SET NewSet;
+
+    /* Sockets don't hold poll sets, the other handles to AFD do */
+    if( FCB->TdiDeviceName.Buffer )
+        return STATUS_INVALID_PARAMETER;
+
+    if( !FCB->PollSet ) {
+        NewSet = ExAllocatePoolWithTag(NonPagedPool,
+                                       sizeof(AFD_POLL_SET),
+                                       TAG_AFD_POLL_SET);
+        if( !NewSet )
+            return STATUS_NO_MEMORY;
+
+        InitializeListHead( &NewSet->Entries );
+        InitializeListHead( &NewSet->ReadyList );
+        InitializeListHead( &NewSet->Waits );
+        FCB->PollSet = NewSet;
+    }
+
+    *PollSet = FCB->PollSet;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS NTAPI
+AfdPollControl( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+                PIO_STACK_LOCATION IrpSp ) {
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_DEVICE_EXTENSION DeviceExt = DeviceObject->DeviceExtension;
+    PAFD_POLL_CONTROL_INFO ControlReq = Irp->AssociatedIrp.SystemBuffer;
+    PAFD_POLL_SET PollSet;
+    PAFD_POLL_ENTRY Entry = NULL, NewEntry = NULL;
+    PFILE_OBJECT SocketObject;
+    PAFD_FCB SocketFCB;
+    PLIST_ENTRY ListEntry;
+    LIST_ENTRY FreeList;
+    NTSTATUS Status;
+    KIRQL OldIrql;
+
+    if( !SocketAcquireStateLock( FCB ) ) {
+        return LostSocket( Irp );
+    }
+
+    if( IrpSp->Parameters.DeviceIoControl.InputBufferLength < sizeof(*ControlReq) ) {
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_PARAMETER, Irp, 0 );
+    }
+
+    AFD_DbgPrint(MID_TRACE,("Called (Operation %u Handle %p Events %x)\n",
+                            ControlReq->Operation,
+                            (PVOID)ControlReq->Handle,
+                            ControlReq->Events));
+
+    Status = GetPollSet( FCB, &PollSet );
+    if( !NT_SUCCESS(Status) ) {
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    Status = ObReferenceObjectByHandle( (HANDLE)ControlReq->Handle,
+                                        0,
+                                        *IoFileObjectType,
+                                        Irp->RequestorMode,
+                                        (PVOID *)&SocketObject,
+                                        NULL );
+    if( !NT_SUCCESS(Status) ) {
+        return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+    }
+
+    /* Only sockets can be polled, which leaves out the poll sets */
+    SocketFCB = SocketObject->FsContext;
+    if( SocketObject->DeviceObject != DeviceObject ||
+        !SocketFCB || !SocketFCB->TdiDeviceName.Buffer ) {
+        ObDereferenceObject( SocketObject );
+        return UnlockAndMaybeComplete( FCB, STATUS_INVALID_HANDLE, Irp, 0 );
+    }
+
+    if( ControlReq->Operation == AFD_POLL_ADD ) {
+        NewEntry = ExAllocatePoolWithTag(NonPagedPool,
+                                         sizeof(AFD_POLL_ENTRY),
+                                         TAG_AFD_POLL_ENTRY);
+        if( !NewEntry ) {
+            ObDereferenceObject( SocketObject );
+            return UnlockAndMaybeComplete( FCB, STATUS_NO_MEMORY, Irp, 0 );
+        }
+    }
+
+    InitializeListHead( &FreeList );
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    for( ListEntry = SocketFCB->PollEntries.Flink;
+         ListEntry != &SocketFCB->PollEntries;
+         ListEntry = ListEntry->Flink ) {
+        if( CONTAINING_RECORD( ListEntry, AFD_POLL_ENTRY, SocketEntry )->PollSet == PollSet ) {
+            Entry = CONTAINING_RECORD( ListEntry, AFD_POLL_ENTRY, SocketEntry );
+            break;
+        }
+    }
+
+    switch( ControlReq->Operation ) {
+    case AFD_POLL_ADD:
+        if( Entry ) {
+            Status = STATUS_OBJECT_NAME_COLLISION;
+            break;
+        }
+
+        /* The entry keeps our reference to the socket */
+        Entry = NewEntry;
+        NewEntry = NULL;
+        Entry->PollSet = PollSet;
+        Entry->FileObject = SocketObject;
+        SocketObject = NULL;
+        InitializeListHead( &Entry->ReadyEntry );
+        InsertTailList( &PollSet->Entries, &Entry->SetEntry );
+        InsertTailList( &SocketFCB->PollEntries, &Entry->SocketEntry );
+        /* Fall through */
+
+    case AFD_POLL_MODIFY:
+        if( !Entry ) {
+            Status = STATUS_NOT_FOUND;
+            break;
+        }
+
+        Entry->Events = ControlReq->Events;
+        Entry->Flags = ControlReq->Flags;
+        Entry->Context = ControlReq->Context;
+        CheckPollEntry( Entry );
+        Status = STATUS_SUCCESS;
+        break;
+
+    case AFD_POLL_REMOVE:
+        if( !Entry ) {
+            Status = STATUS_NOT_FOUND;
+            break;
+        }
+
+        UnlinkPollEntry( Entry );
+        InsertTailList( &FreeList, &Entry->SetEntry );
+        Status = STATUS_SUCCESS;
+        break;
+
+    default:
+        Status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    FreePollEntries( &FreeList );
+
+    if( NewEntry )
+        ExFreePoolWithTag(NewEntry, TAG_AFD_POLL_ENTRY);
+
+    if( SocketObject )
+        ObDereferenceObject( SocketObject );
+
+    AFD_DbgPrint(MID_TRACE,("Returning %x\n", Status));
+
+    return UnlockAndMaybeComplete( FCB, Status, Irp, 0 );
+}
+
+NTSTATUS NTAPI
+AfdPollWait( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+             PIO_STACK_LOCATION IrpSp ) {
+    PFILE_OBJECT FileObject = IrpSp->FileObject;
+    PAFD_FCB FCB = FileObject->FsContext;
+    PAFD_DEVICE_EXTENSION DeviceExt = DeviceObject->DeviceExtension;
+    PAFD_POLL_WAIT_INFO WaitReq = Irp->AssociatedIrp.SystemBuffer;
+    PAFD_POLL_SET PollSet;
+    PAFD_POLL_WAITER Wait;
+    LARGE_INTEGER Timeout;
+    ULONG EventCount;
+    NTSTATUS Status;
+    KIRQL OldIrql;
+
+    if( IrpSp->Parameters.DeviceIoControl.InputBufferLength <
+            FIELD_OFFSET(AFD_POLL_WAIT_INFO, Events) ||
+        IrpSp->Parameters.DeviceIoControl.OutputBufferLength <
+            sizeof(AFD_POLL_WAIT_INFO) ) {
+        Irp->IoStatus.Status = STATUS_INVALID_PARAMETER;
+        Irp->IoStatus.Information = 0;
+        IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if( !SocketAcquireStateLock( FCB ) ) {
+        return LostSocket( Irp );
+    }
+
+    Status = GetPollSet( FCB, &PollSet );
+    SocketStateUnlock( FCB );
+
+    if( !NT_SUCCESS(Status) ) {
+        Irp->IoStatus.Status = Status;
+        Irp->IoStatus.Information = 0;
+        IoCompleteRequest( Irp, IO_NETWORK_INCREMENT );
+        return Status;
+    }
+
+    /* The output overwrites it */
+    Timeout = WaitReq->Timeout;
+
+    AFD_DbgPrint(MID_TRACE,("Called (PollSet %p Timeout %d)\n",
+                            PollSet, (INT)(Timeout.QuadPart)));
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    EventCount = GatherPollEvents( PollSet, Irp );
+
+    if( EventCount ) {
+        Status = STATUS_SUCCESS;
+        CompletePollWaitIrp( Irp, Status, EventCount );
+    } else if( !Timeout.QuadPart ) {
+        Status = STATUS_TIMEOUT;
+        CompletePollWaitIrp( Irp, Status, 0 );
+    } else {
+        Wait = ExAllocatePoolWithTag(NonPagedPool,
+                                     sizeof(AFD_POLL_WAITER),
+                                     TAG_AFD_POLL_WAITER);
+
+        if( Wait ) {
+            Wait->Irp = Irp;
+            Wait->DeviceExt = DeviceExt;
+
+            KeInitializeTimerEx( &Wait->Timer, NotificationTimer );
+
+            KeInitializeDpc( &Wait->TimeoutDpc, PollWaitTimeout, Wait );
+
+            InsertTailList( &PollSet->Waits, &Wait->ListEntry );
+
+            Wait->TimedOut = FALSE;
+
+            KeSetTimer( &Wait->Timer, Timeout, &Wait->TimeoutDpc );
+
+            Status = STATUS_PENDING;
+            IoMarkIrpPending( Irp );
+
+            /* If it got cancelled already, nobody calls the cancel routine */
+            if( !SetPollWaitCancelRoutine( Irp ) )
+                CompletePollWait( Wait, STATUS_CANCELLED, 0 );
+        } else {
+            Status = STATUS_NO_MEMORY;
+            CompletePollWaitIrp( Irp, Status, 0 );
+        }
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    AFD_DbgPrint(MID_TRACE,("Returning %x\n", Status));
+
+    return Status;
+}
+
+/* Called from the cancel routine, with the state lock held */
+VOID CancelPollWait( PAFD_FCB FCB, PIRP Irp ) {
+    PAFD_DEVICE_EXTENSION DeviceExt = FCB->DeviceExt;
+    PLIST_ENTRY ListEntry;
+    PAFD_POLL_WAITER Wait;
+    KIRQL OldIrql;
+
+    if( !FCB->PollSet ) return;
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    for( ListEntry = FCB->PollSet->Waits.Flink;
+         ListEntry != &FCB->PollSet->Waits;
+         ListEntry = ListEntry->Flink ) {
+        Wait = CONTAINING_RECORD( ListEntry, AFD_POLL_WAITER, ListEntry );
+        if( Wait->Irp == Irp ) {
+            CompletePollWait( Wait, STATUS_CANCELLED, 0 );
+            break;
+        }
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+}
+
+/* The socket is going away, take it out of the poll sets */
+VOID KillPollEntriesForFCB( PAFD_FCB FCB ) {
+    PAFD_DEVICE_EXTENSION DeviceExt = FCB->DeviceExt;
+    PAFD_POLL_ENTRY Entry;
+    LIST_ENTRY FreeList;
+    KIRQL OldIrql;
+
+    InitializeListHead( &FreeList );
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    while( !IsListEmpty( &FCB->PollEntries ) ) {
+        Entry = CONTAINING_RECORD( FCB->PollEntries.Flink, AFD_POLL_ENTRY, SocketEntry );
+        UnlinkPollEntry( Entry );
+        InsertTailList( &FreeList, &Entry->SetEntry );
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    FreePollEntries( &FreeList );
+}
+
+/* The poll set handle is going away, release its waits and sockets */
+VOID KillPollSet( PAFD_FCB FCB ) {
+    PAFD_DEVICE_EXTENSION DeviceExt = FCB->DeviceExt;
+    PAFD_POLL_SET PollSet = FCB->PollSet;
+    PAFD_POLL_ENTRY Entry;
+    PAFD_POLL_WAITER Wait;
+    PLIST_ENTRY ListEntry;
+    LIST_ENTRY FreeList;
+    KIRQL OldIrql;
+
+    if( !PollSet ) return;
+
+    InitializeListHead( &FreeList );
+
+    KeAcquireSpinLock( &DeviceExt->Lock, &OldIrql );
+
+    /* The waits being cancelled are left to the cancel routine, which runs
+     * once the state lock is released, and still finds the poll set */
+    ListEntry = PollSet->Waits.Flink;
+    while( ListEntry != &PollSet->Waits ) {
+        Wait = CONTAINING_RECORD( ListEntry, AFD_POLL_WAITER, ListEntry );
+        ListEntry = ListEntry->Flink;
+        if( IoSetCancelRoutine(Wait->Irp, NULL) )
+            CompletePollWait( Wait, STATUS_CANCELLED, 0 );
+    }
+
+    while( !IsListEmpty( &PollSet->Entries ) ) {
+        Entry = CONTAINING_RECORD( PollSet->Entries.Flink, AFD_POLL_ENTRY, SetEntry );
+        UnlinkPollEntry( Entry );
+        InsertTailList( &FreeList, &Entry->SetEntry );
+    }
+
+    KeReleaseSpinLock( &DeviceExt->Lock, OldIrql );
+
+    FreePollEntries( &FreeList );
+}
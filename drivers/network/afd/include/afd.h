@@ -52,6 +52,9 @@
 #define TAG_AFD_SNMP_ADDRESS_INFO          'asfA'
 #define TAG_AFD_TDI_CONNECTION_INFORMATION 'cTfA'
 #define TAG_AFD_WSA_BUFFER                 'bWfA'
+#define TAG_AFD_POLL_SET                   'spfA'
+#define TAG_AFD_POLL_ENTRY                 'epfA'
+#define TAG_AFD_POLL_WAITER                'wpfA'
 
 typedef struct IPADDR_ENTRY {
 	ULONG  Addr;
@@ -123,6 +126,36 @@ typedef struct _AFD_ACTIVE_POLL {
     BOOLEAN Exclusive;
 } AFD_ACTIVE_POLL, *PAFD_ACTIVE_POLL;
 
+/* A persistent poll set, see IOCTL_AFD_POLL_CONTROL.
+ * All of its lists are protected by the device extension lock */
+typedef struct _AFD_POLL_SET {
+    LIST_ENTRY Entries;         /* AFD_POLL_ENTRY.SetEntry */
+    LIST_ENTRY ReadyList;       /* AFD_POLL_ENTRY.ReadyEntry */
+    LIST_ENTRY Waits;           /* AFD_POLL_WAITER.ListEntry */
+} AFD_POLL_SET, *PAFD_POLL_SET;
+
+/* A socket registered in a poll set, linked both from the set and from
+ * the socket so that an event only looks at the sets it matters to */
+typedef struct _AFD_POLL_ENTRY {
+    LIST_ENTRY SetEntry;
+    LIST_ENTRY SocketEntry;     /* AFD_FCB.PollEntries */
+    LIST_ENTRY ReadyEntry;      /* Points to itself while not ready */
+    PAFD_POLL_SET PollSet;
+    PFILE_OBJECT FileObject;    /* Referenced */
+    ULONG Events;               /* 0 once a one shot entry is reported */
+    ULONG Flags;
+    ULONG_PTR Context;
+} AFD_POLL_ENTRY, *PAFD_POLL_ENTRY;
+
+typedef struct _AFD_POLL_WAITER {
+    LIST_ENTRY ListEntry;
+    PIRP Irp;                   /* NULL once completed, for the timeout DPC to free us */
+    PAFD_DEVICE_EXTENSION DeviceExt;
+    KDPC TimeoutDpc;
+    KTIMER Timer;
+    BOOLEAN TimedOut;           /* The timeout DPC left the IRP to the cancel routine */
+} AFD_POLL_WAITER, *PAFD_POLL_WAITER;
+
 typedef struct _IRP_LIST {
     LIST_ENTRY ListEntry;
     PIRP Irp;
@@ -201,6 +234,8 @@ typedef struct _AFD_FCB {
     LIST_ENTRY PendingIrpList[MAX_FUNCTIONS];
     LIST_ENTRY DatagramList;
     LIST_ENTRY PendingConnections;
+    LIST_ENTRY PollEntries;
+    PAFD_POLL_SET PollSet;
 } AFD_FCB, *PAFD_FCB;
 
 /* bind.c */
@@ -336,6 +371,15 @@ VOID ZeroEvents( PAFD_HANDLE HandleArray,
 VOID SignalSocket(
    PAFD_ACTIVE_POLL Poll OPTIONAL, PIRP _Irp OPTIONAL,
    PAFD_POLL_INFO PollReq, NTSTATUS Status);
+NTSTATUS NTAPI
+AfdPollControl( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+		PIO_STACK_LOCATION IrpSp );
+NTSTATUS NTAPI
+AfdPollWait( PDEVICE_OBJECT DeviceObject, PIRP Irp,
+	     PIO_STACK_LOCATION IrpSp );
+VOID CancelPollWait( PAFD_FCB FCB, PIRP Irp );
+VOID KillPollEntriesForFCB( PAFD_FCB FCB );
+VOID KillPollSet( PAFD_FCB FCB );
 
 /* tdi.c */
 
@@ -304,6 +304,37 @@ VOID NTAPI ProtocolSendComplete(
     FreeNdisPacket(Packet);
 }
 
+VOID LanGetReceiveChecksumInfo(
+    PLAN_ADAPTER Adapter,
+    PIP_PACKET IPPacket)
+/*
+ * FUNCTION: Records which checksums the adapter verified for a packet
+ * ARGUMENTS:
+ *     Adapter  = Pointer to a LAN_ADAPTER structure
+ *     IPPacket = Pointer to the IP packet wrapping the received NDIS packet
+ * NOTES:
+ *     Failed checksums are left to the software checks, which will
+ *     drop the packet
+ */
+{
+    NDIS_TCP_IP_CHECKSUM_PACKET_INFO ChecksumInfo;
+
+    if (!Adapter->ChecksumOffload.V4Receive.IpChecksum &&
+        !Adapter->ChecksumOffload.V4Receive.TcpChecksum &&
+        !Adapter->ChecksumOffload.V4Receive.UdpChecksum)
+        return;
+
+    ChecksumInfo.Value = PtrToUlong(NDIS_PER_PACKET_INFO_FROM_PACKET(IPPacket->NdisPacket,
+                                                                     TcpIpChecksumPacketInfo));
+
+    if (ChecksumInfo.Receive.NdisPacketIpChecksumSucceeded)
+        IPPacket->Flags |= IP_PACKET_FLAG_IP_CHECKSUM_OK;
+    if (ChecksumInfo.Receive.NdisPacketTcpChecksumSucceeded)
+        IPPacket->Flags |= IP_PACKET_FLAG_TCP_CHECKSUM_OK;
+    if (ChecksumInfo.Receive.NdisPacketUdpChecksumSucceeded)
+        IPPacket->Flags |= IP_PACKET_FLAG_UDP_CHECKSUM_OK;
+}
+
 VOID LanReceiveWorker( PVOID Context ) {
     ULONG PacketType;
     PLAN_WQ_ITEM WorkItem = (PLAN_WQ_ITEM)Context;
@@ -330,6 +361,10 @@ VOID LanReceiveWorker( PVOID Context ) {
     IPPacket.NdisPacket = Packet;
     IPPacket.ReturnPacket = !LegacyReceive;
 
+    /* Only packets indicated by the miniport carry checksum information */
+    if (!LegacyReceive)
+        LanGetReceiveChecksumInfo(Adapter, &IPPacket);
+
     if (LegacyReceive)
     {
         /* Packet type is precomputed */
@@ -1472,6 +1507,112 @@ VOID UnbindAdapter(
 }
 
 
+VOID LANNegotiateChecksumOffload(
+    PLAN_ADAPTER Adapter)
+/*
+ * FUNCTION: Enables the receive checksum offload of an adapter, if any
+ * ARGUMENTS:
+ *     Adapter = Pointer to a LAN_ADAPTER structure
+ * NOTES:
+ *     Only the receive side is enabled. Outgoing TCP segments are
+ *     checksummed by lwIP while it copies the user data, which costs
+ *     next to nothing
+ */
+{
+    PNDIS_TASK_OFFLOAD_HEADER Header;
+    PNDIS_TASK_OFFLOAD Task;
+    PNDIS_TASK_TCP_IP_CHECKSUM Supported = NULL;
+    NDIS_TASK_TCP_IP_CHECKSUM Enabled;
+    NDIS_STATUS NdisStatus;
+    ULONG Offset;
+
+    Header = ExAllocatePoolWithTag(NonPagedPool, TASK_OFFLOAD_BUFFER_SIZE, TASK_OFFLOAD_TAG);
+    if (!Header)
+        return;
+
+    RtlZeroMemory(Header, TASK_OFFLOAD_BUFFER_SIZE);
+    Header->Version = NDIS_TASK_OFFLOAD_VERSION;
+    Header->Size = sizeof(NDIS_TASK_OFFLOAD_HEADER);
+    Header->EncapsulationFormat.Encapsulation = IEEE_802_3_Encapsulation;
+    Header->EncapsulationFormat.Flags.FixedHeaderSize = 1;
+    Header->EncapsulationFormat.EncapsulationHeaderSize = Adapter->HeaderSize;
+
+    /* Legacy NIC drivers don't know about task offload at all */
+    NdisStatus = NDISCall(Adapter,
+                          NdisRequestQueryInformation,
+                          OID_TCP_TASK_OFFLOAD,
+                          Header,
+                          TASK_OFFLOAD_BUFFER_SIZE);
+    if (NdisStatus != NDIS_STATUS_SUCCESS) {
+        ExFreePoolWithTag(Header, TASK_OFFLOAD_TAG);
+        return;
+    }
+
+    /* Look for the checksum task in the list */
+    Offset = Header->OffsetFirstTask;
+    while (Offset && Offset <= TASK_OFFLOAD_BUFFER_SIZE - FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer)) {
+        Task = (PNDIS_TASK_OFFLOAD)((PUCHAR)Header + Offset);
+
+        if (Task->Task == TcpIpChecksumNdisTask &&
+            Task->TaskBufferLength >= sizeof(NDIS_TASK_TCP_IP_CHECKSUM) &&
+            Offset + FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) + sizeof(NDIS_TASK_TCP_IP_CHECKSUM) <= TASK_OFFLOAD_BUFFER_SIZE) {
+            Supported = (PNDIS_TASK_TCP_IP_CHECKSUM)Task->TaskBuffer;
+            break;
+        }
+
+        if (!Task->OffsetNextTask)
+            break;
+        Offset += Task->OffsetNextTask;
+    }
+
+    if (!Supported) {
+        ExFreePoolWithTag(Header, TASK_OFFLOAD_TAG);
+        return;
+    }
+
+    RtlZeroMemory(&Enabled, sizeof(Enabled));
+    Enabled.V4Receive.IpOptionsSupported  = Supported->V4Receive.IpOptionsSupported;
+    Enabled.V4Receive.TcpOptionsSupported = Supported->V4Receive.TcpOptionsSupported;
+    Enabled.V4Receive.IpChecksum          = Supported->V4Receive.IpChecksum;
+    Enabled.V4Receive.TcpChecksum         = Supported->V4Receive.TcpChecksum;
+    Enabled.V4Receive.UdpChecksum         = Supported->V4Receive.UdpChecksum;
+
+    TI_DbgPrint(MID_TRACE, ("Receive checksum offload: IP %d TCP %d UDP %d\n",
+                            Enabled.V4Receive.IpChecksum,
+                            Enabled.V4Receive.TcpChecksum,
+                            Enabled.V4Receive.UdpChecksum));
+
+    if (!Enabled.V4Receive.IpChecksum &&
+        !Enabled.V4Receive.TcpChecksum &&
+        !Enabled.V4Receive.UdpChecksum) {
+        ExFreePoolWithTag(Header, TASK_OFFLOAD_TAG);
+        return;
+    }
+
+    /* Ask for exactly these tasks, in a list of one */
+    Header->OffsetFirstTask = sizeof(NDIS_TASK_OFFLOAD_HEADER);
+    Task = (PNDIS_TASK_OFFLOAD)(Header + 1);
+    Task->Version = NDIS_TASK_OFFLOAD_VERSION;
+    Task->Size = sizeof(NDIS_TASK_OFFLOAD);
+    Task->Task = TcpIpChecksumNdisTask;
+    Task->OffsetNextTask = 0;
+    Task->TaskBufferLength = sizeof(NDIS_TASK_TCP_IP_CHECKSUM);
+    RtlCopyMemory(Task->TaskBuffer, &Enabled, sizeof(Enabled));
+
+    NdisStatus = NDISCall(Adapter,
+                          NdisRequestSetInformation,
+                          OID_TCP_TASK_OFFLOAD,
+                          Header,
+                          sizeof(NDIS_TASK_OFFLOAD_HEADER) +
+                          FIELD_OFFSET(NDIS_TASK_OFFLOAD, TaskBuffer) +
+                          sizeof(NDIS_TASK_TCP_IP_CHECKSUM));
+    if (NdisStatus == NDIS_STATUS_SUCCESS)
+        Adapter->ChecksumOffload = Enabled;
+
+    ExFreePoolWithTag(Header, TASK_OFFLOAD_TAG);
+}
+
+
 NDIS_STATUS LANRegisterAdapter(
     PNDIS_STRING AdapterName,
     PNDIS_STRING RegistryPath)
@@ -1571,6 +1712,9 @@ NDIS_STATUS LANRegisterAdapter(
            assume it can send at least one packet per call to NdisSend(Packets) */
         IF->MaxSendPackets = 1;
 
+    /* Let the adapter verify checksums of received packets, if it can */
+    LANNegotiateChecksumOffload(IF);
+
     /* Get current hardware address */
     NdisStatus = NDISCall(IF,
                           NdisRequestQueryInformation,
@@ -15,6 +15,12 @@ ULONG ChecksumCompute(
     UINT Count,
     ULONG Seed);
 
+ULONG ChecksumCopyCompute(
+    PVOID Destination,
+    PVOID Source,
+    UINT Count,
+    ULONG Seed);
+
 unsigned int
 csum_partial(
   const unsigned char * buff,
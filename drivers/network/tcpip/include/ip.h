@@ -91,6 +91,9 @@ typedef struct _IP_PACKET {
 } IP_PACKET, *PIP_PACKET;
 
 #define IP_PACKET_FLAG_RAW      0x01    /* Raw IP packet */
+#define IP_PACKET_FLAG_IP_CHECKSUM_OK  0x02 /* IPv4 header checksum verified by the adapter */
+#define IP_PACKET_FLAG_TCP_CHECKSUM_OK 0x04 /* TCP checksum verified by the adapter */
+#define IP_PACKET_FLAG_UDP_CHECKSUM_OK 0x08 /* UDP checksum verified by the adapter */
 
 
 /* Packet context */
@@ -59,6 +59,7 @@ typedef struct LAN_ADAPTER {
     UINT MacOptions;                        /* MAC options for NIC driver/adapter */
     UINT Speed;                             /* Link speed */
     UINT PacketFilter;                      /* Packet filter for this adapter */
+    NDIS_TASK_TCP_IP_CHECKSUM ChecksumOffload; /* Checksum tasks enabled on the adapter */
 } LAN_ADAPTER, *PLAN_ADAPTER;
 
 /* LAN adapter state constants */
@@ -67,6 +68,9 @@ typedef struct LAN_ADAPTER {
 #define LAN_STATE_STARTED   2
 #define LAN_STATE_STOPPED   3
 
+/* Size of the buffer used to query the task offload capabilities */
+#define TASK_OFFLOAD_BUFFER_SIZE 512
+
 /* Size of out lookahead buffer */
 #define LOOKAHEAD_SIZE  128
 
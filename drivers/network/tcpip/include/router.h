@@ -10,9 +10,35 @@
 #include <neighbor.h>
 
 
+/* Maximum number of bits in a route prefix (IPv6) */
+#define ROUTE_MAX_PREFIX_BITS (sizeof(IPv6_RAW_ADDRESS) * 8)
+
+/* Number of destinations remembered by the route cache (power of 2) */
+#define ROUTE_CACHE_SIZE 256
+
+struct _FIB_ENTRY;
+
+/* Node of the prefix trie, indexing the FIB by network address */
+typedef struct _ROUTE_NODE {
+    struct _ROUTE_NODE *Parent;   /* Parent node, NULL for the root */
+    struct _ROUTE_NODE *Child[2]; /* Subtrees, by the bit following the prefix */
+    LIST_ENTRY RouteListHead;     /* FIB entries for exactly this prefix */
+    UINT PrefixLength;            /* Number of significant bits in Prefix */
+    UCHAR Prefix[sizeof(IPv6_RAW_ADDRESS)]; /* Network address, masked */
+} ROUTE_NODE, *PROUTE_NODE;
+
+/* Route cache entry, remembering the last route used for a destination */
+typedef struct _ROUTE_CACHE_ENTRY {
+    IP_ADDRESS Destination;       /* Destination address */
+    PNEIGHBOR_CACHE_ENTRY Router; /* NCE of the router to use */
+    ULONG Generation;             /* FIB generation the entry is valid for */
+} ROUTE_CACHE_ENTRY, *PROUTE_CACHE_ENTRY;
+
 /* Forward Information Base Entry */
 typedef struct _FIB_ENTRY {
     LIST_ENTRY ListEntry;         /* Entry on list */
+    LIST_ENTRY NodeListEntry;     /* Entry on the list of the trie node */
+    PROUTE_NODE Node;             /* Trie node holding this entry */
     OBJECT_FREE_ROUTINE Free;     /* Routine used to free resources for the object */
     IP_ADDRESS NetworkAddress;    /* Address of network */
     IP_ADDRESS Netmask;           /* Netmask of network */
@@ -27,6 +27,7 @@
 #define PACKET_BUFFER_TAG 'fuBP'
 #define FRAGMENT_DATA_TAG 'taDF'
 #define FIB_TAG ' BIF'
+#define ROUTE_NODE_TAG 'NtuR'
 #define IFC_TAG ' CFI'
 #define TDI_BUCKET_TAG 'BidT'
 #define FBSD_TAG 'DSBF'
@@ -34,6 +35,7 @@
 #define OSK_LARGE_TAG 'LKSO'
 #define OSK_SMALL_TAG 'SKSO'
 #define LAN_ADAPTER_TAG ' NAL'
+#define TASK_OFFLOAD_TAG 'OksT'
 #define WQ_CONTEXT_TAG 'noCW'
 #define ROUTE_ENTRY_TAG 'erCT'
 #define OUT_DATA_TAG 'doCT'
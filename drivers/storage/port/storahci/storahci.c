@@ -440,30 +440,35 @@ AhciCommandCompletionDpcRoutine (
     AdapterExtension = (PAHCI_ADAPTER_EXTENSION)HwDeviceExtension;
     PortExtension = (PAHCI_PORT_EXTENSION)SystemArgument1;
 
-    StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
-    Srb = RemoveQueue(&PortExtension->CompletionQueue);
-    StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
+    // several commands can complete before the DPC gets to run,
+    // while an already queued DPC is not queued a second time
+    for (;;)
+    {
+        StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
+        Srb = RemoveQueue(&PortExtension->CompletionQueue);
+        StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
 
-    NT_ASSERT(Srb != NULL);
+        if (Srb == NULL)
+        {
+            break;
+        }
 
-    if (Srb->SrbStatus == SRB_STATUS_PENDING)
-    {
-        Srb->SrbStatus = SRB_STATUS_SUCCESS;
-    }
-    else
-    {
-        return;
-    }
+        // a command failed by error recovery keeps its status
+        if (Srb->SrbStatus == SRB_STATUS_PENDING)
+        {
+            Srb->SrbStatus = SRB_STATUS_SUCCESS;
+        }
 
-    SrbExtension = GetSrbExtension(Srb);
+        SrbExtension = GetSrbExtension(Srb);
 
-    CompletionRoutine = SrbExtension->CompletionRoutine;
-    NT_ASSERT(CompletionRoutine != NULL);
+        CompletionRoutine = SrbExtension->CompletionRoutine;
+        NT_ASSERT(CompletionRoutine != NULL);
 
-    // now it's completion routine responsibility to set SrbStatus
-    CompletionRoutine(PortExtension, Srb);
+        // now it's completion routine responsibility to set SrbStatus
+        CompletionRoutine(PortExtension, Srb);
 
-    StorPortNotification(RequestComplete, AdapterExtension, Srb);
+        StorPortNotification(RequestComplete, AdapterExtension, Srb);
+    }
 
     return;
 }// -- AhciCommandCompletionDpcRoutine();
@@ -499,6 +504,7 @@ AhciHwPassiveInitialize (
             PortExtension = &AdapterExtension->PortExtension[index];
             PortExtension->DeviceParams.IsActive = AhciStartPort(PortExtension);
             StorPortInitializeDpc(AdapterExtension, &PortExtension->CommandCompletion, AhciCommandCompletionDpcRoutine);
+            StorPortInitializeDpc(AdapterExtension, &PortExtension->ErrorRecovery, AhciErrorRecoveryDpcRoutine);
         }
     }
 
@@ -579,7 +585,7 @@ AhciCompleteIssuedSrb (
 
     for (i = 0; i < NCS; i++)
     {
-        if (((1 << i) & CommandsToComplete) != 0)
+        if ((((ULONG)1 << i) & CommandsToComplete) != 0)
         {
             Srb = PortExtension->Slot[i];
 
@@ -588,6 +594,9 @@ AhciCompleteIssuedSrb (
                 continue;
             }
 
+            // the slot is free for the next command
+            PortExtension->Slot[i] = NULL;
+
             SrbExtension = GetSrbExtension(Srb);
             NT_ASSERT(SrbExtension != NULL);
 
@@ -598,8 +607,11 @@ AhciCompleteIssuedSrb (
             }
             else
             {
-                NT_ASSERT(Srb->SrbStatus == SRB_STATUS_PENDING);
-                Srb->SrbStatus = SRB_STATUS_SUCCESS;
+                // a command failed by error recovery keeps its status
+                if (Srb->SrbStatus == SRB_STATUS_PENDING)
+                {
+                    Srb->SrbStatus = SRB_STATUS_SUCCESS;
+                }
                 StorPortNotification(RequestComplete, AdapterExtension, Srb);
             }
         }
@@ -608,6 +620,359 @@ AhciCompleteIssuedSrb (
     return;
 }// -- AhciCompleteIssuedSrb();
 
+/**
+ * @name AhciRestartPort
+ * @implemented
+ *
+ * Stop the port and start it again, as required to recover from a fatal error (section 6.2.2)
+ * Clearing PxCMD.ST also clears PxCI and PxSACT, so the commands which were outstanding are lost.
+ *
+ * @param PortExtension
+ * @param ComReset
+ * Reset the device too, it is done anyway if the device is still busy
+ *
+ * @return
+ * return TRUE if the port is running again
+ */
+BOOLEAN
+AhciRestartPort (
+    __in PAHCI_PORT_EXTENSION PortExtension,
+    __in BOOLEAN ComReset
+    )
+{
+    ULONG ticks;
+    AHCI_PORT_CMD cmd;
+    AHCI_TASK_FILE_DATA tfd;
+    AHCI_SERIAL_ATA_STATUS ssts;
+    AHCI_SERIAL_ATA_CONTROL sctl;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+
+    AhciDebugPrint("AhciRestartPort()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+
+    // 10.4.2
+    // Software shall clear PxCMD.ST and wait at least 500 milliseconds for PxCMD.CR to return '0'
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+    cmd.ST = 0;
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+
+    for (ticks = 0; ticks < 500; ticks++)
+    {
+        cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+        if (cmd.CR == 0)
+        {
+            break;
+        }
+        StorPortStallExecution(1000);
+    }
+
+    if (cmd.CR != 0)
+    {
+        // only an HBA reset can help now
+        AhciDebugPrint("\tPxCMD.CR did not clear\n");
+        return FALSE;
+    }
+
+    // clear the error bits, PxSERR before PxIS
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SERR, (ULONG)~0);
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IS, (ULONG)~0);
+
+    tfd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->TFD);
+    if ((tfd.STS.BSY) || (tfd.STS.DRQ))
+    {
+        ComReset = TRUE;
+    }
+
+    if (ComReset)
+    {
+        AhciDebugPrint("\tCOMRESET\n");
+
+        // same as in AhciStartPort
+        sctl.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SCTL);
+        sctl.DET = 1;
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SCTL, sctl.Status);
+
+        StorPortStallExecution(1000);
+
+        sctl.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SCTL);
+        sctl.DET = 0;
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SCTL, sctl.Status);
+
+        for (ticks = 0; ticks < 100; ticks++)
+        {
+            StorPortStallExecution(1000);
+            ssts.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SSTS);
+            if (ssts.DET == 0x3)
+            {
+                break;
+            }
+        }
+
+        // the device is ready once it sent its D2H Register FIS
+        for (ticks = 0; ticks < 500; ticks++)
+        {
+            tfd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->TFD);
+            if ((tfd.STS.BSY == 0) && (tfd.STS.DRQ == 0))
+            {
+                break;
+            }
+            StorPortStallExecution(1000);
+        }
+
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SERR, (ULONG)~0);
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IS, (ULONG)~0);
+    }
+
+    if ((tfd.STS.BSY) || (tfd.STS.DRQ))
+    {
+        AhciDebugPrint("\tDevice still busy: %x\n", tfd.Status);
+        return FALSE;
+    }
+
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+    cmd.ST = 1;
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CMD, cmd.Status);
+    cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+
+    return (cmd.ST == 1);
+}// -- AhciRestartPort();
+
+/**
+ * @name AhciPortErrorRecovery
+ * @implemented
+ *
+ * Recover from a fatal error, section 6.2.2, once the port was restarted. Caller holds InterruptLock.
+ * A failed non-queued command is the one in PxCMD.CCS, it is completed with an error
+ * and the commands which were issued with it are issued again.
+ * A native queued command error aborts all the queued commands without telling which one failed,
+ * so they are issued again as non-queued commands, the failing one then fails alone.
+ *
+ * @param PortExtension
+ * @param Running
+ * Whether the port restarted, the outstanding commands all fail otherwise
+ *
+ */
+VOID
+AhciPortErrorRecovery (
+    __in PAHCI_PORT_EXTENSION PortExtension,
+    __in BOOLEAN Running
+    )
+{
+    PSCSI_REQUEST_BLOCK Srb;
+    PAHCI_SRB_EXTENSION SrbExtension;
+    ULONG i, outstanding, ncqSlots, failedSlot, sectorCount;
+
+    AhciDebugPrint("AhciPortErrorRecovery()\n");
+
+    outstanding = PortExtension->CommandIssuedSlots;
+    ncqSlots = PortExtension->NcqSlots;
+    failedSlot = PortExtension->FailedSlot;
+
+    PortExtension->CommandIssuedSlots = 0;
+    PortExtension->NcqSlots = 0;
+
+    for (i = 0; i < MAXIMUM_AHCI_PORT_NCS; i++)
+    {
+        if ((((ULONG)1 << i) & outstanding) == 0)
+        {
+            continue;
+        }
+
+        Srb = PortExtension->Slot[i];
+        NT_ASSERT(Srb != NULL);
+
+        if ((!Running) || ((ncqSlots == 0) && (i == failedSlot)))
+        {
+            Srb->SrbStatus = SRB_STATUS_ERROR;
+            AhciCompleteIssuedSrb(PortExtension, ((ULONG)1 << i));
+            continue;
+        }
+
+        SrbExtension = GetSrbExtension(Srb);
+        if (IsNcqCommand(SrbExtension))
+        {
+            // READ/WRITE DMA EXT does the same transfer, with the sector count where it belongs
+            sectorCount = SrbExtension->FeaturesLow | (SrbExtension->FeaturesHigh << 8);
+
+            SrbExtension->Flags &= ~ATA_FLAGS_NCQ;
+            if (SrbExtension->CommandReg == IDE_COMMAND_READ_FPDMA_QUEUED)
+            {
+                SrbExtension->CommandReg = IDE_COMMAND_READ_DMA_EXT;
+            }
+            else
+            {
+                SrbExtension->CommandReg = IDE_COMMAND_WRITE_DMA_EXT;
+            }
+
+            SrbExtension->FeaturesLow = 0;
+            SrbExtension->FeaturesHigh = 0;
+            SrbExtension->SectorCountLow = (sectorCount >> 0) & 0xFF;
+            SrbExtension->SectorCountHigh = (sectorCount >> 8) & 0xFF;
+            SrbExtension->Device = (0xA0 | IDE_LBA_MODE);
+
+            AhciATA_CFIS(PortExtension, SrbExtension);
+        }
+
+        // command header and command table are still programmed, only issue it again
+        PortExtension->QueueSlots |= ((ULONG)1 << i);
+    }
+
+    if (ncqSlots != 0)
+    {
+        PortExtension->DeviceParams.NcqErrors++;
+        if ((PortExtension->DeviceParams.NcqEnabled) &&
+            (PortExtension->DeviceParams.NcqErrors >= MAXIMUM_AHCI_NCQ_ERRORS))
+        {
+            AhciDebugPrint("\tToo many NCQ errors, using non-queued commands\n");
+            PortExtension->DeviceParams.NcqEnabled = FALSE;
+        }
+    }
+
+    return;
+}// -- AhciPortErrorRecovery();
+
+/**
+ * @name AhciScheduleRecovery
+ * @implemented
+ *
+ * Mask the port interrupts and leave the port restart to the error recovery DPC,
+ * waiting for the HBA and the device takes far too long for the interrupt handler.
+ * Caller holds InterruptLock, AhciActivatePort issues nothing until the DPC is done.
+ *
+ * @param PortExtension
+ * @param Flags
+ * AHCI_RECOVERY_ERROR or AHCI_RECOVERY_RESET
+ *
+ */
+VOID
+AhciScheduleRecovery (
+    __in PAHCI_PORT_EXTENSION PortExtension,
+    __in ULONG Flags
+    )
+{
+    AHCI_PORT_CMD cmd;
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+
+    AhciDebugPrint("AhciScheduleRecovery()\n");
+
+    AdapterExtension = PortExtension->AdapterExtension;
+
+    if ((Flags & AHCI_RECOVERY_ERROR) && !(PortExtension->RecoveryFlags & AHCI_RECOVERY_ERROR))
+    {
+        // PxCMD.CCS is only valid while PxCMD.ST is set
+        cmd.Status = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CMD);
+        PortExtension->FailedSlot = cmd.CCS;
+    }
+
+    if (PortExtension->RecoveryFlags == 0)
+    {
+        PortExtension->InterruptEnable = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->IE);
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IE, 0);
+        StorPortIssueDpc(AdapterExtension, &PortExtension->ErrorRecovery, PortExtension, NULL);
+    }
+
+    PortExtension->RecoveryFlags |= Flags;
+
+    return;
+}// -- AhciScheduleRecovery();
+
+/**
+ * @name AhciErrorRecoveryDpcRoutine
+ * @implemented
+ *
+ * Restart a port stopped by AhciScheduleRecovery. The port is polled outside InterruptLock,
+ * its interrupts are masked and nothing is issued to it meanwhile.
+ *
+ * @param Dpc
+ * @param HwDeviceExtension
+ * @param SystemArgument1
+ * Port extension
+ * @param SystemArgument2
+ */
+VOID
+AhciErrorRecoveryDpcRoutine (
+    __in PSTOR_DPC Dpc,
+    __in PVOID HwDeviceExtension,
+    __in PVOID SystemArgument1,
+    __in PVOID SystemArgument2
+    )
+{
+    BOOLEAN running;
+    ULONG i, flags, issuedSlots;
+    PSCSI_REQUEST_BLOCK Srb;
+    STOR_LOCK_HANDLE lockhandle = {0};
+    PAHCI_ADAPTER_EXTENSION AdapterExtension;
+    PAHCI_PORT_EXTENSION PortExtension;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    AhciDebugPrint("AhciErrorRecoveryDpcRoutine()\n");
+
+    AdapterExtension = (PAHCI_ADAPTER_EXTENSION)HwDeviceExtension;
+    PortExtension = (PAHCI_PORT_EXTENSION)SystemArgument1;
+
+    StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
+
+    // a reset requested while we restart the port needs another round
+    while ((flags = PortExtension->RecoveryFlags) != 0)
+    {
+        StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
+
+        // After a queued command error the device aborts everything but READ LOG EXT,
+        // resetting it is the other way to get it back to work
+        running = AhciRestartPort(PortExtension,
+                                  ((flags & AHCI_RECOVERY_RESET) || (PortExtension->NcqSlots != 0)));
+
+        StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
+
+        if (flags & AHCI_RECOVERY_RESET)
+        {
+            // commands in the slots are lost, those in the completion queue are done and left to their DPC
+            issuedSlots = PortExtension->QueueSlots | PortExtension->CommandIssuedSlots;
+            PortExtension->QueueSlots = 0;
+            PortExtension->CommandIssuedSlots = 0;
+            PortExtension->NcqSlots = 0;
+
+            for (i = 0; i < MAXIMUM_AHCI_PORT_NCS; i++)
+            {
+                if ((((ULONG)1 << i) & issuedSlots) != 0)
+                {
+                    Srb = PortExtension->Slot[i];
+                    if (Srb != NULL)
+                    {
+                        Srb->SrbStatus = SRB_STATUS_BUS_RESET;
+                        AhciCompleteIssuedSrb(PortExtension, ((ULONG)1 << i));
+                    }
+                }
+            }
+
+            while ((Srb = RemoveQueue(&PortExtension->SrbQueue)) != NULL)
+            {
+                Srb->SrbStatus = SRB_STATUS_BUS_RESET;
+                StorPortNotification(RequestComplete, AdapterExtension, Srb);
+            }
+        }
+        else
+        {
+            AhciPortErrorRecovery(PortExtension, running);
+        }
+
+        PortExtension->RecoveryFlags &= ~flags;
+    }
+
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->IE, PortExtension->InterruptEnable);
+
+    // give the free slots to pending Srbs, and issue what can be issued
+    AhciFillCommandSlots(PortExtension);
+    AhciActivatePort(PortExtension);
+
+    StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
+
+    return;
+}// -- AhciErrorRecoveryDpcRoutine();
+
 /**
  * @name AhciInterruptHandler
  * @not_implemented
@@ -622,6 +987,7 @@ AhciInterruptHandler (
     __in PAHCI_PORT_EXTENSION PortExtension
     )
 {
+    BOOLEAN fatal;
     ULONG is, ci, sact, outstanding;
     AHCI_INTERRUPT_STATUS PxIS;
     AHCI_INTERRUPT_STATUS PxISMasked;
@@ -652,7 +1018,9 @@ AhciInterruptHandler (
     // 6.2.2
     // Fatal Error
     // signified by the setting of PxIS.HBFS, PxIS.HBDS, PxIS.IFS, or PxIS.TFES
-    if (PxIS.HBFS || PxIS.HBDS || PxIS.IFS || PxIS.TFES)
+    // The error bits are left set, the port restart clears them
+    fatal = (PxIS.HBFS || PxIS.HBDS || PxIS.IFS || PxIS.TFES);
+    if (fatal)
     {
         // In this state, the HBA shall not issue any new commands nor acknowledge DMA Setup FISes to process
         // any native command queuing commands. To recover, the port must be restarted
@@ -692,13 +1060,26 @@ AhciInterruptHandler (
     ci = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->CI);
     sact = StorPortReadRegisterUlong(AdapterExtension, &PortExtension->Port->SACT);
 
+    // A native queued command keeps its PxSACT bit until the device reports its completion
+    // in a Set Device Bits FIS, the HBA then clears the bits set in the FIS SActive field.
     outstanding = ci | sact; // NOTE: Including both non-NCQ and NCQ based commands
     if ((PortExtension->CommandIssuedSlots & (~outstanding)) != 0)
     {
         AhciCompleteIssuedSrb(PortExtension, (PortExtension->CommandIssuedSlots & (~outstanding)));
         PortExtension->CommandIssuedSlots &= outstanding;
+        PortExtension->NcqSlots &= outstanding;
     }
 
+    // whatever is still outstanding after a fatal error is stuck until the port restarts
+    if (fatal)
+    {
+        AhciScheduleRecovery(PortExtension, AHCI_RECOVERY_ERROR);
+    }
+
+    // give the free slots to pending Srbs, and issue what can be issued
+    AhciFillCommandSlots(PortExtension);
+    AhciActivatePort(PortExtension);
+
     return;
 }// -- AhciInterruptHandler();
 
@@ -915,9 +1296,11 @@ AhciHwStartIo (
 
 /**
  * @name AhciHwResetBus
- * @not_implemented
+ * @implemented
  *
  * The HwStorResetBus routine is called by the port driver to clear error conditions.
+ * Port's device is reset from the error recovery DPC, which then completes every request
+ * it holds with SRB_STATUS_BUS_RESET
  *
  * @param adapterExtension
  * @param PathId
@@ -933,24 +1316,29 @@ AhciHwResetBus (
     )
 {
     STOR_LOCK_HANDLE lockhandle = {0};
-//    PAHCI_ADAPTER_EXTENSION adapterExtension;
+    PAHCI_PORT_EXTENSION PortExtension;
+    PAHCI_ADAPTER_EXTENSION adapterExtension;
 
     AhciDebugPrint("AhciHwResetBus()\n");
 
-//    adapterExtension = AdapterExtension;
+    adapterExtension = AdapterExtension;
 
-    if (IsPortValid(AdapterExtension, PathId))
+    if (!IsPortValid(AdapterExtension, PathId))
     {
-        // Acquire Lock
-        StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
+        return FALSE;
+    }
 
-        // TODO: Perform port reset
+    PortExtension = &adapterExtension->PortExtension[PathId];
 
-        // Release lock
-        StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
-    }
+    // Acquire Lock
+    StorPortAcquireSpinLock(AdapterExtension, InterruptLock, NULL, &lockhandle);
 
-    return FALSE;
+    AhciScheduleRecovery(PortExtension, AHCI_RECOVERY_RESET);
+
+    // Release lock
+    StorPortReleaseSpinLock(AdapterExtension, &lockhandle);
+
+    return TRUE;
 }// -- AhciHwResetBus();
 
 /**
@@ -1403,6 +1791,12 @@ AhciProcessSrb (
     NT_ASSERT(SlotIndex < AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
     SrbExtension->SlotIndex = SlotIndex;
 
+    // the tag of a native queued command is its slot, it goes in SectorCount(7:3)
+    if (IsNcqCommand(SrbExtension))
+    {
+        SrbExtension->SectorCountLow = (UCHAR)(SlotIndex << 3);
+    }
+
     // program the CFIS in the CommandTable
     CommandHeader = &PortExtension->CommandList[SlotIndex];
 
@@ -1467,7 +1861,7 @@ AhciProcessSrb (
 
     // mark this slot
     PortExtension->Slot[SlotIndex] = Srb;
-    PortExtension->QueueSlots |= 1 << SlotIndex;
+    PortExtension->QueueSlots |= ((ULONG)1 << SlotIndex);
     return;
 }// -- AhciProcessSrb();
 
@@ -1476,6 +1870,8 @@ AhciProcessSrb (
  * @implemented
  *
  * Program Port and populate command list
+ * Native queued and non-queued commands are never outstanding together,
+ * a non-queued command waits for the queued ones to complete, and holds back the next ones.
  *
  * @param PortExtension
  *
@@ -1492,7 +1888,8 @@ AhciActivatePort (
     )
 {
     AHCI_PORT_CMD cmd;
-    ULONG QueueSlots, slotToActivate, tmp;
+    PAHCI_SRB_EXTENSION SrbExtension;
+    ULONG QueueSlots, slotsToActivate, ncqSlots, index;
     PAHCI_ADAPTER_EXTENSION AdapterExtension;
 
     AhciDebugPrint("AhciActivatePort()\n");
@@ -1514,23 +1911,63 @@ AhciActivatePort (
         return;
     }
 
-    // get the lowest set bit
-    tmp = QueueSlots & (QueueSlots - 1);
+    // a non-queued command is still running
+    if ((PortExtension->CommandIssuedSlots & ~PortExtension->NcqSlots) != 0)
+    {
+        return;
+    }
+
+    // the port is being restarted, the recovery DPC activates it when done
+    if (PortExtension->RecoveryFlags != 0)
+    {
+        return;
+    }
+
+    ncqSlots = 0;
+    for (index = 0; index < MAXIMUM_AHCI_PORT_NCS; index++)
+    {
+        if ((QueueSlots & ((ULONG)1 << index)) != 0)
+        {
+            SrbExtension = GetSrbExtension(PortExtension->Slot[index]);
+            if (IsNcqCommand(SrbExtension))
+            {
+                ncqSlots |= ((ULONG)1 << index);
+            }
+        }
+    }
+
+    if (ncqSlots != QueueSlots)
+    {
+        // non-queued commands go first, once the queued ones are done
+        if (PortExtension->CommandIssuedSlots != 0)
+        {
+            return;
+        }
 
-    if (tmp == 0)
-        slotToActivate = QueueSlots;
+        slotsToActivate = QueueSlots & ~ncqSlots;
+    }
     else
-        slotToActivate = (QueueSlots & (~tmp));
+    {
+        slotsToActivate = ncqSlots;
+    }
 
-    // mark that bit off in QueueSlots
+    // mark those bits off in QueueSlots
     // so we can know we it is really needed to activate port or not
-    PortExtension->QueueSlots &= ~slotToActivate;
+    PortExtension->QueueSlots &= ~slotsToActivate;
     // mark this CommandIssuedSlots
     // to validate in completeIssuedCommand
-    PortExtension->CommandIssuedSlots |= slotToActivate;
+    PortExtension->CommandIssuedSlots |= slotsToActivate;
 
-    // tell the HBA to issue this Command Slot to the given port
-    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, slotToActivate);
+    if ((slotsToActivate & ncqSlots) != 0)
+    {
+        // section 3.3.13
+        // software shall write PxSACT with the tags before writing PxCI
+        PortExtension->NcqSlots |= slotsToActivate;
+        StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->SACT, slotsToActivate);
+    }
+
+    // tell the HBA to issue these Command Slots to the given port
+    StorPortWriteRegisterUlong(AdapterExtension, &PortExtension->Port->CI, slotsToActivate);
 
     return;
 }// -- AhciActivatePort();
@@ -1539,6 +1976,51 @@ AhciActivatePort (
     #pragma warning(pop)
 #endif
 
+/**
+ * @name AhciFillCommandSlots
+ * @implemented
+ *
+ * Give each free command slot to the next pending Srb, caller holds InterruptLock.
+ * Any free slot is taken, so native queued commands get their tags from all the slots.
+ *
+ * @param PortExtension
+ *
+ */
+VOID
+AhciFillCommandSlots (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    )
+{
+    PSCSI_REQUEST_BLOCK Srb;
+    ULONG freeSlots, slotIndex;
+
+    AhciDebugPrint("AhciFillCommandSlots()\n");
+
+    // slots beyond the device queue depth can't be used as tags
+    freeSlots = AHCI_SLOT_MASK(PortExtension->MaxPortQueueDepth);
+    freeSlots &= ~(PortExtension->QueueSlots | PortExtension->CommandIssuedSlots);
+
+    for (slotIndex = 0; (freeSlots != 0) && (slotIndex < MAXIMUM_AHCI_PORT_NCS); slotIndex++)
+    {
+        if ((freeSlots & ((ULONG)1 << slotIndex)) == 0)
+        {
+            continue;
+        }
+
+        Srb = RemoveQueue(&PortExtension->SrbQueue);
+        if (Srb == NULL)
+        {
+            break;
+        }
+
+        NT_ASSERT(Srb->PathId == PortExtension->PortNumber);
+        AhciProcessSrb(PortExtension, Srb, slotIndex);
+        freeSlots &= ~((ULONG)1 << slotIndex);
+    }
+
+    return;
+}// -- AhciFillCommandSlots();
+
 /**
  * @name AhciProcessIO
  * @implemented
@@ -1558,10 +2040,8 @@ AhciProcessIO (
     __in PSCSI_REQUEST_BLOCK Srb
     )
 {
-    PSCSI_REQUEST_BLOCK tmpSrb;
     STOR_LOCK_HANDLE lockhandle = {0};
     PAHCI_PORT_EXTENSION PortExtension;
-    ULONG commandSlotMask, occupiedSlots, slotIndex, NCS;
 
     AhciDebugPrint("AhciProcessIO()\n");
     AhciDebugPrint("\tPathId: %d\n", PathId);
@@ -1583,36 +2063,7 @@ AhciProcessIO (
         return; // we should wait for device to get active
     }
 
-    occupiedSlots = (PortExtension->QueueSlots | PortExtension->CommandIssuedSlots); // Busy command slots for given port
-    NCS = AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP);
-    commandSlotMask = (1 << NCS) - 1; // available slots mask
-
-    commandSlotMask = (commandSlotMask & ~occupiedSlots);
-    if(commandSlotMask != 0)
-    {
-        // iterate over HBA port slots
-        for (slotIndex = 0; slotIndex < NCS; slotIndex++)
-        {
-            // find first free slot
-            if ((commandSlotMask & (1 << slotIndex)) != 0)
-            {
-                tmpSrb = RemoveQueue(&PortExtension->SrbQueue);
-                if (tmpSrb != NULL)
-                {
-                    NT_ASSERT(tmpSrb->PathId == PathId);
-                    AhciProcessSrb(PortExtension, tmpSrb, slotIndex);
-                }
-                else
-                {
-                    break;
-                }
-            }
-            else
-            {
-                break;
-            }
-        }
-    }
+    AhciFillCommandSlots(PortExtension);
 
     // program HBA port
     AhciActivatePort(PortExtension);
@@ -1735,6 +2186,25 @@ InquiryCompletion (
             PortExtension->DeviceParams.Lba48BitMode = 1;
         }
 
+        // native command queuing needs both the HBA and the device, and 48-bit addressing
+        PortExtension->DeviceParams.NcqEnabled = 0;
+        PortExtension->MaxPortQueueDepth = AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP);
+        if (IsAdapterCAPSNCQ(AdapterExtension->CAP) &&
+            ((IdentifyDeviceData->ReservedWords76[0] & IDENTIFY_SATA_CAPABILITIES_NCQ) != 0) &&
+            (PortExtension->DeviceParams.Lba48BitMode) &&
+            (PortExtension->DeviceParams.NcqErrors < MAXIMUM_AHCI_NCQ_ERRORS))
+        {
+            PortExtension->DeviceParams.NcqEnabled = 1;
+
+            // tags can't go beyond the device queue depth (0's based)
+            if (PortExtension->MaxPortQueueDepth > (ULONG)IdentifyDeviceData->QueueDepth + 1)
+            {
+                PortExtension->MaxPortQueueDepth = IdentifyDeviceData->QueueDepth + 1;
+            }
+
+            AhciDebugPrint("\tNCQ Queue Depth: %d\n", PortExtension->MaxPortQueueDepth);
+        }
+
         PortExtension->DeviceParams.AccessType = DIRECT_ACCESS_DEVICE;
 
         /* Device max address lba */
@@ -1798,7 +2268,7 @@ InquiryCompletion (
     // prepare data to send
     InquiryData->Versions = 2;
     InquiryData->Wide32Bit = 1;
-    InquiryData->CommandQueue = 0; // NCQ not supported
+    InquiryData->CommandQueue = PortExtension->DeviceParams.NcqEnabled;
     InquiryData->ResponseDataFormat = 0x2;
     InquiryData->DeviceTypeModifier = 0;
     InquiryData->DeviceTypeQualifier = DEVICE_CONNECTED;
@@ -1820,7 +2290,7 @@ InquiryCompletion (
                                          Srb->PathId,
                                          Srb->TargetId,
                                          Srb->Lun,
-                                         AHCI_Global_Port_CAP_NCS(AdapterExtension->CAP));
+                                         PortExtension->MaxPortQueueDepth);
 
     NT_ASSERT(status == TRUE);
     return;
@@ -2027,7 +2497,7 @@ DeviceRequestReadWrite (
     NT_ASSERT(SectorCount > 0);
 
     SrbExtension->AtaFunction = ATA_FUNCTION_ATA_READ;
-    SrbExtension->Flags |= ATA_FLAGS_USE_DMA;
+    SrbExtension->Flags = ATA_FLAGS_USE_DMA;
     SrbExtension->CompletionRoutine = NULL;
 
     if (IsReading)
@@ -2076,6 +2546,28 @@ DeviceRequestReadWrite (
 
     NT_ASSERT(SectorCount < 0x100);
 
+    if (PortExtension->DeviceParams.NcqEnabled)
+    {
+        // READ/WRITE FPDMA QUEUED takes the sector count in the features,
+        // the sector count holds the tag, set once the command gets its slot
+        SrbExtension->Flags |= ATA_FLAGS_NCQ;
+
+        if (IsReading)
+        {
+            SrbExtension->CommandReg = IDE_COMMAND_READ_FPDMA_QUEUED;
+        }
+        else
+        {
+            SrbExtension->CommandReg = IDE_COMMAND_WRITE_FPDMA_QUEUED;
+        }
+
+        SrbExtension->FeaturesLow = SrbExtension->SectorCountLow;
+        SrbExtension->FeaturesHigh = SrbExtension->SectorCountHigh;
+        SrbExtension->SectorCountLow = 0;
+        SrbExtension->SectorCountHigh = 0;
+        SrbExtension->Device = IDE_LBA_MODE;
+    }
+
     SrbExtension->pSgl = (PLOCAL_SCATTER_GATHER_LIST)StorPortGetScatterGatherList(AdapterExtension, Srb);
 
     return SRB_STATUS_PENDING;
@@ -2284,7 +2776,7 @@ DeviceInquiryRequest (
         NT_ASSERT(SrbExtension != NULL);
 
         SrbExtension->AtaFunction = ATA_FUNCTION_ATA_IDENTIFY;
-        SrbExtension->Flags |= ATA_FLAGS_DATA_IN;
+        SrbExtension->Flags = ATA_FLAGS_DATA_IN;
         SrbExtension->CompletionRoutine = InquiryCompletion;
         SrbExtension->CommandReg = IDE_COMMAND_NOT_VALID;
 
@@ -20,7 +20,7 @@
 
 #define MAXIMUM_AHCI_PORT_COUNT             32
 #define MAXIMUM_AHCI_PRDT_ENTRIES           32
-#define MAXIMUM_AHCI_PORT_NCS               30
+#define MAXIMUM_AHCI_PORT_NCS               32
 #define MAXIMUM_QUEUE_BUFFER_SIZE           255
 #define MAXIMUM_TRANSFER_LENGTH             (128*1024) // 128 KB
 
@@ -31,8 +31,27 @@
 #define AHCI_DEVICE_TYPE_ATAPI              2
 #define AHCI_DEVICE_TYPE_NODEVICE           3
 
+// NCQ errors after which a port falls back to non-queued commands
+#define MAXIMUM_AHCI_NCQ_ERRORS             3
+
+// port restarts pending in the error recovery DPC (RecoveryFlags)
+#define AHCI_RECOVERY_ERROR                 (1 << 0)    // a fatal error stopped the port
+#define AHCI_RECOVERY_RESET                 (1 << 1)    // HwResetBus resets the device
+
 // section 3.1.2
 #define AHCI_Global_HBA_CAP_S64A            (1 << 31)
+#define AHCI_Global_HBA_CAP_SNCQ            (1 << 30)
+
+// Serial ATA Capabilities, IDENTIFY DEVICE word 76
+#define IDENTIFY_SATA_CAPABILITIES_NCQ      (1 << 8)
+
+// Native command queuing commands (ATA8-ACS)
+#ifndef IDE_COMMAND_READ_FPDMA_QUEUED
+#define IDE_COMMAND_READ_FPDMA_QUEUED       0x60
+#endif
+#ifndef IDE_COMMAND_WRITE_FPDMA_QUEUED
+#define IDE_COMMAND_WRITE_FPDMA_QUEUED      0x61
+#endif
 
 // FIS Types : http://wiki.osdev.org/AHCI
 #define FIS_TYPE_REG_H2D        0x27 // Register FIS - host to device
@@ -71,14 +90,20 @@
 #define ATA_FLAGS_DATA_OUT                  (1 << 2)
 #define ATA_FLAGS_48BIT_COMMAND             (1 << 3)
 #define ATA_FLAGS_USE_DMA                   (1 << 4)
+#define ATA_FLAGS_NCQ                       (1 << 5)
 
 #define IsAtaCommand(AtaFunction)           (AtaFunction & ATA_FUNCTION_ATA_COMMAND)
 #define IsAtapiCommand(AtaFunction)         (AtaFunction & ATA_FUNCTION_ATAPI_COMMAND)
 #define IsDataTransferNeeded(SrbExtension)  (SrbExtension->Flags & (ATA_FLAGS_DATA_IN | ATA_FLAGS_DATA_OUT))
 #define IsAdapterCAPS64(CAP)                (CAP & AHCI_Global_HBA_CAP_S64A)
+#define IsAdapterCAPSNCQ(CAP)               (CAP & AHCI_Global_HBA_CAP_SNCQ)
+#define IsNcqCommand(SrbExtension)          (SrbExtension->Flags & ATA_FLAGS_NCQ)
 
-// 3.1.1 NCS = CAP[12:08] -> Align
-#define AHCI_Global_Port_CAP_NCS(x)         (((x) & 0xF00) >> 8)
+// 3.1.1 NCS = CAP[12:08] -> Align, 0's based value
+#define AHCI_Global_Port_CAP_NCS(x)         ((((x) & 0x1F00) >> 8) + 1)
+
+// bit mask of the first N command slots, N can be 32
+#define AHCI_SLOT_MASK(N)                   (((N) >= 32) ? (ULONG)~0 : (((ULONG)1 << (N)) - 1))
 
 #define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
 //#define AhciDebugPrint(format, ...) StorPortDebugPrint(0, format, __VA_ARGS__)
@@ -464,7 +489,11 @@ typedef struct _AHCI_PORT_EXTENSION
     ULONG PortNumber;
     ULONG QueueSlots;                                   // slots which we have already assigned task (Slot)
     ULONG CommandIssuedSlots;                           // slots which has been programmed
+    ULONG NcqSlots;                                     // programmed slots holding native queued commands
     ULONG MaxPortQueueDepth;
+    ULONG RecoveryFlags;                                // no command is issued while set
+    ULONG FailedSlot;                                   // PxCMD.CCS latched on a fatal error
+    ULONG InterruptEnable;                              // PxIE, masked until the recovery is done
 
     struct
     {
@@ -473,6 +502,8 @@ typedef struct _AHCI_PORT_EXTENSION
         UCHAR AccessType;
         UCHAR DeviceType;
         UCHAR IsActive;
+        UCHAR NcqEnabled;
+        UCHAR NcqErrors;
         LARGE_INTEGER MaxLba;
         ULONG BytesPerLogicalSector;
         ULONG BytesPerPhysicalSector;
@@ -482,6 +513,7 @@ typedef struct _AHCI_PORT_EXTENSION
     } DeviceParams;
 
     STOR_DPC CommandCompletion;
+    STOR_DPC ErrorRecovery;
     PAHCI_PORT Port;                                    // AHCI Port Infomation
     AHCI_QUEUE SrbQueue;                                // pending Srbs
     AHCI_QUEUE CompletionQueue;
@@ -576,6 +608,36 @@ AhciProcessIO (
     __in PSCSI_REQUEST_BLOCK Srb
     );
 
+ULONG
+AhciATA_CFIS (
+    __in PAHCI_PORT_EXTENSION PortExtension,
+    __in PAHCI_SRB_EXTENSION SrbExtension
+    );
+
+VOID
+AhciFillCommandSlots (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    );
+
+VOID
+AhciActivatePort (
+    __in PAHCI_PORT_EXTENSION PortExtension
+    );
+
+BOOLEAN
+AhciRestartPort (
+    __in PAHCI_PORT_EXTENSION PortExtension,
+    __in BOOLEAN ComReset
+    );
+
+VOID
+AhciErrorRecoveryDpcRoutine (
+    __in PSTOR_DPC Dpc,
+    __in PVOID HwDeviceExtension,
+    __in PVOID SystemArgument1,
+    __in PVOID SystemArgument2
+    );
+
 BOOLEAN
 AhciAdapterReset (
     __in PAHCI_ADAPTER_EXTENSION AdapterExtension
@@ -24,8 +24,8 @@ PortFdoInterruptRoutine(
 {
     PFDO_DEVICE_EXTENSION DeviceExtension;
 
-    DPRINT1("PortFdoInterruptRoutine(%p %p)\n",
-            Interrupt, ServiceContext);
+    DPRINT("PortFdoInterruptRoutine(%p %p)\n",
+           Interrupt, ServiceContext);
 
     DeviceExtension = (PFDO_DEVICE_EXTENSION)ServiceContext;
 
@@ -139,11 +139,20 @@ PortFdoStartMiniport(
         return Status;
     }
 
+    /* Set up the request queues for the configuration the miniport found */
+    Status = PortInitializeQueues(DeviceExtension);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("PortInitializeQueues() failed (Status 0x%08lx)\n", Status);
+        return Status;
+    }
+
     /* Connect the configured interrupt */
     Status = PortFdoConnectInterrupt(DeviceExtension);
     if (!NT_SUCCESS(Status))
     {
         DPRINT1("PortFdoConnectInterrupt() failed (Status 0x%08lx)\n", Status);
+        PortDeleteQueues(DeviceExtension, SRB_STATUS_ABORTED);
         return Status;
     }
 
@@ -152,6 +161,7 @@ PortFdoStartMiniport(
     if (!NT_SUCCESS(Status))
     {
         DPRINT1("MiniportHwInitialize() failed (Status 0x%08lx)\n", Status);
+        PortDeleteQueues(DeviceExtension, SRB_STATUS_ABORTED);
         return Status;
     }
 
@@ -162,6 +172,7 @@ PortFdoStartMiniport(
         if (!DeviceExtension->HwPassiveInitRoutine(&DeviceExtension->Miniport.MiniportExtension->HwDeviceExtension))
         {
             DPRINT1("HwPassiveInitRoutine() failed\n");
+            PortDeleteQueues(DeviceExtension, SRB_STATUS_ABORTED);
             return STATUS_UNSUCCESSFUL;
         }
     }
@@ -616,6 +627,7 @@ PortFdoPnp(
 
         case IRP_MN_REMOVE_DEVICE: /* 0x02 */
             DPRINT1("IRP_MJ_PNP / IRP_MN_REMOVE_DEVICE\n");
+            PortDeleteQueues(DeviceExtension, SRB_STATUS_NO_DEVICE);
             break;
 
         case IRP_MN_CANCEL_REMOVE_DEVICE: /* 0x03 */
@@ -624,6 +636,7 @@ PortFdoPnp(
 
         case IRP_MN_STOP_DEVICE: /* 0x04 */
             DPRINT1("IRP_MJ_PNP / IRP_MN_STOP_DEVICE\n");
+            PortDeleteQueues(DeviceExtension, SRB_STATUS_ABORTED);
             break;
 
         case IRP_MN_QUERY_STOP_DEVICE: /* 0x05 */
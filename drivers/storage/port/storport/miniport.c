@@ -353,11 +353,32 @@ MiniportHwInterrupt(
 {
     BOOLEAN Result;
 
-    DPRINT1("MiniportHwInterrupt(%p)\n",
-            Miniport);
+    DPRINT("MiniportHwInterrupt(%p)\n",
+           Miniport);
 
     Result = Miniport->InitData->HwInterrupt(&Miniport->MiniportExtension->HwDeviceExtension);
-    DPRINT1("HwInterrupt() returned %u\n", Result);
+    DPRINT("HwInterrupt() returned %u\n", Result);
+
+    return Result;
+}
+
+
+BOOLEAN
+MiniportBuildIo(
+    _In_ PMINIPORT Miniport,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    BOOLEAN Result;
+
+    DPRINT("MiniportBuildIo(%p %p)\n",
+           Miniport, Srb);
+
+    /* HwBuildIo is optional */
+    if (Miniport->InitData->HwBuildIo == NULL)
+        return TRUE;
+
+    Result = Miniport->InitData->HwBuildIo(&Miniport->MiniportExtension->HwDeviceExtension, Srb);
+    DPRINT("HwBuildIo() returned %u\n", Result);
 
     return Result;
 }
@@ -370,11 +391,11 @@ MiniportStartIo(
 {
     BOOLEAN Result;
 
-    DPRINT1("MiniportHwStartIo(%p %p)\n",
-            Miniport, Srb);
+    DPRINT("MiniportHwStartIo(%p %p)\n",
+           Miniport, Srb);
 
     Result = Miniport->InitData->HwStartIo(&Miniport->MiniportExtension->HwDeviceExtension, Srb);
-    DPRINT1("HwStartIo() returned %u\n", Result);
+    DPRINT("HwStartIo() returned %u\n", Result);
 
     return Result;
 }
@@ -58,6 +58,12 @@ PortCreatePdo(
     DeviceExtension->FdoExtension = FdoDeviceExtension;
     DeviceExtension->PnpState = dsStopped;
 
+    DeviceExtension->Bus = Bus;
+    DeviceExtension->Target = Target;
+    DeviceExtension->Lun = Lun;
+
+    PortInitializeUnitQueue(DeviceExtension);
+
     /* Add the PDO to the PDO list*/
     KeAcquireInStackQueuedSpinLock(&FdoDeviceExtension->PdoListLock,
                                    &LockHandle);
@@ -66,13 +72,21 @@ PortCreatePdo(
     FdoDeviceExtension->PdoCount++;
     KeReleaseInStackQueuedSpinLock(&LockHandle);
 
-    DeviceExtension->Bus = Bus;
-    DeviceExtension->Target = Target;
-    DeviceExtension->Lun = Lun;
-
-
-    // FIXME: More initialization
-
+    /* Allocate the miniports logical unit extension */
+    if (FdoDeviceExtension->Miniport.PortConfig.SpecificLuExtensionSize != 0)
+    {
+        DeviceExtension->LuExtension = ExAllocatePoolWithTag(NonPagedPool,
+                                                             FdoDeviceExtension->Miniport.PortConfig.SpecificLuExtensionSize,
+                                                             TAG_LU_EXTENSION);
+        if (DeviceExtension->LuExtension == NULL)
+        {
+            PortDeletePdo(DeviceExtension);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(DeviceExtension->LuExtension,
+                      FdoDeviceExtension->Miniport.PortConfig.SpecificLuExtensionSize);
+    }
 
     /* The device has been initialized */
     Pdo->Flags &= ~DO_DEVICE_INITIALIZING;
@@ -91,6 +105,8 @@ PortDeletePdo(
 
     DPRINT("PortDeletePdo(%p)\n", PdoExtension);
 
+    PortDeleteUnitQueue(PdoExtension);
+
     /* Remove the PDO from the PDO list*/
     KeAcquireInStackQueuedSpinLock(&PdoExtension->FdoExtension->PdoListLock,
                                    &LockHandle);
@@ -105,8 +121,11 @@ PortDeletePdo(
     }
 
 
-    // FIXME: More uninitialization
-
+    if (PdoExtension->LuExtension)
+    {
+        ExFreePoolWithTag(PdoExtension->LuExtension, TAG_LU_EXTENSION);
+        PdoExtension->LuExtension = NULL;
+    }
 
     /* Delete the PDO */
     IoDeleteDevice(PdoExtension->Device);
@@ -121,12 +140,53 @@ PortPdoScsi(
     _In_ PDEVICE_OBJECT DeviceObject,
     _In_ PIRP Irp)
 {
-    DPRINT1("PortPdoScsi(%p %p)\n", DeviceObject, Irp);
+    PPDO_DEVICE_EXTENSION DeviceExtension;
+    PIO_STACK_LOCATION Stack;
+    PSCSI_REQUEST_BLOCK Srb;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    DPRINT("PortPdoScsi(%p %p)\n", DeviceObject, Irp);
+
+    DeviceExtension = (PPDO_DEVICE_EXTENSION)DeviceObject->DeviceExtension;
+    ASSERT(DeviceExtension);
+    ASSERT(DeviceExtension->ExtensionType == PdoExtension);
+
+    Stack = IoGetCurrentIrpStackLocation(Irp);
+    Srb = Stack->Parameters.Scsi.Srb;
+    if (Srb == NULL)
+    {
+        Status = STATUS_INVALID_PARAMETER;
+    }
+    else
+    {
+        switch (Srb->Function)
+        {
+            case SRB_FUNCTION_CLAIM_DEVICE:
+                DPRINT("SRB_FUNCTION_CLAIM_DEVICE\n");
+                Srb->DataBuffer = DeviceObject;
+                Srb->SrbStatus = SRB_STATUS_SUCCESS;
+                break;
+
+            case SRB_FUNCTION_RELEASE_DEVICE:
+            case SRB_FUNCTION_RELEASE_QUEUE:
+            case SRB_FUNCTION_FLUSH_QUEUE:
+            case SRB_FUNCTION_LOCK_QUEUE:
+            case SRB_FUNCTION_UNLOCK_QUEUE:
+                /* The unit queues are never frozen */
+                DPRINT("SRB function 0x%x\n", Srb->Function);
+                Srb->SrbStatus = SRB_STATUS_SUCCESS;
+                break;
+
+            default:
+                /* Everything else goes to the miniport, through the unit queue */
+                return PortQueueRequest(DeviceExtension, Irp, Srb);
+        }
+    }
 
     Irp->IoStatus.Information = 0;
-    Irp->IoStatus.Status = STATUS_SUCCESS;
+    Irp->IoStatus.Status = Status;
     IoCompleteRequest(Irp, IO_NO_INCREMENT);
-    return STATUS_SUCCESS;
+    return Status;
 }
 
 
@@ -144,4 +204,34 @@ PortPdoPnp(
     return STATUS_SUCCESS;
 }
 
+
+
+PPDO_DEVICE_EXTENSION
+PortGetPdoExtension(
+    _In_ PFDO_DEVICE_EXTENSION FdoExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun)
+{
+    PPDO_DEVICE_EXTENSION PdoExtension;
+    PLIST_ENTRY ListEntry;
+
+    /* The miniport may call in at interrupt level, so walk the list without
+       the lock, like scsiport does. PDOs are only added and removed at
+       PASSIVE_LEVEL, while the unit has no requests outstanding. */
+    for (ListEntry = FdoExtension->PdoListHead.Flink;
+         ListEntry != &FdoExtension->PdoListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        PdoExtension = CONTAINING_RECORD(ListEntry, PDO_DEVICE_EXTENSION, PdoListEntry);
+
+        if (PdoExtension->Bus == PathId &&
+            PdoExtension->Target == TargetId &&
+            PdoExtension->Lun == Lun)
+            return PdoExtension;
+    }
+
+    return NULL;
+}
+
 /* EOF */
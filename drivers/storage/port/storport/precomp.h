@@ -31,6 +31,34 @@
 #define TAG_ADDRESS_MAPPING 'MAtS'
 #define TAG_INQUIRY_DATA    'QItS'
 #define TAG_SENSE_DATA      'NStS'
+#define TAG_PORT_REQUEST    'QRtS'
+#define TAG_SG_LIST         'GStS'
+#define TAG_LU_EXTENSION    'ULtS'
+
+/* From srb.h, which can't be included along with storport.h */
+#ifndef SP_UNINITIALIZED_VALUE
+#define SP_UNINITIALIZED_VALUE ((ULONG) ~0)
+#endif
+#ifndef SP_UNTAGGED
+#define SP_UNTAGGED ((UCHAR) ~0)
+#endif
+
+/* Queue limits */
+#define PORT_DEFAULT_DEVICE_QUEUE_DEPTH 20
+#define PORT_MAXIMUM_DEVICE_QUEUE_DEPTH 254
+#define PORT_MAXIMUM_ADAPTER_REQUESTS   254
+#define PORT_MINIMUM_ADAPTER_REQUESTS   16
+#define PORT_DEFAULT_SG_ELEMENTS        17
+#define PORT_SRB_EXTENSION_ALIGNMENT    128
+
+/* Relative timeout after which a busy queue without outstanding requests is retried */
+#define PORT_BUSY_RETRY_INTERVAL        (-250LL * 10000)
+
+/* IRP driver context slot which holds the PORT_REQUEST */
+#define PORT_REQUEST_CONTEXT            3
+
+/* StorPortCompleteRequest calls above DISPATCH_LEVEL kept for the completion DPC */
+#define PORT_MAX_PENDING_COMPLETIONS    4
 
 typedef enum
 {
@@ -87,6 +115,49 @@ typedef struct _UNIT_DATA
     INQUIRYDATA InquiryData;
 } UNIT_DATA, *PUNIT_DATA;
 
+typedef struct _QUEUE_CONTROL
+{
+    /* Limits and state, the miniport may change them at any IRQL */
+    ULONG QueueDepth;
+    LONG OutstandingCount;
+    LONG BusyCount;
+    BOOLEAN Busy;
+    BOOLEAN Paused;
+    LONG TimerUpdate;
+    ULONG PauseTimeout;
+    KTIMER PauseTimer;
+    KDPC PauseTimerDpc;
+    KTIMER BusyTimer;
+    KDPC BusyTimerDpc;
+
+    /* Throughput counters */
+    ULONGLONG RequestsStarted;
+    ULONGLONG RequestsCompleted;
+    ULONGLONG BytesTransferred;
+    ULONG MaximumOutstanding;
+} QUEUE_CONTROL, *PQUEUE_CONTROL;
+
+typedef struct _PORT_REQUEST
+{
+    SLIST_ENTRY CompletionEntry;
+    LIST_ENTRY ListEntry;
+    PIRP Irp;
+    PSCSI_REQUEST_BLOCK Srb;
+    struct _PDO_DEVICE_EXTENSION *PdoExtension;
+    PVOID OriginalDataBuffer;
+    PSTOR_SCATTER_GATHER_LIST SgList;
+    LONG Completed;
+    BOOLEAN FromLookaside;
+} PORT_REQUEST, *PPORT_REQUEST;
+
+typedef struct _PORT_PENDING_COMPLETION
+{
+    UCHAR PathId;
+    UCHAR TargetId;
+    UCHAR Lun;
+    UCHAR SrbStatus;
+} PORT_PENDING_COMPLETION, *PPORT_PENDING_COMPLETION;
+
 typedef struct _FDO_DEVICE_EXTENSION
 {
     EXTENSION_TYPE ExtensionType;
@@ -115,6 +186,26 @@ typedef struct _FDO_DEVICE_EXTENSION
     KSPIN_LOCK PdoListLock;
     LIST_ENTRY PdoListHead;
     ULONG PdoCount;
+
+    /* Request pipeline */
+    KSPIN_LOCK QueueLock;
+    KSPIN_LOCK StartIoLock;
+    LIST_ENTRY ReadyUnitListHead;
+    SLIST_HEADER CompletionList;
+    KDPC CompletionDpc;
+    PORT_PENDING_COMPLETION PendingCompletions[PORT_MAX_PENDING_COMPLETIONS];
+    ULONG PendingCompletionCount;
+    LONG UnitTimerUpdate;
+    ULONGLONG CompletionBatches;
+    QUEUE_CONTROL Queue;
+    NPAGED_LOOKASIDE_LIST RequestLookaside;
+    ULONG MaxSgElements;
+    BOOLEAN QueuesInitialized;
+    PUCHAR SrbExtensionBase;
+    PHYSICAL_ADDRESS SrbExtensionPhysicalBase;
+    ULONG SrbExtensionStride;
+    ULONG SrbExtensionPoolSize;
+    SINGLE_LIST_ENTRY SrbExtensionFreeList;
 } FDO_DEVICE_EXTENSION, *PFDO_DEVICE_EXTENSION;
 
 
@@ -131,8 +222,13 @@ typedef struct _PDO_DEVICE_EXTENSION
     ULONG Target;
     ULONG Lun;
     PINQUIRYDATA InquiryBuffer;
+    PVOID LuExtension;
 
-
+    /* Requests waiting for the miniport, and requests owned by it */
+    LIST_ENTRY RequestListHead;
+    LIST_ENTRY OutstandingListHead;
+    LIST_ENTRY ReadyListEntry;
+    QUEUE_CONTROL Queue;
 } PDO_DEVICE_EXTENSION, *PPDO_DEVICE_EXTENSION;
 
 
@@ -171,6 +267,11 @@ BOOLEAN
 MiniportHwInterrupt(
     _In_ PMINIPORT Miniport);
 
+BOOLEAN
+MiniportBuildIo(
+    _In_ PMINIPORT Miniport,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
 BOOLEAN
 MiniportStartIo(
     _In_ PMINIPORT Miniport,
@@ -260,6 +361,89 @@ PortPdoPnp(
     _In_ PDEVICE_OBJECT DeviceObject,
     _In_ PIRP Irp);
 
+PPDO_DEVICE_EXTENSION
+PortGetPdoExtension(
+    _In_ PFDO_DEVICE_EXTENSION FdoExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun);
+
+
+/* queue.c */
+
+NTSTATUS
+PortInitializeQueues(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension);
+
+VOID
+PortDeleteQueues(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ UCHAR SrbStatus);
+
+VOID
+PortInitializeUnitQueue(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension);
+
+VOID
+PortDeleteUnitQueue(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension);
+
+NTSTATUS
+PortQueueRequest(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension,
+    _In_ PIRP Irp,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
+VOID
+PortStartRequests(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension);
+
+VOID
+PortNotifyRequestComplete(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
+VOID
+PortCompleteOutstandingRequests(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ UCHAR SrbStatus);
+
+PSTOR_SCATTER_GATHER_LIST
+PortGetScatterGatherList(
+    _In_ PSCSI_REQUEST_BLOCK Srb);
+
+BOOLEAN
+PortGetSrbExtensionAddress(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PVOID VirtualAddress,
+    _Out_ PPHYSICAL_ADDRESS PhysicalAddress,
+    _Out_ ULONG *Length);
+
+VOID
+PortQueueBusy(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PQUEUE_CONTROL Queue,
+    _In_ ULONG RequestsToComplete);
+
+VOID
+PortQueueReady(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PQUEUE_CONTROL Queue);
+
+VOID
+PortQueuePause(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PQUEUE_CONTROL Queue,
+    _In_ ULONG TimeOut);
+
+VOID
+PortQueueResume(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PQUEUE_CONTROL Queue);
+
 
 /* storport.c */
 
@@ -0,0 +1,1296 @@
+/*
+ * PROJECT:     ReactOS Storport Driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Per-unit request queues and batched request completion
+ */
+
+/* INCLUDES *******************************************************************/
+
+#include "precomp.h"
+
+#define NDEBUG
+#include <debug.h>
+
+
+static KDEFERRED_ROUTINE PortCompletionDpc;
+
+static
+VOID
+PortCompleteIrp(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PPORT_REQUEST Request);
+
+
+/* FUNCTIONS ******************************************************************/
+
+static
+BOOLEAN
+PortQueueCanStart(
+    _In_ PQUEUE_CONTROL Queue)
+{
+    return !Queue->Busy &&
+           !Queue->Paused &&
+           ((ULONG)Queue->OutstandingCount < Queue->QueueDepth);
+}
+
+
+static
+VOID
+PortQueueRequestStarted(
+    _In_ PQUEUE_CONTROL Queue)
+{
+    Queue->OutstandingCount++;
+    Queue->RequestsStarted++;
+
+    if ((ULONG)Queue->OutstandingCount > Queue->MaximumOutstanding)
+        Queue->MaximumOutstanding = Queue->OutstandingCount;
+}
+
+
+static
+VOID
+PortQueueRequestDone(
+    _In_ PQUEUE_CONTROL Queue,
+    _In_ ULONG BytesTransferred)
+{
+    Queue->OutstandingCount--;
+    Queue->RequestsCompleted++;
+    Queue->BytesTransferred += BytesTransferred;
+
+    /* A busy queue becomes ready after the requested number of completions */
+    if (Queue->Busy && InterlockedDecrement(&Queue->BusyCount) <= 0)
+        Queue->Busy = FALSE;
+}
+
+
+static
+VOID
+PortQueueUpdateTimer(
+    _In_ PQUEUE_CONTROL Queue)
+{
+    LARGE_INTEGER DueTime;
+
+    /* Apply pause and resume notifications, which may come in at any IRQL */
+    if (InterlockedExchange(&Queue->TimerUpdate, 0) != 0)
+    {
+        if (Queue->Paused)
+        {
+            DueTime.QuadPart = -10000000LL * Queue->PauseTimeout;
+            KeSetTimer(&Queue->PauseTimer, DueTime, &Queue->PauseTimerDpc);
+        }
+        else
+        {
+            KeCancelTimer(&Queue->PauseTimer);
+        }
+    }
+
+    /* Nothing left to complete would ever make a busy queue ready again */
+    if (Queue->Busy && !Queue->Paused && Queue->OutstandingCount == 0)
+    {
+        DueTime.QuadPart = PORT_BUSY_RETRY_INTERVAL;
+        KeSetTimer(&Queue->BusyTimer, DueTime, &Queue->BusyTimerDpc);
+    }
+}
+
+
+static
+VOID
+NTAPI
+PortQueuePauseTimerDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PFDO_DEVICE_EXTENSION DeviceExtension = (PFDO_DEVICE_EXTENSION)DeferredContext;
+    PQUEUE_CONTROL Queue;
+
+    Queue = CONTAINING_RECORD(Dpc, QUEUE_CONTROL, PauseTimerDpc);
+
+    DPRINT("PortQueuePauseTimerDpc(%p %p)\n", DeviceExtension, Queue);
+
+    /* The pause timed out, a busy state is left to its own timer */
+    Queue->Paused = FALSE;
+
+    PortStartRequests(DeviceExtension);
+}
+
+
+static
+VOID
+NTAPI
+PortQueueBusyTimerDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PFDO_DEVICE_EXTENSION DeviceExtension = (PFDO_DEVICE_EXTENSION)DeferredContext;
+    PQUEUE_CONTROL Queue;
+
+    Queue = CONTAINING_RECORD(Dpc, QUEUE_CONTROL, BusyTimerDpc);
+
+    DPRINT("PortQueueBusyTimerDpc(%p %p)\n", DeviceExtension, Queue);
+
+    /* Retry a busy queue, but never end a pause early */
+    Queue->Busy = FALSE;
+    InterlockedExchange(&Queue->BusyCount, 0);
+
+    PortStartRequests(DeviceExtension);
+}
+
+
+static
+VOID
+PortInitializeQueueControl(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PQUEUE_CONTROL Queue,
+    _In_ ULONG QueueDepth)
+{
+    RtlZeroMemory(Queue, sizeof(QUEUE_CONTROL));
+
+    Queue->QueueDepth = QueueDepth;
+
+    KeInitializeTimer(&Queue->PauseTimer);
+    KeInitializeDpc(&Queue->PauseTimerDpc,
+                    PortQueuePauseTimerDpc,
+                    DeviceExtension);
+
+    KeInitializeTimer(&Queue->BusyTimer);
+    KeInitializeDpc(&Queue->BusyTimerDpc,
+                    PortQueueBusyTimerDpc,
+                    DeviceExtension);
+}
+
+
+static
+PVOID
+PortAllocateSrbExtension(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PSINGLE_LIST_ENTRY Entry;
+
+    if (DeviceExtension->SrbExtensionBase == NULL)
+        return NULL;
+
+    Entry = PopEntryList(&DeviceExtension->SrbExtensionFreeList);
+    if (Entry == NULL)
+        return NULL;
+
+    RtlZeroMemory(Entry, DeviceExtension->Miniport.PortConfig.SrbExtensionSize);
+
+    return Entry;
+}
+
+
+static
+VOID
+PortFreeSrbExtension(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PVOID SrbExtension)
+{
+    if (SrbExtension == NULL)
+        return;
+
+    PushEntryList(&DeviceExtension->SrbExtensionFreeList,
+                  (PSINGLE_LIST_ENTRY)SrbExtension);
+}
+
+
+static
+NTSTATUS
+PortAllocateSrbExtensionPool(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PHYSICAL_ADDRESS LowestAddress, HighestAddress, Alignment;
+    ULONG Stride, Count, i;
+
+    DeviceExtension->SrbExtensionFreeList.Next = NULL;
+
+    if (DeviceExtension->Miniport.PortConfig.SrbExtensionSize == 0)
+        return STATUS_SUCCESS;
+
+    /* The miniports hand SRB extensions to the hardware, so keep them
+       physically contiguous and aligned like the uncached extension */
+    Stride = ALIGN_UP_BY(max(DeviceExtension->Miniport.PortConfig.SrbExtensionSize,
+                             sizeof(SINGLE_LIST_ENTRY)),
+                         PORT_SRB_EXTENSION_ALIGNMENT);
+
+    Alignment.QuadPart = 0;
+    LowestAddress.QuadPart = 0;
+    HighestAddress.QuadPart = 0x00000000FFFFFFFF;
+
+    for (Count = PORT_MAXIMUM_ADAPTER_REQUESTS; Count >= PORT_MINIMUM_ADAPTER_REQUESTS; Count /= 2)
+    {
+        DeviceExtension->SrbExtensionBase = MmAllocateContiguousMemorySpecifyCache(Stride * Count,
+                                                                                   LowestAddress,
+                                                                                   HighestAddress,
+                                                                                   Alignment,
+                                                                                   MmCached);
+        if (DeviceExtension->SrbExtensionBase != NULL)
+            break;
+    }
+
+    if (DeviceExtension->SrbExtensionBase == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    DeviceExtension->SrbExtensionPhysicalBase = MmGetPhysicalAddress(DeviceExtension->SrbExtensionBase);
+    DeviceExtension->SrbExtensionStride = Stride;
+    DeviceExtension->SrbExtensionPoolSize = Count;
+
+    for (i = Count; i > 0; i--)
+    {
+        PushEntryList(&DeviceExtension->SrbExtensionFreeList,
+                      (PSINGLE_LIST_ENTRY)(DeviceExtension->SrbExtensionBase + (i - 1) * Stride));
+    }
+
+    DPRINT1("SRB extension pool: %lu extensions of %lu bytes\n", Count, Stride);
+
+    return STATUS_SUCCESS;
+}
+
+
+static
+VOID
+PortFreeSrbExtensionPool(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    if (DeviceExtension->SrbExtensionBase == NULL)
+        return;
+
+    MmFreeContiguousMemorySpecifyCache(DeviceExtension->SrbExtensionBase,
+                                       DeviceExtension->SrbExtensionStride * DeviceExtension->SrbExtensionPoolSize,
+                                       MmCached);
+
+    DeviceExtension->SrbExtensionBase = NULL;
+    DeviceExtension->SrbExtensionPoolSize = 0;
+    DeviceExtension->SrbExtensionFreeList.Next = NULL;
+}
+
+
+BOOLEAN
+PortGetSrbExtensionAddress(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PVOID VirtualAddress,
+    _Out_ PPHYSICAL_ADDRESS PhysicalAddress,
+    _Out_ ULONG *Length)
+{
+    ULONG_PTR Offset;
+
+    if (DeviceExtension->SrbExtensionBase == NULL ||
+        (ULONG_PTR)VirtualAddress < (ULONG_PTR)DeviceExtension->SrbExtensionBase)
+        return FALSE;
+
+    Offset = (ULONG_PTR)VirtualAddress - (ULONG_PTR)DeviceExtension->SrbExtensionBase;
+    if (Offset >= DeviceExtension->SrbExtensionStride * DeviceExtension->SrbExtensionPoolSize)
+        return FALSE;
+
+    PhysicalAddress->QuadPart = DeviceExtension->SrbExtensionPhysicalBase.QuadPart + Offset;
+
+    /* Report the length up to the end of the extension */
+    *Length = DeviceExtension->SrbExtensionStride - (ULONG)(Offset % DeviceExtension->SrbExtensionStride);
+
+    return TRUE;
+}
+
+
+/* Called with the queue lock held */
+static
+VOID
+PortTakeQueuedRequests(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension,
+    _Inout_ PLIST_ENTRY ListHead)
+{
+    while (!IsListEmpty(&PdoExtension->RequestListHead))
+        InsertTailList(ListHead, RemoveHeadList(&PdoExtension->RequestListHead));
+
+    /* The unit has nothing left to start */
+    if (!IsListEmpty(&PdoExtension->ReadyListEntry))
+    {
+        RemoveEntryList(&PdoExtension->ReadyListEntry);
+        InitializeListHead(&PdoExtension->ReadyListEntry);
+    }
+}
+
+
+/* Completes requests which were queued, but never given to the miniport */
+static
+VOID
+PortFailQueuedRequests(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PLIST_ENTRY ListHead,
+    _In_ UCHAR SrbStatus)
+{
+    PPORT_REQUEST Request;
+
+    while (!IsListEmpty(ListHead))
+    {
+        Request = CONTAINING_RECORD(RemoveHeadList(ListHead), PORT_REQUEST, ListEntry);
+
+        DPRINT1("Failing queued Srb %p with status 0x%02x\n", Request->Srb, SrbStatus);
+
+        Request->Srb->SrbStatus = SrbStatus;
+        PortCompleteIrp(DeviceExtension, Request);
+    }
+}
+
+
+NTSTATUS
+PortInitializeQueues(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PPORT_CONFIGURATION_INFORMATION PortConfig;
+    NTSTATUS Status;
+
+    DPRINT1("PortInitializeQueues(%p)\n", DeviceExtension);
+
+    /* A repeated start must not insert the lookaside list a second time */
+    if (DeviceExtension->QueuesInitialized)
+        return STATUS_SUCCESS;
+
+    PortConfig = &DeviceExtension->Miniport.PortConfig;
+
+    KeInitializeSpinLock(&DeviceExtension->QueueLock);
+    KeInitializeSpinLock(&DeviceExtension->StartIoLock);
+    InitializeListHead(&DeviceExtension->ReadyUnitListHead);
+    InitializeSListHead(&DeviceExtension->CompletionList);
+
+    Status = PortAllocateSrbExtensionPool(DeviceExtension);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("PortAllocateSrbExtensionPool() failed (Status 0x%08lx)\n", Status);
+        return Status;
+    }
+
+    /* The adapter can't have more requests outstanding than there are SRB extensions */
+    PortInitializeQueueControl(DeviceExtension,
+                               &DeviceExtension->Queue,
+                               (DeviceExtension->SrbExtensionBase != NULL) ?
+                                   DeviceExtension->SrbExtensionPoolSize :
+                                   PORT_MAXIMUM_ADAPTER_REQUESTS);
+
+    /* Size the request lookaside list for the largest transfer the miniport accepts */
+    if (PortConfig->MaximumTransferLength != SP_UNINITIALIZED_VALUE &&
+        PortConfig->MaximumTransferLength != 0)
+    {
+        DeviceExtension->MaxSgElements = BYTES_TO_PAGES(PortConfig->MaximumTransferLength) + 1;
+    }
+    else
+    {
+        DeviceExtension->MaxSgElements = PORT_DEFAULT_SG_ELEMENTS;
+    }
+
+    ExInitializeNPagedLookasideList(&DeviceExtension->RequestLookaside,
+                                    NULL,
+                                    NULL,
+                                    0,
+                                    sizeof(PORT_REQUEST) +
+                                        FIELD_OFFSET(STOR_SCATTER_GATHER_LIST, List[DeviceExtension->MaxSgElements]),
+                                    TAG_PORT_REQUEST,
+                                    0);
+
+    KeInitializeDpc(&DeviceExtension->CompletionDpc,
+                    PortCompletionDpc,
+                    DeviceExtension);
+
+    DeviceExtension->QueuesInitialized = TRUE;
+
+    DPRINT1("Adapter queue depth %lu, %lu SG elements per request\n",
+            DeviceExtension->Queue.QueueDepth, DeviceExtension->MaxSgElements);
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID
+PortDeleteQueues(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ UCHAR SrbStatus)
+{
+    PPDO_DEVICE_EXTENSION PdoExtension;
+    KLOCK_QUEUE_HANDLE LockHandle;
+    LIST_ENTRY ListHead;
+    PLIST_ENTRY PdoEntry;
+    KIRQL OldIrql;
+
+    DPRINT1("PortDeleteQueues(%p 0x%02x)\n", DeviceExtension, SrbStatus);
+
+    if (!DeviceExtension->QueuesInitialized)
+        return;
+
+    /* New requests are failed from now on */
+    DeviceExtension->QueuesInitialized = FALSE;
+
+    /* Fail the requests which are still waiting to be started */
+    InitializeListHead(&ListHead);
+
+    KeAcquireSpinLock(&DeviceExtension->QueueLock, &OldIrql);
+    KeAcquireInStackQueuedSpinLockAtDpcLevel(&DeviceExtension->PdoListLock, &LockHandle);
+
+    for (PdoEntry = DeviceExtension->PdoListHead.Flink;
+         PdoEntry != &DeviceExtension->PdoListHead;
+         PdoEntry = PdoEntry->Flink)
+    {
+        PdoExtension = CONTAINING_RECORD(PdoEntry, PDO_DEVICE_EXTENSION, PdoListEntry);
+        PortTakeQueuedRequests(PdoExtension, &ListHead);
+    }
+
+    KeReleaseInStackQueuedSpinLockFromDpcLevel(&LockHandle);
+    KeReleaseSpinLock(&DeviceExtension->QueueLock, OldIrql);
+
+    PortFailQueuedRequests(DeviceExtension, &ListHead, SrbStatus);
+
+    ASSERT(DeviceExtension->Queue.OutstandingCount == 0);
+
+    KeCancelTimer(&DeviceExtension->Queue.PauseTimer);
+    KeCancelTimer(&DeviceExtension->Queue.BusyTimer);
+    KeRemoveQueueDpc(&DeviceExtension->CompletionDpc);
+    KeFlushQueuedDpcs();
+
+    DPRINT1("Adapter: %I64u requests in %I64u completion batches, at most %lu outstanding\n",
+            DeviceExtension->Queue.RequestsCompleted, DeviceExtension->CompletionBatches,
+            DeviceExtension->Queue.MaximumOutstanding);
+
+    ExDeleteNPagedLookasideList(&DeviceExtension->RequestLookaside);
+    PortFreeSrbExtensionPool(DeviceExtension);
+}
+
+
+VOID
+PortInitializeUnitQueue(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension)
+{
+    PFDO_DEVICE_EXTENSION DeviceExtension = PdoExtension->FdoExtension;
+
+    InitializeListHead(&PdoExtension->RequestListHead);
+    InitializeListHead(&PdoExtension->OutstandingListHead);
+    InitializeListHead(&PdoExtension->ReadyListEntry);
+
+    /* Units which can't take several requests get one at a time */
+    PortInitializeQueueControl(DeviceExtension,
+                               &PdoExtension->Queue,
+                               DeviceExtension->Miniport.PortConfig.MultipleRequestPerLu ?
+                                   PORT_DEFAULT_DEVICE_QUEUE_DEPTH : 1);
+}
+
+
+VOID
+PortDeleteUnitQueue(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension)
+{
+    PFDO_DEVICE_EXTENSION DeviceExtension = PdoExtension->FdoExtension;
+    PQUEUE_CONTROL Queue = &PdoExtension->Queue;
+    LIST_ENTRY ListHead;
+    KIRQL OldIrql;
+
+    /* Once the adapter queues are gone, PortDeleteQueues has failed the requests */
+    if (DeviceExtension->QueuesInitialized)
+    {
+        InitializeListHead(&ListHead);
+
+        KeAcquireSpinLock(&DeviceExtension->QueueLock, &OldIrql);
+        PortTakeQueuedRequests(PdoExtension, &ListHead);
+        KeReleaseSpinLock(&DeviceExtension->QueueLock, OldIrql);
+
+        PortFailQueuedRequests(DeviceExtension, &ListHead, SRB_STATUS_NO_DEVICE);
+    }
+
+    ASSERT(IsListEmpty(&PdoExtension->RequestListHead));
+    ASSERT(IsListEmpty(&PdoExtension->OutstandingListHead));
+
+    KeCancelTimer(&Queue->PauseTimer);
+    KeCancelTimer(&Queue->BusyTimer);
+    KeFlushQueuedDpcs();
+
+    DPRINT1("Unit %lu:%lu:%lu: %I64u requests, %I64u bytes, at most %lu outstanding\n",
+            PdoExtension->Bus, PdoExtension->Target, PdoExtension->Lun,
+            Queue->RequestsCompleted, Queue->BytesTransferred, Queue->MaximumOutstanding);
+}
+
+
+static
+BOOLEAN
+PortIsReadWriteCdb(
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    switch (Srb->Cdb[0])
+    {
+        case SCSIOP_READ6:
+        case SCSIOP_WRITE6:
+        case SCSIOP_READ:
+        case SCSIOP_WRITE:
+        case SCSIOP_READ12:
+        case SCSIOP_WRITE12:
+        case SCSIOP_READ16:
+        case SCSIOP_WRITE16:
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+
+static
+PHYSICAL_ADDRESS
+PortGetBufferPhysicalAddress(
+    _In_opt_ PMDL Mdl,
+    _In_ PUCHAR VirtualAddress)
+{
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PPFN_NUMBER Pfns;
+
+    /* Buffers without an MDL are nonpaged system memory */
+    if (Mdl == NULL)
+        return MmGetPhysicalAddress(VirtualAddress);
+
+    /* The MDL pages are locked, and valid in any process context */
+    Pfns = MmGetMdlPfnArray(Mdl);
+    PhysicalAddress.QuadPart = (ULONGLONG)Pfns[((ULONG_PTR)VirtualAddress - (ULONG_PTR)Mdl->StartVa) >> PAGE_SHIFT] << PAGE_SHIFT;
+    PhysicalAddress.QuadPart += BYTE_OFFSET(VirtualAddress);
+
+    return PhysicalAddress;
+}
+
+
+static
+BOOLEAN
+PortBuildScatterGatherList(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PPORT_REQUEST Request,
+    _In_opt_ PMDL Mdl)
+{
+    PSTOR_SCATTER_GATHER_LIST SgList = Request->SgList;
+    PSTOR_SCATTER_GATHER_ELEMENT Element = NULL;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    PUCHAR VirtualAddress;
+    ULONG Remaining, Length;
+
+    SgList->NumberOfElements = 0;
+    SgList->Reserved = 0;
+
+    VirtualAddress = Request->OriginalDataBuffer;
+    Remaining = Request->Srb->DataTransferLength;
+
+    while (Remaining > 0)
+    {
+        Length = min(PAGE_SIZE - BYTE_OFFSET(VirtualAddress), Remaining);
+        PhysicalAddress = PortGetBufferPhysicalAddress(Mdl, VirtualAddress);
+
+        /* There are no map registers to bounce through, so a miniport
+           without 64-bit DMA support can't take pages above 4GB */
+        if (DeviceExtension->Miniport.PortConfig.Dma64BitAddresses == 0 &&
+            (ULONGLONG)PhysicalAddress.QuadPart + Length - 1 > 0xFFFFFFFFULL)
+        {
+            DPRINT1("Buffer page at 0x%I64x is out of the 32-bit DMA range\n", PhysicalAddress.QuadPart);
+            return FALSE;
+        }
+
+        /* Merge physically contiguous pages into a single element */
+        if (Element != NULL &&
+            Element->PhysicalAddress.QuadPart + Element->Length == PhysicalAddress.QuadPart)
+        {
+            Element->Length += Length;
+        }
+        else
+        {
+            Element = &SgList->List[SgList->NumberOfElements++];
+            Element->PhysicalAddress = PhysicalAddress;
+            Element->Length = Length;
+            Element->Reserved = 0;
+        }
+
+        VirtualAddress += Length;
+        Remaining -= Length;
+    }
+
+    return TRUE;
+}
+
+
+static
+PPORT_REQUEST
+PortAllocateRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PPORT_REQUEST Request;
+    ULONG Elements;
+    BOOLEAN FromLookaside;
+
+    Elements = 0;
+    if (Srb->DataBuffer != NULL && Srb->DataTransferLength != 0)
+        Elements = ADDRESS_AND_SIZE_TO_SPAN_PAGES(Srb->DataBuffer, Srb->DataTransferLength);
+
+    FromLookaside = (Elements <= DeviceExtension->MaxSgElements);
+    if (FromLookaside)
+    {
+        Request = ExAllocateFromNPagedLookasideList(&DeviceExtension->RequestLookaside);
+    }
+    else
+    {
+        Request = ExAllocatePoolWithTag(NonPagedPool,
+                                        sizeof(PORT_REQUEST) +
+                                            FIELD_OFFSET(STOR_SCATTER_GATHER_LIST, List[Elements]),
+                                        TAG_SG_LIST);
+    }
+
+    if (Request == NULL)
+        return NULL;
+
+    RtlZeroMemory(Request, sizeof(PORT_REQUEST));
+    Request->FromLookaside = FromLookaside;
+    if (Elements != 0)
+        Request->SgList = (PSTOR_SCATTER_GATHER_LIST)(Request + 1);
+
+    return Request;
+}
+
+
+static
+VOID
+PortFreeRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PPORT_REQUEST Request)
+{
+    if (Request->FromLookaside)
+        ExFreeToNPagedLookasideList(&DeviceExtension->RequestLookaside, Request);
+    else
+        ExFreePoolWithTag(Request, TAG_SG_LIST);
+}
+
+
+NTSTATUS
+PortQueueRequest(
+    _In_ PPDO_DEVICE_EXTENSION PdoExtension,
+    _In_ PIRP Irp,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PFDO_DEVICE_EXTENSION DeviceExtension = PdoExtension->FdoExtension;
+    PPORT_REQUEST Request;
+    PMDL Mdl = NULL;
+    PUCHAR SystemAddress;
+    KIRQL OldIrql;
+
+    DPRINT("PortQueueRequest(%p %p %p)\n", PdoExtension, Irp, Srb);
+
+    if (!DeviceExtension->QueuesInitialized)
+    {
+        Srb->SrbStatus = SRB_STATUS_NO_HBA;
+        Irp->IoStatus.Information = 0;
+        Irp->IoStatus.Status = STATUS_DEVICE_NOT_READY;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+        return STATUS_DEVICE_NOT_READY;
+    }
+
+    Request = PortAllocateRequest(DeviceExtension, Srb);
+    if (Request == NULL)
+    {
+        Srb->SrbStatus = SRB_STATUS_INTERNAL_ERROR;
+        Irp->IoStatus.Information = 0;
+        Irp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Request->Irp = Irp;
+    Request->Srb = Srb;
+    Request->PdoExtension = PdoExtension;
+    Request->OriginalDataBuffer = Srb->DataBuffer;
+
+    /* Use the MDL only if it describes the data buffer */
+    if (Irp->MdlAddress != NULL &&
+        (ULONG_PTR)Srb->DataBuffer >= (ULONG_PTR)MmGetMdlVirtualAddress(Irp->MdlAddress) &&
+        (ULONG_PTR)Srb->DataBuffer - (ULONG_PTR)MmGetMdlVirtualAddress(Irp->MdlAddress) < MmGetMdlByteCount(Irp->MdlAddress))
+    {
+        Mdl = Irp->MdlAddress;
+    }
+
+    /* The list is built now, while a buffer without an MDL is still in its context */
+    if (Request->SgList != NULL &&
+        !PortBuildScatterGatherList(DeviceExtension, Request, Mdl))
+    {
+        PortFreeRequest(DeviceExtension, Request);
+        Srb->SrbStatus = SRB_STATUS_INTERNAL_ERROR;
+        Irp->IoStatus.Information = 0;
+        Irp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    /* Give the miniport a system address, unless it only transfers data by DMA */
+    if (Mdl != NULL &&
+        DeviceExtension->Miniport.PortConfig.MapBuffers != STOR_MAP_NO_BUFFERS &&
+        !(DeviceExtension->Miniport.PortConfig.MapBuffers == STOR_MAP_NON_READ_WRITE_BUFFERS &&
+          Srb->Function == SRB_FUNCTION_EXECUTE_SCSI &&
+          PortIsReadWriteCdb(Srb)))
+    {
+        SystemAddress = MmGetSystemAddressForMdlSafe(Mdl, HighPagePriority);
+        if (SystemAddress == NULL)
+        {
+            PortFreeRequest(DeviceExtension, Request);
+            Srb->SrbStatus = SRB_STATUS_INTERNAL_ERROR;
+            Irp->IoStatus.Information = 0;
+            Irp->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+            IoCompleteRequest(Irp, IO_NO_INCREMENT);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        Srb->DataBuffer = SystemAddress +
+                          ((ULONG_PTR)Request->OriginalDataBuffer - (ULONG_PTR)MmGetMdlVirtualAddress(Mdl));
+    }
+
+    Srb->OriginalRequest = Irp;
+    Srb->SrbStatus = SRB_STATUS_PENDING;
+    Srb->SrbExtension = NULL;
+    Irp->Tail.Overlay.DriverContext[PORT_REQUEST_CONTEXT] = Request;
+
+    IoMarkIrpPending(Irp);
+
+    /* Queue the request behind the other requests for the unit */
+    KeAcquireSpinLock(&DeviceExtension->QueueLock, &OldIrql);
+
+    InsertTailList(&PdoExtension->RequestListHead, &Request->ListEntry);
+    if (IsListEmpty(&PdoExtension->ReadyListEntry))
+        InsertTailList(&DeviceExtension->ReadyUnitListHead, &PdoExtension->ReadyListEntry);
+
+    KeReleaseSpinLock(&DeviceExtension->QueueLock, OldIrql);
+
+    PortStartRequests(DeviceExtension);
+
+    return STATUS_PENDING;
+}
+
+
+static
+PPORT_REQUEST
+PortGetNextRequest(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PPDO_DEVICE_EXTENSION PdoExtension;
+    PPORT_REQUEST Request;
+    PLIST_ENTRY Entry;
+
+    if (!PortQueueCanStart(&DeviceExtension->Queue))
+        return NULL;
+
+    /* Take the first unit which may start a request */
+    for (Entry = DeviceExtension->ReadyUnitListHead.Flink;
+         Entry != &DeviceExtension->ReadyUnitListHead;
+         Entry = Entry->Flink)
+    {
+        PdoExtension = CONTAINING_RECORD(Entry, PDO_DEVICE_EXTENSION, ReadyListEntry);
+        if (PortQueueCanStart(&PdoExtension->Queue))
+            break;
+    }
+
+    if (Entry == &DeviceExtension->ReadyUnitListHead)
+        return NULL;
+
+    Request = CONTAINING_RECORD(RemoveHeadList(&PdoExtension->RequestListHead),
+                                PORT_REQUEST,
+                                ListEntry);
+
+    /* Move the unit to the end, so that all units get their turn */
+    RemoveEntryList(&PdoExtension->ReadyListEntry);
+    if (IsListEmpty(&PdoExtension->RequestListHead))
+        InitializeListHead(&PdoExtension->ReadyListEntry);
+    else
+        InsertTailList(&DeviceExtension->ReadyUnitListHead, &PdoExtension->ReadyListEntry);
+
+    InsertTailList(&PdoExtension->OutstandingListHead, &Request->ListEntry);
+
+    Request->Srb->SrbExtension = PortAllocateSrbExtension(DeviceExtension);
+    ASSERT(Request->Srb->SrbExtension != NULL || DeviceExtension->SrbExtensionBase == NULL);
+
+    PortQueueRequestStarted(&PdoExtension->Queue);
+    PortQueueRequestStarted(&DeviceExtension->Queue);
+
+    return Request;
+}
+
+
+VOID
+PortStartRequests(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PPORT_REQUEST Request;
+    BOOLEAN Built;
+    KIRQL OldIrql;
+
+    for (;;)
+    {
+        KeAcquireSpinLock(&DeviceExtension->QueueLock, &OldIrql);
+        Request = PortGetNextRequest(DeviceExtension);
+        KeReleaseSpinLock(&DeviceExtension->QueueLock, OldIrql);
+
+        if (Request == NULL)
+            break;
+
+        /* HwBuildIo runs at DISPATCH_LEVEL, without any lock held */
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        Built = MiniportBuildIo(&DeviceExtension->Miniport, Request->Srb);
+        KeLowerIrql(OldIrql);
+
+        if (!Built)
+        {
+            /* The miniport rejected the request, complete it with the status it set */
+            if (SRB_STATUS(Request->Srb->SrbStatus) == SRB_STATUS_PENDING)
+                Request->Srb->SrbStatus = SRB_STATUS_ERROR;
+
+            PortNotifyRequestComplete(DeviceExtension, Request->Srb);
+            continue;
+        }
+
+        /* A full duplex miniport may take interrupts while starting a request */
+        if (DeviceExtension->Miniport.PortConfig.SynchronizationModel == StorSynchronizeFullDuplex ||
+            DeviceExtension->Interrupt == NULL)
+        {
+            KeAcquireSpinLock(&DeviceExtension->StartIoLock, &OldIrql);
+            MiniportStartIo(&DeviceExtension->Miniport, Request->Srb);
+            KeReleaseSpinLock(&DeviceExtension->StartIoLock, OldIrql);
+        }
+        else
+        {
+            OldIrql = KeAcquireInterruptSpinLock(DeviceExtension->Interrupt);
+            MiniportStartIo(&DeviceExtension->Miniport, Request->Srb);
+            KeReleaseInterruptSpinLock(DeviceExtension->Interrupt, OldIrql);
+        }
+    }
+}
+
+
+VOID
+PortNotifyRequestComplete(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PPORT_REQUEST Request;
+    PIRP Irp;
+
+    Irp = (PIRP)Srb->OriginalRequest;
+    if (Irp == NULL)
+        return;
+
+    Request = Irp->Tail.Overlay.DriverContext[PORT_REQUEST_CONTEXT];
+    if (Request == NULL)
+    {
+        DPRINT1("Srb %p was not started by the port driver\n", Srb);
+        return;
+    }
+    ASSERT(Request->Srb == Srb);
+
+    if (InterlockedExchange(&Request->Completed, TRUE) != FALSE)
+    {
+        DPRINT1("Srb %p completed twice\n", Srb);
+        return;
+    }
+
+    /* This may run at interrupt level, so leave the real work to the DPC */
+    InterlockedPushEntrySList(&DeviceExtension->CompletionList,
+                              &Request->CompletionEntry);
+    KeInsertQueueDpc(&DeviceExtension->CompletionDpc, NULL, NULL);
+}
+
+
+/*
+ * Called from the interrupt routine, with the interrupt lock held. The
+ * queue lock can't be taken there, so the completion DPC does the work.
+ */
+static
+VOID
+PortDeferCompleteOutstandingRequests(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ UCHAR SrbStatus)
+{
+    PPORT_PENDING_COMPLETION Pending;
+
+    ASSERT(DeviceExtension->Interrupt != NULL);
+
+    if (DeviceExtension->PendingCompletionCount == PORT_MAX_PENDING_COMPLETIONS)
+    {
+        /* Out of room, widen the last one to the whole adapter */
+        DPRINT1("Too many pending completions, completing all requests\n");
+        Pending = &DeviceExtension->PendingCompletions[PORT_MAX_PENDING_COMPLETIONS - 1];
+        Pending->PathId = SP_UNTAGGED;
+        Pending->TargetId = SP_UNTAGGED;
+        Pending->Lun = SP_UNTAGGED;
+    }
+    else
+    {
+        Pending = &DeviceExtension->PendingCompletions[DeviceExtension->PendingCompletionCount++];
+        Pending->PathId = PathId;
+        Pending->TargetId = TargetId;
+        Pending->Lun = Lun;
+    }
+    Pending->SrbStatus = SrbStatus;
+
+    KeInsertQueueDpc(&DeviceExtension->CompletionDpc, NULL, NULL);
+}
+
+
+static
+VOID
+PortRunPendingCompletions(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension)
+{
+    PORT_PENDING_COMPLETION Pending[PORT_MAX_PENDING_COMPLETIONS];
+    ULONG Count, i;
+    KIRQL OldIrql;
+
+    if (DeviceExtension->Interrupt == NULL ||
+        DeviceExtension->PendingCompletionCount == 0)
+        return;
+
+    OldIrql = KeAcquireInterruptSpinLock(DeviceExtension->Interrupt);
+    Count = DeviceExtension->PendingCompletionCount;
+    RtlCopyMemory(Pending, DeviceExtension->PendingCompletions, Count * sizeof(Pending[0]));
+    DeviceExtension->PendingCompletionCount = 0;
+    KeReleaseInterruptSpinLock(DeviceExtension->Interrupt, OldIrql);
+
+    for (i = 0; i < Count; i++)
+    {
+        PortCompleteOutstandingRequests(DeviceExtension,
+                                        Pending[i].PathId,
+                                        Pending[i].TargetId,
+                                        Pending[i].Lun,
+                                        Pending[i].SrbStatus);
+    }
+}
+
+
+VOID
+PortCompleteOutstandingRequests(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ UCHAR PathId,
+    _In_ UCHAR TargetId,
+    _In_ UCHAR Lun,
+    _In_ UCHAR SrbStatus)
+{
+    PPDO_DEVICE_EXTENSION PdoExtension;
+    PPORT_REQUEST Request;
+    PLIST_ENTRY PdoEntry, Entry;
+    KLOCK_QUEUE_HANDLE LockHandle;
+    KIRQL OldIrql;
+
+    /* The miniport may call this from its interrupt routine */
+    if (KeGetCurrentIrql() > DISPATCH_LEVEL)
+    {
+        PortDeferCompleteOutstandingRequests(DeviceExtension, PathId, TargetId, Lun, SrbStatus);
+        return;
+    }
+
+    KeAcquireSpinLock(&DeviceExtension->QueueLock, &OldIrql);
+    KeAcquireInStackQueuedSpinLockAtDpcLevel(&DeviceExtension->PdoListLock, &LockHandle);
+
+    for (PdoEntry = DeviceExtension->PdoListHead.Flink;
+         PdoEntry != &DeviceExtension->PdoListHead;
+         PdoEntry = PdoEntry->Flink)
+    {
+        PdoExtension = CONTAINING_RECORD(PdoEntry, PDO_DEVICE_EXTENSION, PdoListEntry);
+
+        if ((PathId != SP_UNTAGGED && PathId != PdoExtension->Bus) ||
+            (TargetId != SP_UNTAGGED && TargetId != PdoExtension->Target) ||
+            (Lun != SP_UNTAGGED && Lun != PdoExtension->Lun))
+            continue;
+
+        for (Entry = PdoExtension->OutstandingListHead.Flink;
+             Entry != &PdoExtension->OutstandingListHead;
+             Entry = Entry->Flink)
+        {
+            Request = CONTAINING_RECORD(Entry, PORT_REQUEST, ListEntry);
+            if (Request->Completed)
+                continue;
+
+            Request->Srb->SrbStatus = SrbStatus;
+            PortNotifyRequestComplete(DeviceExtension, Request->Srb);
+        }
+    }
+
+    KeReleaseInStackQueuedSpinLockFromDpcLevel(&LockHandle);
+    KeReleaseSpinLock(&DeviceExtension->QueueLock, OldIrql);
+}
+
+
+PSTOR_SCATTER_GATHER_LIST
+PortGetScatterGatherList(
+    _In_ PSCSI_REQUEST_BLOCK Srb)
+{
+    PPORT_REQUEST Request;
+    PIRP Irp;
+
+    Irp = (PIRP)Srb->OriginalRequest;
+    if (Irp == NULL)
+        return NULL;
+
+    Request = Irp->Tail.Overlay.DriverContext[PORT_REQUEST_CONTEXT];
+    ASSERT(Request->Srb == Srb);
+
+    return Request->SgList;
+}
+
+
+static
+NTSTATUS
+PortSrbStatusToNtStatus(
+    _In_ UCHAR SrbStatus)
+{
+    switch (SRB_STATUS(SrbStatus))
+    {
+        case SRB_STATUS_SUCCESS:
+            return STATUS_SUCCESS;
+
+        case SRB_STATUS_TIMEOUT:
+        case SRB_STATUS_COMMAND_TIMEOUT:
+            return STATUS_IO_TIMEOUT;
+
+        case SRB_STATUS_BAD_SRB_BLOCK_LENGTH:
+        case SRB_STATUS_BAD_FUNCTION:
+        case SRB_STATUS_INVALID_REQUEST:
+            return STATUS_INVALID_DEVICE_REQUEST;
+
+        case SRB_STATUS_NO_DEVICE:
+        case SRB_STATUS_INVALID_LUN:
+        case SRB_STATUS_INVALID_TARGET_ID:
+        case SRB_STATUS_NO_HBA:
+            return STATUS_DEVICE_DOES_NOT_EXIST;
+
+        case SRB_STATUS_DATA_OVERRUN:
+            return STATUS_BUFFER_OVERFLOW;
+
+        case SRB_STATUS_SELECTION_TIMEOUT:
+            return STATUS_DEVICE_NOT_CONNECTED;
+
+        case SRB_STATUS_BUS_RESET:
+            return STATUS_DEVICE_BUSY;
+
+        case SRB_STATUS_ABORTED:
+            return STATUS_CANCELLED;
+
+        default:
+            return STATUS_IO_DEVICE_ERROR;
+    }
+}
+
+
+static
+VOID
+PortCompleteIrp(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PPORT_REQUEST Request)
+{
+    PSCSI_REQUEST_BLOCK Srb = Request->Srb;
+    PIRP Irp = Request->Irp;
+
+    Srb->DataBuffer = Request->OriginalDataBuffer;
+    Srb->SrbExtension = NULL;
+
+    Irp->IoStatus.Status = PortSrbStatusToNtStatus(Srb->SrbStatus);
+    if (SRB_STATUS(Srb->SrbStatus) == SRB_STATUS_SUCCESS ||
+        SRB_STATUS(Srb->SrbStatus) == SRB_STATUS_DATA_OVERRUN)
+    {
+        Irp->IoStatus.Information = Srb->DataTransferLength;
+    }
+    else
+    {
+        Irp->IoStatus.Information = 0;
+    }
+
+    Irp->Tail.Overlay.DriverContext[PORT_REQUEST_CONTEXT] = NULL;
+    PortFreeRequest(DeviceExtension, Request);
+
+    IoCompleteRequest(Irp, IO_DISK_INCREMENT);
+}
+
+
+static
+VOID
+NTAPI
+PortCompletionDpc(
+    _In_ PKDPC Dpc,
+    _In_opt_ PVOID DeferredContext,
+    _In_opt_ PVOID SystemArgument1,
+    _In_opt_ PVOID SystemArgument2)
+{
+    PFDO_DEVICE_EXTENSION DeviceExtension = (PFDO_DEVICE_EXTENSION)DeferredContext;
+    PPDO_DEVICE_EXTENSION PdoExtension;
+    PSLIST_ENTRY Entry, Next, Completed, *Link;
+    PPORT_REQUEST Request;
+    PSCSI_REQUEST_BLOCK Srb;
+    KLOCK_QUEUE_HANDLE LockHandle;
+    PLIST_ENTRY PdoEntry;
+    ULONG Transferred;
+
+    DPRINT("PortCompletionDpc(%p)\n", DeviceExtension);
+
+    /* Complete the requests the interrupt routine asked for, they land in the list */
+    PortRunPendingCompletions(DeviceExtension);
+
+    /* Take all requests completed so far, and restore their completion order */
+    Entry = InterlockedFlushSList(&DeviceExtension->CompletionList);
+    Completed = NULL;
+    while (Entry != NULL)
+    {
+        Next = Entry->Next;
+        Entry->Next = Completed;
+        Completed = Entry;
+        Entry = Next;
+    }
+
+    if (Completed != NULL)
+    {
+        DeviceExtension->CompletionBatches++;
+
+        /* Account for the whole batch under a single acquisition of the lock */
+        KeAcquireSpinLockAtDpcLevel(&DeviceExtension->QueueLock);
+
+        Link = &Completed;
+        while ((Entry = *Link) != NULL)
+        {
+            Request = CONTAINING_RECORD(Entry, PORT_REQUEST, CompletionEntry);
+            PdoExtension = Request->PdoExtension;
+            Srb = Request->Srb;
+
+            RemoveEntryList(&Request->ListEntry);
+            PortFreeSrbExtension(DeviceExtension, Srb->SrbExtension);
+            Srb->SrbExtension = NULL;
+
+            Transferred = (SRB_STATUS(Srb->SrbStatus) == SRB_STATUS_SUCCESS) ? Srb->DataTransferLength : 0;
+            PortQueueRequestDone(&PdoExtension->Queue, Transferred);
+            PortQueueRequestDone(&DeviceExtension->Queue, Transferred);
+
+            /* A busy unit gets the request again once it is ready, so take
+               it off the batch before the lock is dropped and it restarts */
+            if (SRB_STATUS(Srb->SrbStatus) == SRB_STATUS_BUSY ||
+                Srb->ScsiStatus == SCSISTAT_BUSY ||
+                Srb->ScsiStatus == SCSISTAT_QUEUE_FULL)
+            {
+                DPRINT("Requeueing busy Srb %p\n", Srb);
+
+                *Link = Entry->Next;
+
+                Srb->SrbStatus = SRB_STATUS_PENDING;
+                Srb->ScsiStatus = SCSISTAT_GOOD;
+                Request->Completed = FALSE;
+
+                if (!PdoExtension->Queue.Busy)
+                {
+                    PdoExtension->Queue.BusyCount = 1;
+                    PdoExtension->Queue.Busy = TRUE;
+                }
+
+                InsertHeadList(&PdoExtension->RequestListHead, &Request->ListEntry);
+                if (IsListEmpty(&PdoExtension->ReadyListEntry))
+                    InsertTailList(&DeviceExtension->ReadyUnitListHead, &PdoExtension->ReadyListEntry);
+            }
+            else
+            {
+                Link = &Entry->Next;
+            }
+
+            PortQueueUpdateTimer(&PdoExtension->Queue);
+        }
+
+        KeReleaseSpinLockFromDpcLevel(&DeviceExtension->QueueLock);
+
+        /* Complete the IRPs outside of the lock */
+        Entry = Completed;
+        while (Entry != NULL)
+        {
+            Next = Entry->Next;
+            Request = CONTAINING_RECORD(Entry, PORT_REQUEST, CompletionEntry);
+            PortCompleteIrp(DeviceExtension, Request);
+            Entry = Next;
+        }
+    }
+
+    /* Apply the busy and pause notifications of the miniport */
+    PortQueueUpdateTimer(&DeviceExtension->Queue);
+
+    if (InterlockedExchange(&DeviceExtension->UnitTimerUpdate, 0) != 0)
+    {
+        KeAcquireInStackQueuedSpinLockAtDpcLevel(&DeviceExtension->PdoListLock, &LockHandle);
+
+        for (PdoEntry = DeviceExtension->PdoListHead.Flink;
+             PdoEntry != &DeviceExtension->PdoListHead;
+             PdoEntry = PdoEntry->Flink)
+        {
+            PdoExtension = CONTAINING_RECORD(PdoEntry, PDO_DEVICE_EXTENSION, PdoListEntry);
+            PortQueueUpdateTimer(&PdoExtension->Queue);
+        }
+
+        KeReleaseInStackQueuedSpinLockFromDpcLevel(&LockHandle);
+    }
+
+    PortStartRequests(DeviceExtension);
+}
+
+
+static
+VOID
+PortQueueNotify(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PQUEUE_CONTROL Queue)
+{
+    /* The DPC updates the timers and restarts the queues */
+    if (Queue != &DeviceExtension->Queue)
+        InterlockedExchange(&DeviceExtension->UnitTimerUpdate, 1);
+
+    KeInsertQueueDpc(&DeviceExtension->CompletionDpc, NULL, NULL);
+}
+
+
+VOID
+PortQueueBusy(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PQUEUE_CONTROL Queue,
+    _In_ ULONG RequestsToComplete)
+{
+    InterlockedExchange(&Queue->BusyCount, (LONG)max(RequestsToComplete, 1));
+    Queue->Busy = TRUE;
+
+    PortQueueNotify(DeviceExtension, Queue);
+}
+
+
+VOID
+PortQueueReady(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PQUEUE_CONTROL Queue)
+{
+    Queue->Busy = FALSE;
+    InterlockedExchange(&Queue->BusyCount, 0);
+
+    PortQueueNotify(DeviceExtension, Queue);
+}
+
+
+VOID
+PortQueuePause(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PQUEUE_CONTROL Queue,
+    _In_ ULONG TimeOut)
+{
+    Queue->PauseTimeout = TimeOut;
+    Queue->Paused = TRUE;
+    InterlockedExchange(&Queue->TimerUpdate, 1);
+
+    PortQueueNotify(DeviceExtension, Queue);
+}
+
+
+VOID
+PortQueueResume(
+    _In_ PFDO_DEVICE_EXTENSION DeviceExtension,
+    _In_ PQUEUE_CONTROL Queue)
+{
+    Queue->Paused = FALSE;
+    InterlockedExchange(&Queue->TimerUpdate, 1);
+
+    PortQueueNotify(DeviceExtension, Queue);
+}
+
+/* EOF */
@@ -108,23 +108,28 @@ PortAcquireSpinLock(
     PVOID LockContext,
     PSTOR_LOCK_HANDLE LockHandle)
 {
-    DPRINT1("PortAcquireSpinLock(%p %lu %p %p)\n",
-            DeviceExtension, SpinLock, LockContext, LockHandle);
+    DPRINT("PortAcquireSpinLock(%p %lu %p %p)\n",
+           DeviceExtension, SpinLock, LockContext, LockHandle);
 
     LockHandle->Lock = SpinLock;
 
     switch (SpinLock)
     {
         case DpcLock: /* 1, */
-            DPRINT1("DpcLock\n");
+            DPRINT("DpcLock\n");
+            LockHandle->Context.LockQueue.Lock = &((PSTOR_DPC)LockContext)->Lock;
+            KeAcquireSpinLock((PKSPIN_LOCK)LockHandle->Context.LockQueue.Lock,
+                              &LockHandle->Context.OldIrql);
             break;
 
         case StartIoLock: /* 2 */
-            DPRINT1("StartIoLock\n");
+            DPRINT("StartIoLock\n");
+            KeAcquireSpinLock(&DeviceExtension->StartIoLock,
+                              &LockHandle->Context.OldIrql);
             break;
 
         case InterruptLock: /* 3 */
-            DPRINT1("InterruptLock\n");
+            DPRINT("InterruptLock\n");
             if (DeviceExtension->Interrupt == NULL)
                 LockHandle->Context.OldIrql = 0;
             else
@@ -140,21 +145,25 @@ PortReleaseSpinLock(
     PFDO_DEVICE_EXTENSION DeviceExtension,
     PSTOR_LOCK_HANDLE LockHandle)
 {
-    DPRINT1("PortReleaseSpinLock(%p %p)\n",
-            DeviceExtension, LockHandle);
+    DPRINT("PortReleaseSpinLock(%p %p)\n",
+           DeviceExtension, LockHandle);
 
     switch (LockHandle->Lock)
     {
         case DpcLock: /* 1, */
-            DPRINT1("DpcLock\n");
+            DPRINT("DpcLock\n");
+            KeReleaseSpinLock((PKSPIN_LOCK)LockHandle->Context.LockQueue.Lock,
+                              LockHandle->Context.OldIrql);
             break;
 
         case StartIoLock: /* 2 */
-            DPRINT1("StartIoLock\n");
+            DPRINT("StartIoLock\n");
+            KeReleaseSpinLock(&DeviceExtension->StartIoLock,
+                              LockHandle->Context.OldIrql);
             break;
 
         case InterruptLock: /* 3 */
-            DPRINT1("InterruptLock\n");
+            DPRINT("InterruptLock\n");
             if (DeviceExtension->Interrupt != NULL)
                 KeReleaseInterruptSpinLock(DeviceExtension->Interrupt,
                                            LockHandle->Context.OldIrql);
@@ -348,11 +357,11 @@ PortDispatchScsi(
 {
     PFDO_DEVICE_EXTENSION DeviceExtension;
 
-    DPRINT1("PortDispatchScsi(%p %p)\n",
-            DeviceObject, Irp);
+    DPRINT("PortDispatchScsi(%p %p)\n",
+           DeviceObject, Irp);
 
     DeviceExtension = (PFDO_DEVICE_EXTENSION)DeviceObject->DeviceExtension;
-    DPRINT1("ExtensionType: %u\n", DeviceExtension->ExtensionType);
+    DPRINT("ExtensionType: %u\n", DeviceExtension->ExtensionType);
 
     switch (DeviceExtension->ExtensionType)
     {
@@ -480,7 +489,7 @@ StorPortAllocateRegistryBuffer(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -489,14 +498,27 @@ StorPortBusy(
     _In_ PVOID HwDeviceExtension,
     _In_ ULONG RequestsToComplete)
 {
-    DPRINT1("StorPortBuzy()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+
+    DPRINT("StorPortBusy(%p %lu)\n",
+           HwDeviceExtension, RequestsToComplete);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PortQueueBusy(DeviceExtension,
+                  &DeviceExtension->Queue,
+                  RequestsToComplete);
+
+    return TRUE;
 }
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 VOID
@@ -508,8 +530,22 @@ StorPortCompleteRequest(
     _In_ UCHAR Lun,
     _In_ UCHAR SrbStatus)
 {
-    DPRINT1("StorPortCompleteRequest()\n");
-    UNIMPLEMENTED;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+
+    DPRINT1("StorPortCompleteRequest(%p %u %u %u 0x%x)\n",
+            HwDeviceExtension, PathId, TargetId, Lun, SrbStatus);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PortCompleteOutstandingRequests(DeviceExtension,
+                                    PathId,
+                                    TargetId,
+                                    Lun,
+                                    SrbStatus);
 }
 
 
@@ -565,7 +601,7 @@ StorPortDebugPrint(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -577,14 +613,32 @@ StorPortDeviceBusy(
     _In_ UCHAR Lun,
     _In_ ULONG RequestsToComplete)
 {
-    DPRINT1("StorPortDeviceBusy()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    PPDO_DEVICE_EXTENSION PdoExtension;
+
+    DPRINT("StorPortDeviceBusy(%p %u %u %u %lu)\n",
+           HwDeviceExtension, PathId, TargetId, Lun, RequestsToComplete);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PdoExtension = PortGetPdoExtension(DeviceExtension, PathId, TargetId, Lun);
+    if (PdoExtension == NULL)
+        return FALSE;
+
+    PortQueueBusy(DeviceExtension,
+                  &PdoExtension->Queue,
+                  RequestsToComplete);
+
+    return TRUE;
 }
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -595,9 +649,26 @@ StorPortDeviceReady(
     _In_ UCHAR TargetId,
     _In_ UCHAR Lun)
 {
-    DPRINT1("StorPortDeviceReady()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    PPDO_DEVICE_EXTENSION PdoExtension;
+
+    DPRINT("StorPortDeviceReady(%p %u %u %u)\n",
+           HwDeviceExtension, PathId, TargetId, Lun);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PdoExtension = PortGetPdoExtension(DeviceExtension, PathId, TargetId, Lun);
+    if (PdoExtension == NULL)
+        return FALSE;
+
+    PortQueueReady(DeviceExtension,
+                   &PdoExtension->Queue);
+
+    return TRUE;
 }
 
 
@@ -765,7 +836,7 @@ StorPortGetDeviceBase(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 PVOID
@@ -776,9 +847,23 @@ StorPortGetLogicalUnit(
     _In_ UCHAR TargetId,
     _In_ UCHAR Lun)
 {
-    DPRINT1("StorPortGetLogicalUnit()\n");
-    UNIMPLEMENTED;
-    return NULL;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    PPDO_DEVICE_EXTENSION PdoExtension;
+
+    DPRINT("StorPortGetLogicalUnit(%p %u %u %u)\n",
+           HwDeviceExtension, PathId, TargetId, Lun);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PdoExtension = PortGetPdoExtension(DeviceExtension, PathId, TargetId, Lun);
+    if (PdoExtension == NULL)
+        return NULL;
+
+    return PdoExtension->LuExtension;
 }
 
 
@@ -799,15 +884,15 @@ StorPortGetPhysicalAddress(
     STOR_PHYSICAL_ADDRESS PhysicalAddress;
     ULONG_PTR Offset;
 
-    DPRINT1("StorPortGetPhysicalAddress(%p %p %p %p)\n",
-            HwDeviceExtension, Srb, VirtualAddress, Length);
+    DPRINT("StorPortGetPhysicalAddress(%p %p %p %p)\n",
+           HwDeviceExtension, Srb, VirtualAddress, Length);
 
     /* Get the miniport extension */
     MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
                                           MINIPORT_DEVICE_EXTENSION,
                                           HwDeviceExtension);
-    DPRINT1("HwDeviceExtension %p  MiniportExtension %p\n",
-            HwDeviceExtension, MiniportExtension);
+    DPRINT("HwDeviceExtension %p  MiniportExtension %p\n",
+           HwDeviceExtension, MiniportExtension);
 
     DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
 
@@ -823,6 +908,13 @@ StorPortGetPhysicalAddress(
         return PhysicalAddress;
     }
 
+    /* Inside of an SRB extension? */
+    if (PortGetSrbExtensionAddress(DeviceExtension,
+                                   VirtualAddress,
+                                   &PhysicalAddress,
+                                   Length))
+        return PhysicalAddress;
+
     // FIXME
 
 
@@ -838,7 +930,7 @@ StorPortGetPhysicalAddress(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 PSTOR_SCATTER_GATHER_LIST
@@ -847,9 +939,10 @@ StorPortGetScatterGatherList(
     _In_ PVOID DeviceExtension,
     _In_ PSCSI_REQUEST_BLOCK Srb)
 {
-    DPRINT1("StorPortGetScatterGatherList()\n");
-    UNIMPLEMENTED;
-    return NULL;
+    DPRINT("StorPortGetScatterGatherList(%p %p)\n",
+           DeviceExtension, Srb);
+
+    return PortGetScatterGatherList(Srb);
 }
 
 
@@ -1102,6 +1195,8 @@ StorPortNotification(
     PBOOLEAN Result;
     PSTOR_DPC Dpc;
     PHW_DPC_ROUTINE HwDpcRoutine;
+    PVOID SystemArgument1, SystemArgument2;
+    PLONG Succ;
     va_list ap;
 
     STOR_SPINLOCK SpinLock;
@@ -1109,8 +1204,8 @@ StorPortNotification(
     PSTOR_LOCK_HANDLE LockHandle;
     PSCSI_REQUEST_BLOCK Srb;
 
-    DPRINT1("StorPortNotification(%x %p)\n",
-            NotificationType, HwDeviceExtension);
+    DPRINT("StorPortNotification(%x %p)\n",
+           NotificationType, HwDeviceExtension);
 
     /* Get the miniport extension */
     if (HwDeviceExtension != NULL)
@@ -1118,8 +1213,8 @@ StorPortNotification(
         MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
                                               MINIPORT_DEVICE_EXTENSION,
                                               HwDeviceExtension);
-        DPRINT1("HwDeviceExtension %p  MiniportExtension %p\n",
-                HwDeviceExtension, MiniportExtension);
+        DPRINT("HwDeviceExtension %p  MiniportExtension %p\n",
+               HwDeviceExtension, MiniportExtension);
 
         DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
     }
@@ -1129,14 +1224,11 @@ StorPortNotification(
     switch (NotificationType)
     {
         case RequestComplete:
-            DPRINT1("RequestComplete\n");
+            DPRINT("RequestComplete\n");
             Srb = (PSCSI_REQUEST_BLOCK)va_arg(ap, PSCSI_REQUEST_BLOCK);
-            DPRINT1("Srb %p\n", Srb);
-            if (Srb->OriginalRequest != NULL)
-            {
-                DPRINT1("Need to complete the IRP!\n");
-
-            }
+            DPRINT("Srb %p\n", Srb);
+            if (DeviceExtension != NULL)
+                PortNotifyRequestComplete(DeviceExtension, Srb);
             break;
 
         case GetExtendedFunctionTable:
@@ -1169,20 +1261,33 @@ StorPortNotification(
             HwDpcRoutine = (PHW_DPC_ROUTINE)va_arg(ap, PHW_DPC_ROUTINE);
             DPRINT1("HwDpcRoutine %p\n", HwDpcRoutine);
 
+            /* The miniport routine gets its own extension as context */
             KeInitializeDpc((PRKDPC)&Dpc->Dpc,
                             (PKDEFERRED_ROUTINE)HwDpcRoutine,
-                            (PVOID)DeviceExtension);
+                            HwDeviceExtension);
             KeInitializeSpinLock(&Dpc->Lock);
             break;
 
+        case IssueDpc:
+            DPRINT("IssueDpc\n");
+            Dpc = (PSTOR_DPC)va_arg(ap, PSTOR_DPC);
+            SystemArgument1 = (PVOID)va_arg(ap, PVOID);
+            SystemArgument2 = (PVOID)va_arg(ap, PVOID);
+            Succ = (PLONG)va_arg(ap, PLONG);
+            DPRINT("Dpc %p\n", Dpc);
+            *Succ = KeInsertQueueDpc((PRKDPC)&Dpc->Dpc,
+                                     SystemArgument1,
+                                     SystemArgument2);
+            break;
+
         case AcquireSpinLock:
-            DPRINT1("AcquireSpinLock\n");
+            DPRINT("AcquireSpinLock\n");
             SpinLock = (STOR_SPINLOCK)va_arg(ap, STOR_SPINLOCK);
-            DPRINT1("SpinLock %lu\n", SpinLock);
+            DPRINT("SpinLock %lu\n", SpinLock);
             LockContext = (PVOID)va_arg(ap, PVOID);
-            DPRINT1("LockContext %p\n", LockContext);
+            DPRINT("LockContext %p\n", LockContext);
             LockHandle = (PSTOR_LOCK_HANDLE)va_arg(ap, PSTOR_LOCK_HANDLE);
-            DPRINT1("LockHandle %p\n", LockHandle);
+            DPRINT("LockHandle %p\n", LockHandle);
             PortAcquireSpinLock(DeviceExtension,
                                 SpinLock,
                                 LockContext,
@@ -1190,9 +1295,9 @@ StorPortNotification(
             break;
 
         case ReleaseSpinLock:
-            DPRINT1("ReleaseSpinLock\n");
+            DPRINT("ReleaseSpinLock\n");
             LockHandle = (PSTOR_LOCK_HANDLE)va_arg(ap, PSTOR_LOCK_HANDLE);
-            DPRINT1("LockHandle %p\n", LockHandle);
+            DPRINT("LockHandle %p\n", LockHandle);
             PortReleaseSpinLock(DeviceExtension,
                                 LockHandle);
             break;
@@ -1207,7 +1312,7 @@ StorPortNotification(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -1216,14 +1321,27 @@ StorPortPause(
     _In_ PVOID HwDeviceExtension,
     _In_ ULONG TimeOut)
 {
-    DPRINT1("StorPortPause()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+
+    DPRINT("StorPortPause(%p %lu)\n",
+           HwDeviceExtension, TimeOut);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PortQueuePause(DeviceExtension,
+                   &DeviceExtension->Queue,
+                   TimeOut);
+
+    return TRUE;
 }
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -1235,9 +1353,27 @@ StorPortPauseDevice(
     _In_ UCHAR Lun,
     _In_ ULONG TimeOut)
 {
-    DPRINT1("StorPortPauseDevice()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    PPDO_DEVICE_EXTENSION PdoExtension;
+
+    DPRINT("StorPortPauseDevice(%p %u %u %u %lu)\n",
+           HwDeviceExtension, PathId, TargetId, Lun, TimeOut);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PdoExtension = PortGetPdoExtension(DeviceExtension, PathId, TargetId, Lun);
+    if (PdoExtension == NULL)
+        return FALSE;
+
+    PortQueuePause(DeviceExtension,
+                   &PdoExtension->Queue,
+                   TimeOut);
+
+    return TRUE;
 }
 
 
@@ -1261,7 +1397,7 @@ StorPortQuerySystemTime(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -1269,9 +1405,20 @@ NTAPI
 StorPortReady(
     _In_ PVOID HwDeviceExtension)
 {
-    DPRINT1("StorPortReady()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+
+    DPRINT("StorPortReady(%p)\n", HwDeviceExtension);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PortQueueReady(DeviceExtension,
+                   &DeviceExtension->Queue);
+
+    return TRUE;
 }
 
 
@@ -1316,7 +1463,7 @@ StorPortRegistryWrite(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -1324,14 +1471,25 @@ NTAPI
 StorPortResume(
     _In_ PVOID HwDeviceExtension)
 {
-    DPRINT1("StorPortResume()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+
+    DPRINT("StorPortResume(%p)\n", HwDeviceExtension);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PortQueueResume(DeviceExtension,
+                    &DeviceExtension->Queue);
+
+    return TRUE;
 }
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -1342,9 +1500,26 @@ StorPortResumeDevice(
     _In_ UCHAR TargetId,
     _In_ UCHAR Lun)
 {
-    DPRINT1("StorPortResumeDevice()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    PPDO_DEVICE_EXTENSION PdoExtension;
+
+    DPRINT("StorPortResumeDevice(%p %u %u %u)\n",
+           HwDeviceExtension, PathId, TargetId, Lun);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PdoExtension = PortGetPdoExtension(DeviceExtension, PathId, TargetId, Lun);
+    if (PdoExtension == NULL)
+        return FALSE;
+
+    PortQueueResume(DeviceExtension,
+                    &PdoExtension->Queue);
+
+    return TRUE;
 }
 
 
@@ -1390,7 +1565,7 @@ StorPortSetBusDataByOffset(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 BOOLEAN
@@ -1402,9 +1577,35 @@ StorPortSetDeviceQueueDepth(
     _In_ UCHAR Lun,
     _In_ ULONG Depth)
 {
-    DPRINT1("StorPortSetDeviceQueueDepth()\n");
-    UNIMPLEMENTED;
-    return FALSE;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    PPDO_DEVICE_EXTENSION PdoExtension;
+
+    DPRINT1("StorPortSetDeviceQueueDepth(%p %u %u %u %lu)\n",
+            HwDeviceExtension, PathId, TargetId, Lun, Depth);
+
+    if (Depth == 0 || Depth > PORT_MAXIMUM_DEVICE_QUEUE_DEPTH)
+        return FALSE;
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    PdoExtension = PortGetPdoExtension(DeviceExtension, PathId, TargetId, Lun);
+    if (PdoExtension == NULL)
+        return FALSE;
+
+    /* Units which can't take several requests keep a depth of one */
+    if (!DeviceExtension->Miniport.PortConfig.MultipleRequestPerLu)
+        return (Depth == 1);
+
+    PdoExtension->Queue.QueueDepth = Depth;
+
+    /* A deeper queue may start more requests now */
+    KeInsertQueueDpc(&DeviceExtension->CompletionDpc, NULL, NULL);
+
+    return TRUE;
 }
 
 
@@ -1422,7 +1623,7 @@ StorPortStallExecution(
 
 
 /*
- * @unimplemented
+ * @implemented
  */
 STORPORT_API
 VOID
@@ -1432,8 +1633,28 @@ StorPortSynchronizeAccess(
     _In_ PSTOR_SYNCHRONIZED_ACCESS SynchronizedAccessRoutine,
     _In_opt_ PVOID Context)
 {
-    DPRINT1("StorPortSynchronizeAccess()\n");
-    UNIMPLEMENTED;
+    PMINIPORT_DEVICE_EXTENSION MiniportExtension;
+    PFDO_DEVICE_EXTENSION DeviceExtension;
+    KIRQL OldIrql;
+
+    DPRINT("StorPortSynchronizeAccess(%p %p %p)\n",
+           HwDeviceExtension, SynchronizedAccessRoutine, Context);
+
+    MiniportExtension = CONTAINING_RECORD(HwDeviceExtension,
+                                          MINIPORT_DEVICE_EXTENSION,
+                                          HwDeviceExtension);
+    DeviceExtension = MiniportExtension->Miniport->DeviceExtension;
+
+    /* Synchronize with the interrupt service routine */
+    if (DeviceExtension->Interrupt == NULL)
+    {
+        SynchronizedAccessRoutine(HwDeviceExtension, Context);
+        return;
+    }
+
+    OldIrql = KeAcquireInterruptSpinLock(DeviceExtension->Interrupt);
+    SynchronizedAccessRoutine(HwDeviceExtension, Context);
+    KeReleaseInterruptSpinLock(DeviceExtension->Interrupt, OldIrql);
 }
 
 
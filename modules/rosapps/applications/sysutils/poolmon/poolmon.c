@@ -0,0 +1,239 @@
+/*
+ * PROJECT:     ReactOS Pool Tag Profiler
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Displays the hottest pool tags by allocation rate
+ */
+
+#define WIN32_NO_STATUS
+#include <windows.h>
+#define NTOS_MODE_USER
+#include <ndk/ntndk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SORT_BY_ALLOCS  'a'
+#define SORT_BY_BYTES   'b'
+#define SORT_BY_USED    'u'
+
+static CHAR SortKey = SORT_BY_BYTES;
+static ULONG WindowSeconds = 1;
+
+static
+void
+Usage(void)
+{
+    printf("Usage: poolmon [-r rate] [-i seconds] [-n count] [-t top] [-s a|b|u] [-c] [-d]\n\n"
+           "  -r rate     Record the caller of one allocation out of rate (default 16)\n"
+           "  -i seconds  Refresh interval (default 2)\n"
+           "  -n count    Number of refreshes, 0 for no limit (default 0)\n"
+           "  -t top      Number of tags to display (default 20)\n"
+           "  -s a|b|u    Sort by allocations, allocated bytes or used bytes (default b)\n"
+           "  -c          Display the sampled callers of each tag\n"
+           "  -d          Disable the profiler and exit\n");
+}
+
+static
+NTSTATUS
+SetProfiler(BOOLEAN Enable, ULONG SampleRate)
+{
+    SYSTEM_POOLTAG_PROFILE_CONTROL Control;
+    BOOLEAN WasEnabled;
+
+    /* Profiling the whole system requires this privilege */
+    RtlAdjustPrivilege(SE_SYSTEM_PROFILE_PRIVILEGE, TRUE, FALSE, &WasEnabled);
+
+    Control.Enable = Enable;
+    Control.SampleRate = SampleRate;
+    return NtSetSystemInformation(SystemPoolTagProfileInformation,
+                                  &Control,
+                                  sizeof(Control));
+}
+
+static
+BOOL
+WINAPI
+ConsoleCtrlHandler(DWORD CtrlType)
+{
+    /* Don't leave the profiler running behind us, then let the default handler terminate us */
+    SetProfiler(FALSE, 0);
+    return FALSE;
+}
+
+static
+PSYSTEM_POOLTAG_PROFILE_INFORMATION
+QueryProfile(void)
+{
+    PSYSTEM_POOLTAG_PROFILE_INFORMATION Info = NULL;
+    ULONG Size = sizeof(SYSTEM_POOLTAG_PROFILE_INFORMATION) + 64 * sizeof(SYSTEM_POOLTAG_PROFILE);
+    NTSTATUS Status;
+
+    /* The number of tags may grow between two calls, so loop until it fits */
+    do
+    {
+        free(Info);
+        Info = malloc(Size);
+        if (!Info) return NULL;
+
+        Status = NtQuerySystemInformation(SystemPoolTagProfileInformation, Info, Size, &Size);
+        if (Status == STATUS_INFO_LENGTH_MISMATCH)
+            Size += 16 * sizeof(SYSTEM_POOLTAG_PROFILE);
+    } while (Status == STATUS_INFO_LENGTH_MISMATCH);
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Failed to query the pool tag profile: 0x%08lx\n", Status);
+        free(Info);
+        return NULL;
+    }
+
+    return Info;
+}
+
+static
+SIZE_T
+SortValue(const SYSTEM_POOLTAG_PROFILE *Profile)
+{
+    switch (SortKey)
+    {
+        case SORT_BY_ALLOCS: return Profile->Allocs;
+        case SORT_BY_USED: return Profile->Used;
+        default: return Profile->AllocatedBytes;
+    }
+}
+
+static
+int
+__cdecl
+CompareProfiles(const void *First, const void *Second)
+{
+    SIZE_T FirstValue = SortValue(First);
+    SIZE_T SecondValue = SortValue(Second);
+
+    if (FirstValue == SecondValue) return 0;
+    return (FirstValue < SecondValue) ? 1 : -1;
+}
+
+static
+void
+DisplayProfile(PSYSTEM_POOLTAG_PROFILE_INFORMATION Info, ULONG Top, BOOLEAN ShowCallers)
+{
+    PSYSTEM_POOLTAG_PROFILE Profile;
+    ULONG i, j;
+
+    WindowSeconds = max(Info->WindowSeconds, 1);
+    qsort(Info->TagInfo, Info->Count, sizeof(Info->TagInfo[0]), CompareProfiles);
+
+    printf("\n%lu tags over the last %lu seconds, caller sample rate 1/%lu%s\n",
+           Info->Count, WindowSeconds, Info->SampleRate,
+           Info->Enabled ? "" : " (profiler disabled)");
+    printf("Tag    Allocs/s    Frees/s     Bytes/s           Used           Peak\n");
+
+    for (i = 0; i < min(Info->Count, Top); i++)
+    {
+        Profile = &Info->TagInfo[i];
+        printf("%.4s %10lu %10lu %11Iu %14Iu %14Iu\n",
+               Profile->Tag,
+               Profile->Allocs / WindowSeconds,
+               Profile->Frees / WindowSeconds,
+               Profile->AllocatedBytes / WindowSeconds,
+               Profile->Used,
+               Profile->PeakUsed);
+
+        if (!ShowCallers) continue;
+        for (j = 0; j < POOLTAG_PROFILE_CALLERS; j++)
+        {
+            if (!Profile->Callers[j]) continue;
+            printf("     %p (%lu samples)\n", Profile->Callers[j], Profile->CallerHits[j]);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    PSYSTEM_POOLTAG_PROFILE_INFORMATION Info;
+    ULONG SampleRate = 16, Interval = 2, Count = 0, Top = 20, Iteration;
+    BOOLEAN ShowCallers = FALSE;
+    NTSTATUS Status;
+    int i, Result = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if ((argv[i][0] != '-' && argv[i][0] != '/') || !argv[i][1] || argv[i][2])
+        {
+            Usage();
+            return 1;
+        }
+
+        switch (argv[i][1])
+        {
+            case 'c':
+                ShowCallers = TRUE;
+                continue;
+
+            case 'd':
+                Status = SetProfiler(FALSE, 0);
+                if (!NT_SUCCESS(Status))
+                {
+                    printf("Failed to disable the profiler: 0x%08lx\n", Status);
+                    return 1;
+                }
+                return 0;
+
+            case 'r':
+            case 'i':
+            case 'n':
+            case 't':
+            case 's':
+                break;
+
+            default:
+                Usage();
+                return 1;
+        }
+
+        /* All the other options take a value */
+        if (i + 1 >= argc)
+        {
+            Usage();
+            return 1;
+        }
+
+        switch (argv[i][1])
+        {
+            case 'r': SampleRate = strtoul(argv[++i], NULL, 0); break;
+            case 'i': Interval = max(strtoul(argv[++i], NULL, 0), 1); break;
+            case 'n': Count = strtoul(argv[++i], NULL, 0); break;
+            case 't': Top = strtoul(argv[++i], NULL, 0); break;
+            case 's': SortKey = argv[++i][0]; break;
+        }
+    }
+
+    Status = SetProfiler(TRUE, SampleRate);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Failed to enable the profiler: 0x%08lx\n", Status);
+        return 1;
+    }
+    SetConsoleCtrlHandler(ConsoleCtrlHandler, TRUE);
+
+    for (Iteration = 0; !Count || Iteration < Count; Iteration++)
+    {
+        Sleep(Interval * 1000);
+
+        Info = QueryProfile();
+        if (!Info)
+        {
+            Result = 1;
+            break;
+        }
+
+        DisplayProfile(Info, Top, ShowCallers);
+        free(Info);
+    }
+
+    SetConsoleCtrlHandler(ConsoleCtrlHandler, FALSE);
+    SetProfiler(FALSE, 0);
+    return Result;
+}
@@ -0,0 +1,150 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for the key index of the INF parser library
+ */
+
+#include <apitest.h>
+#include <stdio.h>
+
+#define WIN32_NO_STATUS
+#include <ndk/rtlfuncs.h>
+#include <infros.h>
+
+/* Keyless lines come first, so that the line table doesn't grow along with the key buckets */
+#define KEYLESS_LINES   1000
+#define KEYED_LINES     2048
+
+/* Far more allocations than adding a single line takes */
+#define MAX_ALLOCATIONS 64
+
+static
+PCHAR
+BuildInf(
+    OUT PULONG Size)
+{
+    PCHAR Buffer, Ptr;
+    ULONG i;
+
+    Buffer = HeapAlloc(GetProcessHeap(), 0, 32 * (KEYLESS_LINES + KEYED_LINES + 1));
+    if (!Buffer)
+        return NULL;
+
+    Ptr = Buffer + sprintf(Buffer, "[Test]\r\n");
+    for (i = 0; i < KEYLESS_LINES; i++)
+        Ptr += sprintf(Ptr, "Line%lu\r\n", i);
+    for (i = 0; i < KEYED_LINES; i++)
+        Ptr += sprintf(Ptr, "Key%lu = %lu\r\n", i, i);
+
+    *Size = (ULONG)(Ptr - Buffer);
+    return Buffer;
+}
+
+static
+BOOLEAN
+FindKey(
+    IN HINF InfHandle,
+    IN PCWSTR Key)
+{
+    PINFCONTEXT Context;
+
+    if (!InfFindFirstLine(InfHandle, L"Test", Key, &Context))
+        return FALSE;
+
+    InfFreeContext(Context);
+    return TRUE;
+}
+
+static
+BOOLEAN
+OpenTestInf(
+    OUT PHINF InfHandle,
+    OUT PINFCONTEXT *Context)
+{
+    PCHAR Buffer;
+    ULONG BufferSize, ErrorLine;
+    NTSTATUS Status;
+
+    Buffer = BuildInf(&BufferSize);
+    if (!Buffer)
+    {
+        skip("Out of memory\n");
+        return FALSE;
+    }
+
+    Status = InfOpenBufferedFile(InfHandle, Buffer, BufferSize, 0, &ErrorLine);
+    HeapFree(GetProcessHeap(), 0, Buffer);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return FALSE;
+
+    if (!InfFindOrAddSection(*InfHandle, L"Test", Context))
+    {
+        ok(FALSE, "InfFindOrAddSection failed\n");
+        InfCloseFile(*InfHandle);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Adds a key with each of the allocations it takes failing in turn. With
+ * KEYED_LINES keys already there, the add also grows the key buckets. A
+ * failed add may leave the line behind, but an add that succeeds must
+ * leave the key findable, and the keys that were there before must stay
+ * findable either way.
+ */
+static
+VOID
+TestAllocationFailures(VOID)
+{
+    HINF InfHandle;
+    PINFCONTEXT Context;
+    ULONG Failure, Pending, Survived = 0;
+    BOOLEAN Success;
+
+    for (Failure = 1; Failure <= MAX_ALLOCATIONS; Failure++)
+    {
+        if (!OpenTestInf(&InfHandle, &Context))
+            return;
+
+        InfSetAllocationFailure(Failure);
+        Success = InfAddLine(Context, L"Key2048");
+        Pending = InfSetAllocationFailure(0);
+
+        if (Success)
+        {
+            ok(FindKey(InfHandle, L"Key2048"), "Failure %lu: Key2048 not found\n", Failure);
+            if (!Pending)
+                Survived++;
+        }
+        ok(FindKey(InfHandle, L"Key0"), "Failure %lu: Key0 not found\n", Failure);
+        ok(FindKey(InfHandle, L"Key2047"), "Failure %lu: Key2047 not found\n", Failure);
+
+        /* Without failures the next key goes in, and nothing is lost */
+        ok(InfAddLine(Context, L"Key2049"), "Failure %lu: InfAddLine failed\n", Failure);
+        ok(FindKey(InfHandle, L"Key2049"), "Failure %lu: Key2049 not found\n", Failure);
+        if (Success)
+            ok(FindKey(InfHandle, L"Key2048"), "Failure %lu: Key2048 lost\n", Failure);
+
+        InfFreeContext(Context);
+        InfCloseFile(InfHandle);
+
+        /* The add was done before the failure was due, every allocation has been tried */
+        if (Pending)
+        {
+            ok(Success, "InfAddLine failed without an allocation failure\n");
+            break;
+        }
+    }
+
+    ok(Failure > 1, "InfAddLine made no allocation\n");
+    ok(Failure <= MAX_ALLOCATIONS, "InfAddLine made more than %u allocations\n", MAX_ALLOCATIONS);
+    trace("InfAddLine made %lu allocations, survived %lu failures\n", Failure - 1, Survived);
+}
+
+START_TEST(KeyIndex)
+{
+    TestAllocationFailures();
+}
@@ -0,0 +1,13 @@
+#define __ROS_LONG64__
+
+#define STANDALONE
+#include <wine/test.h>
+
+extern void func_KeyIndex(void);
+
+const struct test winetest_testlist[] =
+{
+    { "KeyIndex", func_KeyIndex },
+
+    { 0, 0 }
+};
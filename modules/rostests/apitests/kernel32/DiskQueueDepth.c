@@ -0,0 +1,213 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test and benchmark for random disk reads at several queue depths
+ */
+
+#include "precomp.h"
+
+#include <winioctl.h>
+
+#define BENCH_BLOCK_SIZE 4096
+#define BENCH_READS 4000
+#define MAX_QUEUE_DEPTH 32
+#define WAIT_TIMEOUT_MS 30000
+
+static HANDLE Disk;
+static HANDLE Port;
+static ULONGLONG DiskBlocks;
+static PUCHAR Buffers;
+static OVERLAPPED Overlapped[MAX_QUEUE_DEPTH];
+
+static
+ULONGLONG
+NextBlock(
+    PULONGLONG Seed)
+{
+    /* Spread the reads over the whole disk, the same way for each run */
+    *Seed = *Seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (*Seed >> 16) % DiskBlocks;
+}
+
+static
+BOOL
+StartRead(
+    ULONG Index,
+    ULONGLONG Block)
+{
+    ULONGLONG Offset = Block * BENCH_BLOCK_SIZE;
+
+    ZeroMemory(&Overlapped[Index], sizeof(Overlapped[Index]));
+    Overlapped[Index].Offset = (ULONG)Offset;
+    Overlapped[Index].OffsetHigh = (ULONG)(Offset >> 32);
+
+    if (ReadFile(Disk, Buffers + Index * BENCH_BLOCK_SIZE, BENCH_BLOCK_SIZE, NULL, &Overlapped[Index]))
+        return TRUE;
+
+    return GetLastError() == ERROR_IO_PENDING;
+}
+
+static
+LPOVERLAPPED
+WaitRead(VOID)
+{
+    LPOVERLAPPED Completed = NULL;
+    DWORD Transferred = 0;
+    ULONG_PTR Key;
+
+    if (!GetQueuedCompletionStatus(Port, &Transferred, &Key, &Completed, WAIT_TIMEOUT_MS))
+    {
+        ok(FALSE, "Read failed: %lu\n", GetLastError());
+        return Completed;
+    }
+
+    ok(Transferred == BENCH_BLOCK_SIZE, "Read %lu bytes\n", Transferred);
+    return Completed;
+}
+
+/* Keeps QueueDepth reads in flight until BENCH_READS are done */
+static
+ULONGLONG
+BenchQueueDepth(
+    ULONG QueueDepth)
+{
+    LARGE_INTEGER Start, End;
+    LPOVERLAPPED Completed;
+    ULONGLONG Seed = 1;
+    ULONG Started, Done, Index;
+
+    QueryPerformanceCounter(&Start);
+    for (Started = 0; Started < QueueDepth; Started++)
+    {
+        if (!StartRead(Started, NextBlock(&Seed)))
+        {
+            ok(FALSE, "Failed to start read %lu: %lu\n", Started, GetLastError());
+            break;
+        }
+    }
+
+    for (Done = 0; Done < Started; Done++)
+    {
+        Completed = WaitRead();
+        if (Completed == NULL)
+            break;
+
+        if (Started < BENCH_READS)
+        {
+            Index = (ULONG)(Completed - Overlapped);
+            if (StartRead(Index, NextBlock(&Seed)))
+                Started++;
+            else
+                ok(FALSE, "Failed to start read %lu: %lu\n", Started, GetLastError());
+        }
+    }
+    QueryPerformanceCounter(&End);
+
+    ok(Done == BENCH_READS, "Only %lu reads done\n", Done);
+    return End.QuadPart - Start.QuadPart;
+}
+
+/* Reads issued together must return the same data as reads issued one by one */
+static
+VOID
+TestConcurrentReads(VOID)
+{
+    ULONGLONG Blocks[MAX_QUEUE_DEPTH];
+    BOOL Started[MAX_QUEUE_DEPTH];
+    UCHAR Expected[BENCH_BLOCK_SIZE];
+    ULONGLONG Seed = 7;
+    ULONG i, Done, StartedCount = 0;
+
+    for (i = 0; i < MAX_QUEUE_DEPTH; i++)
+    {
+        Blocks[i] = NextBlock(&Seed);
+        Started[i] = StartRead(i, Blocks[i]);
+        ok(Started[i], "Failed to start read %lu: %lu\n", i, GetLastError());
+        if (Started[i])
+            StartedCount++;
+    }
+
+    /* Only the reads that were started ever complete */
+    for (Done = 0; Done < StartedCount; Done++)
+    {
+        if (WaitRead() == NULL)
+            return;
+    }
+
+    for (i = 0; i < MAX_QUEUE_DEPTH; i++)
+    {
+        if (!Started[i])
+            continue;
+
+        CopyMemory(Expected, Buffers + i * BENCH_BLOCK_SIZE, BENCH_BLOCK_SIZE);
+        if (!StartRead(i, Blocks[i]) || WaitRead() == NULL)
+            return;
+
+        ok(!memcmp(Expected, Buffers + i * BENCH_BLOCK_SIZE, BENCH_BLOCK_SIZE),
+           "Block %I64u read differently\n", Blocks[i]);
+    }
+}
+
+START_TEST(DiskQueueDepth)
+{
+    GET_LENGTH_INFORMATION LengthInfo;
+    LARGE_INTEGER Frequency;
+    ULONGLONG Time;
+    ULONG QueueDepth;
+    DWORD Returned;
+
+    /* Reading the raw disk needs administrator rights */
+    Disk = CreateFileW(L"\\\\.\\PhysicalDrive0",
+                       GENERIC_READ,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE,
+                       NULL,
+                       OPEN_EXISTING,
+                       FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING,
+                       NULL);
+    if (Disk == INVALID_HANDLE_VALUE)
+    {
+        skip("Failed to open the first disk: %lu\n", GetLastError());
+        return;
+    }
+
+    if (!DeviceIoControl(Disk, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0, &LengthInfo, sizeof(LengthInfo), &Returned, NULL) ||
+        LengthInfo.Length.QuadPart < BENCH_BLOCK_SIZE)
+    {
+        skip("Failed to get the disk length: %lu\n", GetLastError());
+        CloseHandle(Disk);
+        return;
+    }
+    DiskBlocks = LengthInfo.Length.QuadPart / BENCH_BLOCK_SIZE;
+
+    /* Unbuffered reads need sector aligned buffers */
+    Buffers = VirtualAlloc(NULL, MAX_QUEUE_DEPTH * BENCH_BLOCK_SIZE, MEM_COMMIT, PAGE_READWRITE);
+    Port = CreateIoCompletionPort(Disk, NULL, 0, 0);
+    ok(Buffers != NULL && Port != NULL, "Setup failed: %lu\n", GetLastError());
+    if (Buffers == NULL || Port == NULL)
+    {
+        if (Buffers)
+            VirtualFree(Buffers, 0, MEM_RELEASE);
+        CloseHandle(Disk);
+        return;
+    }
+
+    QueryPerformanceFrequency(&Frequency);
+
+    for (QueueDepth = 1; QueueDepth <= MAX_QUEUE_DEPTH; QueueDepth *= 2)
+    {
+        Time = BenchQueueDepth(QueueDepth);
+        if (Time == 0)
+            Time = 1;
+
+        trace("%u random %u bytes reads at queue depth %2lu: %I64u us, %I64u reads/s\n",
+              BENCH_READS, BENCH_BLOCK_SIZE, QueueDepth,
+              Time * 1000000 / Frequency.QuadPart,
+              BENCH_READS * Frequency.QuadPart / Time);
+    }
+
+    TestConcurrentReads();
+
+    CloseHandle(Port);
+    VirtualFree(Buffers, 0, MEM_RELEASE);
+    CloseHandle(Disk);
+}
@@ -0,0 +1,157 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test and benchmark for opening files in a large directory
+ */
+
+#include "precomp.h"
+
+#define BENCH_FILES 2000
+#define BENCH_ROUNDS 4
+
+static WCHAR TestDir[MAX_PATH];
+
+static
+VOID
+GetTestFileName(
+    PWSTR FileName,
+    ULONG Index)
+{
+    /* Long names sharing their beginning, so that their 8.3 names need a tilde */
+    swprintf(FileName, L"%s\\Large directory test file %04lu.data", TestDir, Index);
+}
+
+static
+BOOL
+OpenTestFile(
+    PCWSTR FileName)
+{
+    HANDLE hFile;
+
+    hFile = CreateFileW(FileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    CloseHandle(hFile);
+    return TRUE;
+}
+
+static
+ULONGLONG
+OpenAllFiles(
+    ULONG Count)
+{
+    WCHAR FileName[MAX_PATH];
+    LARGE_INTEGER Start, End;
+    ULONG Round, i, Index;
+
+    QueryPerformanceCounter(&Start);
+    for (Round = 0; Round < BENCH_ROUNDS; Round++)
+    {
+        for (i = 0; i < Count; i++)
+        {
+            /* Spread the lookups over the whole directory */
+            Index = (i * 7919) % Count;
+            GetTestFileName(FileName, Index);
+            ok(OpenTestFile(FileName), "Failed to open file %lu: %lu\n", Index, GetLastError());
+        }
+    }
+    QueryPerformanceCounter(&End);
+
+    return End.QuadPart - Start.QuadPart;
+}
+
+START_TEST(LargeDirectory)
+{
+    WCHAR FileName[MAX_PATH];
+    WCHAR ShortName[MAX_PATH];
+    LARGE_INTEGER Frequency;
+    ULONGLONG SmallTime, LargeTime;
+    HANDLE hFile;
+    ULONG Created, i;
+
+    if (!GetTempPathW(_countof(TestDir), TestDir) ||
+        !GetTempFileNameW(TestDir, L"dir", 0, TestDir))
+    {
+        skip("No temporary directory\n");
+        return;
+    }
+
+    /* GetTempFileName created a file, use its name for the directory */
+    DeleteFileW(TestDir);
+    if (!CreateDirectoryW(TestDir, NULL))
+    {
+        skip("Failed to create %S: %lu\n", TestDir, GetLastError());
+        return;
+    }
+
+    for (Created = 0; Created < BENCH_FILES; Created++)
+    {
+        GetTestFileName(FileName, Created);
+        hFile = CreateFileW(FileName, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+        ok(hFile != INVALID_HANDLE_VALUE, "Failed to create file %lu: %lu\n", Created, GetLastError());
+        if (hFile == INVALID_HANDLE_VALUE)
+            break;
+        CloseHandle(hFile);
+    }
+
+    if (Created == BENCH_FILES)
+    {
+        QueryPerformanceFrequency(&Frequency);
+
+        /* The first files are found early in a linear scan, the whole set is not */
+        SmallTime = OpenAllFiles(BENCH_FILES / 20);
+        LargeTime = OpenAllFiles(BENCH_FILES);
+
+        trace("%u opens in a %u files directory: %I64u us per open for the first %u files, %I64u us for all\n",
+              BENCH_FILES * BENCH_ROUNDS, BENCH_FILES,
+              SmallTime * 1000000 / Frequency.QuadPart / (BENCH_FILES / 20 * BENCH_ROUNDS), BENCH_FILES / 20,
+              LargeTime * 1000000 / Frequency.QuadPart / (BENCH_FILES * BENCH_ROUNDS));
+
+        /* Lookups are case insensitive */
+        GetTestFileName(FileName, BENCH_FILES - 1);
+        _wcsupr(FileName + wcslen(TestDir));
+        ok(OpenTestFile(FileName), "Failed to open %S: %lu\n", FileName, GetLastError());
+
+        /* And work with the short names */
+        GetTestFileName(FileName, BENCH_FILES / 2);
+        if (GetShortPathNameW(FileName, ShortName, _countof(ShortName)))
+            ok(OpenTestFile(ShortName), "Failed to open %S: %lu\n", ShortName, GetLastError());
+
+        /* Names that don't exist */
+        GetTestFileName(FileName, BENCH_FILES);
+        ok(!OpenTestFile(FileName), "Opened %S\n", FileName);
+        ok_long(GetLastError(), ERROR_FILE_NOT_FOUND);
+
+        /* Deleted files must not be found anymore, the others must */
+        for (i = 0; i < BENCH_FILES; i += 2)
+        {
+            GetTestFileName(FileName, i);
+            ok(DeleteFileW(FileName), "Failed to delete file %lu: %lu\n", i, GetLastError());
+        }
+        for (i = 0; i < BENCH_FILES; i++)
+        {
+            GetTestFileName(FileName, i);
+            ok(OpenTestFile(FileName) == (i & 1), "File %lu is %s\n", i, (i & 1) ? "missing" : "still there");
+        }
+
+        /* Entries reusing the freed slots */
+        for (i = 0; i < BENCH_FILES; i += 2)
+        {
+            swprintf(FileName, L"%s\\Replacement %lu", TestDir, i);
+            hFile = CreateFileW(FileName, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+            ok(hFile != INVALID_HANDLE_VALUE, "Failed to create %S: %lu\n", FileName, GetLastError());
+            if (hFile != INVALID_HANDLE_VALUE)
+                CloseHandle(hFile);
+            ok(OpenTestFile(FileName), "Failed to open %S: %lu\n", FileName, GetLastError());
+            DeleteFileW(FileName);
+        }
+    }
+
+    for (i = 0; i < Created; i++)
+    {
+        GetTestFileName(FileName, i);
+        DeleteFileW(FileName);
+    }
+    ok(RemoveDirectoryW(TestDir), "Failed to remove %S: %lu\n", TestDir, GetLastError());
+}
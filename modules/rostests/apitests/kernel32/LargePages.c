@@ -0,0 +1,184 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for MEM_LARGE_PAGES allocations
+ */
+
+#include "precomp.h"
+
+#include <ndk/mmfuncs.h>
+
+#ifndef MEM_LARGE_PAGES
+#define MEM_LARGE_PAGES 0x20000000
+#endif
+
+static SIZE_T (WINAPI * pGetLargePageMinimum)(VOID);
+
+static
+BOOL
+EnableLockMemoryPrivilege(VOID)
+{
+    HANDLE hToken;
+    TOKEN_PRIVILEGES tp;
+    BOOL Success;
+
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &hToken))
+        return FALSE;
+
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    Success = LookupPrivilegeValueW(NULL, L"SeLockMemoryPrivilege", &tp.Privileges[0].Luid);
+    if (Success)
+    {
+        /* Succeeds with ERROR_NOT_ALL_ASSIGNED if the token doesn't have it */
+        Success = AdjustTokenPrivileges(hToken, FALSE, &tp, 0, NULL, NULL) &&
+                  (GetLastError() == ERROR_SUCCESS);
+    }
+
+    CloseHandle(hToken);
+    return Success;
+}
+
+static
+VOID
+TestAllocation(
+    SIZE_T LargePageSize)
+{
+    MEMORY_BASIC_INFORMATION MemoryInfo;
+    PUCHAR Buffer;
+    PVOID BaseAddress;
+    SIZE_T RegionSize, Offset;
+    ULONG Mismatches = 0;
+    NTSTATUS Status;
+    BOOL Success;
+
+    Buffer = VirtualAlloc(NULL, 2 * LargePageSize, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (!Buffer)
+    {
+        /* The memory may be too fragmented to find aligned runs */
+        skip("Large page allocation failed (error %lu)\n", GetLastError());
+        return;
+    }
+    ok(((ULONG_PTR)Buffer & (LargePageSize - 1)) == 0, "Buffer %p is not large page aligned\n", Buffer);
+
+    /* The pages come zeroed, and the whole range is usable */
+    for (Offset = 0; Offset < 2 * LargePageSize; Offset += PAGE_SIZE)
+    {
+        if (*(PULONG)(Buffer + Offset) != 0)
+            Mismatches++;
+        *(PULONG)(Buffer + Offset) = (ULONG)(Offset / PAGE_SIZE);
+    }
+    ok_long(Mismatches, 0);
+
+    RtlZeroMemory(&MemoryInfo, sizeof(MemoryInfo));
+    ok(VirtualQuery(Buffer + PAGE_SIZE, &MemoryInfo, sizeof(MemoryInfo)) == sizeof(MemoryInfo),
+       "VirtualQuery failed (error %lu)\n", GetLastError());
+    ok(MemoryInfo.AllocationBase == Buffer, "AllocationBase is %p, expected %p\n", MemoryInfo.AllocationBase, Buffer);
+    ok_hex(MemoryInfo.State, MEM_COMMIT);
+    ok_hex(MemoryInfo.Protect, PAGE_READWRITE);
+    ok_hex(MemoryInfo.Type, MEM_PRIVATE);
+
+    /* Large pages can't be decommitted or released in part */
+    SetLastError(0xdeadbeef);
+    Success = VirtualFree(Buffer, PAGE_SIZE, MEM_DECOMMIT);
+    ok(!Success, "Decommitting one page of a large page succeeded\n");
+
+    SetLastError(0xdeadbeef);
+    Success = VirtualFree(Buffer + LargePageSize, 0, MEM_RELEASE);
+    ok(!Success, "Releasing from the second large page succeeded\n");
+
+    BaseAddress = Buffer;
+    RegionSize = LargePageSize;
+    Status = NtFreeVirtualMemory(NtCurrentProcess(), &BaseAddress, &RegionSize, MEM_RELEASE);
+    ok(!NT_SUCCESS(Status), "Releasing the first large page succeeded\n");
+
+    /* Nothing of it went away */
+    Mismatches = 0;
+    for (Offset = 0; Offset < 2 * LargePageSize; Offset += PAGE_SIZE)
+    {
+        if (*(PULONG)(Buffer + Offset) != (ULONG)(Offset / PAGE_SIZE))
+            Mismatches++;
+    }
+    ok_long(Mismatches, 0);
+
+    Success = VirtualFree(Buffer, 0, MEM_RELEASE);
+    ok(Success, "VirtualFree failed (error %lu)\n", GetLastError());
+
+    RtlZeroMemory(&MemoryInfo, sizeof(MemoryInfo));
+    ok(VirtualQuery(Buffer, &MemoryInfo, sizeof(MemoryInfo)) == sizeof(MemoryInfo),
+       "VirtualQuery failed (error %lu)\n", GetLastError());
+    ok_hex(MemoryInfo.State, MEM_FREE);
+}
+
+static
+VOID
+TestInvalidAllocations(
+    SIZE_T LargePageSize)
+{
+    PVOID Buffer;
+
+    /* Large pages are reserved and committed at once */
+    SetLastError(0xdeadbeef);
+    Buffer = VirtualAlloc(NULL, LargePageSize, MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+    ok(Buffer == NULL, "Reserve only large page allocation succeeded\n");
+    ok_err(ERROR_INVALID_PARAMETER);
+    if (Buffer) VirtualFree(Buffer, 0, MEM_RELEASE);
+
+    SetLastError(0xdeadbeef);
+    Buffer = VirtualAlloc(NULL, LargePageSize, MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    ok(Buffer == NULL, "Commit only large page allocation succeeded\n");
+    ok_err(ERROR_INVALID_PARAMETER);
+    if (Buffer) VirtualFree(Buffer, 0, MEM_RELEASE);
+
+    /* The size must be a multiple of the large page size */
+    SetLastError(0xdeadbeef);
+    Buffer = VirtualAlloc(NULL, LargePageSize + PAGE_SIZE, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+    ok(Buffer == NULL, "Unaligned large page allocation succeeded\n");
+    if (Buffer) VirtualFree(Buffer, 0, MEM_RELEASE);
+
+    /* Large pages are always accessible and cached */
+    SetLastError(0xdeadbeef);
+    Buffer = VirtualAlloc(NULL, LargePageSize, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_NOACCESS);
+    ok(Buffer == NULL, "PAGE_NOACCESS large page allocation succeeded\n");
+    if (Buffer) VirtualFree(Buffer, 0, MEM_RELEASE);
+
+    SetLastError(0xdeadbeef);
+    Buffer = VirtualAlloc(NULL, LargePageSize, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE | PAGE_NOCACHE);
+    ok(Buffer == NULL, "PAGE_NOCACHE large page allocation succeeded\n");
+    if (Buffer) VirtualFree(Buffer, 0, MEM_RELEASE);
+}
+
+START_TEST(LargePages)
+{
+    SYSTEM_INFO SystemInfo;
+    SIZE_T LargePageSize;
+
+    GetSystemInfo(&SystemInfo);
+
+    pGetLargePageMinimum = (void *)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "GetLargePageMinimum");
+    if (!pGetLargePageMinimum)
+    {
+        skip("GetLargePageMinimum not found. Can't proceed\n");
+        return;
+    }
+
+    /* Zero means large pages aren't supported at all */
+    LargePageSize = pGetLargePageMinimum();
+    trace("Large page minimum is 0x%Ix\n", LargePageSize);
+    if (!LargePageSize)
+    {
+        skip("Large pages are not supported\n");
+        return;
+    }
+    ok((LargePageSize & (LargePageSize - 1)) == 0, "Large page minimum 0x%Ix is not a power of two\n", LargePageSize);
+    ok(LargePageSize > SystemInfo.dwPageSize, "Large page minimum 0x%Ix is not above the page size\n", LargePageSize);
+
+    if (!EnableLockMemoryPrivilege())
+    {
+        skip("Cannot enable SeLockMemoryPrivilege\n");
+        return;
+    }
+
+    TestInvalidAllocations(LargePageSize);
+    TestAllocation(LargePageSize);
+}
@@ -0,0 +1,218 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test for RtlSetHeapInformation and the low fragmentation heap
+ */
+
+#include "precomp.h"
+
+#define BENCH_MAX_THREADS 8
+#define BENCH_ITERATIONS 20000
+#define BENCH_BLOCKS 64
+
+static HANDLE BenchHeap;
+static HANDLE StartEvent;
+
+static
+DWORD
+WINAPI
+AllocThread(
+    PVOID Param)
+{
+    PVOID Blocks[BENCH_BLOCKS] = { NULL };
+    ULONG Seed = (ULONG)(ULONG_PTR)Param;
+    ULONG i, Index;
+    SIZE_T Size;
+
+    WaitForSingleObject(StartEvent, INFINITE);
+
+    for (i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        Index = i % BENCH_BLOCKS;
+        if (Blocks[Index])
+            RtlFreeHeap(BenchHeap, 0, Blocks[Index]);
+
+        /* Small blocks of mixed sizes, as a typical application does */
+        Size = 8 + RtlRandom(&Seed) % 256;
+        Blocks[Index] = RtlAllocateHeap(BenchHeap, 0, Size);
+        if (Blocks[Index])
+            *(PUCHAR)Blocks[Index] = (UCHAR)i;
+    }
+
+    for (Index = 0; Index < BENCH_BLOCKS; Index++)
+    {
+        if (Blocks[Index])
+            RtlFreeHeap(BenchHeap, 0, Blocks[Index]);
+    }
+
+    return 0;
+}
+
+static
+ULONGLONG
+RunBenchmark(
+    HANDLE Heap,
+    ULONG ThreadCount)
+{
+    HANDLE Threads[BENCH_MAX_THREADS];
+    LARGE_INTEGER Start, End;
+    ULONG i;
+
+    BenchHeap = Heap;
+    StartEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!StartEvent)
+        return 0;
+
+    for (i = 0; i < ThreadCount; i++)
+    {
+        Threads[i] = CreateThread(NULL, 0, AllocThread, (PVOID)(ULONG_PTR)(i + 1), 0, NULL);
+        ok(Threads[i] != NULL, "CreateThread failed: %lu\n", GetLastError());
+        if (!Threads[i])
+        {
+            ThreadCount = i;
+            break;
+        }
+    }
+
+    QueryPerformanceCounter(&Start);
+    SetEvent(StartEvent);
+    WaitForMultipleObjects(ThreadCount, Threads, TRUE, INFINITE);
+    QueryPerformanceCounter(&End);
+
+    for (i = 0; i < ThreadCount; i++)
+        CloseHandle(Threads[i]);
+    CloseHandle(StartEvent);
+
+    return End.QuadPart - Start.QuadPart;
+}
+
+static
+VOID
+TestBenchmark(VOID)
+{
+    HANDLE Heap, LfhHeap;
+    ULONG CompatibilityMode = 2;
+    ULONG ThreadCount;
+    SYSTEM_INFO SystemInfo;
+    LARGE_INTEGER Frequency;
+    ULONGLONG Time, LfhTime;
+    NTSTATUS Status;
+
+    GetSystemInfo(&SystemInfo);
+    QueryPerformanceFrequency(&Frequency);
+    ThreadCount = min(max(SystemInfo.dwNumberOfProcessors, 2), BENCH_MAX_THREADS);
+
+    Heap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    LfhHeap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    if (!Heap || !LfhHeap)
+    {
+        skip("Failed to create heaps\n");
+        goto Cleanup;
+    }
+
+    Status = RtlSetHeapInformation(LfhHeap, HeapCompatibilityInformation, &CompatibilityMode, sizeof(CompatibilityMode));
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    Time = RunBenchmark(Heap, ThreadCount);
+    LfhTime = RunBenchmark(LfhHeap, ThreadCount);
+
+    trace("%lu threads x %u alloc/free: back end %I64u ms, LFH %I64u ms\n",
+          ThreadCount, BENCH_ITERATIONS,
+          Time * 1000 / Frequency.QuadPart,
+          LfhTime * 1000 / Frequency.QuadPart);
+
+Cleanup:
+    if (LfhHeap) RtlDestroyHeap(LfhHeap);
+    if (Heap) RtlDestroyHeap(Heap);
+}
+
+START_TEST(RtlSetHeapInformation)
+{
+    HANDLE Heap;
+    ULONG CompatibilityMode, i;
+    SIZE_T ReturnLength;
+    PUCHAR Blocks[0x100];
+    PUCHAR Block;
+    NTSTATUS Status;
+
+    Heap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    if (!Heap)
+    {
+        skip("RtlCreateHeap failed\n");
+        return;
+    }
+
+    /* No front end by default */
+    CompatibilityMode = 0xdeadbeef;
+    Status = RtlQueryHeapInformation(Heap, HeapCompatibilityInformation, &CompatibilityMode, sizeof(CompatibilityMode), &ReturnLength);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok_long(CompatibilityMode, 0);
+
+    /* Only the LFH can be enabled */
+    CompatibilityMode = 1;
+    Status = RtlSetHeapInformation(Heap, HeapCompatibilityInformation, &CompatibilityMode, sizeof(CompatibilityMode));
+    ok_ntstatus(Status, STATUS_UNSUCCESSFUL);
+
+    CompatibilityMode = 2;
+    Status = RtlSetHeapInformation(Heap, HeapCompatibilityInformation, &CompatibilityMode, sizeof(CompatibilityMode));
+    ok_ntstatus(Status, STATUS_SUCCESS);
+
+    CompatibilityMode = 0xdeadbeef;
+    Status = RtlQueryHeapInformation(Heap, HeapCompatibilityInformation, &CompatibilityMode, sizeof(CompatibilityMode), &ReturnLength);
+    ok_ntstatus(Status, STATUS_SUCCESS);
+    ok_long(CompatibilityMode, 2);
+
+    /* Blocks of all the sizes must be usable and distinct */
+    for (i = 0; i < 0x100; i++)
+    {
+        Blocks[i] = RtlAllocateHeap(Heap, HEAP_ZERO_MEMORY, i * 8);
+        ok(Blocks[i] != NULL, "Allocation of %lu bytes failed\n", i * 8);
+        if (!Blocks[i]) continue;
+        ok(((ULONG_PTR)Blocks[i] & 7) == 0, "Block %p is not aligned\n", Blocks[i]);
+        ok_size_t(RtlSizeHeap(Heap, 0, Blocks[i]), i * 8);
+        if (i > 0) ok(Blocks[i][i * 8 - 1] == 0, "Block %lu is not zeroed\n", i);
+        RtlFillMemory(Blocks[i], i * 8, (UCHAR)i);
+    }
+
+    for (i = 0; i < 0x100; i++)
+    {
+        if (!Blocks[i]) continue;
+        if (i > 0) ok(Blocks[i][0] == (UCHAR)i && Blocks[i][i * 8 - 1] == (UCHAR)i, "Block %lu was overwritten\n", i);
+        ok(RtlValidateHeap(Heap, 0, Blocks[i]), "Block %lu is invalid\n", i);
+        ok(RtlFreeHeap(Heap, 0, Blocks[i]), "Freeing block %lu failed\n", i);
+    }
+
+    /* Reallocations within and out of a slot */
+    Block = RtlAllocateHeap(Heap, 0, 10);
+    ok(Block != NULL, "Allocation failed\n");
+    if (Block)
+    {
+        RtlFillMemory(Block, 10, 0x7a);
+        Block = RtlReAllocateHeap(Heap, HEAP_ZERO_MEMORY, Block, 12);
+        ok(Block != NULL, "Reallocation failed\n");
+        ok_size_t(RtlSizeHeap(Heap, 0, Block), 12);
+        ok(Block[9] == 0x7a && Block[10] == 0 && Block[11] == 0, "Unexpected content\n");
+
+        Block = RtlReAllocateHeap(Heap, HEAP_ZERO_MEMORY, Block, 0x10000);
+        ok(Block != NULL, "Reallocation failed\n");
+        ok_size_t(RtlSizeHeap(Heap, 0, Block), 0x10000);
+        ok(Block[9] == 0x7a && Block[10] == 0 && Block[0xFFFF] == 0, "Unexpected content\n");
+        ok(RtlFreeHeap(Heap, 0, Block), "Freeing failed\n");
+    }
+
+    RtlDestroyHeap(Heap);
+
+    /* Heaps without serialization can't get the LFH */
+    Heap = RtlCreateHeap(HEAP_GROWABLE | HEAP_NO_SERIALIZE, NULL, 0, 0, NULL, NULL);
+    if (Heap)
+    {
+        CompatibilityMode = 2;
+        Status = RtlSetHeapInformation(Heap, HeapCompatibilityInformation, &CompatibilityMode, sizeof(CompatibilityMode));
+        ok_ntstatus(Status, STATUS_UNSUCCESSFUL);
+        RtlDestroyHeap(Heap);
+    }
+
+    TestBenchmark();
+}
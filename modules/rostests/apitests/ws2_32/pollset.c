@@ -0,0 +1,290 @@
+/*
+ * PROJECT:         ReactOS api tests
+ * LICENSE:         GPLv2+ - See COPYING in the top level directory
+ * PURPOSE:         Test and benchmark for AFD poll sets against select
+ */
+
+#include "ws2_32.h"
+
+#include <ndk/iofuncs.h>
+#include <ndk/obfuncs.h>
+#include <tcpioctl.h>
+#include <tdi.h>
+#include <afd/shared.h>
+
+/* select() takes up to FD_SETSIZE sockets, give both the same */
+#define BENCH_SOCKETS FD_SETSIZE
+#define BENCH_ROUNDS 2000
+#define WAIT_TIMEOUT_MS 5000
+
+static SOCKET Clients[BENCH_SOCKETS];
+static SOCKET Servers[BENCH_SOCKETS];
+
+static
+BOOL
+CreateConnections(VOID)
+{
+    SOCKET Listener;
+    struct sockaddr_in Address;
+    int AddressLength = sizeof(Address);
+    ULONG i;
+
+    Listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (Listener == INVALID_SOCKET)
+        return FALSE;
+
+    ZeroMemory(&Address, sizeof(Address));
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(Listener, (struct sockaddr *)&Address, sizeof(Address)) ||
+        getsockname(Listener, (struct sockaddr *)&Address, &AddressLength) ||
+        listen(Listener, SOMAXCONN))
+    {
+        closesocket(Listener);
+        return FALSE;
+    }
+
+    for (i = 0; i < BENCH_SOCKETS; i++)
+    {
+        Clients[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (Clients[i] == INVALID_SOCKET ||
+            connect(Clients[i], (struct sockaddr *)&Address, sizeof(Address)))
+        {
+            break;
+        }
+
+        Servers[i] = accept(Listener, NULL, NULL);
+        if (Servers[i] == INVALID_SOCKET)
+            break;
+    }
+
+    closesocket(Listener);
+    return i == BENCH_SOCKETS;
+}
+
+static
+VOID
+CloseConnections(VOID)
+{
+    ULONG i;
+
+    for (i = 0; i < BENCH_SOCKETS; i++)
+    {
+        if (Clients[i] != INVALID_SOCKET && Clients[i] != 0)
+            closesocket(Clients[i]);
+        if (Servers[i] != INVALID_SOCKET && Servers[i] != 0)
+            closesocket(Servers[i]);
+    }
+}
+
+/* Each round makes one socket readable, and waits for it among all of them */
+static
+ULONGLONG
+BenchSelect(VOID)
+{
+    LARGE_INTEGER Start, End;
+    struct timeval Timeout = { WAIT_TIMEOUT_MS / 1000, 0 };
+    fd_set ReadSet;
+    ULONG Round, i, Index;
+    char Byte;
+    int Result;
+
+    QueryPerformanceCounter(&Start);
+    for (Round = 0; Round < BENCH_ROUNDS; Round++)
+    {
+        Index = (Round * 7) % BENCH_SOCKETS;
+        send(Clients[Index], "x", 1, 0);
+
+        FD_ZERO(&ReadSet);
+        for (i = 0; i < BENCH_SOCKETS; i++)
+            FD_SET(Servers[i], &ReadSet);
+
+        Result = select(0, &ReadSet, NULL, NULL, &Timeout);
+        ok(Result == 1, "Round %lu: select returned %d\n", Round, Result);
+        if (Result != 1)
+            break;
+        ok(FD_ISSET(Servers[Index], &ReadSet), "Round %lu: socket %lu not reported\n", Round, Index);
+
+        recv(Servers[Index], &Byte, 1, 0);
+    }
+    QueryPerformanceCounter(&End);
+
+    return End.QuadPart - Start.QuadPart;
+}
+
+static
+NTSTATUS
+PollControl(
+    HANDLE PollSet,
+    ULONG Operation,
+    SOCKET Socket,
+    ULONG Events,
+    ULONG_PTR Context)
+{
+    AFD_POLL_CONTROL_INFO ControlInfo;
+    IO_STATUS_BLOCK IoStatus;
+    NTSTATUS Status;
+
+    ControlInfo.Operation = Operation;
+    ControlInfo.Handle = Socket;
+    ControlInfo.Events = Events;
+    ControlInfo.Flags = 0;
+    ControlInfo.Context = Context;
+
+    Status = NtDeviceIoControlFile(PollSet, NULL, NULL, NULL, &IoStatus,
+                                   IOCTL_AFD_POLL_CONTROL,
+                                   &ControlInfo, sizeof(ControlInfo),
+                                   NULL, 0);
+    ok(Status != STATUS_PENDING, "Poll control pended\n");
+    return Status;
+}
+
+static
+ULONGLONG
+BenchPollSet(
+    HANDLE PollSet,
+    HANDLE Port)
+{
+    LARGE_INTEGER Start, End;
+    AFD_POLL_WAIT_INFO WaitInfo;
+    IO_STATUS_BLOCK IoStatus;
+    OVERLAPPED Overlapped;
+    LPOVERLAPPED Completed;
+    ULONG_PTR Key;
+    DWORD Transferred;
+    NTSTATUS Status;
+    ULONG Round, Index;
+    char Byte;
+
+    QueryPerformanceCounter(&Start);
+    for (Round = 0; Round < BENCH_ROUNDS; Round++)
+    {
+        Index = (Round * 7) % BENCH_SOCKETS;
+        send(Clients[Index], "x", 1, 0);
+
+        WaitInfo.Timeout.QuadPart = -10000LL * WAIT_TIMEOUT_MS;
+        WaitInfo.EventCount = 0;
+        Status = NtDeviceIoControlFile(PollSet, NULL, NULL, &Overlapped, &IoStatus,
+                                       IOCTL_AFD_POLL_WAIT,
+                                       &WaitInfo, sizeof(WaitInfo),
+                                       &WaitInfo, sizeof(WaitInfo));
+        ok(NT_SUCCESS(Status), "Round %lu: poll wait failed with 0x%lx\n", Round, Status);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        /* Whether it pended or not, the result comes through the port */
+        Completed = NULL;
+        ok(GetQueuedCompletionStatus(Port, &Transferred, &Key, &Completed, WAIT_TIMEOUT_MS),
+           "Round %lu: no completion, error %lu\n", Round, GetLastError());
+        ok(Completed == &Overlapped, "Round %lu: completed %p\n", Round, Completed);
+        if (Completed != &Overlapped)
+            break;
+
+        ok(IoStatus.Status == STATUS_SUCCESS, "Round %lu: status 0x%lx\n", Round, IoStatus.Status);
+        ok(WaitInfo.EventCount == 1, "Round %lu: %lu events\n", Round, WaitInfo.EventCount);
+        ok(WaitInfo.Events[0].Context == Index, "Round %lu: context %lu, expected %lu\n",
+           Round, (ULONG)WaitInfo.Events[0].Context, Index);
+        ok(WaitInfo.Events[0].Events & AFD_EVENT_RECEIVE, "Round %lu: events 0x%lx\n",
+           Round, WaitInfo.Events[0].Events);
+
+        recv(Servers[Index], &Byte, 1, 0);
+    }
+    QueryPerformanceCounter(&End);
+
+    return End.QuadPart - Start.QuadPart;
+}
+
+static
+VOID
+TestPollSet(VOID)
+{
+    UNICODE_STRING DeviceName = RTL_CONSTANT_STRING(L"\\Device\\Afd\\Endpoint");
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    LARGE_INTEGER Frequency;
+    ULONGLONG SelectTime, PollSetTime;
+    HANDLE PollSet, Port;
+    NTSTATUS Status;
+    ULONG i;
+
+    /* A handle to AFD which isn't a socket holds the poll set */
+    InitializeObjectAttributes(&ObjectAttributes, &DeviceName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtCreateFile(&PollSet,
+                          GENERIC_READ | GENERIC_WRITE | SYNCHRONIZE,
+                          &ObjectAttributes,
+                          &IoStatus,
+                          NULL,
+                          0,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          FILE_OPEN_IF,
+                          0,
+                          NULL,
+                          0);
+    ok(Status == STATUS_SUCCESS, "Failed to open AFD: 0x%lx\n", Status);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    Port = CreateIoCompletionPort(PollSet, NULL, 1, 0);
+    ok(Port != NULL, "CreateIoCompletionPort failed: %lu\n", GetLastError());
+    if (!Port)
+    {
+        NtClose(PollSet);
+        return;
+    }
+
+    for (i = 0; i < BENCH_SOCKETS; i++)
+    {
+        Status = PollControl(PollSet, AFD_POLL_ADD, Servers[i], AFD_EVENT_RECEIVE, i);
+        ok(Status == STATUS_SUCCESS, "Failed to add socket %lu: 0x%lx\n", i, Status);
+    }
+
+    /* Registrations are unique, and only sockets can be registered */
+    Status = PollControl(PollSet, AFD_POLL_ADD, Servers[0], AFD_EVENT_RECEIVE, 0);
+    ok(Status == STATUS_OBJECT_NAME_COLLISION, "Status = 0x%lx\n", Status);
+    Status = PollControl(PollSet, AFD_POLL_ADD, (SOCKET)PollSet, AFD_EVENT_RECEIVE, 0);
+    ok(Status == STATUS_INVALID_HANDLE, "Status = 0x%lx\n", Status);
+    Status = PollControl(PollSet, AFD_POLL_MODIFY, Servers[0], AFD_EVENT_RECEIVE, 0);
+    ok(Status == STATUS_SUCCESS, "Status = 0x%lx\n", Status);
+
+    QueryPerformanceFrequency(&Frequency);
+
+    SelectTime = BenchSelect();
+    PollSetTime = BenchPollSet(PollSet, Port);
+
+    trace("%u rounds over %u sockets: select %I64u us, poll set %I64u us\n",
+          BENCH_ROUNDS, BENCH_SOCKETS,
+          SelectTime * 1000000 / Frequency.QuadPart,
+          PollSetTime * 1000000 / Frequency.QuadPart);
+
+    Status = PollControl(PollSet, AFD_POLL_REMOVE, Servers[0], 0, 0);
+    ok(Status == STATUS_SUCCESS, "Status = 0x%lx\n", Status);
+    Status = PollControl(PollSet, AFD_POLL_REMOVE, Servers[0], 0, 0);
+    ok(Status == STATUS_NOT_FOUND, "Status = 0x%lx\n", Status);
+
+    /* Closing the poll set releases the remaining sockets */
+    CloseHandle(Port);
+    NtClose(PollSet);
+}
+
+START_TEST(pollset)
+{
+    WSADATA WsaData;
+
+    if (WSAStartup(MAKEWORD(2, 2), &WsaData) != 0)
+    {
+        skip("WSAStartup failed\n");
+        return;
+    }
+
+    if (!CreateConnections())
+    {
+        skip("Failed to set up %u loopback connections: %d\n", BENCH_SOCKETS, WSAGetLastError());
+    }
+    else
+    {
+        TestPollSet();
+    }
+
+    CloseConnections();
+    WSACleanup();
+}
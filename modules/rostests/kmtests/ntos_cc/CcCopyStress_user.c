@@ -0,0 +1,130 @@
+/*
+ * PROJECT:     ReactOS kernel-mode tests
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Kernel-Mode Test Suite concurrent cached file copy test user-mode part
+ */
+
+#include <kmt_test.h>
+
+#define STRESS_FILE_SIZE (4 * 1024 * 1024)
+#define STRESS_CHUNK_SIZE (64 * 1024)
+#define STRESS_PASSES 8
+#define STRESS_MAX_THREADS 8
+
+static
+DWORD
+WINAPI
+CopyThread(
+    _In_ PVOID Parameter)
+{
+    ULONG Pass;
+    PVOID Buffer;
+    NTSTATUS Status;
+    HANDLE Source, Destination;
+    LARGE_INTEGER ByteOffset;
+    IO_STATUS_BLOCK IoStatusBlock;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING SourceName = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyStress\\Source");
+    UNICODE_STRING DestinationName = RTL_CONSTANT_STRING(L"\\Device\\Kmtest-CcCopyStress\\Destination");
+
+    UNREFERENCED_PARAMETER(Parameter);
+
+    Buffer = RtlAllocateHeap(RtlGetProcessHeap(), 0, STRESS_CHUNK_SIZE);
+    if (!Buffer)
+    {
+        skip(0, "Out of memory\n");
+        return 1;
+    }
+
+    InitializeObjectAttributes(&ObjectAttributes, &SourceName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&Source, FILE_ALL_ACCESS, &ObjectAttributes, &IoStatusBlock, 0, FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    InitializeObjectAttributes(&ObjectAttributes, &DestinationName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&Destination, FILE_ALL_ACCESS, &ObjectAttributes, &IoStatusBlock, 0, FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+
+    for (Pass = 0; Pass < STRESS_PASSES; ++Pass)
+    {
+        for (ByteOffset.QuadPart = 0;
+             ByteOffset.QuadPart < STRESS_FILE_SIZE;
+             ByteOffset.QuadPart += STRESS_CHUNK_SIZE)
+        {
+            Status = NtReadFile(Source, NULL, NULL, NULL, &IoStatusBlock, Buffer, STRESS_CHUNK_SIZE, &ByteOffset, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                ok_eq_hex(Status, STATUS_SUCCESS);
+                break;
+            }
+            Status = NtWriteFile(Destination, NULL, NULL, NULL, &IoStatusBlock, Buffer, STRESS_CHUNK_SIZE, &ByteOffset, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                ok_eq_hex(Status, STATUS_SUCCESS);
+                break;
+            }
+        }
+    }
+
+    NtClose(Destination);
+    NtClose(Source);
+    RtlFreeHeap(RtlGetProcessHeap(), 0, Buffer);
+    return 0;
+}
+
+static
+LONGLONG
+RunCopyThreads(
+    _In_ ULONG ThreadCount)
+{
+    ULONG i;
+    HANDLE Threads[STRESS_MAX_THREADS];
+    LARGE_INTEGER Start, End;
+
+    QueryPerformanceCounter(&Start);
+    for (i = 0; i < ThreadCount; ++i)
+    {
+        Threads[i] = CreateThread(NULL, 0, CopyThread, NULL, 0, NULL);
+        ok(Threads[i] != NULL, "CreateThread failed: %lu\n", GetLastError());
+    }
+    for (i = 0; i < ThreadCount; ++i)
+    {
+        if (Threads[i] != NULL)
+        {
+            WaitForSingleObject(Threads[i], INFINITE);
+            CloseHandle(Threads[i]);
+        }
+    }
+    QueryPerformanceCounter(&End);
+
+    return End.QuadPart - Start.QuadPart;
+}
+
+START_TEST(CcCopyStress)
+{
+    ULONG ThreadCount;
+    SYSTEM_INFO SystemInfo;
+    LARGE_INTEGER Frequency;
+    LONGLONG SingleTime, MultiTime;
+
+    KmtLoadDriver(L"CcCopyStress", FALSE);
+    KmtOpenDriver();
+
+    GetSystemInfo(&SystemInfo);
+    QueryPerformanceFrequency(&Frequency);
+    ThreadCount = min(max(SystemInfo.dwNumberOfProcessors, 2), STRESS_MAX_THREADS);
+
+    /* Each thread copies its own files: per-file Cc work shouldn't serialize.
+     * N threads doing N times the work should take well below N times as long
+     * on SMP. Wall-clock time depends on the machine, so it is only reported.
+     */
+    SingleTime = RunCopyThreads(1);
+    MultiTime = RunCopyThreads(ThreadCount);
+
+    trace("1 thread: %I64d ms, %lu threads: %I64d ms, scaling: %I64d%%\n",
+          SingleTime * 1000 / Frequency.QuadPart,
+          ThreadCount,
+          MultiTime * 1000 / Frequency.QuadPart,
+          MultiTime ? SingleTime * ThreadCount * 100 / MultiTime : 0);
+
+    KmtCloseDriver();
+    KmtUnloadDriver();
+}
@@ -0,0 +1,229 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite scheduler statistics and CPU saturation benchmark
+ */
+
+#include <kmt_test.h>
+
+#define NDEBUG
+#include <debug.h>
+
+#define WORKER_ITERATIONS   (20 * 1000 * 1000)
+#define MAX_WORKERS         16
+
+typedef struct _WORKER_CONTEXT
+{
+    KEVENT StartEvent;
+    ULONG_PTR ProcessorsUsed;
+    volatile ULONG Result;
+    volatile BOOLEAN Done;
+} WORKER_CONTEXT, *PWORKER_CONTEXT;
+
+static
+VOID
+NTAPI
+WorkerThread(
+    IN PVOID Context)
+{
+    PWORKER_CONTEXT WorkerContext = Context;
+    ULONG i, Value = 1;
+
+    KeWaitForSingleObject(&WorkerContext->StartEvent, Executive, KernelMode, FALSE, NULL);
+
+    /* Pure CPU work, checking now and then where we are running */
+    for (i = 0; i < WORKER_ITERATIONS; i++)
+    {
+        Value = Value * 1103515245 + 12345;
+        if (!(i & 0xFFFF))
+            WorkerContext->ProcessorsUsed |= ((KAFFINITY)1 << KeGetCurrentProcessorNumber());
+    }
+
+    WorkerContext->Result = Value;
+    WorkerContext->Done = TRUE;
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+static
+ULONGLONG
+RunWorkers(
+    IN PWORKER_CONTEXT Contexts,
+    IN ULONG Count)
+{
+    PKTHREAD Threads[MAX_WORKERS];
+    ULONGLONG Start;
+    ULONG i;
+
+    for (i = 0; i < Count; i++)
+    {
+        KeInitializeEvent(&Contexts[i].StartEvent, NotificationEvent, FALSE);
+        Contexts[i].ProcessorsUsed = 0;
+        Contexts[i].Done = FALSE;
+        Threads[i] = KmtStartThread(WorkerThread, &Contexts[i]);
+    }
+
+    /* Release them all at once */
+    Start = KeQueryInterruptTime();
+    for (i = 0; i < Count; i++)
+        KeSetEvent(&Contexts[i].StartEvent, IO_NO_INCREMENT, FALSE);
+
+    for (i = 0; i < Count; i++)
+        KmtFinishThread(Threads[i], NULL);
+
+    return KeQueryInterruptTime() - Start;
+}
+
+static
+NTSTATUS
+QuerySchedulerInformation(
+    OUT PSYSTEM_SCHEDULER_INFORMATION *Information)
+{
+    PSYSTEM_SCHEDULER_INFORMATION Buffer;
+    ULONG Size, ReturnLength = 0;
+    NTSTATUS Status;
+
+    Size = KeNumberProcessors * sizeof(SYSTEM_SCHEDULER_INFORMATION);
+    Buffer = ExAllocatePoolWithTag(NonPagedPool, Size, 'hcSK');
+    if (!Buffer)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    /* Too small a buffer must be refused */
+    Status = ZwQuerySystemInformation(SystemSchedulerInformation, Buffer, Size - 1, &ReturnLength);
+    ok_eq_hex(Status, STATUS_INFO_LENGTH_MISMATCH);
+    ok_eq_ulong(ReturnLength, Size);
+
+    Status = ZwQuerySystemInformation(SystemSchedulerInformation, Buffer, Size, &ReturnLength);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok_eq_ulong(ReturnLength, Size);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreePoolWithTag(Buffer, 'hcSK');
+        return Status;
+    }
+
+    *Information = Buffer;
+    return STATUS_SUCCESS;
+}
+
+/* Yields, short sleeps and a trip over every processor, all switching this thread out */
+static
+VOID
+ForceContextSwitches(VOID)
+{
+    LARGE_INTEGER Interval;
+    CCHAR Processor;
+    ULONG i;
+
+    for (i = 0; i < 50; i++)
+    {
+        /* A zero delay only yields to the other ready threads */
+        Interval.QuadPart = 0;
+        KeDelayExecutionThread(KernelMode, FALSE, &Interval);
+
+        Interval.QuadPart = -10 * 1000;
+        KeDelayExecutionThread(KernelMode, FALSE, &Interval);
+    }
+
+    for (Processor = 0; Processor < KeNumberProcessors; Processor++)
+    {
+        KeSetSystemAffinityThread((KAFFINITY)1 << Processor);
+        ok_eq_ulong(KeGetCurrentProcessorNumber(), (ULONG)Processor);
+    }
+    KeRevertToUserAffinityThread();
+}
+
+/* The counters only ever go up */
+static
+VOID
+CheckCountersNotDecreased(
+    IN PSYSTEM_SCHEDULER_INFORMATION Before,
+    IN PSYSTEM_SCHEDULER_INFORMATION After)
+{
+    ULONG i;
+
+    for (i = 0; i < KeNumberProcessors; i++)
+    {
+        ok(After[i].Migrations >= Before[i].Migrations,
+           "CPU %lu: migrations went from %lu to %lu\n", i, Before[i].Migrations, After[i].Migrations);
+        ok(After[i].Steals >= Before[i].Steals,
+           "CPU %lu: steals went from %lu to %lu\n", i, Before[i].Steals, After[i].Steals);
+        ok(After[i].IdlePlacements >= Before[i].IdlePlacements,
+           "CPU %lu: idle placements went from %lu to %lu\n", i, Before[i].IdlePlacements, After[i].IdlePlacements);
+    }
+}
+
+START_TEST(KeScheduler)
+{
+    PWORKER_CONTEXT Contexts;
+    PSYSTEM_SCHEDULER_INFORMATION Before = NULL, After = NULL;
+    ULONGLONG SingleTime, SaturatedTime;
+    ULONG_PTR ProcessorsUsed = 0;
+    ULONG WorkerCount, UsedCount = 0, Steals = 0, Migrations = 0;
+    ULONG i;
+
+    Contexts = ExAllocatePoolWithTag(NonPagedPool, MAX_WORKERS * sizeof(*Contexts), 'hcSK');
+    if (skip(Contexts != NULL, "Out of memory\n"))
+        return;
+
+    if (!NT_SUCCESS(QuerySchedulerInformation(&Before)))
+        goto Cleanup;
+
+    ForceContextSwitches();
+
+    if (!NT_SUCCESS(QuerySchedulerInformation(&After)))
+        goto Cleanup;
+    CheckCountersNotDecreased(Before, After);
+    RtlCopyMemory(Before, After, KeNumberProcessors * sizeof(SYSTEM_SCHEDULER_INFORMATION));
+    ExFreePoolWithTag(After, 'hcSK');
+    After = NULL;
+
+    /* Baseline: one worker alone */
+    SingleTime = RunWorkers(Contexts, 1);
+    ok(Contexts[0].Done, "The single worker didn't finish\n");
+
+    /* Saturate all the processors, with twice as many workers as there are CPUs */
+    WorkerCount = min(KeNumberProcessors * 2, MAX_WORKERS);
+    SaturatedTime = RunWorkers(Contexts, WorkerCount);
+
+    for (i = 0; i < WorkerCount; i++)
+    {
+        ok(Contexts[i].ProcessorsUsed != 0, "Worker %lu never ran\n", i);
+        ok(Contexts[i].Done, "Worker %lu didn't finish\n", i);
+        ProcessorsUsed |= Contexts[i].ProcessorsUsed;
+    }
+    for (i = 0; i < KeNumberProcessors; i++)
+    {
+        if (ProcessorsUsed & ((KAFFINITY)1 << i))
+            UsedCount++;
+    }
+
+    if (!NT_SUCCESS(QuerySchedulerInformation(&After)))
+        goto Cleanup;
+    CheckCountersNotDecreased(Before, After);
+
+    for (i = 0; i < KeNumberProcessors; i++)
+    {
+        Steals += After[i].Steals - Before[i].Steals;
+        Migrations += After[i].Migrations - Before[i].Migrations;
+    }
+
+    /* Throughput is the work done per unit of time, relative to one worker alone.
+       Timings depend on the load of the machine, so they are only reported */
+    trace("%lu CPUs, %lu workers: single %I64u ms, saturated %I64u ms, speedup x%I64u.%02I64u\n",
+          (ULONG)KeNumberProcessors, WorkerCount,
+          SingleTime / 10000, SaturatedTime / 10000,
+          (SingleTime * WorkerCount) / max(SaturatedTime, 1),
+          ((SingleTime * WorkerCount * 100) / max(SaturatedTime, 1)) % 100);
+    trace("%lu processors used, %lu steals, %lu migrations\n", UsedCount, Steals, Migrations);
+
+    if (KeNumberProcessors > 1)
+    {
+        /* Idle processors must have picked up work */
+        ok(UsedCount > 1, "Only %lu processor(s) ran the workers\n", UsedCount);
+    }
+
+Cleanup:
+    if (After) ExFreePoolWithTag(After, 'hcSK');
+    if (Before) ExFreePoolWithTag(Before, 'hcSK');
+    ExFreePoolWithTag(Contexts, 'hcSK');
+}
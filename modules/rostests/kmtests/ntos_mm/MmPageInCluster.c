@@ -0,0 +1,169 @@
+/*
+ * PROJECT:         ReactOS kernel-mode tests
+ * LICENSE:         LGPLv2+ - See COPYING.LIB in the top level directory
+ * PURPOSE:         Kernel-Mode Test Suite page faults taken when reading a mapped file
+ */
+
+#include <kmt_test.h>
+
+#define TEST_FILE_SIZE  (1024 * 1024)
+#define TEST_PAGES      (TEST_FILE_SIZE / PAGE_SIZE)
+#define WRITE_CHUNK     (64 * 1024)
+
+/* A fault brings in up to 64KB, allow for clusters cut short by the view layout */
+#define MAX_CLUSTERED_FAULTS    (2 * TEST_PAGES / (0x10000 / PAGE_SIZE))
+
+static UNICODE_STRING FileName = RTL_CONSTANT_STRING(L"\\SystemRoot\\kmtest-MmPageInCluster.dat");
+
+static
+ULONG
+GetPageFaultCount(VOID)
+{
+    VM_COUNTERS VmCounters;
+    NTSTATUS Status;
+
+    Status = ZwQueryInformationProcess(NtCurrentProcess(),
+                                       ProcessVmCounters,
+                                       &VmCounters,
+                                       sizeof(VmCounters),
+                                       NULL);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    return NT_SUCCESS(Status) ? VmCounters.PageFaultCount : 0;
+}
+
+/* Each page starts with its own index, so misplaced pages can be spotted */
+static
+BOOLEAN
+CreateTestFile(
+    OUT PHANDLE FileHandle)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatusBlock;
+    LARGE_INTEGER FileOffset;
+    PULONG Buffer;
+    NTSTATUS Status;
+    ULONG i;
+
+    Buffer = ExAllocatePoolWithTag(PagedPool, WRITE_CHUNK, 'CPmK');
+    if (skip(Buffer != NULL, "Out of memory\n"))
+        return FALSE;
+
+    InitializeObjectAttributes(&ObjectAttributes, &FileName, OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, NULL, NULL);
+    Status = ZwCreateFile(FileHandle,
+                          GENERIC_READ | GENERIC_WRITE | DELETE | SYNCHRONIZE,
+                          &ObjectAttributes,
+                          &IoStatusBlock,
+                          NULL,
+                          FILE_ATTRIBUTE_NORMAL,
+                          0,
+                          FILE_SUPERSEDE,
+                          FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT | FILE_DELETE_ON_CLOSE,
+                          NULL,
+                          0);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreePoolWithTag(Buffer, 'CPmK');
+        return FALSE;
+    }
+
+    RtlZeroMemory(Buffer, WRITE_CHUNK);
+    for (FileOffset.QuadPart = 0; FileOffset.QuadPart < TEST_FILE_SIZE; FileOffset.QuadPart += WRITE_CHUNK)
+    {
+        for (i = 0; i < WRITE_CHUNK / PAGE_SIZE; i++)
+            Buffer[i * PAGE_SIZE / sizeof(ULONG)] = (ULONG)(FileOffset.QuadPart / PAGE_SIZE) + i;
+
+        Status = ZwWriteFile(*FileHandle, NULL, NULL, NULL, &IoStatusBlock, Buffer, WRITE_CHUNK, &FileOffset, NULL);
+        ok_eq_hex(Status, STATUS_SUCCESS);
+        if (!NT_SUCCESS(Status))
+            break;
+    }
+
+    ExFreePoolWithTag(Buffer, 'CPmK');
+    if (!NT_SUCCESS(Status))
+    {
+        ZwClose(*FileHandle);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static
+VOID
+TestSequentialRead(
+    IN HANDLE SectionHandle)
+{
+    PVOID BaseAddress = NULL;
+    SIZE_T ViewSize = 0;
+    volatile ULONG *Page;
+    ULONG FaultsBefore, Faults;
+    ULONG i, Mismatches = 0;
+    NTSTATUS Status;
+
+    Status = ZwMapViewOfSection(SectionHandle,
+                                NtCurrentProcess(),
+                                &BaseAddress,
+                                0,
+                                0,
+                                NULL,
+                                &ViewSize,
+                                ViewUnmap,
+                                0,
+                                PAGE_READONLY);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (!NT_SUCCESS(Status))
+        return;
+    ok_eq_size(ViewSize, TEST_FILE_SIZE);
+
+    FaultsBefore = GetPageFaultCount();
+    _SEH2_TRY
+    {
+        for (i = 0; i < TEST_PAGES; i++)
+        {
+            Page = (PULONG)((PUCHAR)BaseAddress + i * PAGE_SIZE);
+            if (*Page != i)
+                Mismatches++;
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+    Faults = GetPageFaultCount() - FaultsBefore;
+
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    ok_eq_ulong(Mismatches, 0UL);
+
+    /* Pages brought in along with a faulting one don't fault on their own */
+    trace("Sequential read of a 1MB mapped file: %lu faults\n", Faults);
+    ok(Faults <= MAX_CLUSTERED_FAULTS, "%lu faults for %u pages\n", Faults, TEST_PAGES);
+
+    Status = ZwUnmapViewOfSection(NtCurrentProcess(), BaseAddress);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+}
+
+START_TEST(MmPageInCluster)
+{
+    HANDLE FileHandle, SectionHandle;
+    NTSTATUS Status;
+
+    if (!CreateTestFile(&FileHandle))
+        return;
+
+    Status = ZwCreateSection(&SectionHandle,
+                             SECTION_ALL_ACCESS,
+                             NULL,
+                             NULL,
+                             PAGE_READONLY,
+                             SEC_COMMIT,
+                             FileHandle);
+    ok_eq_hex(Status, STATUS_SUCCESS);
+    if (NT_SUCCESS(Status))
+    {
+        TestSequentialRead(SectionHandle);
+        ZwClose(SectionHandle);
+    }
+
+    ZwClose(FileHandle);
+}
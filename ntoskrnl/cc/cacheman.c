@@ -151,7 +151,7 @@ CcRemapBcb (
 }
 
 /*
- * @unimplemented
+ * @implemented
  */
 VOID
 NTAPI
@@ -162,6 +162,11 @@ CcScheduleReadAhead (
 	)
 {
     KIRQL OldIrql;
+    ULONG Window;
+    LONGLONG Stride;
+    LONGLONG ReadAheadStart;
+    LONGLONG ReadAheadEnd;
+    LONGLONG PrefetchedEnd;
     LARGE_INTEGER NewOffset;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
     PPRIVATE_CACHE_MAP PrivateCacheMap;
@@ -183,42 +188,76 @@ CcScheduleReadAhead (
 
     /* Lock read ahead spin lock */
     KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
-    /* Easy case: the file is sequentially read */
-    if (BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
+
+    /* We use the first read ahead slot to keep the read ahead window of this
+     * handle, the second one holds the last range handed to read ahead.
+     * Note that FileOffset2/BeyondLastByte2 still describe the previous read
+     */
+    Window = PrivateCacheMap->ReadAheadLength[0];
+    if (Window < CC_MIN_READ_AHEAD)
+    {
+        Window = CC_MIN_READ_AHEAD;
+    }
+
+    /* Easy case: the file is sequentially read, or this read continues the previous one.
+     * Grow the window while the caller keeps reading sequentially.
+     */
+    if (BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY) ||
+        FileOffset->QuadPart == PrivateCacheMap->BeyondLastByte2.QuadPart)
     {
         /* If we went backward, this is no go! */
-        if (NewOffset.QuadPart < PrivateCacheMap->ReadAheadOffset[1].QuadPart)
+        if (NewOffset.QuadPart < PrivateCacheMap->FileOffset2.QuadPart)
         {
             KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
             return;
         }
 
-        /* FIXME: hackish, but will do the job for now */
-        PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset.QuadPart;
-        PrivateCacheMap->ReadAheadLength[1] = Length;
+        Window = min(Window * 2, CC_MAX_READ_AHEAD);
+        ReadAheadStart = NewOffset.QuadPart;
+        ReadAheadEnd = NewOffset.QuadPart + Window;
+    }
+    /* Going forward with a constant stride: bring the next chunk */
+    else if (PrivateCacheMap->FileOffset2.QuadPart > PrivateCacheMap->FileOffset1.QuadPart &&
+             FileOffset->QuadPart - PrivateCacheMap->FileOffset2.QuadPart ==
+             PrivateCacheMap->FileOffset2.QuadPart - PrivateCacheMap->FileOffset1.QuadPart)
+    {
+        Stride = FileOffset->QuadPart - PrivateCacheMap->FileOffset2.QuadPart;
+        ReadAheadStart = FileOffset->QuadPart + Stride;
+        ReadAheadEnd = ReadAheadStart + Length;
     }
-    /* Other cases: try to find some logic in that mess... */
+    /* Other cases: the file is randomly accessed, shrink the window */
     else
     {
-        /* Let's check if we always read the same way (like going down in the file)
-         * and pretend it's enough for now
-         */
-        if (PrivateCacheMap->FileOffset2.QuadPart >= PrivateCacheMap->FileOffset1.QuadPart &&
-            FileOffset->QuadPart >= PrivateCacheMap->FileOffset2.QuadPart)
-        {
-            /* FIXME: hackish, but will do the job for now */
-            PrivateCacheMap->ReadAheadOffset[1].QuadPart = NewOffset.QuadPart;
-            PrivateCacheMap->ReadAheadLength[1] = Length;
-        }
-        else
-        {
-            /* FIXME: handle the other cases */
-            KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
-            UNIMPLEMENTED_ONCE;
-            return;
-        }
+        PrivateCacheMap->ReadAheadLength[0] = max(Window / 2, CC_MIN_READ_AHEAD);
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
+
+    PrivateCacheMap->ReadAheadLength[0] = Window;
+
+    /* Don't bring again what the previous read ahead already asked for */
+    PrefetchedEnd = PrivateCacheMap->ReadAheadOffset[1].QuadPart + PrivateCacheMap->ReadAheadLength[1];
+    if (ReadAheadStart >= PrivateCacheMap->ReadAheadOffset[1].QuadPart &&
+        ReadAheadStart < PrefetchedEnd)
+    {
+        ReadAheadStart = PrefetchedEnd;
     }
 
+    /* Read ahead works on whole views, so wait until there's at least one to bring */
+    ReadAheadEnd = ROUND_UP(ReadAheadEnd, VACB_MAPPING_GRANULARITY);
+    if (ReadAheadStart >= ReadAheadEnd ||
+        ReadAheadStart >= SharedCacheMap->FileSize.QuadPart)
+    {
+        KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
+        return;
+    }
+
+    /* If read ahead is already running, it will pick up the new range
+     * when it's done with the current one
+     */
+    PrivateCacheMap->ReadAheadOffset[1].QuadPart = ReadAheadStart;
+    PrivateCacheMap->ReadAheadLength[1] = (ULONG)(ReadAheadEnd - ReadAheadStart);
+
     /* If read ahead isn't active yet */
     if (!PrivateCacheMap->Flags.ReadAheadActive)
     {
@@ -250,9 +289,11 @@ CcScheduleReadAhead (
         /* Fail path: lock again, and revert read ahead active */
         KeAcquireSpinLock(&PrivateCacheMap->ReadAheadSpinLock, &OldIrql);
         InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
+        /* Nothing was read, forget about the range */
+        PrivateCacheMap->ReadAheadLength[1] = 0;
     }
 
-    /* Done (fail) */
+    /* Done */
     KeReleaseSpinLock(&PrivateCacheMap->ReadAheadSpinLock, OldIrql);
 }
 
@@ -50,6 +50,13 @@ ULONG CcFastReadResourceMiss;
 ULONG CcDataPages = 0;
 ULONG CcDataFlushes = 0;
 
+/* Counters:
+ * - Number of views read by read ahead
+ * - Amount of pages brought by read ahead
+ */
+ULONG CcReadAheadIos = 0;
+ULONG CcReadAheadPages = 0;
+
 /* FUNCTIONS *****************************************************************/
 
 VOID
@@ -268,7 +275,7 @@ CcCopyData (
     ULONG BytesCopied;
     KIRQL OldIrql;
     PROS_SHARED_CACHE_MAP SharedCacheMap;
-    PLIST_ENTRY ListEntry;
+    LONGLONG ViewOffset;
     PROS_VACB Vacb;
     ULONG PartialLength;
     PVOID BaseAddress;
@@ -285,25 +292,18 @@ CcCopyData (
         /* test if the requested data is available */
         KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &OldIrql);
         /* FIXME: this loop doesn't take into account areas that don't have
-         * a VACB in the list yet */
-        ListEntry = SharedCacheMap->CacheMapVacbListHead.Flink;
-        while (ListEntry != &SharedCacheMap->CacheMapVacbListHead)
+         * a VACB in the index yet */
+        for (ViewOffset = ROUND_DOWN(CurrentOffset, VACB_MAPPING_GRANULARITY);
+             ViewOffset < CurrentOffset + Length;
+             ViewOffset += VACB_MAPPING_GRANULARITY)
         {
-            Vacb = CONTAINING_RECORD(ListEntry,
-                                     ROS_VACB,
-                                     CacheMapVacbListEntry);
-            ListEntry = ListEntry->Flink;
-            if (!Vacb->Valid &&
-                DoRangesIntersect(Vacb->FileOffset.QuadPart,
-                                  VACB_MAPPING_GRANULARITY,
-                                  CurrentOffset, Length))
+            Vacb = CcRosVacbIndexLookup(SharedCacheMap, ViewOffset);
+            if (Vacb != NULL && !Vacb->Valid)
             {
                 KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
                 /* data not available */
                 return FALSE;
             }
-            if (Vacb->FileOffset.QuadPart >= CurrentOffset + Length)
-                break;
         }
         KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, OldIrql);
     }
@@ -387,11 +387,10 @@ CcCopyData (
     /* If that was a successful sync read operation, let's handle read ahead */
     if (Operation == CcOperationRead && Length == 0 && Wait)
     {
-        /* If file isn't random access and next read may get us cross VACB boundary,
-         * schedule next read
+        /* If file isn't random access, let read ahead look at the access
+         * pattern, it will only bring views when the window needs them
          */
-        if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS) &&
-            (CurrentOffset - 1) / VACB_MAPPING_GRANULARITY != (CurrentOffset + BytesCopied - 1) / VACB_MAPPING_GRANULARITY)
+        if (!BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS))
         {
             CcScheduleReadAhead(FileObject, (PLARGE_INTEGER)&FileOffset, BytesCopied);
         }
@@ -497,6 +496,7 @@ CcPerformReadAhead(
     ULONG Length;
     PPRIVATE_CACHE_MAP PrivateCacheMap;
     BOOLEAN Locked;
+    BOOLEAN MoreWork;
 
     SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
 
@@ -537,6 +537,7 @@ CcPerformReadAhead(
     /* Remember it's locked */
     Locked = TRUE;
 
+NextRange:
     /* Don't read past the end of the file */
     if (CurrentOffset >= SharedCacheMap->FileSize.QuadPart)
     {
@@ -576,6 +577,9 @@ CcPerformReadAhead(
                 DPRINT1("Failed to read data: %lx!\n", Status);
                 goto Clear;
             }
+
+            InterlockedIncrement((PLONG)&CcReadAheadIos);
+            InterlockedExchangeAdd((PLONG)&CcReadAheadPages, VACB_MAPPING_GRANULARITY / PAGE_SIZE);
         }
 
         CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
@@ -608,6 +612,9 @@ CcPerformReadAhead(
                 DPRINT1("Failed to read data: %lx!\n", Status);
                 goto Clear;
             }
+
+            InterlockedIncrement((PLONG)&CcReadAheadIos);
+            InterlockedExchangeAdd((PLONG)&CcReadAheadPages, VACB_MAPPING_GRANULARITY / PAGE_SIZE);
         }
 
         CcRosReleaseVacb(SharedCacheMap, Vacb, TRUE, FALSE, FALSE);
@@ -618,17 +625,36 @@ CcPerformReadAhead(
 
 Clear:
     /* See previous comment about private cache map */
+    MoreWork = FALSE;
     OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
     PrivateCacheMap = FileObject->PrivateCacheMap;
     if (PrivateCacheMap != NULL)
     {
-        /* Mark read ahead as unactive */
         KeAcquireSpinLockAtDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
-        InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
+        /* If the reader went on while we were busy, and scheduled a new range
+         * keep read ahead active and handle it right away
+         */
+        if (Locked && Length == 0 &&
+            PrivateCacheMap->ReadAheadOffset[1].QuadPart + PrivateCacheMap->ReadAheadLength[1] > CurrentOffset)
+        {
+            CurrentOffset = max(CurrentOffset, PrivateCacheMap->ReadAheadOffset[1].QuadPart);
+            Length = (ULONG)(PrivateCacheMap->ReadAheadOffset[1].QuadPart + PrivateCacheMap->ReadAheadLength[1] - CurrentOffset);
+            MoreWork = TRUE;
+        }
+        else
+        {
+            /* Mark read ahead as unactive */
+            InterlockedAnd((volatile long *)&PrivateCacheMap->UlongFlags, ~PRIVATE_CACHE_MAP_READ_AHEAD_ACTIVE);
+        }
         KeReleaseSpinLockFromDpcLevel(&PrivateCacheMap->ReadAheadSpinLock);
     }
     KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 
+    if (MoreWork)
+    {
+        goto NextRange;
+    }
+
     /* If file was locked, release it */
     if (Locked)
     {
@@ -786,6 +812,22 @@ CcCanIWrite (
                                     &CcDeferredWriteSpinLock);
     }
 
+    /* Account the throttled write to the file */
+    if (TryContext != RetryMasterLocked)
+    {
+        OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+    }
+    if (FileObject->SectionObjectPointer != NULL &&
+        FileObject->SectionObjectPointer->SharedCacheMap != NULL)
+    {
+        SharedCacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+        ++SharedCacheMap->DeferredWrites;
+    }
+    if (TryContext != RetryMasterLocked)
+    {
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+    }
+
     DPRINT1("Actively deferring write for: %p\n", FileObject);
     /* Now, we'll loop until our event is set. When it is set, it means that caller
      * can immediately write, and has to
@@ -921,6 +963,11 @@ CcDeferWrite (
 
     /* Schedule a lazy writer run to handle deferred writes */
     OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+    if (FileObject->SectionObjectPointer != NULL &&
+        FileObject->SectionObjectPointer->SharedCacheMap != NULL)
+    {
+        ++((PROS_SHARED_CACHE_MAP)FileObject->SectionObjectPointer->SharedCacheMap)->DeferredWrites;
+    }
     if (!LazyWriter.ScanActive)
     {
         CcScheduleLazyWriteScan(FALSE);
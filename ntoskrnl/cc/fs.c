@@ -211,7 +211,9 @@ CcPurgeCacheSection (
         Vacb = CONTAINING_RECORD(ListEntry, ROS_VACB, CacheMapVacbListEntry);
         ListEntry = ListEntry->Flink;
 
-        /* Skip VACBs outside the range, or only partially in range */
+        /* Skip VACBs outside the range, or only partially in range.
+         * The list isn't sorted by offset, so check all of them.
+         */
         if (Vacb->FileOffset.QuadPart < StartOffset)
         {
             continue;
@@ -220,7 +222,7 @@ CcPurgeCacheSection (
                       SharedCacheMap->SectionSize.QuadPart);
         if (ViewEnd >= EndOffset)
         {
-            break;
+            continue;
         }
 
         /* Still in use, it cannot be purged, fail
@@ -242,6 +244,7 @@ CcPurgeCacheSection (
         {
             CcRosUnmarkDirtyVacb(Vacb, FALSE);
         }
+        CcRosVacbIndexRemove(SharedCacheMap, Vacb);
         RemoveEntryList(&Vacb->CacheMapVacbListEntry);
         InsertHeadList(&FreeList, &Vacb->CacheMapVacbListEntry);
     }
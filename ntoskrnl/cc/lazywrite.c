@@ -113,12 +113,38 @@ CcScanDpc(
     CcPostWorkQueue(WorkItem, &CcRegularWorkQueue);
 }
 
+static
+ULONG
+CcComputeLazyWriteTarget(VOID)
+{
+    ULONG DirtyPages, Threshold;
+    ULONGLONG Target;
+
+    DirtyPages = CcTotalDirtyPages;
+    Threshold = max(CcDirtyPageThreshold, 1);
+
+    /* Flush in proportion of how much of the dirty page budget is used:
+     * one eighth of the dirty pages when we're far from the threshold,
+     * up to all of them when we reach it
+     */
+    Target = (ULONGLONG)DirtyPages * DirtyPages / Threshold;
+    Target = max(Target, DirtyPages / 8);
+
+    /* If writers are waiting, bring us back to half the budget for them */
+    if (!IsListEmpty(&CcDeferredWrites) && DirtyPages > Threshold / 2)
+    {
+        Target = max(Target, DirtyPages - Threshold / 2);
+    }
+
+    return (ULONG)min(Target, DirtyPages);
+}
+
 VOID
 CcWriteBehind(VOID)
 {
     ULONG Target, Count;
 
-    Target = CcTotalDirtyPages / 8;
+    Target = CcComputeLazyWriteTarget();
     if (Target != 0)
     {
         /* Flush! */
@@ -156,8 +182,8 @@ CcLazyWriteScan(VOID)
     }
     KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
 
-    /* Our target is one-eighth of the dirty pages */
-    Target = CcTotalDirtyPages / 8;
+    /* Our target depends on how much of the dirty page budget is used */
+    Target = CcComputeLazyWriteTarget();
     if (Target != 0)
     {
         /* There is stuff to flush, schedule a write-behind operation */
@@ -188,6 +214,15 @@ CcLazyWriteScan(VOID)
          */
         CcScheduleLazyWriteScan(FALSE);
     }
+    /* If more than half the budget is still dirty, keep scanning
+     * every second, rather than waiting for writers to hit the threshold
+     */
+    else if (CcTotalDirtyPages > CcDirtyPageThreshold / 2)
+    {
+        OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+        CcScheduleLazyWriteScan(FALSE);
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+    }
     else
     {
         /* We're no longer active */
@@ -113,6 +113,138 @@ ULONG CcRosVacbGetRefCount_(PROS_VACB vacb, PCSTR file, INT line)
 
 /* FUNCTIONS *****************************************************************/
 
+/* Must be called with the shared cache map lock held */
+PROS_VACB
+CcRosVacbIndexLookup (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    LONGLONG FileOffset)
+{
+    ULONGLONG Slot;
+    ULONGLONG Level;
+
+    ASSERT(FileOffset >= 0);
+
+    Slot = (ULONGLONG)FileOffset / VACB_MAPPING_GRANULARITY;
+    Level = Slot / VACB_INDEX_LEVEL_SIZE;
+    if (Level >= SharedCacheMap->VacbIndexSize ||
+        SharedCacheMap->VacbIndex[Level] == NULL)
+    {
+        return NULL;
+    }
+
+    return SharedCacheMap->VacbIndex[Level][Slot % VACB_INDEX_LEVEL_SIZE];
+}
+
+/* Must be called with the shared cache map lock held */
+static
+NTSTATUS
+CcRosVacbIndexInsert (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    PROS_VACB Vacb)
+{
+    ULONGLONG Slot;
+    ULONGLONG Level;
+    ULONGLONG NewSize;
+    PROS_VACB **NewIndex;
+
+    Slot = (ULONGLONG)Vacb->FileOffset.QuadPart / VACB_MAPPING_GRANULARITY;
+    Level = Slot / VACB_INDEX_LEVEL_SIZE;
+
+    /* Grow the directory so that it covers the new view */
+    if (Level >= SharedCacheMap->VacbIndexSize)
+    {
+        NewSize = max(Level + 1, 2ULL * SharedCacheMap->VacbIndexSize);
+        if (NewSize > MAXULONG / sizeof(PROS_VACB *))
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        NewIndex = ExAllocatePoolWithTag(NonPagedPool,
+                                         (SIZE_T)NewSize * sizeof(PROS_VACB *),
+                                         TAG_VACB_INDEX);
+        if (NewIndex == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(NewIndex, (SIZE_T)NewSize * sizeof(PROS_VACB *));
+        if (SharedCacheMap->VacbIndex != NULL)
+        {
+            RtlCopyMemory(NewIndex,
+                          SharedCacheMap->VacbIndex,
+                          SharedCacheMap->VacbIndexSize * sizeof(PROS_VACB *));
+            ExFreePoolWithTag(SharedCacheMap->VacbIndex, TAG_VACB_INDEX);
+        }
+
+        SharedCacheMap->VacbIndex = NewIndex;
+        SharedCacheMap->VacbIndexSize = (ULONG)NewSize;
+    }
+
+    /* Level blocks are only allocated for the parts of the file that get mapped */
+    if (SharedCacheMap->VacbIndex[Level] == NULL)
+    {
+        SharedCacheMap->VacbIndex[Level] = ExAllocatePoolWithTag(NonPagedPool,
+                                                                 VACB_INDEX_LEVEL_SIZE * sizeof(PROS_VACB),
+                                                                 TAG_VACB_INDEX);
+        if (SharedCacheMap->VacbIndex[Level] == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(SharedCacheMap->VacbIndex[Level],
+                      VACB_INDEX_LEVEL_SIZE * sizeof(PROS_VACB));
+    }
+
+    ASSERT(SharedCacheMap->VacbIndex[Level][Slot % VACB_INDEX_LEVEL_SIZE] == NULL);
+    SharedCacheMap->VacbIndex[Level][Slot % VACB_INDEX_LEVEL_SIZE] = Vacb;
+
+    return STATUS_SUCCESS;
+}
+
+/* Must be called with the shared cache map lock held */
+VOID
+CcRosVacbIndexRemove (
+    PROS_SHARED_CACHE_MAP SharedCacheMap,
+    PROS_VACB Vacb)
+{
+    ULONGLONG Slot;
+    ULONGLONG Level;
+
+    Slot = (ULONGLONG)Vacb->FileOffset.QuadPart / VACB_MAPPING_GRANULARITY;
+    Level = Slot / VACB_INDEX_LEVEL_SIZE;
+
+    ASSERT(Level < SharedCacheMap->VacbIndexSize);
+    ASSERT(SharedCacheMap->VacbIndex[Level] != NULL);
+    ASSERT(SharedCacheMap->VacbIndex[Level][Slot % VACB_INDEX_LEVEL_SIZE] == Vacb);
+
+    SharedCacheMap->VacbIndex[Level][Slot % VACB_INDEX_LEVEL_SIZE] = NULL;
+}
+
+static
+VOID
+CcRosVacbIndexFree (
+    PROS_SHARED_CACHE_MAP SharedCacheMap)
+{
+    ULONG i;
+
+    if (SharedCacheMap->VacbIndex == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < SharedCacheMap->VacbIndexSize; i++)
+    {
+        if (SharedCacheMap->VacbIndex[i] != NULL)
+        {
+            ExFreePoolWithTag(SharedCacheMap->VacbIndex[i], TAG_VACB_INDEX);
+        }
+    }
+
+    ExFreePoolWithTag(SharedCacheMap->VacbIndex, TAG_VACB_INDEX);
+    SharedCacheMap->VacbIndex = NULL;
+    SharedCacheMap->VacbIndexSize = 0;
+}
+
 VOID
 NTAPI
 CcRosTraceCacheMap (
@@ -249,7 +381,6 @@ CcRosFlushDirtyPages (
             current->SharedCacheMap->LazyWriteContext);
 
         OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-        CcRosVacbDecRefCount(current);
 
         if (!NT_SUCCESS(Status) && (Status != STATUS_END_OF_FILE) &&
             (Status != STATUS_MEDIA_WRITE_PROTECTED))
@@ -264,6 +395,13 @@ CcRosFlushDirtyPages (
             PagesFreed = VACB_MAPPING_GRANULARITY / PAGE_SIZE;
             (*Count) += PagesFreed;
 
+            /* Account it to the file, if that's write behind */
+            if (CalledFromLazy)
+            {
+                current->SharedCacheMap->LazyWritePages += PagesFreed;
+                ++current->SharedCacheMap->LazyWriteIos;
+            }
+
             /* Make sure we don't overflow target! */
             if (Target < PagesFreed)
             {
@@ -276,6 +414,7 @@ CcRosFlushDirtyPages (
             }
         }
 
+        CcRosVacbDecRefCount(current);
         current_entry = DirtyVacbListHead.Flink;
     }
 
@@ -363,6 +502,7 @@ retry:
             ASSERT(!current->MappedCount);
             ASSERT(Refs == 1);
 
+            CcRosVacbIndexRemove(current->SharedCacheMap, current);
             RemoveEntryList(&current->CacheMapVacbListEntry);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
@@ -452,14 +592,13 @@ CcRosReleaseVacb (
     return STATUS_SUCCESS;
 }
 
-/* Returns with VACB Lock Held! */
+/* Returns a referenced VACB */
 PROS_VACB
 NTAPI
 CcRosLookupVacb (
     PROS_SHARED_CACHE_MAP SharedCacheMap,
     LONGLONG FileOffset)
 {
-    PLIST_ENTRY current_entry;
     PROS_VACB current;
     KIRQL oldIrql;
 
@@ -468,33 +607,24 @@ CcRosLookupVacb (
     DPRINT("CcRosLookupVacb(SharedCacheMap 0x%p, FileOffset %I64u)\n",
            SharedCacheMap, FileOffset);
 
-    oldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-    KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
+    /* The index is only ever modified with the shared cache map lock held
+     * and VACBs are only removed from it when nobody references them, so
+     * referencing under that lock is enough, no need for the master lock
+     */
+    KeAcquireSpinLock(&SharedCacheMap->CacheMapLock, &oldIrql);
 
-    current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+    current = CcRosVacbIndexLookup(SharedCacheMap, FileOffset);
+    if (current != NULL)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
-        {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
-            KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
-            return current;
-        }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
-        current_entry = current_entry->Flink;
+        ASSERT(IsPointInRange(current->FileOffset.QuadPart,
+                              VACB_MAPPING_GRANULARITY,
+                              FileOffset));
+        CcRosVacbIncRefCount(current);
     }
 
-    KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
-    KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
+    KeReleaseSpinLock(&SharedCacheMap->CacheMapLock, oldIrql);
 
-    return NULL;
+    return current;
 }
 
 VOID
@@ -503,14 +633,18 @@ CcRosMarkDirtyVacb (
     PROS_VACB Vacb)
 {
     KIRQL oldIrql;
-    PROS_SHARED_CACHE_MAP SharedCacheMap;
-
-    SharedCacheMap = Vacb->SharedCacheMap;
 
+    /* Dirty state lives in the global dirty list, so the master lock
+     * protects it, the shared cache map lock isn't needed
+     */
     oldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-    KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
 
-    ASSERT(!Vacb->Dirty);
+    /* Caller checked without the lock, someone may have been faster */
+    if (Vacb->Dirty)
+    {
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
+        return;
+    }
 
     InsertTailList(&DirtyVacbListHead, &Vacb->DirtyVacbListEntry);
     CcTotalDirtyPages += VACB_MAPPING_GRANULARITY / PAGE_SIZE;
@@ -523,12 +657,15 @@ CcRosMarkDirtyVacb (
 
     Vacb->Dirty = TRUE;
 
-    KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
-
-    /* Schedule a lazy writer run to now that we have dirty VACB */
+    /* Schedule a lazy writer run to now that we have dirty VACB.
+     * If we're getting close to the dirty page budget, don't wait: start
+     * flushing before writers have to be throttled. A scan already in
+     * progress keeps rescheduling itself while above half the budget,
+     * so don't re-arm its timer on every dirtied view
+     */
     if (!LazyWriter.ScanActive)
     {
-        CcScheduleLazyWriteScan(FALSE);
+        CcScheduleLazyWriteScan(CcTotalDirtyPages >= CcDirtyPageThreshold / 4 * 3);
     }
     KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
 }
@@ -540,14 +677,10 @@ CcRosUnmarkDirtyVacb (
     BOOLEAN LockViews)
 {
     KIRQL oldIrql;
-    PROS_SHARED_CACHE_MAP SharedCacheMap;
-
-    SharedCacheMap = Vacb->SharedCacheMap;
 
     if (LockViews)
     {
         oldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-        KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
     }
 
     ASSERT(Vacb->Dirty);
@@ -562,7 +695,6 @@ CcRosUnmarkDirtyVacb (
 
     if (LockViews)
     {
-        KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
         KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
     }
 }
@@ -733,6 +865,7 @@ CcRosFreeUnusedVacb (
             ASSERT(Refs == 1);
 
             /* Reset and move to free list */
+            CcRosVacbIndexRemove(current->SharedCacheMap, current);
             RemoveEntryList(&current->CacheMapVacbListEntry);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
@@ -783,8 +916,6 @@ CcRosCreateVacb (
     PROS_VACB *Vacb)
 {
     PROS_VACB current;
-    PROS_VACB previous;
-    PLIST_ENTRY current_entry;
     NTSTATUS Status;
     KIRQL oldIrql;
     ULONG Refs;
@@ -853,56 +984,43 @@ Retry:
      * our newly created VACB and return the existing one.
      */
     KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
-    current_entry = SharedCacheMap->CacheMapVacbListHead.Flink;
-    previous = NULL;
-    while (current_entry != &SharedCacheMap->CacheMapVacbListHead)
+    current = CcRosVacbIndexLookup(SharedCacheMap, FileOffset);
+    if (current != NULL)
     {
-        current = CONTAINING_RECORD(current_entry,
-                                    ROS_VACB,
-                                    CacheMapVacbListEntry);
-        if (IsPointInRange(current->FileOffset.QuadPart,
-                           VACB_MAPPING_GRANULARITY,
-                           FileOffset))
-        {
-            CcRosVacbIncRefCount(current);
-            KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
+        CcRosVacbIncRefCount(current);
+        KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
 #if DBG
-            if (SharedCacheMap->Trace)
-            {
-                DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
-                        SharedCacheMap,
-                        (*Vacb),
-                        current);
-            }
+        if (SharedCacheMap->Trace)
+        {
+            DPRINT1("CacheMap 0x%p: deleting newly created VACB 0x%p ( found existing one 0x%p )\n",
+                    SharedCacheMap,
+                    (*Vacb),
+                    current);
+        }
 #endif
-            KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
 
-            Refs = CcRosVacbDecRefCount(*Vacb);
-            ASSERT(Refs == 0);
+        Refs = CcRosVacbDecRefCount(*Vacb);
+        ASSERT(Refs == 0);
 
-            *Vacb = current;
-            return STATUS_SUCCESS;
-        }
-        if (current->FileOffset.QuadPart < FileOffset)
-        {
-            ASSERT(previous == NULL ||
-                   previous->FileOffset.QuadPart < current->FileOffset.QuadPart);
-            previous = current;
-        }
-        if (current->FileOffset.QuadPart > FileOffset)
-            break;
-        current_entry = current_entry->Flink;
+        *Vacb = current;
+        return STATUS_SUCCESS;
     }
     /* There was no existing VACB. */
     current = *Vacb;
-    if (previous)
-    {
-        InsertHeadList(&previous->CacheMapVacbListEntry, &current->CacheMapVacbListEntry);
-    }
-    else
+    Status = CcRosVacbIndexInsert(SharedCacheMap, current);
+    if (!NT_SUCCESS(Status))
     {
-        InsertHeadList(&SharedCacheMap->CacheMapVacbListHead, &current->CacheMapVacbListEntry);
+        KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
+
+        Refs = CcRosVacbDecRefCount(current);
+        ASSERT(Refs == 0);
+
+        *Vacb = NULL;
+        return Status;
     }
+    InsertTailList(&SharedCacheMap->CacheMapVacbListHead, &current->CacheMapVacbListEntry);
     KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
     InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
     KeReleaseQueuedSpinLock(LockQueueMasterLock, oldIrql);
@@ -969,13 +1087,16 @@ CcRosGetVacb (
 
     Refs = CcRosVacbGetRefCount(current);
 
-    OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
-
-    /* Move to the tail of the LRU list */
-    RemoveEntryList(&current->VacbLruListEntry);
-    InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
-
-    KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+    /* Move to the tail of the LRU list, unless it's already there:
+     * that spares the master lock to sequential accesses to a view
+     */
+    if (VacbLruListHead.Blink != &current->VacbLruListEntry)
+    {
+        OldIrql = KeAcquireQueuedSpinLock(LockQueueMasterLock);
+        RemoveEntryList(&current->VacbLruListEntry);
+        InsertTailList(&VacbLruListHead, &current->VacbLruListEntry);
+        KeReleaseQueuedSpinLock(LockQueueMasterLock, OldIrql);
+    }
 
     /*
      * Return information about the VACB to the caller.
@@ -1189,16 +1310,17 @@ CcRosDeleteFileCache (
         while (!IsListEmpty(&SharedCacheMap->CacheMapVacbListHead))
         {
             current_entry = RemoveTailList(&SharedCacheMap->CacheMapVacbListHead);
+            current = CONTAINING_RECORD(current_entry, ROS_VACB, CacheMapVacbListEntry);
+
+            /* Lookups don't take the master lock, so hide it from them first */
+            CcRosVacbIndexRemove(SharedCacheMap, current);
             KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
 
-            current = CONTAINING_RECORD(current_entry, ROS_VACB, CacheMapVacbListEntry);
             RemoveEntryList(&current->VacbLruListEntry);
             InitializeListHead(&current->VacbLruListEntry);
             if (current->Dirty)
             {
-                KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
                 CcRosUnmarkDirtyVacb(current, FALSE);
-                KeReleaseSpinLockFromDpcLevel(&SharedCacheMap->CacheMapLock);
                 DPRINT1("Freeing dirty VACB\n");
             }
             if (current->MappedCount != 0)
@@ -1211,6 +1333,7 @@ CcRosDeleteFileCache (
 
             KeAcquireSpinLockAtDpcLevel(&SharedCacheMap->CacheMapLock);
         }
+        CcRosVacbIndexFree(SharedCacheMap);
 #if DBG
         SharedCacheMap->Trace = FALSE;
 #endif
@@ -1577,7 +1700,7 @@ ExpKdbgExtFileCache(ULONG Argc, PCHAR Argv[])
     UNICODE_STRING NoName = RTL_CONSTANT_STRING(L"No name for File");
 
     KdbpPrint("  Usage Summary (in kb)\n");
-    KdbpPrint("Shared\t\tValid\tDirty\tName\n");
+    KdbpPrint("Shared\t\tValid\tDirty\tLazyW\tLwIos\tDefer\tName\n");
     /* No need to lock the spin lock here, we're in DBG */
     for (ListEntry = CcCleanSharedCacheMapList.Flink;
          ListEntry != &CcCleanSharedCacheMapList;
@@ -1629,9 +1752,15 @@ ExpKdbgExtFileCache(ULONG Argc, PCHAR Argv[])
         }
 
         /* And print */
-        KdbpPrint("%p\t%d\t%d\t%wZ%S\n", SharedCacheMap, Valid, Dirty, FileName, Extra);
+        KdbpPrint("%p\t%d\t%d\t%lu\t%lu\t%lu\t%wZ%S\n", SharedCacheMap, Valid, Dirty,
+                  (SharedCacheMap->LazyWritePages * PAGE_SIZE) / 1024,
+                  SharedCacheMap->LazyWriteIos, SharedCacheMap->DeferredWrites,
+                  FileName, Extra);
     }
 
+    KdbpPrint("Read ahead:\t%lu views, %lu pages (%lu Kb)\n", CcReadAheadIos,
+              CcReadAheadPages, (CcReadAheadPages * PAGE_SIZE) / 1024);
+
     return TRUE;
 }
 
@@ -453,6 +453,13 @@ INIT_SECTION CM_SYSTEM_CONTROL_VECTOR CmControlVector[] =
         NULL,
         NULL
     },
+    {
+        L"Session Manager\\Memory Management",
+        L"LargePageDrivers",
+        MmLargePageDriverBuffer,
+        &MmLargePageDriverBufferLength,
+        NULL
+    },
     {
         L"Session Manager\\Memory Management",
         L"EnforceWriteProtection",
@@ -14,6 +14,7 @@
 
 #if defined (ALLOC_PRAGMA)
 #pragma alloc_text(INIT, ExpInitLookasideLists)
+#pragma alloc_text(INIT, ExInitPerProcessorPoolLookasideLists)
 #endif
 
 /* GLOBALS *******************************************************************/
@@ -24,8 +25,12 @@ LIST_ENTRY ExpPagedLookasideListHead;
 KSPIN_LOCK ExpPagedLookasideListLock;
 LIST_ENTRY ExSystemLookasideListHead;
 LIST_ENTRY ExPoolLookasideListHead;
-GENERAL_LOOKASIDE ExpSmallNPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
-GENERAL_LOOKASIDE ExpSmallPagedPoolLookasideLists[MAXIMUM_PROCESSORS];
+GENERAL_LOOKASIDE ExpSmallNPagedPoolLookasideLists[NUMBER_POOL_LOOKASIDE_LISTS];
+GENERAL_LOOKASIDE ExpSmallPagedPoolLookasideLists[NUMBER_POOL_LOOKASIDE_LISTS];
+
+/* Depth tuning: below this many allocations per scan, a list is idle */
+#define LOOKASIDE_MINIMUM_ALLOCATIONS 25
+USHORT ExMinimumLookasideDepth = 4;
 
 /* PRIVATE FUNCTIONS *********************************************************/
 
@@ -66,8 +71,9 @@ ExInitPoolLookasidePointers(VOID)
     PKPRCB Prcb = KeGetCurrentPrcb();
     PGENERAL_LOOKASIDE Entry;
 
-    /* Loop for all pool lists */
-    for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+    /* Loop for all pool lists. Until the pool is up, every CPU uses the
+       system lists, they get their own in ExInitPerProcessorPoolLookasideLists */
+    for (i = 0; i < NUMBER_POOL_LOOKASIDE_LISTS; i++)
     {
         /* Initialize the non-paged list */
         Entry = &ExpSmallNPagedPoolLookasideLists[i];
@@ -103,7 +109,7 @@ ExpInitLookasideLists(VOID)
     KeInitializeSpinLock(&ExpPagedLookasideListLock);
 
     /* Initialize the system lookaside lists */
-    for (i = 0; i < MAXIMUM_PROCESSORS; i++)
+    for (i = 0; i < NUMBER_POOL_LOOKASIDE_LISTS; i++)
     {
         /* Initialize the non-paged list */
         ExInitializeSystemLookasideList(&ExpSmallNPagedPoolLookasideLists[i],
@@ -123,6 +129,152 @@ ExpInitLookasideLists(VOID)
     }
 }
 
+INIT_FUNCTION
+VOID
+NTAPI
+ExInitPerProcessorPoolLookasideLists(VOID)
+{
+    ULONG i, j;
+    PKPRCB Prcb;
+    PGENERAL_LOOKASIDE CurrentList;
+
+    /* Loop all processors */
+    for (i = 0; i < (ULONG)KeNumberProcessors; i++)
+    {
+        /* Get the PRCB for this CPU */
+        Prcb = KiProcessorBlock[i];
+
+        /* Allocate its paged and non-paged lists at once */
+        CurrentList = ExAllocatePoolWithTag(NonPagedPool,
+                                            2 * NUMBER_POOL_LOOKASIDE_LISTS *
+                                            sizeof(GENERAL_LOOKASIDE),
+                                            'looP');
+        if (!CurrentList)
+        {
+            /* Keep using the system lists */
+            continue;
+        }
+
+        for (j = 0; j < NUMBER_POOL_LOOKASIDE_LISTS; j++)
+        {
+            /* Initialize the non-paged list */
+            ExInitializeSystemLookasideList(CurrentList,
+                                            NonPagedPool,
+                                            (j + 1) * 8,
+                                            'looP',
+                                            256,
+                                            &ExPoolLookasideListHead);
+            Prcb->PPNPagedLookasideList[j].P = CurrentList;
+            CurrentList++;
+
+            /* Initialize the paged list */
+            ExInitializeSystemLookasideList(CurrentList,
+                                            PagedPool,
+                                            (j + 1) * 8,
+                                            'looP',
+                                            256,
+                                            &ExPoolLookasideListHead);
+            Prcb->PPPagedLookasideList[j].P = CurrentList;
+            CurrentList++;
+        }
+    }
+}
+
+static
+VOID
+ExpComputeLookasideDepth(IN PGENERAL_LOOKASIDE Lookaside,
+                         IN ULONG Misses)
+{
+    ULONG Allocates, MissRatio;
+    LONG Depth, MaximumDepth;
+
+    /* How much was this list used since the previous scan? */
+    Allocates = Lookaside->TotalAllocates - Lookaside->LastTotalAllocates;
+    Lookaside->LastTotalAllocates = Lookaside->TotalAllocates;
+
+    Depth = Lookaside->Depth;
+    MaximumDepth = Lookaside->MaximumDepth;
+
+    if (Allocates < LOOKASIDE_MINIMUM_ALLOCATIONS)
+    {
+        /* Barely used: shrink it, so that it doesn't keep memory for nothing */
+        Depth -= 10;
+    }
+    else
+    {
+        /* Miss ratio, in per mille */
+        MissRatio = (ULONG)(((ULONGLONG)min(Misses, Allocates) * 1000) / Allocates);
+        if (MissRatio < 5)
+        {
+            /* Deep enough, slowly give memory back */
+            Depth -= 1;
+        }
+        else
+        {
+            /* Grow it proportionally to the misses */
+            Depth += ((MaximumDepth - Depth) * (LONG)MissRatio) / 2000 + 5;
+        }
+    }
+
+    /* Stay within the bounds */
+    if (Depth > MaximumDepth) Depth = MaximumDepth;
+    if (Depth < ExMinimumLookasideDepth) Depth = ExMinimumLookasideDepth;
+    Lookaside->Depth = (USHORT)Depth;
+}
+
+static
+VOID
+ExpScanGeneralLookasideList(IN PLIST_ENTRY ListHead,
+                            IN PKSPIN_LOCK Lock OPTIONAL,
+                            IN BOOLEAN CountsHits)
+{
+    PLIST_ENTRY ListEntry;
+    PGENERAL_LOOKASIDE Lookaside;
+    ULONG Misses;
+    KIRQL OldIrql = PASSIVE_LEVEL;
+
+    if (Lock) KeAcquireSpinLock(Lock, &OldIrql);
+
+    for (ListEntry = ListHead->Flink;
+         ListEntry != ListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        Lookaside = CONTAINING_RECORD(ListEntry, GENERAL_LOOKASIDE, ListEntry);
+
+        /* The pool lists count their hits, all the others their misses */
+        if (CountsHits)
+        {
+            Misses = (Lookaside->TotalAllocates - Lookaside->LastTotalAllocates) -
+                     (Lookaside->AllocateHits - Lookaside->LastAllocateHits);
+            Lookaside->LastAllocateHits = Lookaside->AllocateHits;
+        }
+        else
+        {
+            Misses = Lookaside->AllocateMisses - Lookaside->LastAllocateMisses;
+            Lookaside->LastAllocateMisses = Lookaside->AllocateMisses;
+        }
+
+        ExpComputeLookasideDepth(Lookaside, Misses);
+    }
+
+    if (Lock) KeReleaseSpinLock(Lock, OldIrql);
+}
+
+VOID
+ExAdjustLookasideDepth(VOID)
+{
+    /* Called by the balance set manager every second, to size all the
+       lookaside lists after their recent miss ratio */
+    ExpScanGeneralLookasideList(&ExPoolLookasideListHead, NULL, TRUE);
+    ExpScanGeneralLookasideList(&ExSystemLookasideListHead, NULL, FALSE);
+    ExpScanGeneralLookasideList(&ExpNonPagedLookasideListHead,
+                                &ExpNonPagedLookasideListLock,
+                                FALSE);
+    ExpScanGeneralLookasideList(&ExpPagedLookasideListHead,
+                                &ExpPagedLookasideListLock,
+                                FALSE);
+}
+
 /* PUBLIC FUNCTIONS **********************************************************/
 
 /*
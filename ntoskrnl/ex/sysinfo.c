@@ -796,7 +796,7 @@ QSI_DEF(SystemPerformanceInformation)
     Spi->CcMdlReadWait = 0; /* FIXME */
     Spi->CcMdlReadNoWaitMiss = 0; /* FIXME */
     Spi->CcMdlReadWaitMiss = 0; /* FIXME */
-    Spi->CcReadAheadIos = 0; /* FIXME */
+    Spi->CcReadAheadIos = CcReadAheadIos;
     Spi->CcLazyWriteIos = CcLazyWriteIos;
     Spi->CcLazyWritePages = CcLazyWritePages;
     Spi->CcDataFlushes = CcDataFlushes;
@@ -2815,6 +2815,62 @@ QSI_DEF(SystemFirmwareTableInformation)
     return Status;
 }
 
+/* ReactOS extension - Live Pool Tag Profile */
+QSI_DEF(SystemPoolTagProfileInformation)
+{
+    return ExGetPoolTagProfileInfo(Buffer, Size, ReqSize);
+}
+
+SSI_DEF(SystemPoolTagProfileInformation)
+{
+    PSYSTEM_POOLTAG_PROFILE_CONTROL Control = (PSYSTEM_POOLTAG_PROFILE_CONTROL)Buffer;
+
+    if (Size != sizeof(SYSTEM_POOLTAG_PROFILE_CONTROL))
+    {
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    /* Profiling the whole system requires the profile privilege */
+    if (!SeSinglePrivilegeCheck(SeSystemProfilePrivilege, ExGetPreviousMode()))
+    {
+        DPRINT1("SystemPoolTagProfileInformation: Caller requires the SeSystemProfilePrivilege privilege!\n");
+        return STATUS_PRIVILEGE_NOT_HELD;
+    }
+
+    return ExSetPoolTagProfile(Control->Enable != 0, Control->SampleRate);
+}
+
+/* ReactOS extension - Scheduler statistics for all processors */
+QSI_DEF(SystemSchedulerInformation)
+{
+    PSYSTEM_SCHEDULER_INFORMATION ssi = (PSYSTEM_SCHEDULER_INFORMATION)Buffer;
+    ULONG ReadyThreads;
+    KIRQL OldIrql;
+    LONG i;
+
+    *ReqSize = KeNumberProcessors * sizeof(SYSTEM_SCHEDULER_INFORMATION);
+    if (Size < *ReqSize)
+    {
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    for (i = 0; i < KeNumberProcessors; i++)
+    {
+        /* Count the ready threads first, the caller's buffer may be paged */
+        OldIrql = KeRaiseIrqlToSynchLevel();
+        ReadyThreads = KiCountReadyThreads(KiProcessorBlock[i]);
+        KeLowerIrql(OldIrql);
+
+        ssi->ReadyThreads = ReadyThreads;
+        ssi->Migrations = KiSchedulerStatistics[i].Migrations;
+        ssi->Steals = KiSchedulerStatistics[i].Steals;
+        ssi->IdlePlacements = KiSchedulerStatistics[i].IdlePlacements;
+        ssi++;
+    }
+
+    return STATUS_SUCCESS;
+}
+
 /* Query/Set Calls Table */
 typedef
 struct _QSSI_CALLS
@@ -2920,6 +2976,37 @@ C_ASSERT(SystemBasicInformation == 0);
 #define MIN_SYSTEM_INFO_CLASS (SystemBasicInformation)
 #define MAX_SYSTEM_INFO_CLASS (sizeof(CallQS) / sizeof(CallQS[0]))
 
+/* ReactOS specific classes, starting at MinRosSystemInfoClass */
+static
+QSSI_CALLS
+CallRosQS [] =
+{
+    SI_QS(SystemPoolTagProfileInformation),
+    SI_QX(SystemSchedulerInformation),
+};
+
+C_ASSERT(RTL_NUMBER_OF(CallRosQS) == MaxRosSystemInfoClass - MinRosSystemInfoClass);
+
+static
+const QSSI_CALLS *
+ExpGetSystemInfoCalls(
+    _In_ SYSTEM_INFORMATION_CLASS SystemInformationClass)
+{
+    if (SystemInformationClass >= MIN_SYSTEM_INFO_CLASS &&
+        SystemInformationClass < MAX_SYSTEM_INFO_CLASS)
+    {
+        return &CallQS[SystemInformationClass];
+    }
+
+    if (SystemInformationClass >= MinRosSystemInfoClass &&
+        SystemInformationClass < MaxRosSystemInfoClass)
+    {
+        return &CallRosQS[SystemInformationClass - MinRosSystemInfoClass];
+    }
+
+    return NULL;
+}
+
 /*
  * @implemented
  */
@@ -2936,6 +3023,7 @@ NtQuerySystemInformation(
     ULONG ResultLength = 0;
     ULONG Alignment = TYPE_ALIGNMENT(ULONG);
     NTSTATUS FStatus = STATUS_NOT_IMPLEMENTED;
+    const QSSI_CALLS *Calls;
 
     PAGED_CODE();
 
@@ -2947,8 +3035,8 @@ NtQuerySystemInformation(
         /*
          * Check if the request is valid.
          */
-        if (SystemInformationClass < MIN_SYSTEM_INFO_CLASS ||
-            SystemInformationClass >= MAX_SYSTEM_INFO_CLASS)
+        Calls = ExpGetSystemInfoCalls(SystemInformationClass);
+        if (Calls == NULL)
         {
             _SEH2_YIELD(return STATUS_INVALID_INFO_CLASS);
         }
@@ -2972,21 +3060,21 @@ NtQuerySystemInformation(
         /*
          * Check if the request is valid.
          */
-        if (SystemInformationClass < MIN_SYSTEM_INFO_CLASS ||
-            SystemInformationClass >= MAX_SYSTEM_INFO_CLASS)
+        Calls = ExpGetSystemInfoCalls(SystemInformationClass);
+        if (Calls == NULL)
         {
             _SEH2_YIELD(return STATUS_INVALID_INFO_CLASS);
         }
 #endif
 
-        if (NULL != CallQS [SystemInformationClass].Query)
+        if (NULL != Calls->Query)
         {
             /*
              * Hand the request to a subhandler.
              */
-            FStatus = CallQS [SystemInformationClass].Query(SystemInformation,
-                                                            Length,
-                                                            &ResultLength);
+            FStatus = Calls->Query(SystemInformation,
+                                   Length,
+                                   &ResultLength);
 
             /* Save the result length to the caller */
             if (UnsafeResultLength)
@@ -3011,6 +3099,7 @@ NtSetSystemInformation (IN SYSTEM_INFORMATION_CLASS SystemInformationClass,
 {
     NTSTATUS Status = STATUS_INVALID_INFO_CLASS;
     KPROCESSOR_MODE PreviousMode;
+    const QSSI_CALLS *Calls;
 
     PAGED_CODE();
 
@@ -3030,16 +3119,16 @@ NtSetSystemInformation (IN SYSTEM_INFORMATION_CLASS SystemInformationClass,
         /*
          * Check the request is valid.
          */
-        if ((SystemInformationClass >= MIN_SYSTEM_INFO_CLASS) &&
-            (SystemInformationClass < MAX_SYSTEM_INFO_CLASS))
+        Calls = ExpGetSystemInfoCalls(SystemInformationClass);
+        if (Calls != NULL)
         {
-            if (NULL != CallQS [SystemInformationClass].Set)
+            if (NULL != Calls->Set)
             {
                 /*
                  * Hand the request to a subhandler.
                  */
-                Status = CallQS [SystemInformationClass].Set(SystemInformation,
-                                                             SystemInformationLength);
+                Status = Calls->Set(SystemInformation,
+                                    SystemInformationLength);
             }
         }
     }
@@ -65,6 +65,8 @@ extern ULONG CcPinReadNoWait;
 extern ULONG CcPinMappedDataCount;
 extern ULONG CcDataPages;
 extern ULONG CcDataFlushes;
+extern ULONG CcReadAheadIos;
+extern ULONG CcReadAheadPages;
 
 typedef struct _PF_SCENARIO_ID
 {
@@ -188,13 +190,27 @@ typedef struct _ROS_SHARED_CACHE_MAP
 
     /* ROS specific */
     LIST_ENTRY CacheMapVacbListHead;
+    /* Offset-indexed view of CacheMapVacbListHead: a directory of level
+     * blocks, each covering VACB_INDEX_LEVEL_SIZE consecutive VACBs */
+    struct _ROS_VACB ***VacbIndex;
+    ULONG VacbIndexSize;
     BOOLEAN PinAccess;
-    KSPIN_LOCK CacheMapLock;
+    KSPIN_LOCK CacheMapLock; /* Protects the VACB list and index */
+    /* Write behind statistics, protected by the master lock */
+    ULONG LazyWritePages;
+    ULONG LazyWriteIos;
+    ULONG DeferredWrites;
 #if DBG
     BOOLEAN Trace; /* enable extra trace output for this cache map and it's VACBs */
 #endif
 } ROS_SHARED_CACHE_MAP, *PROS_SHARED_CACHE_MAP;
 
+#define VACB_INDEX_LEVEL_SIZE (PAGE_SIZE / sizeof(PVOID))
+
+/* Bounds of the per-handle read ahead window */
+#define CC_MIN_READ_AHEAD VACB_MAPPING_GRANULARITY
+#define CC_MAX_READ_AHEAD (8 * VACB_MAPPING_GRANULARITY)
+
 #define READAHEAD_DISABLED 0x1
 #define WRITEBEHIND_DISABLED 0x2
 
@@ -474,6 +490,16 @@ NTSTATUS
 CcRosInternalFreeVacb(
     IN PROS_VACB Vacb);
 
+PROS_VACB
+CcRosVacbIndexLookup(
+    IN PROS_SHARED_CACHE_MAP SharedCacheMap,
+    IN LONGLONG FileOffset);
+
+VOID
+CcRosVacbIndexRemove(
+    IN PROS_SHARED_CACHE_MAP SharedCacheMap,
+    IN PROS_VACB Vacb);
+
 FORCEINLINE
 BOOLEAN
 DoRangesIntersect(
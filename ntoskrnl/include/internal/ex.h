@@ -167,6 +167,21 @@ ExGetPoolTagInfo(
     IN OUT PULONG ReturnLength OPTIONAL
 );
 
+NTSTATUS
+NTAPI
+ExGetPoolTagProfileInfo(
+    IN PSYSTEM_POOLTAG_PROFILE_INFORMATION SystemInformation,
+    IN ULONG SystemInformationLength,
+    IN OUT PULONG ReturnLength OPTIONAL
+);
+
+NTSTATUS
+NTAPI
+ExSetPoolTagProfile(
+    IN BOOLEAN Enable,
+    IN ULONG SampleRate
+);
+
 typedef struct _UUID_CACHED_VALUES_STRUCT
 {
     ULONGLONG Time;
@@ -302,6 +317,14 @@ VOID
 NTAPI
 ExInitPoolLookasidePointers(VOID);
 
+INIT_FUNCTION
+VOID
+NTAPI
+ExInitPerProcessorPoolLookasideLists(VOID);
+
+VOID
+ExAdjustLookasideDepth(VOID);
+
 /* Callback Functions ********************************************************/
 
 VOID
@@ -49,6 +49,13 @@ typedef struct _DEFERRED_REVERSE_BARRIER
     ULONG TotalProcessors;
 } DEFERRED_REVERSE_BARRIER, *PDEFERRED_REVERSE_BARRIER;
 
+typedef struct _KI_SCHEDULER_STATISTICS
+{
+    ULONG Migrations;
+    ULONG Steals;
+    ULONG IdlePlacements;
+} KI_SCHEDULER_STATISTICS, *PKI_SCHEDULER_STATISTICS;
+
 typedef struct _KI_SAMPLE_MAP
 {
     LARGE_INTEGER PerfStart;
@@ -134,6 +141,7 @@ extern KEVENT KiSwapEvent;
 extern PKPRCB KiProcessorBlock[];
 extern ULONG KiMask32Array[MAXIMUM_PRIORITY];
 extern ULONG_PTR KiIdleSummary;
+extern KI_SCHEDULER_STATISTICS KiSchedulerStatistics[MAXIMUM_PROCESSORS];
 extern PVOID KeUserApcDispatcher;
 extern PVOID KeUserCallbackDispatcher;
 extern PVOID KeUserExceptionDispatcher;
@@ -272,6 +280,12 @@ KiSelectNextThread(
     IN PKPRCB Prcb
 );
 
+ULONG
+FASTCALL
+KiCountReadyThreads(
+    IN PKPRCB Prcb
+);
+
 BOOLEAN
 FASTCALL
 KiInsertTimerTable(
@@ -815,6 +829,11 @@ FASTCALL
 KeZeroPages(IN PVOID Address,
             IN ULONG Size);
 
+VOID
+FASTCALL
+KeZeroPagesFromIdleThread(IN PVOID Address,
+                          IN ULONG Size);
+
 BOOLEAN
 FASTCALL
 KeInvalidAccessAllowed(IN PVOID TrapInformation OPTIONAL);
@@ -207,6 +207,16 @@ KiSetThreadSwapBusy(IN PKTHREAD Thread)
     UNREFERENCED_PARAMETER(Thread);
 }
 
+//
+// This routine waits for a thread's context to be saved, it's meaningless on UP.
+//
+FORCEINLINE
+VOID
+KiWaitForSwapBusy(IN PKTHREAD Thread)
+{
+    UNREFERENCED_PARAMETER(Thread);
+}
+
 //
 // This routine protects against multiple CPU acquires, it's meaningless on UP.
 //
@@ -423,6 +433,23 @@ KiSetThreadSwapBusy(IN PKTHREAD Thread)
     Thread->SwapBusy = TRUE;
 }
 
+//
+// This routine waits until a thread which is being switched out on another
+// CPU has its context fully saved, so that we can safely switch to it. The
+// swap busy state is cleared once the switch has left the thread's stack.
+//
+FORCEINLINE
+VOID
+KiWaitForSwapBusy(IN PKTHREAD Thread)
+{
+    /* Loop until the other CPU is done with it */
+    while (Thread->SwapBusy)
+    {
+        /* Let the CPU know that this is a loop */
+        YieldProcessor();
+    }
+}
+
 //
 // This routine acquires the PRCB lock so that only one caller can touch
 // volatile PRCB data.
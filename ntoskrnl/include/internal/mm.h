@@ -151,6 +151,11 @@ typedef ULONG_PTR SWAPENTRY;
 //
 #define MM_WAIT_ENTRY            0x7ffffc00
 
+//
+// Most pages brought in by a single page fault, 64KB
+//
+#define MM_PAGE_IN_CLUSTER_PAGES (0x10000 / PAGE_SIZE)
+
 #define InterlockedCompareExchangePte(PointerPte, Exchange, Comperand) \
     InterlockedCompareExchange((PLONG)(PointerPte), Exchange, Comperand)
 
@@ -643,6 +648,21 @@ MmReadFromSwapPage(
     PFN_NUMBER Page
 );
 
+NTSTATUS
+NTAPI
+MmReadFromSwapPages(
+    SWAPENTRY SwapEntry,
+    PPFN_NUMBER Pages,
+    ULONG PageCount
+);
+
+SWAPENTRY
+NTAPI
+MmGetAdjacentSwapEntry(
+    SWAPENTRY SwapEntry,
+    ULONG Distance
+);
+
 NTSTATUS
 NTAPI
 MmWriteToSwapPage(
@@ -661,6 +681,14 @@ MiReadPageFile(
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset);
 
+NTSTATUS
+NTAPI
+MiReadPageFileRun(
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ ULONG PageCount,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset);
+
 /* process.c ****************************************************************/
 
 NTSTATUS
@@ -1012,7 +1040,8 @@ MiUnmapPageInHyperSpace(IN PEPROCESS Process,
 
 PVOID
 NTAPI
-MiMapPagesInZeroSpace(IN PMMPFN Pfn1,
+MiMapPagesInZeroSpace(IN PMMPTE FirstZeroingPte,
+                      IN PMMPFN Pfn1,
                       IN PFN_NUMBER NumberOfPages);
 
 VOID
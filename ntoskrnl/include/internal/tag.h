@@ -6,6 +6,7 @@
 #define TAG_SHARED_CACHE_MAP    'cScC'
 #define TAG_PRIVATE_CACHE_MAP   'cPcC'
 #define TAG_BCB                 'cBcC'
+#define TAG_VACB_INDEX          'iVcC'
 
 /* Executive Callbacks */
 #define TAG_CALLBACK_ROUTINE_BLOCK 'brbC'
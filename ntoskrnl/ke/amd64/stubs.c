@@ -52,23 +52,39 @@ KiDpcInterruptHandler(VOID)
     }
     else if (Prcb->NextThread)
     {
-        /* Capture current thread data */
-        OldThread = Prcb->CurrentThread;
-        NewThread = Prcb->NextThread;
+        /* Lock the PRCB, other CPUs may still change the next thread */
+        KiAcquirePrcbLock(Prcb);
+        if (!Prcb->NextThread)
+        {
+            /* It was taken away from us in the meantime */
+            KiReleasePrcbLock(Prcb);
+        }
+        else
+        {
+            /* Capture current thread data */
+            OldThread = Prcb->CurrentThread;
+            NewThread = Prcb->NextThread;
+
+            /* Nobody can switch to the old thread until it's switched out */
+            KiSetThreadSwapBusy(OldThread);
 
-        /* Set new thread data */
-        Prcb->NextThread = NULL;
-        Prcb->CurrentThread = NewThread;
+            /* Set new thread data */
+            Prcb->NextThread = NULL;
+            Prcb->CurrentThread = NewThread;
+
+            /* The thread is now running */
+            NewThread->State = Running;
+            OldThread->WaitReason = WrDispatchInt;
 
-        /* The thread is now running */
-        NewThread->State = Running;
-        OldThread->WaitReason = WrDispatchInt;
+            /* Make the old thread ready, this releases the PRCB lock */
+            KxQueueReadyThread(OldThread, Prcb);
 
-        /* Make the old thread ready */
-        KxQueueReadyThread(OldThread, Prcb);
+            /* Make sure the new thread was completely switched out on its last CPU */
+            KiWaitForSwapBusy(NewThread);
 
-        /* Swap to the new thread */
-        KiSwapContext(APC_LEVEL, OldThread);
+            /* Swap to the new thread */
+            KiSwapContext(APC_LEVEL, OldThread);
+        }
     }
 
     /* Go back to old irql and disable interrupts */
@@ -86,6 +102,15 @@ KeZeroPages(IN PVOID Address,
     RtlZeroMemory(Address, Size);
 }
 
+VOID
+FASTCALL
+KeZeroPagesFromIdleThread(IN PVOID Address,
+                          IN ULONG Size)
+{
+    /* Not using XMMI in this routine */
+    RtlZeroMemory(Address, Size);
+}
+
 PVOID
 NTAPI
 KeSwitchKernelStack(PVOID StackBase, PVOID StackLimit)
@@ -136,12 +161,25 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+#ifdef CONFIG_SMP
+        /* If nothing was given to us, try to steal work from a busy CPU */
+        if (!Prcb->NextThread)
+        {
+            _enable();
+            KiIdleSchedule(Prcb);
+            _disable();
+        }
+#endif
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
             /* Enable interrupts */
             _enable();
 
+            /* Lock the PRCB, other CPUs may still change the next thread */
+            KiAcquirePrcbLock(Prcb);
+
             /* Capture current thread data */
             OldThread = Prcb->CurrentThread;
             NewThread = Prcb->NextThread;
@@ -152,6 +190,10 @@ KiIdleLoop(VOID)
 
             /* The thread is now running */
             NewThread->State = Running;
+            KiReleasePrcbLock(Prcb);
+
+            /* Make sure it was completely switched out on its last CPU */
+            KiWaitForSwapBusy(NewThread);
 
             /* Do the swap at SYNCH_LEVEL */
             KfRaiseIrql(SYNCH_LEVEL);
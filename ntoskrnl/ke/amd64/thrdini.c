@@ -183,6 +183,11 @@ KiSwapContextResume(
                      0);
     }
 
+#ifdef CONFIG_SMP
+    /* The old thread is completely switched out, other CPUs may now run it */
+    OldThread->SwapBusy = FALSE;
+#endif
+
     /* Kernel APCs may be pending */
     if (NewThread->ApcState.KernelApcPending)
     {
@@ -549,6 +549,9 @@ KiQuantumEnd(VOID)
     /* Set wait IRQL to APC_LEVEL */
     Thread->WaitIrql = APC_LEVEL;
 
+    /* Make sure the new thread was completely switched out on its last CPU */
+    KiWaitForSwapBusy(NextThread);
+
     /* Swap threads */
     KiSwapContext(APC_LEVEL, Thread);
 
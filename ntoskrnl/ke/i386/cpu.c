@@ -1134,10 +1134,62 @@ FASTCALL
 KeZeroPages(IN PVOID Address,
             IN ULONG Size)
 {
-    /* Not using XMMI in this routine */
+    /* Not using XMMI in this routine, the caller touches the page right away */
     RtlZeroMemory(Address, Size);
 }
 
+VOID
+FASTCALL
+KeZeroPagesFromIdleThread(IN PVOID Address,
+                          IN ULONG Size)
+{
+    /* Non-temporal stores need SSE2, fall back to regular stores without it */
+    if (!(KeFeatureBits & KF_XMMI64))
+    {
+        RtlZeroMemory(Address, Size);
+        return;
+    }
+
+    /* Pages zeroed ahead of time are not touched soon, so don't pull them into the cache */
+    ASSERT(((ULONG_PTR)Address & (PAGE_SIZE - 1)) == 0);
+    ASSERT((Size != 0) && ((Size & (PAGE_SIZE - 1)) == 0));
+#ifdef __GNUC__
+    __asm__ __volatile__
+    (
+        "1:\n\t"
+        "movnti %%eax, (%0)\n\t"
+        "movnti %%eax, 4(%0)\n\t"
+        "movnti %%eax, 8(%0)\n\t"
+        "movnti %%eax, 12(%0)\n\t"
+        "addl $16, %0\n\t"
+        "subl $16, %1\n\t"
+        "jnz 1b\n\t"
+        : "+r" (Address),
+          "+r" (Size)
+        : "a" (0)
+        : "memory"
+    );
+#else
+    __asm
+    {
+        mov edx, Address
+        mov ecx, Size
+        xor eax, eax
+    ZeroLoop:
+        movnti [edx], eax
+        movnti [edx + 4], eax
+        movnti [edx + 8], eax
+        movnti [edx + 12], eax
+        add edx, 16
+        sub ecx, 16
+        jnz ZeroLoop
+    };
+#endif
+
+    /* Make the stores visible before anyone can see the pages */
+    _mm_sfence();
+}
+
 VOID
 NTAPI
 KiSaveProcessorState(IN PKTRAP_FRAME TrapFrame,
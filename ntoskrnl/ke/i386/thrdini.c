@@ -294,12 +294,25 @@ KiIdleLoop(VOID)
             KiRetireDpcList(Prcb);
         }
 
+#ifdef CONFIG_SMP
+        /* If nothing was given to us, try to steal work from a busy CPU */
+        if (!Prcb->NextThread)
+        {
+            _enable();
+            KiIdleSchedule(Prcb);
+            _disable();
+        }
+#endif
+
         /* Check if a new thread is scheduled for execution */
         if (Prcb->NextThread)
         {
             /* Enable interrupts */
             _enable();
 
+            /* Lock the PRCB, other CPUs may still change the next thread */
+            KiAcquirePrcbLock(Prcb);
+
             /* Capture current thread data */
             OldThread = Prcb->CurrentThread;
             NewThread = Prcb->NextThread;
@@ -310,6 +323,10 @@ KiIdleLoop(VOID)
 
             /* The thread is now running */
             NewThread->State = Running;
+            KiReleasePrcbLock(Prcb);
+
+            /* Make sure it was completely switched out on its last CPU */
+            KiWaitForSwapBusy(NewThread);
 
             /* Switch away from the idle thread */
             KiSwapContext(APC_LEVEL, OldThread);
@@ -391,6 +408,11 @@ KiSwapContextExit(IN PKTHREAD OldThread,
                      0);
     }
 
+#ifdef CONFIG_SMP
+    /* The old thread is completely switched out, other CPUs may now run it */
+    OldThread->SwapBusy = FALSE;
+#endif
+
     /* Kernel APCs may be pending */
     if (NewThread->ApcState.KernelApcPending)
     {
@@ -493,23 +515,39 @@ KiDispatchInterrupt(VOID)
     }
     else if (Prcb->NextThread)
     {
-        /* Capture current thread data */
-        OldThread = Prcb->CurrentThread;
-        NewThread = Prcb->NextThread;
+        /* Lock the PRCB, other CPUs may still change the next thread */
+        KiAcquirePrcbLock(Prcb);
+        if (!Prcb->NextThread)
+        {
+            /* It was taken away from us in the meantime */
+            KiReleasePrcbLock(Prcb);
+        }
+        else
+        {
+            /* Capture current thread data */
+            OldThread = Prcb->CurrentThread;
+            NewThread = Prcb->NextThread;
 
-        /* Set new thread data */
-        Prcb->NextThread = NULL;
-        Prcb->CurrentThread = NewThread;
+            /* Nobody can switch to the old thread until it's switched out */
+            KiSetThreadSwapBusy(OldThread);
 
-        /* The thread is now running */
-        NewThread->State = Running;
-        OldThread->WaitReason = WrDispatchInt;
+            /* Set new thread data */
+            Prcb->NextThread = NULL;
+            Prcb->CurrentThread = NewThread;
 
-        /* Make the old thread ready */
-        KxQueueReadyThread(OldThread, Prcb);
+            /* The thread is now running */
+            NewThread->State = Running;
+            OldThread->WaitReason = WrDispatchInt;
+
+            /* Make the old thread ready, this releases the PRCB lock */
+            KxQueueReadyThread(OldThread, Prcb);
+
+            /* Make sure the new thread was completely switched out on its last CPU */
+            KiWaitForSwapBusy(NewThread);
 
-        /* Swap to the new thread */
-        KiSwapContext(APC_LEVEL, OldThread);
+            /* Swap to the new thread */
+            KiSwapContext(APC_LEVEL, OldThread);
+        }
     }
 }
 
@@ -15,25 +15,206 @@
 #ifdef _WIN64
 # define InterlockedOrSetMember(Destination, SetMember) \
     InterlockedOr64((PLONG64)Destination, SetMember);
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd64((PLONG64)Destination, ~(SetMember));
+# define BitScanForwardAffinity BitScanForward64
 #else
 # define InterlockedOrSetMember(Destination, SetMember) \
     InterlockedOr((PLONG)Destination, SetMember);
+# define InterlockedAndSetMember(Destination, SetMember) \
+    InterlockedAnd((PLONG)Destination, ~(SetMember));
+# define BitScanForwardAffinity BitScanForward
 #endif
 
 /* GLOBALS *******************************************************************/
 
 ULONG_PTR KiIdleSummary;
 ULONG_PTR KiIdleSMTSummary;
+KI_SCHEDULER_STATISTICS KiSchedulerStatistics[MAXIMUM_PROCESSORS];
 
 /* FUNCTIONS *****************************************************************/
 
+#ifdef CONFIG_SMP
+static
+ULONG
+KiSelectReadyProcessor(IN PKTHREAD Thread)
+{
+    KAFFINITY Affinity, IdleSet;
+    ULONG Processor;
+
+    /* Only consider the processors this thread is allowed to run on */
+    Affinity = Thread->Affinity & KeActiveProcessors;
+    ASSERT(Affinity != 0);
+
+    /* Check if any of them is idle */
+    IdleSet = KiIdleSummary & Affinity;
+    if (IdleSet)
+    {
+        /* Prefer the ideal processor, then the last one, whose cache is warm */
+        if (IdleSet & AFFINITY_MASK(Thread->IdealProcessor)) return Thread->IdealProcessor;
+        if (IdleSet & AFFINITY_MASK(Thread->NextProcessor)) return Thread->NextProcessor;
+        Affinity = IdleSet;
+    }
+    else
+    {
+        /*
+         * Nobody is idle, so stay on the last processor. Should it remain busy
+         * for too long, the next processor to go idle will steal the thread.
+         */
+        if (Affinity & AFFINITY_MASK(Thread->NextProcessor)) return Thread->NextProcessor;
+        if (Affinity & AFFINITY_MASK(Thread->IdealProcessor)) return Thread->IdealProcessor;
+    }
+
+    /* Otherwise, use the first processor of the set */
+    BitScanForwardAffinity(&Processor, Affinity);
+    return Processor;
+}
+
+static
+PKTHREAD
+KiFindStealableThread(IN PKPRCB VictimPrcb,
+                      IN PKPRCB Prcb)
+{
+    ULONG PrioritySet;
+    LONG Priority;
+    PLIST_ENTRY ListHead, ListEntry;
+    PKTHREAD Thread, Candidate;
+
+    /* Scan the ready lists from the highest priority down */
+    PrioritySet = VictimPrcb->ReadySummary;
+    while (PrioritySet)
+    {
+        BitScanReverse((PULONG)&Priority, PrioritySet);
+        PrioritySet ^= PRIORITY_MASK(Priority);
+
+        /* Look for a thread which can run here, ideally one which wants to */
+        Candidate = NULL;
+        ListHead = &VictimPrcb->DispatcherReadyListHead[Priority];
+        for (ListEntry = ListHead->Flink;
+             ListEntry != ListHead;
+             ListEntry = ListEntry->Flink)
+        {
+            Thread = CONTAINING_RECORD(ListEntry, KTHREAD, WaitListEntry);
+            if (!(Thread->Affinity & Prcb->SetMember)) continue;
+            if (Thread->IdealProcessor == Prcb->Number) return Thread;
+            if (!Candidate) Candidate = Thread;
+        }
+
+        /* Don't skip a priority level for the sake of the ideal processor */
+        if (Candidate) return Candidate;
+    }
+
+    /* Nothing can run on this processor */
+    return NULL;
+}
+
+static
+PKTHREAD
+KiStealReadyThread(IN PKPRCB Prcb)
+{
+    ULONG Index;
+    PKPRCB VictimPrcb;
+    PKTHREAD Thread;
+
+    /* Loop the other processors, starting with our neighbour */
+    for (Index = 1; Index < (ULONG)KeNumberProcessors; Index++)
+    {
+        /* Don't bother locking processors which have nothing ready */
+        VictimPrcb = KiProcessorBlock[(Prcb->Number + Index) % KeNumberProcessors];
+        if (!VictimPrcb->ReadySummary) continue;
+
+        /* Always acquire the PRCB lock of the lowest processor first */
+        if (VictimPrcb->Number < Prcb->Number)
+        {
+            KiAcquirePrcbLock(VictimPrcb);
+            KiAcquirePrcbLock(Prcb);
+        }
+        else
+        {
+            KiAcquirePrcbLock(Prcb);
+            KiAcquirePrcbLock(VictimPrcb);
+        }
+
+        /* Somebody may have given us work in the meantime */
+        Thread = Prcb->NextThread;
+        if (!Thread)
+        {
+            Thread = KiFindStealableThread(VictimPrcb, Prcb);
+            if (Thread)
+            {
+                /* Remove it from the victim's ready list */
+                if (RemoveEntryList(&Thread->WaitListEntry))
+                {
+                    /* The list is empty now, reset the ready summary */
+                    VictimPrcb->ReadySummary ^= PRIORITY_MASK(Thread->Priority);
+                }
+
+                /* And make it ours */
+                Thread->NextProcessor = Prcb->Number;
+                Thread->State = Standby;
+                Prcb->NextThread = Thread;
+                InterlockedAndSetMember(&KiIdleSummary, Prcb->SetMember);
+                KiSchedulerStatistics[Prcb->Number].Steals++;
+                KiSchedulerStatistics[Prcb->Number].Migrations++;
+            }
+        }
+
+        /* Release the locks and stop if we got a thread */
+        KiReleasePrcbLock(VictimPrcb);
+        KiReleasePrcbLock(Prcb);
+        if (Thread) return Thread;
+    }
+
+    /* Nothing to steal */
+    return NULL;
+}
+#endif
+
 PKTHREAD
 FASTCALL
 KiIdleSchedule(IN PKPRCB Prcb)
 {
-    /* FIXME: TODO */
-    ASSERTMSG("SMP: Not yet implemented\n", FALSE);
+#ifdef CONFIG_SMP
+    /* Nothing to do if a thread was already given to us */
+    if (Prcb->NextThread) return Prcb->NextThread;
+
+    /* Try to take work from a busy processor */
+    return KiStealReadyThread(Prcb);
+#else
+    /* There is nobody to steal from on UP */
+    UNREFERENCED_PARAMETER(Prcb);
     return NULL;
+#endif
+}
+
+ULONG
+FASTCALL
+KiCountReadyThreads(IN PKPRCB Prcb)
+{
+    ULONG PrioritySet, Count = 0;
+    LONG Priority;
+    PLIST_ENTRY ListHead, ListEntry;
+    ASSERT(KeGetCurrentIrql() >= DISPATCH_LEVEL);
+
+    /* Walk all the non-empty ready lists of this processor */
+    KiAcquirePrcbLock(Prcb);
+    PrioritySet = Prcb->ReadySummary;
+    while (PrioritySet)
+    {
+        BitScanReverse((PULONG)&Priority, PrioritySet);
+        PrioritySet ^= PRIORITY_MASK(Priority);
+
+        ListHead = &Prcb->DispatcherReadyListHead[Priority];
+        for (ListEntry = ListHead->Flink;
+             ListEntry != ListHead;
+             ListEntry = ListEntry->Flink)
+        {
+            Count++;
+        }
+    }
+    KiReleasePrcbLock(Prcb);
+
+    return Count;
 }
 
 VOID
@@ -228,27 +409,39 @@ KiDeferredReadyThread(IN PKTHREAD Thread)
     OldPriority = Thread->Priority;
     Thread->Preempted = FALSE;
 
-    /* Queue the thread on CPU 0 and get the PRCB and lock it */
-    Thread->NextProcessor = 0;
-    Prcb = KiProcessorBlock[0];
+#ifdef CONFIG_SMP
+    /* Pick the processor this thread should run on */
+    Processor = KiSelectReadyProcessor(Thread);
+#endif
+
+    /* Get the PRCB and lock it */
+    Prcb = KiProcessorBlock[Processor];
     KiAcquirePrcbLock(Prcb);
 
-    /* Check if we have an idle summary */
-    if (KiIdleSummary)
+    /* Account for the thread moving to another processor */
+    if (Thread->NextProcessor != Processor)
+    {
+        KiSchedulerStatistics[Processor].Migrations++;
+    }
+
+    /* Set the CPU number */
+    Thread->NextProcessor = (UCHAR)Processor;
+
+    /* Check if this processor is idle and nothing was given to it yet */
+    if ((KiIdleSummary & Prcb->SetMember) && !(Prcb->NextThread))
     {
         /* Clear it and set this thread as the next one */
-        KiIdleSummary = 0;
+        InterlockedAndSetMember(&KiIdleSummary, Prcb->SetMember);
         Thread->State = Standby;
         Prcb->NextThread = Thread;
+        KiSchedulerStatistics[Processor].IdlePlacements++;
 
-        /* Unlock the PRCB and return */
+        /* Unlock the PRCB and wake the processor up if it isn't us */
         KiReleasePrcbLock(Prcb);
+        KiRescheduleThread(TRUE, Processor);
         return;
     }
 
-    /* Set the CPU number */
-    Thread->NextProcessor = (UCHAR)Processor;
-
     /* Get the next scheduled thread */
     NextThread = Prcb->NextThread;
     if (NextThread)
@@ -336,12 +529,9 @@ KiSelectNextThread(IN PKPRCB Prcb)
         /* Didn't find any, get the current idle thread */
         Thread = Prcb->IdleThread;
 
-        /* Enable idle scheduling */
+        /* Enable idle scheduling, the idle loop will look for work to steal */
         InterlockedOrSetMember(&KiIdleSummary, Prcb->SetMember);
         Prcb->IdleSchedule = TRUE;
-
-        /* FIXME: SMT support */
-        ASSERTMSG("SMP: Not yet implemented\n", FALSE);
     }
 
     /* Sanity checks and return the thread */
@@ -377,6 +567,33 @@ KiSwapThread(IN PKTHREAD CurrentThread,
     {
         /* Try to find a ready thread */
         NextThread = KiSelectReadyThread(0, Prcb);
+#ifdef CONFIG_SMP
+        if (NextThread == CurrentThread)
+        {
+            /*
+             * We were readied by another CPU before we could switch away, so
+             * just keep running.
+             */
+            CurrentThread->State = Running;
+            CurrentThread->SwapBusy = FALSE;
+            KiReleasePrcbLock(Prcb);
+
+            /* Kernel APCs may have been queued while we were waiting */
+            WaitIrql = CurrentThread->WaitIrql;
+            if ((CurrentThread->ApcState.KernelApcPending) &&
+                !(CurrentThread->SpecialApcDisable) &&
+                (WaitIrql == PASSIVE_LEVEL))
+            {
+                /* Request APC delivery, it will happen when lowering IRQL */
+                HalRequestSoftwareInterrupt(APC_LEVEL);
+            }
+
+            /* Lower IRQL back to what it was and return the wait status */
+            WaitStatus = CurrentThread->WaitStatus;
+            KeLowerIrql(WaitIrql);
+            return WaitStatus;
+        }
+#endif
         if (NextThread)
         {
             /* Switch to it */
@@ -399,6 +616,9 @@ KiSwapThread(IN PKTHREAD CurrentThread,
     ASSERT(CurrentThread != Prcb->IdleThread);
     KiReleasePrcbLock(Prcb);
 
+    /* Make sure the new thread was completely switched out on its last CPU */
+    KiWaitForSwapBusy(NextThread);
+
     /* Save the wait IRQL */
     WaitIrql = CurrentThread->WaitIrql;
 
@@ -664,9 +884,8 @@ KiSetPriorityThread(IN PKTHREAD Thread,
             }
             else if (Thread->State == DeferredReady)
             {
-                /* FIXME: TODO */
-                DPRINT1("Deferred state not yet supported\n");
-                ASSERT(FALSE);
+                /* It will be queued at its new priority once it gets readied */
+                Thread->Priority = (SCHAR)Priority;
             }
             else
             {
@@ -686,6 +905,11 @@ KiSetAffinityThread(IN PKTHREAD Thread,
                     IN KAFFINITY Affinity)
 {
     KAFFINITY OldAffinity;
+#ifdef CONFIG_SMP
+    PKPRCB Prcb;
+    ULONG Processor;
+    PKTHREAD NewThread;
+#endif
 
     /* Get the current affinity */
     OldAffinity = Thread->UserAffinity;
@@ -704,9 +928,141 @@ KiSetAffinityThread(IN PKTHREAD Thread,
     /* Check if system affinity is disabled */
     if (!Thread->SystemAffinityActive)
     {
+        /* It is, so the new affinity takes effect right away */
+        Thread->Affinity = Affinity;
+
 #ifdef CONFIG_SMP
-        /* FIXME: TODO */
-        DPRINT1("Affinity support disabled!\n");
+        /* Check if the ideal processor is still part of the affinity */
+        if (!(Affinity & AFFINITY_MASK(Thread->UserIdealProcessor)))
+        {
+            /* It's not, use the first processor we may run on instead */
+            BitScanForwardAffinity(&Processor, Affinity & KeActiveProcessors);
+            Thread->UserIdealProcessor = (UCHAR)Processor;
+            Thread->IdealProcessor = (UCHAR)Processor;
+        }
+
+        /* Loop in case the thread changes state under us */
+        for (;;)
+        {
+            /* Choose action based on thread's state */
+            if (Thread->State == Ready)
+            {
+                /* Threads of a swapped out process are placed once readied */
+                if (!Thread->ProcessReadyQueue)
+                {
+                    /* Get the PRCB for the thread and lock it */
+                    Processor = Thread->NextProcessor;
+                    Prcb = KiProcessorBlock[Processor];
+                    KiAcquirePrcbLock(Prcb);
+
+                    /* Make sure the thread is still ready and on this CPU */
+                    if ((Thread->State == Ready) &&
+                        (Thread->NextProcessor == Prcb->Number))
+                    {
+                        /* Check if it may no longer run on this CPU */
+                        if (!(Prcb->SetMember & Affinity))
+                        {
+                            /* Remove it from the current queue */
+                            if (RemoveEntryList(&Thread->WaitListEntry))
+                            {
+                                /* Update the ready summary */
+                                Prcb->ReadySummary ^= PRIORITY_MASK(Thread->
+                                                                    Priority);
+                            }
+
+                            /* Ready it again, on a processor we may use */
+                            KiInsertDeferredReadyList(Thread);
+                        }
+
+                        /* Release the PRCB Lock */
+                        KiReleasePrcbLock(Prcb);
+                    }
+                    else
+                    {
+                        /* Release the lock and loop again */
+                        KiReleasePrcbLock(Prcb);
+                        continue;
+                    }
+                }
+            }
+            else if (Thread->State == Standby)
+            {
+                /* Get the PRCB for the thread and lock it */
+                Processor = Thread->NextProcessor;
+                Prcb = KiProcessorBlock[Processor];
+                KiAcquirePrcbLock(Prcb);
+
+                /* Check if we're still the next thread to run */
+                if (Thread == Prcb->NextThread)
+                {
+                    /* Check if it may no longer run on this CPU */
+                    if (!(Prcb->SetMember & Affinity))
+                    {
+                        /* Select a new thread and set it on standby */
+                        NewThread = KiSelectNextThread(Prcb);
+                        NewThread->State = Standby;
+                        Prcb->NextThread = NewThread;
+
+                        /* Dispatch our thread elsewhere */
+                        KiInsertDeferredReadyList(Thread);
+                    }
+
+                    /* Release the PRCB lock */
+                    KiReleasePrcbLock(Prcb);
+                }
+                else
+                {
+                    /* Release the lock and try again */
+                    KiReleasePrcbLock(Prcb);
+                    continue;
+                }
+            }
+            else if (Thread->State == Running)
+            {
+                /* Get the PRCB for the thread and lock it */
+                Processor = Thread->NextProcessor;
+                Prcb = KiProcessorBlock[Processor];
+                KiAcquirePrcbLock(Prcb);
+
+                /* Check if we're still the current thread running */
+                if (Thread == Prcb->CurrentThread)
+                {
+                    /* Check if it may no longer run here and nothing is pending */
+                    if (!(Prcb->SetMember & Affinity) && !(Prcb->NextThread))
+                    {
+                        /* Select a new thread and set it on standby */
+                        NewThread = KiSelectNextThread(Prcb);
+                        NewThread->State = Standby;
+                        Prcb->NextThread = NewThread;
+
+                        /* Release the lock and make that CPU switch */
+                        KiReleasePrcbLock(Prcb);
+                        if (KeGetCurrentProcessorNumber() != Processor)
+                        {
+                            /* It's another CPU, send an IPI */
+                            KiIpiSend(AFFINITY_MASK(Processor), IPI_DPC);
+                        }
+                    }
+                    else
+                    {
+                        /* Release the PRCB lock */
+                        KiReleasePrcbLock(Prcb);
+                    }
+                }
+                else
+                {
+                    /* Thread changed, release lock and restart */
+                    KiReleasePrcbLock(Prcb);
+                    continue;
+                }
+            }
+
+            /*
+             * Any other state: the thread will be placed according to its new
+             * affinity when it gets readied
+             */
+            break;
+        }
 #endif
     }
 
@@ -800,6 +1156,9 @@ NtYieldExecution(VOID)
             /* Sanity check */
             ASSERT(OldIrql <= DISPATCH_LEVEL);
 
+            /* Make sure the new thread was completely switched out on its last CPU */
+            KiWaitForSwapBusy(NextThread);
+
             /* Swap to new thread */
             KiSwapContext(APC_LEVEL, Thread);
             Status = STATUS_SUCCESS;
@@ -248,6 +248,9 @@ KiExitDispatcher(IN KIRQL OldIrql)
     /* Set wait IRQL */
     Thread->WaitIrql = OldIrql;
 
+    /* Make sure the new thread was completely switched out on its last CPU */
+    KiWaitForSwapBusy(NextThread);
+
     /* Swap threads and check if APCs were pending */
     PendingApc = KiSwapContext(OldIrql, Thread);
     if (PendingApc)
@@ -48,6 +48,9 @@ ULONG ExpPoolBigEntriesInUse;
 ULONG ExpPoolFlags;
 ULONG ExPoolFailures;
 ULONGLONG MiLastPoolDumpTime;
+PPOOL_PROFILE_ENTRY ExpPoolProfileTable;
+BOOLEAN ExpPoolProfilerEnabled;
+ULONG ExpPoolProfilerSampleRate = 16;
 
 /* Pool block/header/list access macros */
 #define POOL_ENTRY(x)       (PPOOL_HEADER)((ULONG_PTR)(x) - sizeof(POOL_HEADER))
@@ -743,6 +746,229 @@ ExpSeedHotTags(VOID)
     }
 }
 
+FORCEINLINE
+ULONG
+ExpPoolProfileCurrentSecond(VOID)
+{
+    //
+    // The interrupt time is cheap to read from any IRQL, and is in 100ns units
+    //
+    return (ULONG)(KeQueryInterruptTime() / (10 * 1000 * 1000));
+}
+
+static
+PPOOL_PROFILE_ENTRY
+ExpPoolProfileLookup(IN PPOOL_PROFILE_ENTRY Table,
+                     IN ULONG Key,
+                     IN BOOLEAN Create)
+{
+    ULONG Hash, Index;
+    PPOOL_PROFILE_ENTRY Entry;
+
+    //
+    // Same open addressing scheme as the tracker table, except that buckets
+    // are claimed with a compare-exchange instead of the tagged pool lock
+    //
+    Hash = ExpComputeHashForTag(Key, POOL_PROFILE_TABLE_SIZE - 1);
+    Index = Hash;
+    do
+    {
+        Entry = &Table[Hash];
+        if (Entry->Key == Key) return Entry;
+        if (!Entry->Key)
+        {
+            if (!Create) return NULL;
+            if (!InterlockedCompareExchange((PLONG)&Entry->Key, Key, 0)) return Entry;
+            if (Entry->Key == Key) return Entry;
+        }
+        Hash = (Hash + 1) & (POOL_PROFILE_TABLE_SIZE - 1);
+    } while (Hash != Index);
+
+    //
+    // The table is full, this tag will simply not be profiled
+    //
+    return NULL;
+}
+
+static
+PPOOL_PROFILE_SLOT
+ExpPoolProfileGetSlot(IN PPOOL_PROFILE_ENTRY Entry)
+{
+    ULONG Second;
+    PPOOL_PROFILE_SLOT Slot;
+
+    //
+    // The first event of a new second recycles the oldest slot of the window.
+    // This is racy against other processors updating the same slot, but we
+    // only ever lose a few counts at a second boundary, which is fine for a
+    // profiler.
+    //
+    Second = ExpPoolProfileCurrentSecond();
+    Slot = &Entry->Slots[Second % POOL_PROFILE_WINDOW];
+    if (Slot->Second != Second)
+    {
+        Slot->Allocs = 0;
+        Slot->Frees = 0;
+        Slot->AllocatedBytes = 0;
+        Slot->FreedBytes = 0;
+        Slot->Second = Second;
+    }
+    return Slot;
+}
+
+static
+VOID
+ExpPoolProfileRecordCaller(IN PPOOL_PROFILE_ENTRY Entry,
+                           IN PVOID CallerAddress)
+{
+    ULONG i, Victim = 0;
+
+    //
+    // Bump the caller if we already know it, otherwise evict the coldest one
+    //
+    for (i = 0; i < POOLTAG_PROFILE_CALLERS; i++)
+    {
+        if (Entry->Callers[i] == CallerAddress)
+        {
+            InterlockedIncrement(&Entry->CallerHits[i]);
+            return;
+        }
+        if (Entry->CallerHits[i] < Entry->CallerHits[Victim]) Victim = i;
+    }
+
+    Entry->Callers[Victim] = CallerAddress;
+    Entry->CallerHits[Victim] = 1;
+}
+
+static
+VOID
+ExpPoolProfileAllocation(IN ULONG Key,
+                         IN SIZE_T NumberOfBytes,
+                         IN SIZE_T Used,
+                         IN PVOID CallerAddress OPTIONAL)
+{
+    PPOOL_PROFILE_ENTRY Table, Entry;
+    PPOOL_PROFILE_SLOT Slot;
+    KIRQL OldIrql;
+
+    //
+    // Stay at DISPATCH_LEVEL while we use the table, so that a new session
+    // can tell when nobody is using the previous one anymore
+    //
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    Table = ExpPoolProfileTable;
+    Entry = Table ? ExpPoolProfileLookup(Table, Key, TRUE) : NULL;
+    if (Entry)
+    {
+        Slot = ExpPoolProfileGetSlot(Entry);
+        InterlockedIncrement(&Slot->Allocs);
+        InterlockedExchangeAddSizeT(&Slot->AllocatedBytes, NumberOfBytes);
+        if (Used > Entry->PeakUsed) Entry->PeakUsed = Used;
+
+        //
+        // Only one allocation out of SampleRate gets its caller recorded, so
+        // that hot tags don't keep bouncing the caller array between processors
+        //
+        if ((CallerAddress) &&
+            !((ULONG)InterlockedIncrement(&Entry->SampleCount) % ExpPoolProfilerSampleRate))
+        {
+            ExpPoolProfileRecordCaller(Entry, CallerAddress);
+        }
+    }
+    KeLowerIrql(OldIrql);
+}
+
+static
+VOID
+ExpPoolProfileFree(IN ULONG Key,
+                   IN SIZE_T NumberOfBytes)
+{
+    PPOOL_PROFILE_ENTRY Table, Entry;
+    PPOOL_PROFILE_SLOT Slot;
+    KIRQL OldIrql;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    Table = ExpPoolProfileTable;
+    Entry = Table ? ExpPoolProfileLookup(Table, Key, FALSE) : NULL;
+    if (Entry)
+    {
+        Slot = ExpPoolProfileGetSlot(Entry);
+        InterlockedIncrement(&Slot->Frees);
+        InterlockedExchangeAddSizeT(&Slot->FreedBytes, NumberOfBytes);
+    }
+    KeLowerIrql(OldIrql);
+}
+
+static
+PPOOL_TRACKER_TABLE
+ExpFindPoolTracker(IN ULONG Key)
+{
+    ULONG Hash, Index;
+
+    Hash = ExpComputeHashForTag(Key, PoolTrackTableMask);
+    Index = Hash;
+    do
+    {
+        if (PoolTrackTable[Hash].Key == Key) return &PoolTrackTable[Hash];
+        Hash = (Hash + 1) & PoolTrackTableMask;
+    } while (Hash != Index);
+
+    return NULL;
+}
+
+BOOLEAN
+NTAPI
+ExpCapturePoolTagProfile(IN ULONG Index,
+                         OUT PSYSTEM_POOLTAG_PROFILE Profile)
+{
+    PPOOL_PROFILE_ENTRY Table, Entry;
+    PPOOL_TRACKER_TABLE TrackerEntry;
+    ULONG i, Second;
+
+    //
+    // Nothing to report if the profiler was never turned on. Callers below
+    // DISPATCH_LEVEL must have raised, the table may be replaced otherwise
+    //
+    Table = ExpPoolProfileTable;
+    if (!Table) return FALSE;
+    Entry = &Table[Index];
+    if (!Entry->Key) return FALSE;
+
+    RtlZeroMemory(Profile, sizeof(*Profile));
+    Profile->TagUlong = Entry->Key;
+    Profile->PeakUsed = Entry->PeakUsed;
+
+    //
+    // Sum up the slots which are still part of the window
+    //
+    Second = ExpPoolProfileCurrentSecond();
+    for (i = 0; i < POOL_PROFILE_WINDOW; i++)
+    {
+        if ((Second - Entry->Slots[i].Second) >= POOL_PROFILE_WINDOW) continue;
+        Profile->Allocs += Entry->Slots[i].Allocs;
+        Profile->Frees += Entry->Slots[i].Frees;
+        Profile->AllocatedBytes += Entry->Slots[i].AllocatedBytes;
+        Profile->FreedBytes += Entry->Slots[i].FreedBytes;
+    }
+
+    for (i = 0; i < POOLTAG_PROFILE_CALLERS; i++)
+    {
+        Profile->Callers[i] = Entry->Callers[i];
+        Profile->CallerHits[i] = Entry->CallerHits[i];
+    }
+
+    //
+    // The current usage comes straight from the tracker table
+    //
+    TrackerEntry = ExpFindPoolTracker(Entry->Key);
+    if (TrackerEntry)
+    {
+        Profile->Used = TrackerEntry->NonPagedBytes + TrackerEntry->PagedBytes;
+    }
+
+    return TRUE;
+}
+
 VOID
 NTAPI
 ExpRemovePoolTracker(IN ULONG Key,
@@ -799,11 +1025,14 @@ ExpRemovePoolTracker(IN ULONG Key,
                 InterlockedIncrement(&TableEntry->NonPagedFrees);
                 InterlockedExchangeAddSizeT(&TableEntry->NonPagedBytes,
                                             -(SSIZE_T)NumberOfBytes);
-                return;
             }
-            InterlockedIncrement(&TableEntry->PagedFrees);
-            InterlockedExchangeAddSizeT(&TableEntry->PagedBytes,
-                                        -(SSIZE_T)NumberOfBytes);
+            else
+            {
+                InterlockedIncrement(&TableEntry->PagedFrees);
+                InterlockedExchangeAddSizeT(&TableEntry->PagedBytes,
+                                            -(SSIZE_T)NumberOfBytes);
+            }
+            if (ExpPoolProfilerEnabled) ExpPoolProfileFree(Key, NumberOfBytes);
             return;
         }
 
@@ -838,7 +1067,8 @@ VOID
 NTAPI
 ExpInsertPoolTracker(IN ULONG Key,
                      IN SIZE_T NumberOfBytes,
-                     IN POOL_TYPE PoolType)
+                     IN POOL_TYPE PoolType,
+                     IN PVOID CallerAddress OPTIONAL)
 {
     ULONG Hash, Index;
     KIRQL OldIrql;
@@ -865,7 +1095,9 @@ ExpInsertPoolTracker(IN ULONG Key,
     // ASSERT on ReactOS features not yet supported
     //
     ASSERT(!(PoolType & SESSION_POOL_MASK));
+#ifndef CONFIG_SMP
     ASSERT(KeGetCurrentProcessorNumber() == 0);
+#endif
 
     //
     // Why the double indirection? Because normally this function is also used
@@ -901,10 +1133,23 @@ ExpInsertPoolTracker(IN ULONG Key,
             {
                 InterlockedIncrement(&TableEntry->NonPagedAllocs);
                 InterlockedExchangeAddSizeT(&TableEntry->NonPagedBytes, NumberOfBytes);
-                return;
             }
-            InterlockedIncrement(&TableEntry->PagedAllocs);
-            InterlockedExchangeAddSizeT(&TableEntry->PagedBytes, NumberOfBytes);
+            else
+            {
+                InterlockedIncrement(&TableEntry->PagedAllocs);
+                InterlockedExchangeAddSizeT(&TableEntry->PagedBytes, NumberOfBytes);
+            }
+
+            //
+            // Feed the live profiler, if somebody is watching
+            //
+            if (ExpPoolProfilerEnabled)
+            {
+                ExpPoolProfileAllocation(Key,
+                                         NumberOfBytes,
+                                         TableEntry->NonPagedBytes + TableEntry->PagedBytes,
+                                         CallerAddress);
+            }
             return;
         }
 
@@ -1187,7 +1432,8 @@ InitializePool(IN POOL_TYPE PoolType,
         ExpInsertPoolTracker('looP',
                              ROUND_TO_PAGES(PoolBigPageTableSize *
                                             sizeof(POOL_TRACKER_BIG_PAGES)),
-                             NonPagedPool);
+                             NonPagedPool,
+                             NULL);
 
         //
         // No support for NUMA systems at this time
@@ -1253,7 +1499,8 @@ InitializePool(IN POOL_TYPE PoolType,
         //
         ExpInsertPoolTracker('looP',
                              ROUND_TO_PAGES(PoolTrackTableSize * sizeof(POOL_TRACKER_TABLE)),
-                             NonPagedPool);
+                             NonPagedPool,
+                             NULL);
     }
 }
 
@@ -1445,6 +1692,114 @@ ExGetPoolTagInfo(IN PSYSTEM_POOLTAG_INFORMATION SystemInformation,
     return Status;
 }
 
+NTSTATUS
+NTAPI
+ExGetPoolTagProfileInfo(IN PSYSTEM_POOLTAG_PROFILE_INFORMATION SystemInformation,
+                        IN ULONG SystemInformationLength,
+                        IN OUT PULONG ReturnLength OPTIONAL)
+{
+    ULONG Index, CurrentLength;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PSYSTEM_POOLTAG_PROFILE TagEntry;
+    SYSTEM_POOLTAG_PROFILE Profile;
+    BOOLEAN Captured;
+    KIRQL OldIrql;
+    ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+    //
+    // Check that the caller can at least receive the header
+    //
+    CurrentLength = FIELD_OFFSET(SYSTEM_POOLTAG_PROFILE_INFORMATION, TagInfo);
+    if (SystemInformationLength < CurrentLength)
+    {
+        if (ReturnLength) *ReturnLength = CurrentLength;
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    SystemInformation->Enabled = ExpPoolProfilerEnabled;
+    SystemInformation->SampleRate = ExpPoolProfilerSampleRate;
+    SystemInformation->WindowSeconds = POOL_PROFILE_WINDOW;
+    SystemInformation->Count = 0;
+    TagEntry = &SystemInformation->TagInfo[0];
+
+    for (Index = 0; Index < POOL_PROFILE_TABLE_SIZE; Index++)
+    {
+        //
+        // Capture into a local copy: the caller's buffer may be pageable
+        //
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        Captured = ExpCapturePoolTagProfile(Index, &Profile);
+        KeLowerIrql(OldIrql);
+        if (!Captured) continue;
+
+        //
+        // Like ExGetPoolTagInfo, keep counting when the buffer is too small so
+        // that the caller knows how much it needs
+        //
+        SystemInformation->Count++;
+        CurrentLength += sizeof(*TagEntry);
+        if (SystemInformationLength < CurrentLength)
+        {
+            Status = STATUS_INFO_LENGTH_MISMATCH;
+        }
+        else
+        {
+            *TagEntry++ = Profile;
+        }
+    }
+
+    if (ReturnLength) *ReturnLength = CurrentLength;
+    return Status;
+}
+
+NTSTATUS
+NTAPI
+ExSetPoolTagProfile(IN BOOLEAN Enable,
+                    IN ULONG SampleRate)
+{
+    PPOOL_PROFILE_ENTRY Table, OldTable;
+    CCHAR Processor;
+    ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+    if (!Enable)
+    {
+        //
+        // Keep the table around: it holds the last results, and allocations
+        // racing with us may still be updating it
+        //
+        ExpPoolProfilerEnabled = FALSE;
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // Every new session starts from a clean table. Allocations racing with
+    // us may still be updating the previous one, so never clear it in place
+    //
+    Table = ExAllocatePoolWithTag(NonPagedPool,
+                                  POOL_PROFILE_TABLE_SIZE * sizeof(POOL_PROFILE_ENTRY),
+                                  'forP');
+    if (!Table) return STATUS_INSUFFICIENT_RESOURCES;
+    RtlZeroMemory(Table, POOL_PROFILE_TABLE_SIZE * sizeof(POOL_PROFILE_ENTRY));
+
+    ExpPoolProfilerSampleRate = SampleRate ? SampleRate : 16;
+    OldTable = InterlockedExchangePointer((PVOID*)&ExpPoolProfileTable, Table);
+    ExpPoolProfilerEnabled = TRUE;
+    if (!OldTable) return STATUS_SUCCESS;
+
+    //
+    // The table is only used at DISPATCH_LEVEL: once we got to run on every
+    // processor, nobody can still hold a pointer to the old one
+    //
+    for (Processor = 0; Processor < KeNumberProcessors; Processor++)
+    {
+        KeSetSystemAffinityThread(AFFINITY_MASK(Processor));
+    }
+    KeRevertToUserAffinityThread();
+
+    ExFreePoolWithTag(OldTable, 'forP');
+    return STATUS_SUCCESS;
+}
+
 _IRQL_requires_(DISPATCH_LEVEL)
 BOOLEAN
 NTAPI
@@ -1529,7 +1884,7 @@ ExpExpandBigPageTable(
     /* Free the old table and update our tracker */
     PagesFreed = MiFreePoolPages(OldTable);
     ExpRemovePoolTracker('looP', PagesFreed << PAGE_SHIFT, 0);
-    ExpInsertPoolTracker('looP', ALIGN_UP_BY(NewSizeInBytes, PAGE_SIZE), 0);
+    ExpInsertPoolTracker('looP', ALIGN_UP_BY(NewSizeInBytes, PAGE_SIZE), 0, NULL);
 
     return TRUE;
 }
@@ -2002,7 +2357,7 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
         {
             Tag = ' GIB';
         }
-        ExpInsertPoolTracker(Tag, ROUND_TO_PAGES(NumberOfBytes), OriginalType);
+        ExpInsertPoolTracker(Tag, ROUND_TO_PAGES(NumberOfBytes), OriginalType, _ReturnAddress());
         return Entry;
     }
 
@@ -2065,7 +2420,8 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
             Entry->PoolType = OriginalType + 1;
             ExpInsertPoolTracker(Tag,
                                  Entry->BlockSize * POOL_BLOCK_SIZE,
-                                 OriginalType);
+                                 OriginalType,
+                                 _ReturnAddress());
 
             //
             // Return the pool allocation
@@ -2249,7 +2605,8 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
             //
             ExpInsertPoolTracker(Tag,
                                  Entry->BlockSize * POOL_BLOCK_SIZE,
-                                 OriginalType);
+                                 OriginalType,
+                                 _ReturnAddress());
 
             //
             // Return the pool allocation
@@ -2393,7 +2750,8 @@ ExAllocatePoolWithTag(IN POOL_TYPE PoolType,
     InterlockedIncrement((PLONG)&PoolDesc->RunningAllocs);
     ExpInsertPoolTracker(Tag,
                          Entry->BlockSize * POOL_BLOCK_SIZE,
-                         OriginalType);
+                         OriginalType,
+                         _ReturnAddress());
 
     //
     // And return the pool allocation
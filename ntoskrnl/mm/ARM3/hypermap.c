@@ -110,7 +110,8 @@ MiUnmapPageInHyperSpace(IN PEPROCESS Process,
 
 PVOID
 NTAPI
-MiMapPagesInZeroSpace(IN PMMPFN Pfn1,
+MiMapPagesInZeroSpace(IN PMMPTE FirstZeroingPte,
+                      IN PMMPFN Pfn1,
                       IN PFN_NUMBER NumberOfPages)
 {
     MMPTE TempPte;
@@ -125,9 +126,10 @@ MiMapPagesInZeroSpace(IN PMMPFN Pfn1,
     ASSERT(NumberOfPages <= MI_ZERO_PTES);
 
     //
-    // Pick the first zeroing PTE
+    // Pick the first zeroing PTE. Each zeroing thread owns its own set of
+    // PTEs and never leaves its processor, so flushing the local TB is enough.
     //
-    PointerPte = MiFirstReservedZeroingPte;
+    PointerPte = FirstZeroingPte;
 
     //
     // Now get the first free PTE
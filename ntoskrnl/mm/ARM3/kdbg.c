@@ -214,6 +214,56 @@ ExpKdbgExtPoolUsed(
     return TRUE;
 }
 
+BOOLEAN
+ExpKdbgExtPoolProf(
+    ULONG Argc,
+    PCHAR Argv[])
+{
+    SYSTEM_POOLTAG_PROFILE Profile;
+    ULONG Tag = 0;
+    ULONG Mask = 0;
+    ULONG Index, i;
+
+    if (Argc > 1)
+    {
+        ExpKdbgExtPoolUsedGetTag(Argv[1], &Tag, &Mask);
+    }
+
+    KdbpPrint("Pool profiler is %s, caller sample rate 1/%lu, window %lu seconds\n",
+              ExpPoolProfilerEnabled ? "enabled" : "disabled",
+              ExpPoolProfilerSampleRate, POOL_PROFILE_WINDOW);
+    KdbpPrint("Tag     Allocs/s     Frees/s   Bytes/s          Used          Peak\n");
+
+    for (Index = 0; Index < POOL_PROFILE_TABLE_SIZE; Index++)
+    {
+        if (!ExpCapturePoolTagProfile(Index, &Profile)) continue;
+        if ((Profile.TagUlong & Mask) != (Tag & Mask)) continue;
+
+        KdbpPrint("%.4s %10lu %11lu %9Iu %13Iu %13Iu\n",
+                  Profile.Tag,
+                  Profile.Allocs / POOL_PROFILE_WINDOW,
+                  Profile.Frees / POOL_PROFILE_WINDOW,
+                  Profile.AllocatedBytes / POOL_PROFILE_WINDOW,
+                  Profile.Used,
+                  Profile.PeakUsed);
+
+        /* Only give the callers when looking at specific tags */
+        if (!Mask) continue;
+        for (i = 0; i < POOLTAG_PROFILE_CALLERS; i++)
+        {
+            if (!Profile.Callers[i]) continue;
+            KdbpPrint("    %8lu hits from ", Profile.CallerHits[i]);
+            if (!KdbSymPrintAddress(Profile.Callers[i], NULL))
+            {
+                KdbpPrint("<%p>", Profile.Callers[i]);
+            }
+            KdbpPrint("\n");
+        }
+    }
+
+    return TRUE;
+}
+
 static
 VOID
 ExpKdbgExtPoolFindLargePool(
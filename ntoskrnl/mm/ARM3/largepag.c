@@ -22,9 +22,10 @@ PMMPTE MiLargePageHyperPte;
 ULONG MiLargePageRangeIndex;
 MI_LARGE_PAGE_RANGES MiLargePageRanges[64];
 WCHAR MmLargePageDriverBuffer[512] = {0};
-ULONG MmLargePageDriverBufferLength = -1;
+ULONG MmLargePageDriverBufferLength = sizeof(MmLargePageDriverBuffer);
 LIST_ENTRY MiLargePageDriverList;
 BOOLEAN MiLargePageAllDrivers;
+SIZE_T MmLargePageMinimum;
 
 /* FUNCTIONS ******************************************************************/
 
@@ -34,18 +35,18 @@ NTAPI
 MiInitializeLargePageSupport(VOID)
 {
 #if _MI_PAGING_LEVELS > 2
-    DPRINT1("MiInitializeLargePageSupport: PAE/x64 Not Implemented\n");
-    //ASSERT(FALSE);
+    /* A single PDE maps a large page, and PAE/x64 don't need CR4.PSE for it */
+    MmLargePageMinimum = PDE_MAPPED_VA;
 #else
     /* Initialize the large-page hyperspace PTE used for initial mapping */
     MiLargePageHyperPte = MiReserveSystemPtes(1, SystemPteSpace);
     ASSERT(MiLargePageHyperPte);
     MiLargePageHyperPte->u.Long = 0;
+#endif
 
     /* Initialize the process tracking list, and insert the system process */
     InitializeListHead(&MmProcessList);
     InsertTailList(&MmProcessList, &PsGetCurrentProcess()->MmProcessLinks);
-#endif
 }
 
 INIT_FUNCTION
@@ -67,7 +68,8 @@ VOID
 NTAPI
 MiInitializeDriverLargePageList(VOID)
 {
-    PWCHAR p, pp;
+    PWCHAR p, pp, Start;
+    PMI_LARGE_PAGE_DRIVER_ENTRY LargePageDriverEntry;
 
     /* Initialize the list */
     InitializeListHead(&MiLargePageDriverList);
@@ -80,8 +82,8 @@ MiInitializeDriverLargePageList(VOID)
     pp = MmLargePageDriverBuffer + (MmLargePageDriverBufferLength / sizeof(WCHAR));
     while (p < pp)
     {
-        /* Skip whitespaces */
-        if ((*p == L' ') || (*p == L'\n') || (*p == L'\r') || (*p == L'\t'))
+        /* Skip whitespaces, and the separators of a multi-string */
+        if ((*p == L' ') || (*p == L'\n') || (*p == L'\r') || (*p == L'\t') || (*p == UNICODE_NULL))
         {
             /* Skip the character */
             p++;
@@ -96,9 +98,296 @@ MiInitializeDriverLargePageList(VOID)
             break;
         }
 
-        DPRINT1("Large page drivers not supported\n");
-        ASSERT(FALSE);
+        /* Find the end of this driver name */
+        Start = p;
+        while ((p < pp) &&
+               (*p != L' ') && (*p != L'\n') && (*p != L'\r') && (*p != L'\t') &&
+               (*p != UNICODE_NULL))
+        {
+            p++;
+        }
+
+        /* Allocate an entry for it */
+        LargePageDriverEntry = ExAllocatePoolWithTag(NonPagedPool,
+                                                     sizeof(MI_LARGE_PAGE_DRIVER_ENTRY),
+                                                     TAG_MM);
+        if (!LargePageDriverEntry) break;
+
+        /* The name stays in the registry buffer, which is never freed */
+        LargePageDriverEntry->BaseName.Buffer = Start;
+        LargePageDriverEntry->BaseName.Length = (USHORT)((p - Start) * sizeof(WCHAR));
+        LargePageDriverEntry->BaseName.MaximumLength = LargePageDriverEntry->BaseName.Length;
+        InsertTailList(&MiLargePageDriverList, &LargePageDriverEntry->Links);
+    }
+}
+
+PFN_NUMBER
+NTAPI
+MiAllocateLargePage(VOID)
+{
+    /* Find a naturally aligned run of pages that a single PDE can map */
+    return MiFindContiguousPages(0,
+                                 MmHighestPhysicalPage,
+                                 PTE_PER_PAGE,
+                                 PTE_PER_PAGE,
+                                 MmCached);
+}
+
+VOID
+NTAPI
+MiFreeLargePage(IN PFN_NUMBER PageFrameIndex)
+{
+    PMMPFN Pfn1;
+    ULONG i;
+
+    /* The PFN lock must be held */
+    MI_ASSERT_PFN_LOCK_HELD();
+
+    /* This is no longer a contiguous allocation */
+    Pfn1 = MiGetPfnEntry(PageFrameIndex);
+    ASSERT(Pfn1->u3.e1.StartOfAllocation == 1);
+    Pfn1->u3.e1.StartOfAllocation = 0;
+    (Pfn1 + PTE_PER_PAGE - 1)->u3.e1.EndOfAllocation = 0;
+
+    /* Drop the share on every page, locked pages go away once they are unlocked */
+    for (i = 0; i < PTE_PER_PAGE; i++, Pfn1++)
+    {
+        ASSERT(Pfn1->u2.ShareCount == 1);
+        MI_SET_PFN_DELETED(Pfn1);
+        MiDecrementShareCount(Pfn1, PageFrameIndex + i);
+    }
+}
+
+VOID
+NTAPI
+MiDeleteLargePage(IN PMMPDE PointerPde)
+{
+    PFN_NUMBER PageFrameIndex, PageDirectoryIndex;
+
+    /* The PFN lock must be held */
+    MI_ASSERT_PFN_LOCK_HELD();
+    ASSERT(MI_IS_PAGE_LARGE(PointerPde));
+
+    /* Erase the PDE, then free the pages it mapped */
+    PageFrameIndex = PFN_FROM_PTE(PointerPde);
+    PageDirectoryIndex = MiGetPfnEntry(PageFrameIndex)->u4.PteFrame;
+    MI_ERASE_PTE(PointerPde);
+    MiFreeLargePage(PageFrameIndex);
+
+    /* Drop the reference on the page directory */
+    MiDecrementShareCount(MiGetPfnEntry(PageDirectoryIndex), PageDirectoryIndex);
+
+    /* Flush the TLB */
+    KeFlushCurrentTb();
+}
+
+NTSTATUS
+NTAPI
+MiAllocateLargePages(IN PFN_NUMBER LargePageCount,
+                     OUT PPFN_NUMBER PageFrames)
+{
+    PFN_NUMBER i, j;
+
+    /* Get every run first, so that mapping them can't fail for lack of memory */
+    for (i = 0; i < LargePageCount; i++)
+    {
+        PageFrames[i] = MiAllocateLargePage();
+        if (!PageFrames[i])
+        {
+            DPRINT1("Out of contiguous memory for large pages\n");
+            MiFreeLargePages(i, PageFrames);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        /* Zero them before anyone can see them */
+        for (j = 0; j < PTE_PER_PAGE; j++) MiZeroPhysicalPage(PageFrames[i] + j);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+MiFreeLargePages(IN PFN_NUMBER LargePageCount,
+                 IN PPFN_NUMBER PageFrames)
+{
+    PFN_NUMBER i;
+    KIRQL OldIrql;
+
+    /* Free runs that were never mapped */
+    OldIrql = MiAcquirePfnLock();
+    for (i = 0; i < LargePageCount; i++) MiFreeLargePage(PageFrames[i]);
+    MiReleasePfnLock(OldIrql);
+}
+
+NTSTATUS
+NTAPI
+MiMapLargePages(IN PEPROCESS Process,
+                IN PMMVAD Vad,
+                IN PPFN_NUMBER PageFrames)
+{
+    PETHREAD Thread = PsGetCurrentThread();
+    ULONG_PTR StartingAddress, EndingAddress, Va;
+    PMMPDE PointerPde;
+    PMMPTE PointerPpe, PointerPxe;
+    MMPDE TempPde;
+    PFN_NUMBER PageFrameIndex, PageDirectoryIndex, Mapped;
+    PMMPFN Pfn1;
+    KIRQL OldIrql;
+    ULONG i;
+
+    /*
+     * The caller holds the address creation lock since it inserted the VAD,
+     * so it can't be freed under us, and faults on it fail until it is mapped.
+     */
+    ASSERT(Process == PsGetCurrentProcess());
+    ASSERT(KeAreAllApcsDisabled() == TRUE);
+    ASSERT(Vad->u.VadFlags.VadType == VadLargePages);
+
+    /* The VAD was inserted on a large page boundary */
+    StartingAddress = Vad->StartingVpn << PAGE_SHIFT;
+    EndingAddress = (Vad->EndingVpn << PAGE_SHIFT) | (PAGE_SIZE - 1);
+    ASSERT((StartingAddress & (PDE_MAPPED_VA - 1)) == 0);
+    ASSERT(((EndingAddress + 1) & (PDE_MAPPED_VA - 1)) == 0);
+
+    /* Map each PDE of the range */
+    MiLockProcessWorkingSetUnsafe(Process, Thread);
+    for (Va = StartingAddress, Mapped = 0; Va < EndingAddress; Va += PDE_MAPPED_VA, Mapped++)
+    {
+        PageFrameIndex = PageFrames[Mapped];
+
+        /*
+         * Make the page directory for this address exist. On 2-level and PAE
+         * page tables the PXE and PPE are the same always valid entry.
+         */
+        PointerPde = MiAddressToPde(Va);
+        PointerPpe = MiAddressToPte(PointerPde);
+        PointerPxe = MiAddressToPde(PointerPde);
+        if (!PointerPxe->u.Hard.Valid) MiMakeSystemAddressValid(PointerPpe, Process);
+        if (!PointerPpe->u.Hard.Valid) MiMakeSystemAddressValid(PointerPde, Process);
+
+        /* A page table left over from an earlier allocation is in the way */
+        if (PointerPde->u.Long != 0)
+        {
+            DPRINT1("Page table in the way of a large page at %p\n", (PVOID)Va);
+
+            /* Unmap whatever was already mapped, and free the rest */
+            if (Va != StartingAddress) MiDeleteVirtualAddresses(StartingAddress, Va - 1, Vad);
+            MiUnlockProcessWorkingSetUnsafe(Process, Thread);
+            MiFreeLargePages(((EndingAddress + 1 - StartingAddress) / PDE_MAPPED_VA) - Mapped,
+                             &PageFrames[Mapped]);
+            return STATUS_CONFLICTING_ADDRESSES;
+        }
+
+        /* Build the large PDE the same way as a user PTE */
+        TempPde.u.Long = 0;
+        TempPde.u.Hard.Valid = TRUE;
+        TempPde.u.Hard.Owner = TRUE;
+        TempPde.u.Hard.PageFrameNumber = PageFrameIndex;
+        TempPde.u.Long |= MmProtectToPteMask[Vad->u.VadFlags.Protection];
+        TempPde.u.Hard.LargePage = TRUE;
+
+        /* Link the pages to the PDE, which references the page directory once */
+        PageDirectoryIndex = PFN_FROM_PTE(MiAddressToPte(PointerPde));
+        OldIrql = MiAcquirePfnLock();
+        Pfn1 = MiGetPfnEntry(PageFrameIndex);
+        for (i = 0; i < PTE_PER_PAGE; i++, Pfn1++)
+        {
+            Pfn1->PteAddress = PointerPde;
+            Pfn1->u4.PteFrame = PageDirectoryIndex;
+            MI_MAKE_SOFTWARE_PTE(&Pfn1->OriginalPte, Vad->u.VadFlags.Protection);
+        }
+        MiGetPfnEntry(PageDirectoryIndex)->u2.ShareCount++;
+        MI_WRITE_VALID_PDE(PointerPde, TempPde);
+        MiReleasePfnLock(OldIrql);
     }
+    MiUnlockProcessWorkingSetUnsafe(Process, Thread);
+
+    return STATUS_SUCCESS;
 }
 
+#if (_MI_PAGING_LEVELS == 4)
+PVOID
+NTAPI
+MiMapLargeSystemPages(IN PFN_NUMBER LargePageCount)
+{
+    PPFN_NUMBER PageFrames;
+    PMMPTE PointerPte, StartPte, EndPte;
+    PMMPDE PointerPde;
+    MMPDE TempPde;
+    PFN_NUMBER PteCount, i, j;
+    PMMPFN Pfn1;
+    KIRQL OldIrql;
+    ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
+
+    /* Get all the physical memory first, it's the part most likely to fail */
+    PageFrames = ExAllocatePoolWithTag(NonPagedPool,
+                                       LargePageCount * sizeof(PFN_NUMBER),
+                                       TAG_MM);
+    if (!PageFrames) return NULL;
+    for (i = 0; i < LargePageCount; i++)
+    {
+        PageFrames[i] = MiAllocateLargePage();
+        if (!PageFrames[i]) goto FreePages;
+        for (j = 0; j < PTE_PER_PAGE; j++) MiZeroPhysicalPage(PageFrames[i] + j);
+    }
+
+    /* System PTEs are only page aligned, so reserve one more large page and trim */
+    PteCount = (LargePageCount + 1) * PTE_PER_PAGE - 1;
+    PointerPte = MiReserveSystemPtes((ULONG)PteCount, SystemPteSpace);
+    if (!PointerPte) goto FreePages;
+    StartPte = (PMMPTE)ALIGN_UP_POINTER_BY(PointerPte, PAGE_SIZE);
+    EndPte = StartPte + LargePageCount * PTE_PER_PAGE;
+    if (StartPte != PointerPte)
+    {
+        MiReleaseSystemPtes(PointerPte, (ULONG)(StartPte - PointerPte), SystemPteSpace);
+    }
+    if (EndPte != PointerPte + PteCount)
+    {
+        MiReleaseSystemPtes(EndPte, (ULONG)(PointerPte + PteCount - EndPte), SystemPteSpace);
+    }
+
+    /*
+     * Kernel page directories are shared by every process on x64, so swapping
+     * the PDEs is seen everywhere. The page tables they pointed to are left as
+     * they are, since the PTEs stay reserved for as long as the mapping lives.
+     */
+    OldIrql = MiAcquirePfnLock();
+    for (i = 0; i < LargePageCount; i++)
+    {
+        PointerPde = MiPteToPde(StartPte + i * PTE_PER_PAGE);
+        ASSERT(PointerPde->u.Hard.Valid == 1);
+
+        /* Link the pages to the PDE */
+        Pfn1 = MiGetPfnEntry(PageFrames[i]);
+        for (j = 0; j < PTE_PER_PAGE; j++, Pfn1++)
+        {
+            Pfn1->PteAddress = PointerPde;
+            Pfn1->u4.PteFrame = PFN_FROM_PTE(MiAddressToPte(PointerPde));
+            MI_MAKE_SOFTWARE_PTE(&Pfn1->OriginalPte, MM_EXECUTE_READWRITE);
+        }
+
+        /* Write the large PDE */
+        TempPde = ValidKernelPde;
+        TempPde.u.Hard.PageFrameNumber = PageFrames[i];
+        TempPde.u.Hard.LargePage = TRUE;
+        *PointerPde = TempPde;
+    }
+    MiReleasePfnLock(OldIrql);
+
+    /* Flush the old mappings everywhere */
+    KeFlushEntireTb(TRUE, TRUE);
+    ExFreePoolWithTag(PageFrames, TAG_MM);
+    return MiPteToAddress(StartPte);
+
+FreePages:
+    /* Give back whatever was allocated */
+    OldIrql = MiAcquirePfnLock();
+    while (i--) MiFreeLargePage(PageFrames[i]);
+    MiReleasePfnLock(OldIrql);
+    ExFreePoolWithTag(PageFrames, TAG_MM);
+    return NULL;
+}
+#endif
+
 /* EOF */
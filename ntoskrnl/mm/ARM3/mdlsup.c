@@ -462,17 +462,32 @@ MmBuildMdlForNonPagedPool(IN PMDL Mdl)
     EndPage = MdlPages + PageCount;
 
     //
-    // Loop the PTEs
+    // Large pages have no PTEs, each page follows the start of its large page
     //
-    PointerPte = MiAddressToPte(Base);
-    do
+    if (MI_IS_PHYSICAL_ADDRESS(Base))
+    {
+        do
+        {
+            Pfn = PFN_FROM_PTE(MiAddressToPde(Base)) + MiAddressToPteOffset(Base);
+            *MdlPages++ = Pfn;
+            Base = (PVOID)((ULONG_PTR)Base + PAGE_SIZE);
+        } while (MdlPages < EndPage);
+    }
+    else
     {
         //
-        // Write the PFN
+        // Loop the PTEs
         //
-        Pfn = PFN_FROM_PTE(PointerPte++);
-        *MdlPages++ = Pfn;
-    } while (MdlPages < EndPage);
+        PointerPte = MiAddressToPte(Base);
+        do
+        {
+            //
+            // Write the PFN
+            //
+            Pfn = PFN_FROM_PTE(PointerPte++);
+            *MdlPages++ = Pfn;
+        } while (MdlPages < EndPage);
+    }
 
     //
     // Set the nonpaged pool flag
@@ -942,7 +957,7 @@ MmProbeAndLockPages(IN PMDL Mdl,
     NTSTATUS Status = STATUS_SUCCESS;
     PEPROCESS CurrentProcess;
     NTSTATUS ProbeStatus;
-    PMMPTE PointerPte, LastPte;
+    PMMPTE PointerPte, LastPte, MappingPte;
     PMMPDE PointerPde;
 #if (_MI_PAGING_LEVELS >= 3)
     PMMPDE PointerPpe;
@@ -1015,9 +1030,6 @@ MmProbeAndLockPages(IN PMDL Mdl,
     TotalPages = LockPages;
     StartAddress = Address;
 
-    /* Large pages not supported */
-    ASSERT(!MI_IS_PHYSICAL_ADDRESS(Address));
-
     //
     // Now probe them
     //
@@ -1200,7 +1212,7 @@ MmProbeAndLockPages(IN PMDL Mdl,
                (PointerPpe->u.Hard.Valid == 0) ||
 #endif
                (PointerPde->u.Hard.Valid == 0) ||
-               (PointerPte->u.Hard.Valid == 0))
+               (!MI_IS_PAGE_LARGE(PointerPde) && (PointerPte->u.Hard.Valid == 0)))
         {
             //
             // What kind of lock were we using?
@@ -1251,6 +1263,11 @@ MmProbeAndLockPages(IN PMDL Mdl,
             }
         }
 
+        //
+        // A large page is mapped by its PDE, there is no PTE to look at
+        //
+        MappingPte = MI_IS_PAGE_LARGE(PointerPde) ? (PMMPTE)PointerPde : PointerPte;
+
         //
         // Check if this was a write or modify
         //
@@ -1259,12 +1276,12 @@ MmProbeAndLockPages(IN PMDL Mdl,
             //
             // Check if the PTE is not writable
             //
-            if (MI_IS_PAGE_WRITEABLE(PointerPte) == FALSE)
+            if (MI_IS_PAGE_WRITEABLE(MappingPte) == FALSE)
             {
                 //
                 // Check if it's copy on write
                 //
-                if (MI_IS_PAGE_COPY_ON_WRITE(PointerPte))
+                if (MI_IS_PAGE_COPY_ON_WRITE(MappingPte))
                 {
                     //
                     // Get the base address and allow a change for user-mode
@@ -1335,9 +1352,10 @@ MmProbeAndLockPages(IN PMDL Mdl,
         }
 
         //
-        // Grab the PFN
+        // Grab the PFN, offset into the large page if that's what this is
         //
-        PageFrameIndex = PFN_FROM_PTE(PointerPte);
+        PageFrameIndex = PFN_FROM_PTE(MappingPte);
+        if (MappingPte != PointerPte) PageFrameIndex += MiAddressToPteOffset(MiPteToAddress(PointerPte));
         Pfn1 = MiGetPfnEntry(PageFrameIndex);
         if (Pfn1)
         {
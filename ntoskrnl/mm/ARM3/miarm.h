@@ -394,6 +394,41 @@ extern POOL_DESCRIPTOR NonPagedPoolDescriptor;
 extern PPOOL_DESCRIPTOR ExpPagedPoolDescriptor[16 + 1];
 extern PPOOL_TRACKER_TABLE PoolTrackTable;
 
+//
+// Live pool tag profiler. Each slot of the window covers one second
+//
+#define POOL_PROFILE_TABLE_SIZE     256
+#define POOL_PROFILE_WINDOW         16
+
+typedef struct _POOL_PROFILE_SLOT
+{
+    ULONG Second;
+    LONG Allocs;
+    LONG Frees;
+    SIZE_T AllocatedBytes;
+    SIZE_T FreedBytes;
+} POOL_PROFILE_SLOT, *PPOOL_PROFILE_SLOT;
+
+typedef struct _POOL_PROFILE_ENTRY
+{
+    ULONG Key;
+    LONG SampleCount;
+    SIZE_T PeakUsed;
+    POOL_PROFILE_SLOT Slots[POOL_PROFILE_WINDOW];
+    PVOID Callers[POOLTAG_PROFILE_CALLERS];
+    LONG CallerHits[POOLTAG_PROFILE_CALLERS];
+} POOL_PROFILE_ENTRY, *PPOOL_PROFILE_ENTRY;
+
+extern BOOLEAN ExpPoolProfilerEnabled;
+extern ULONG ExpPoolProfilerSampleRate;
+
+BOOLEAN
+NTAPI
+ExpCapturePoolTagProfile(
+    IN ULONG Index,
+    OUT PSYSTEM_POOLTAG_PROFILE Profile
+);
+
 //
 // END FIXFIX
 //
@@ -551,6 +586,7 @@ extern LIST_ENTRY MiLargePageDriverList;
 extern BOOLEAN MiLargePageAllDrivers;
 extern ULONG MmVerifyDriverBufferLength;
 extern ULONG MmLargePageDriverBufferLength;
+extern SIZE_T MmLargePageMinimum;
 extern SIZE_T MmSizeOfNonPagedPoolInBytes;
 extern SIZE_T MmMaximumNonPagedPoolInBytes;
 extern PFN_NUMBER MmMaximumNonPagedPoolInPages;
@@ -640,6 +676,7 @@ extern PFN_NUMBER MmSystemPageDirectory[PPE_PER_PAGE];
 extern PMMPTE MmSharedUserDataPte;
 extern LIST_ENTRY MmProcessList;
 extern KEVENT MmZeroingPageEvent;
+extern PFN_NUMBER MmZeroedPageTarget;
 extern ULONG MmSystemPageColor;
 extern ULONG MmProcessColorSeed;
 extern PMMWSL MmWorkingSetList;
@@ -2044,6 +2081,54 @@ MiSyncCachedRanges(
     VOID
 );
 
+PFN_NUMBER
+NTAPI
+MiAllocateLargePage(
+    VOID
+);
+
+VOID
+NTAPI
+MiFreeLargePage(
+    IN PFN_NUMBER PageFrameIndex
+);
+
+VOID
+NTAPI
+MiDeleteLargePage(
+    IN PMMPDE PointerPde
+);
+
+NTSTATUS
+NTAPI
+MiAllocateLargePages(
+    IN PFN_NUMBER LargePageCount,
+    OUT PPFN_NUMBER PageFrames
+);
+
+VOID
+NTAPI
+MiFreeLargePages(
+    IN PFN_NUMBER LargePageCount,
+    IN PPFN_NUMBER PageFrames
+);
+
+NTSTATUS
+NTAPI
+MiMapLargePages(
+    IN PEPROCESS Process,
+    IN PMMVAD Vad,
+    IN PPFN_NUMBER PageFrames
+);
+
+#if (_MI_PAGING_LEVELS == 4)
+PVOID
+NTAPI
+MiMapLargeSystemPages(
+    IN PFN_NUMBER LargePageCount
+);
+#endif
+
 BOOLEAN
 NTAPI
 MiIsPfnInUse(
@@ -2111,6 +2196,16 @@ MiInsertVad(
     _Inout_ PMMVAD Vad,
     _Inout_ PMM_AVL_TABLE VadRoot);
 
+NTSTATUS
+NTAPI
+MiInsertVadExLocked(
+    _Inout_ PMMVAD Vad,
+    _In_ ULONG_PTR *BaseAddress,
+    _In_ SIZE_T ViewSize,
+    _In_ ULONG_PTR HighestAddress,
+    _In_ ULONG_PTR Alignment,
+    _In_ ULONG AllocationType);
+
 NTSTATUS
 NTAPI
 MiInsertVadEx(
@@ -2305,10 +2400,29 @@ FORCEINLINE
 PFN_NUMBER
 MiRemoveZeroPageSafe(IN ULONG Color)
 {
-    if (MmFreePagesByColor[ZeroedPageList][Color].Flink != LIST_HEAD) return MiRemoveZeroPage(Color);
+    /* A zeroed page of another color still beats zeroing one inline */
+    if (MmZeroedPageListHead.Total != 0) return MiRemoveZeroPage(Color);
     return 0;
 }
 
+//
+// Wakes up the zero page threads when the zeroed page pool is below its
+// target depth and there are enough free pages to make it worth it
+//
+FORCEINLINE
+VOID
+MiSignalZeroPageThreads(VOID)
+{
+    MI_ASSERT_PFN_LOCK_HELD();
+
+    if ((MmZeroedPageListHead.Total < MmZeroedPageTarget) &&
+        (MmFreePageListHead.Total >= 8) &&
+        !MmZeroingPageEvent.Header.SignalState)
+    {
+        KeSetEvent(&MmZeroingPageEvent, IO_NO_INCREMENT, FALSE);
+    }
+}
+
 #if (_MI_PAGING_LEVELS == 2)
 FORCEINLINE
 BOOLEAN
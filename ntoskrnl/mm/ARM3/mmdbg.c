@@ -200,6 +200,11 @@ MmDbgCopyMemory(IN ULONG64 Address,
 
         /* If we are going to write to the address, then check if its writable */
         PointerPte = MiAddressToPte(TargetAddress);
+        if (MI_IS_PHYSICAL_ADDRESS(TargetAddress))
+        {
+            /* Large pages have no PTE, the PDE maps them instead */
+            PointerPte = (PMMPTE)MiAddressToPde(TargetAddress);
+        }
         if ((Flags & MMDBG_COPY_WRITE) &&
             (!MI_IS_PAGE_WRITEABLE(PointerPte)))
         {
@@ -208,7 +213,14 @@ MmDbgCopyMemory(IN ULONG64 Address,
 
             /* Calculate the physical address */
             PhysicalAddress = PointerPte->u.Hard.PageFrameNumber << PAGE_SHIFT;
-            PhysicalAddress += BYTE_OFFSET(Address);
+            if (MI_IS_PHYSICAL_ADDRESS(TargetAddress))
+            {
+                PhysicalAddress += Address & (PDE_MAPPED_VA - 1);
+            }
+            else
+            {
+                PhysicalAddress += BYTE_OFFSET(Address);
+            }
 
             /* Translate the physical address */
             TargetAddress = MiDbgTranslatePhysicalAddress(PhysicalAddress,
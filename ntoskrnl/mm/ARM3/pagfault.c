@@ -273,6 +273,13 @@ MiCheckVirtualAddress(IN PVOID VirtualAddress,
             /* ReactOS does not handle AWE VADs yet */
             ASSERT(Vad->u.VadFlags.VadType != VadAwe);
 
+            /* Large pages are mapped along with the VAD, never demand-zeroed */
+            if (Vad->u.VadFlags.VadType == VadLargePages)
+            {
+                *ProtectCode = MM_NOACCESS;
+                return NULL;
+            }
+
             /* This must be a TEB/PEB VAD */
             if (Vad->u.VadFlags.MemCommit)
             {
@@ -2185,10 +2192,11 @@ UserFault:
         ASSERT(KeAreAllApcsDisabled() == TRUE);
         ASSERT(PointerPde->u.Hard.Valid == 1);
     }
-    else
+    else if (MI_IS_PAGE_LARGE(PointerPde))
     {
-        /* Not yet implemented in ReactOS */
-        ASSERT(MI_IS_PAGE_LARGE(PointerPde) == FALSE);
+        /* Large pages are never paged out, so this can only be a protection fault */
+        MiUnlockProcessWorkingSet(CurrentProcess, CurrentThread);
+        return STATUS_ACCESS_VIOLATION;
     }
 
     /* Now capture the PTE. */
@@ -389,8 +389,9 @@ MiRemovePageByColor(IN PFN_NUMBER PageIndex,
     ListName = ListHead->ListName;
     ASSERT(ListName <= FreePageList);
 
-    /* Remove a page */
+    /* Remove a page, and refill the zeroed page pool if it runs low */
     ListHead->Total--;
+    if (ListName == ZeroedPageList) MiSignalZeroPageThreads();
 
     /* Get the forward and back pointers */
     OldFlink = Pfn1->u1.Flink;
@@ -700,12 +701,8 @@ MiInsertPageInFreeList(IN PFN_NUMBER PageFrameIndex)
     /* And increase the count in the colored list */
     ColorTable->Count++;
 
-    /* Notify zero page thread if enough pages are on the free list now */
-    if (ListHead->Total >= 8)
-    {
-        /* Set the event */
-        KeSetEvent(&MmZeroingPageEvent, IO_NO_INCREMENT, FALSE);
-    }
+    /* Notify the zero page threads if enough pages are on the free list now */
+    MiSignalZeroPageThreads();
 
 #if MI_TRACE_PFNS
     Pfn1->PfnUsage = MI_USAGE_FREE_PAGE;
@@ -1669,7 +1669,9 @@ MmFreeDriverInitialization(IN PLDR_DATA_TABLE_ENTRY LdrEntry)
 
     /* Push the DLL base to the first disacrable section, and get its PTE */
     DllBase = (PVOID)ROUND_TO_PAGES((ULONG_PTR)DllBase + DiscardSection->VirtualAddress);
-    ASSERT(MI_IS_PHYSICAL_ADDRESS(DllBase) == FALSE);
+
+    /* Large page mapped images keep their discardable sections */
+    if (MI_IS_PHYSICAL_ADDRESS(DllBase)) return;
     StartPte = MiAddressToPte(DllBase);
 
     /* Check how many pages to free total */
@@ -2345,6 +2347,10 @@ MiUseLargeDriverPage(IN ULONG NumberOfPtes,
     PLIST_ENTRY NextEntry;
     BOOLEAN DriverFound = FALSE;
     PMI_LARGE_PAGE_DRIVER_ENTRY LargePageDriverEntry;
+#if (_MI_PAGING_LEVELS == 4)
+    PVOID LargePageBase;
+    PMMPTE PointerPte;
+#endif
     ASSERT(KeGetCurrentIrql () <= APC_LEVEL);
     ASSERT(*ImageBaseAddress >= MmSystemRangeStart);
 
@@ -2387,9 +2393,26 @@ MiUseLargeDriverPage(IN ULONG NumberOfPtes,
         if (DriverFound == FALSE) return FALSE;
     }
 
-    /* Nothing to do yet */
-    DPRINT1("Large pages not supported!\n");
+#if (_MI_PAGING_LEVELS == 4)
+    /* Map a large page copy of the image */
+    LargePageBase = MiMapLargeSystemPages(ROUND_UP(NumberOfPtes, PTE_PER_PAGE) / PTE_PER_PAGE);
+    if (!LargePageBase) return FALSE;
+    RtlCopyMemory(LargePageBase, *ImageBaseAddress, NumberOfPtes << PAGE_SHIFT);
+
+    /* Free the small page copy and its PTEs */
+    PointerPte = MiAddressToPte(*ImageBaseAddress);
+    MiDeleteSystemPageableVm(PointerPte, NumberOfPtes, 0, NULL);
+    MiReleaseSystemPtes(PointerPte, NumberOfPtes, SystemPteSpace);
+
+    /* The driver lives in the large pages now */
+    DPRINT("Loading %wZ at %p with large pages\n", BaseImageName, LargePageBase);
+    *ImageBaseAddress = LargePageBase;
+    return TRUE;
+#else
+    /* Kernel PDEs are per-process copies here, they can't be changed after boot */
+    DPRINT1("Large page drivers not supported!\n");
     return FALSE;
+#endif
 }
 
 VOID
@@ -2446,8 +2469,8 @@ MiWriteProtectSystemImage(
         return;
     }
 
-    /* Large page mapped images are not supported */
-    NT_ASSERT(!MI_IS_PHYSICAL_ADDRESS(ImageBase));
+    /* Large page mapped images have no PTEs to protect */
+    if (MI_IS_PHYSICAL_ADDRESS(ImageBase)) return;
 
     /* Session images are not yet supported */
     NT_ASSERT(!MI_IS_SESSION_ADDRESS(ImageBase));
@@ -3079,7 +3102,7 @@ LoaderScan:
         if (NT_SUCCESS(Status))
         {
             /* Support large pages for drivers */
-            MiUseLargeDriverPage(DriverSize / PAGE_SIZE,
+            MiUseLargeDriverPage(BYTES_TO_PAGES(DriverSize),
                                  &ModuleLoadBase,
                                  &BaseName,
                                  TRUE);
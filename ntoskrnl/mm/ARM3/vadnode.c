@@ -201,7 +201,7 @@ MiInsertVad(IN PMMVAD Vad,
 
 NTSTATUS
 NTAPI
-MiInsertVadEx(
+MiInsertVadExLocked(
     _Inout_ PMMVAD Vad,
     _In_ ULONG_PTR *BaseAddress,
     _In_ SIZE_T ViewSize,
@@ -221,11 +221,9 @@ MiInsertVadEx(
     /* Get the current process */
     CurrentProcess = PsGetCurrentProcess();
 
-    /* Acquire the address creation lock and make sure the process is alive */
-    KeAcquireGuardedMutex(&CurrentProcess->AddressCreationLock);
+    /* The caller holds the address creation lock, make sure the process is alive */
     if (CurrentProcess->VmDeleted)
     {
-        KeReleaseGuardedMutex(&CurrentProcess->AddressCreationLock);
         DPRINT1("The process is dying\n");
         return STATUS_PROCESS_IS_TERMINATING;
     }
@@ -264,7 +262,6 @@ MiInsertVadEx(
         if ((Result == TableFoundNode) || (EndingAddress > HighestAddress))
         {
             DPRINT1("Not enough free space to insert this VAD node!\n");
-            KeReleaseGuardedMutex(&CurrentProcess->AddressCreationLock);
             return STATUS_NO_MEMORY;
         }
 
@@ -286,7 +283,6 @@ MiInsertVadEx(
         if (Result == TableFoundNode)
         {
             DPRINT("Given address conflicts with existing node\n");
-            KeReleaseGuardedMutex(&CurrentProcess->AddressCreationLock);
             return STATUS_CONFLICTING_ADDRESSES;
         }
     }
@@ -333,13 +329,36 @@ MiInsertVadEx(
         CurrentProcess->PeakVirtualSize = CurrentProcess->VirtualSize;
     }
 
-    /* Unlock the address space */
-    KeReleaseGuardedMutex(&CurrentProcess->AddressCreationLock);
-
     *BaseAddress = StartingAddress;
     return STATUS_SUCCESS;
 }
 
+NTSTATUS
+NTAPI
+MiInsertVadEx(
+    _Inout_ PMMVAD Vad,
+    _In_ ULONG_PTR *BaseAddress,
+    _In_ SIZE_T ViewSize,
+    _In_ ULONG_PTR HighestAddress,
+    _In_ ULONG_PTR Alignment,
+    _In_ ULONG AllocationType)
+{
+    PEPROCESS CurrentProcess = PsGetCurrentProcess();
+    NTSTATUS Status;
+
+    /* Acquire the address creation lock around the insertion */
+    KeAcquireGuardedMutex(&CurrentProcess->AddressCreationLock);
+    Status = MiInsertVadExLocked(Vad,
+                                 BaseAddress,
+                                 ViewSize,
+                                 HighestAddress,
+                                 Alignment,
+                                 AllocationType);
+    KeReleaseGuardedMutex(&CurrentProcess->AddressCreationLock);
+
+    return Status;
+}
+
 VOID
 NTAPI
 MiInsertBasedSection(IN PSECTION Section)
@@ -605,6 +605,23 @@ MiDeleteVirtualAddresses(IN ULONG_PTR Va,
         ASSERT(PointerPde->u.Hard.Valid == 1);
         ASSERT(Va <= EndingAddress);
 
+        /* A large page is mapped by the PDE itself, so free it all at once */
+        if (MI_IS_PAGE_LARGE(PointerPde))
+        {
+            ASSERT((Va & (PDE_MAPPED_VA - 1)) == 0);
+            OldIrql = MiAcquirePfnLock();
+            MiDeleteLargePage(PointerPde);
+            MiReleasePfnLock(OldIrql);
+
+            /* Get out if we're done, or move to the next PDE */
+            Va += PDE_MAPPED_VA;
+            if (Va > EndingAddress) return;
+            PointerPde = MiAddressToPde(Va);
+            PointerPte = MiAddressToPte(Va);
+            AddressGap = FALSE;
+            continue;
+        }
+
         /* Check if this is a section VAD with gaps in it */
         if ((AddressGap) && (LastPrototypePte))
         {
@@ -1462,6 +1479,14 @@ MiQueryAddressState(IN PVOID Va,
     ASSERT((Vad->StartingVpn <= ((ULONG_PTR)Va >> PAGE_SHIFT)) &&
            (Vad->EndingVpn >= ((ULONG_PTR)Va >> PAGE_SHIFT)));
 
+    /* Large page VADs are always fully committed, with the VAD protection */
+    if (Vad->u.VadFlags.VadType == VadLargePages)
+    {
+        *ReturnedProtect = MmProtectToValue[Vad->u.VadFlags.Protection];
+        *NextVa = (PVOID)((Vad->EndingVpn + 1) << PAGE_SHIFT);
+        return MEM_COMMIT;
+    }
+
     /* Only normal VADs supported */
     ASSERT(Vad->u.VadFlags.VadType == VadNone);
 
@@ -4389,6 +4414,8 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
     PMMPTE PointerPte, LastPte;
     PMMPDE PointerPde;
     TABLE_SEARCH_RESULT Result;
+    PPFN_NUMBER LargePageFrames;
+    PFN_NUMBER LargePageCount;
     PAGED_CODE();
 
     /* Check for valid Zero bits */
@@ -4423,11 +4450,11 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
     /* Check if large pages are being used */
     if (AllocationType & MEM_LARGE_PAGES)
     {
-        /* Large page allocations MUST be committed */
-        if (!(AllocationType & MEM_COMMIT))
+        /* Large page allocations MUST be reserved and committed at once */
+        if ((AllocationType & (MEM_RESERVE | MEM_COMMIT)) != (MEM_RESERVE | MEM_COMMIT))
         {
-            DPRINT1("Must supply MEM_COMMIT with MEM_LARGE_PAGES\n");
-            return STATUS_INVALID_PARAMETER_5;
+            DPRINT1("Must supply MEM_RESERVE and MEM_COMMIT with MEM_LARGE_PAGES\n");
+            return STATUS_INVALID_PARAMETER;
         }
 
         /* These flags are not allowed with large page allocations */
@@ -4569,7 +4596,7 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
     //
     // Fail on the things we don't yet support
     //
-    if ((AllocationType & MEM_LARGE_PAGES) == MEM_LARGE_PAGES)
+    if (((AllocationType & MEM_LARGE_PAGES) == MEM_LARGE_PAGES) && !(MmLargePageMinimum))
     {
         DPRINT1("MEM_LARGE_PAGES not supported\n");
         Status = STATUS_INVALID_PARAMETER;
@@ -4604,6 +4631,29 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
             goto FailPathNoLock;
         }
 
+        //
+        // Large pages are mapped by a single PDE, so they are always cached and
+        // accessible, and the allocation must cover whole large pages
+        //
+        if (AllocationType & MEM_LARGE_PAGES)
+        {
+            if ((Protect & (PAGE_NOCACHE | PAGE_WRITECOMBINE | PAGE_GUARD)) ||
+                (ProtectionMask == MM_NOACCESS))
+            {
+                DPRINT1("Invalid protection for large pages\n");
+                Status = STATUS_INVALID_PAGE_PROTECTION;
+                goto FailPathNoLock;
+            }
+
+            if ((PRegionSize & (MmLargePageMinimum - 1)) ||
+                ((ULONG_PTR)PBaseAddress & (MmLargePageMinimum - 1)))
+            {
+                DPRINT1("Large page allocations must be large page aligned\n");
+                Status = STATUS_INVALID_PARAMETER;
+                goto FailPathNoLock;
+            }
+        }
+
         //
         // Does the caller have an address in mind, or is this a blind commit?
         //
@@ -4659,21 +4709,92 @@ NtAllocateVirtualMemory(IN HANDLE ProcessHandle,
         if (AllocationType & MEM_COMMIT) Vad->u.VadFlags.MemCommit = 1;
         Vad->u.VadFlags.Protection = ProtectionMask;
         Vad->u.VadFlags.PrivateMemory = 1;
+        if (AllocationType & MEM_LARGE_PAGES) Vad->u.VadFlags.VadType = VadLargePages;
         Vad->ControlArea = NULL; // For Memory-Area hack
 
         //
-        // Insert the VAD
+        // Large pages can't be demand-faulted, so back them right away
         //
-        Status = MiInsertVadEx(Vad,
-                               &StartingAddress,
-                               PRegionSize,
-                               HighestAddress,
-                               MM_VIRTMEM_GRANULARITY,
-                               AllocationType);
-        if (!NT_SUCCESS(Status))
+        if (Vad->u.VadFlags.VadType == VadLargePages)
         {
-            DPRINT1("Failed to insert the VAD!\n");
-            goto FailPathNoLock;
+            //
+            // Get the pages before the VAD exists, so that no fault or free can
+            // see it half built, and mapping them can't run out of memory
+            //
+            LargePageCount = PRegionSize / MmLargePageMinimum;
+            LargePageFrames = ExAllocatePoolWithTag(NonPagedPool,
+                                                    LargePageCount * sizeof(PFN_NUMBER),
+                                                    'gPmM');
+            if (LargePageFrames == NULL)
+            {
+                ExFreePoolWithTag(Vad, 'SdaV');
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto FailPathNoLock;
+            }
+
+            Status = MiAllocateLargePages(LargePageCount, LargePageFrames);
+            if (!NT_SUCCESS(Status))
+            {
+                ExFreePoolWithTag(LargePageFrames, 'gPmM');
+                ExFreePoolWithTag(Vad, 'SdaV');
+                goto FailPathNoLock;
+            }
+
+            //
+            // Insert the VAD and map it under one hold of the address space lock
+            //
+            AddressSpace = MmGetCurrentAddressSpace();
+            MmLockAddressSpace(AddressSpace);
+            Status = MiInsertVadExLocked(Vad,
+                                         &StartingAddress,
+                                         PRegionSize,
+                                         HighestAddress,
+                                         MmLargePageMinimum,
+                                         AllocationType);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT1("Failed to insert the VAD!\n");
+                MmUnlockAddressSpace(AddressSpace);
+                MiFreeLargePages(LargePageCount, LargePageFrames);
+                ExFreePoolWithTag(LargePageFrames, 'gPmM');
+                ExFreePoolWithTag(Vad, 'SdaV');
+                goto FailPathNoLock;
+            }
+
+            Status = MiMapLargePages(Process, Vad, LargePageFrames);
+            ExFreePoolWithTag(LargePageFrames, 'gPmM');
+            if (!NT_SUCCESS(Status))
+            {
+                //
+                // The pages are gone already, undo the VAD insertion
+                //
+                DPRINT1("Failed to map the large pages!\n");
+                MiLockProcessWorkingSetUnsafe(Process, CurrentThread);
+                MiRemoveNode((PMMADDRESS_NODE)Vad, &Process->VadRoot);
+                MiUnlockProcessWorkingSetUnsafe(Process, CurrentThread);
+                Process->VirtualSize -= PRegionSize;
+                MmUnlockAddressSpace(AddressSpace);
+                ExFreePoolWithTag(Vad, 'SdaV');
+                goto FailPathNoLock;
+            }
+            MmUnlockAddressSpace(AddressSpace);
+        }
+        else
+        {
+            //
+            // Insert the VAD
+            //
+            Status = MiInsertVadEx(Vad,
+                                   &StartingAddress,
+                                   PRegionSize,
+                                   HighestAddress,
+                                   MM_VIRTMEM_GRANULARITY,
+                                   AllocationType);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT1("Failed to insert the VAD!\n");
+                goto FailPathNoLock;
+            }
         }
 
         //
@@ -5266,9 +5387,23 @@ NtFreeVirtualMemory(IN HANDLE ProcessHandle,
     if (FreeType & MEM_RELEASE)
     {
         //
-        // ARM3 only supports this VAD in this path
+        // ARM3 only supports these VADs in this path
         //
-        ASSERT(Vad->u.VadFlags.VadType == VadNone);
+        ASSERT((Vad->u.VadFlags.VadType == VadNone) ||
+               (Vad->u.VadFlags.VadType == VadLargePages));
+
+        //
+        // Large page allocations can only be released as a whole
+        //
+        if ((Vad->u.VadFlags.VadType == VadLargePages) &&
+            (PRegionSize) &&
+            (((StartingAddress >> PAGE_SHIFT) != Vad->StartingVpn) ||
+             ((EndingAddress >> PAGE_SHIFT) != Vad->EndingVpn)))
+        {
+            DPRINT1("Cannot release part of a large page allocation\n");
+            Status = STATUS_FREE_VM_NOT_AT_BASE;
+            goto FailPath;
+        }
 
         //
         // Is the caller trying to remove the whole VAD, or remove only a portion
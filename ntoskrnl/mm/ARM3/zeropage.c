@@ -18,6 +18,10 @@
 /* GLOBALS ********************************************************************/
 
 KEVENT MmZeroingPageEvent;
+PFN_NUMBER MmZeroedPageTarget;
+
+/* Pages zeroed per PFN lock acquisition, two batches fit in the zeroing PTEs */
+#define MI_ZERO_BATCH_PAGES (MI_ZERO_PTES / 2)
 
 /* PRIVATE FUNCTIONS **********************************************************/
 
@@ -31,22 +35,58 @@ NTAPI
 MiFreeInitializationCode(IN PVOID StartVa,
 IN PVOID EndVa);
 
+static
+PMMPFN
+MiRemoveFreePagesForZeroing(OUT PPFN_NUMBER PageCount)
+{
+    PFN_NUMBER PageIndex, FreePage;
+    PMMPFN Pfn1, FirstPfn = (PMMPFN)LIST_HEAD;
+    PFN_NUMBER Count = 0;
+
+    MI_ASSERT_PFN_LOCK_HELD();
+
+    /* Stop once the zeroed pool is deep enough, the remaining pages stay free */
+    while ((Count < MI_ZERO_BATCH_PAGES) &&
+           (MmFreePageListHead.Total != 0) &&
+           (MmZeroedPageListHead.Total + Count < MmZeroedPageTarget))
+    {
+        PageIndex = MmFreePageListHead.Flink;
+        ASSERT(PageIndex != LIST_HEAD);
+        Pfn1 = MiGetPfnEntry(PageIndex);
+        MI_SET_USAGE(MI_USAGE_ZERO_LOOP);
+        MI_SET_PROCESS2("Kernel 0 Loop");
+        FreePage = MiRemoveAnyPage(MI_GET_PAGE_COLOR(PageIndex));
+
+        /* The first global free page should also be the first on its own list */
+        if (FreePage != PageIndex)
+        {
+            KeBugCheckEx(PFN_LIST_CORRUPT,
+                         0x8F,
+                         FreePage,
+                         PageIndex,
+                         0);
+        }
+
+        /* Chain the pages the way MiMapPagesInZeroSpace expects them */
+        Pfn1->u1.Flink = (PFN_NUMBER)FirstPfn;
+        FirstPfn = Pfn1;
+        Count++;
+    }
+
+    *PageCount = Count;
+    return FirstPfn;
+}
+
+static
 VOID
-NTAPI
-MmZeroPageThread(VOID)
+MiZeroPageLoop(IN PMMPTE FirstZeroingPte)
 {
     PKTHREAD Thread = KeGetCurrentThread();
-    PVOID StartAddress, EndAddress;
     PVOID WaitObjects[2];
     KIRQL OldIrql;
     PVOID ZeroAddress;
-    PFN_NUMBER PageIndex, FreePage;
-    PMMPFN Pfn1;
-
-    /* Get the discardable sections to free them */
-    MiFindInitializationCode(&StartAddress, &EndAddress);
-    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
-    DPRINT("Free non-cache pages: %lx\n", MmAvailablePages + MiMemoryConsumers[MC_CACHE].PagesUsed);
+    PFN_NUMBER PageCount;
+    PMMPFN Pfn1, NextPfn;
 
     /* Set our priority to 0 */
     Thread->BasePriority = 0;
@@ -70,43 +110,110 @@ MmZeroPageThread(VOID)
 
         while (TRUE)
         {
-            if (!MmFreePageListHead.Total)
+            Pfn1 = MiRemoveFreePagesForZeroing(&PageCount);
+            if (!PageCount)
             {
+                /* Nothing left to do, until pages are freed or zeroed pages used */
                 KeClearEvent(&MmZeroingPageEvent);
                 MiReleasePfnLock(OldIrql);
                 break;
             }
 
-            PageIndex = MmFreePageListHead.Flink;
-            ASSERT(PageIndex != LIST_HEAD);
-            Pfn1 = MiGetPfnEntry(PageIndex);
-            MI_SET_USAGE(MI_USAGE_ZERO_LOOP);
-            MI_SET_PROCESS2("Kernel 0 Loop");
-            FreePage = MiRemoveAnyPage(MI_GET_PAGE_COLOR(PageIndex));
+            MiReleasePfnLock(OldIrql);
+
+            /* Zero the whole batch through a single mapping */
+            ZeroAddress = MiMapPagesInZeroSpace(FirstZeroingPte, Pfn1, PageCount);
+            ASSERT(ZeroAddress);
+            KeZeroPagesFromIdleThread(ZeroAddress, (ULONG)(PageCount * PAGE_SIZE));
+            MiUnmapPagesInZeroSpace(ZeroAddress, PageCount);
 
-            /* The first global free page should also be the first on its own list */
-            if (FreePage != PageIndex)
+            OldIrql = MiAcquirePfnLock();
+
+            while (Pfn1 != (PMMPFN)LIST_HEAD)
             {
-                KeBugCheckEx(PFN_LIST_CORRUPT,
-                             0x8F,
-                             FreePage,
-                             PageIndex,
-                             0);
+                /* Inserting the page overwrites the chain link */
+                NextPfn = (PMMPFN)Pfn1->u1.Flink;
+                MiInsertPageInList(&MmZeroedPageListHead, MiGetPfnEntryIndex(Pfn1));
+                Pfn1 = NextPfn;
             }
+        }
+    }
+}
 
-            Pfn1->u1.Flink = LIST_HEAD;
-            MiReleasePfnLock(OldIrql);
+static
+VOID
+NTAPI
+MiZeroPageWorkerThread(IN PVOID Context)
+{
+    ULONG Processor = PtrToUlong(Context);
+    PMMPTE FirstZeroingPte;
 
-            ZeroAddress = MiMapPagesInZeroSpace(Pfn1, 1);
-            ASSERT(ZeroAddress);
-            RtlZeroMemory(ZeroAddress, PAGE_SIZE);
-            MiUnmapPagesInZeroSpace(ZeroAddress, 1);
+    /* Stay on our processor, the zeroing PTEs are only flushed locally */
+    KeSetSystemAffinityThread(AFFINITY_MASK(Processor));
 
-            OldIrql = MiAcquirePfnLock();
+    /* Get our own zeroing PTEs, set up like the boot processor's */
+    FirstZeroingPte = MiReserveSystemPtes(MI_ZERO_PTES + 1, SystemPteSpace);
+    if (!FirstZeroingPte)
+    {
+        DPRINT1("No zeroing PTEs for processor %lu\n", Processor);
+        PsTerminateSystemThread(STATUS_INSUFFICIENT_RESOURCES);
+    }
+    RtlZeroMemory(FirstZeroingPte, (MI_ZERO_PTES + 1) * sizeof(MMPTE));
+    FirstZeroingPte->u.Hard.PageFrameNumber = MI_ZERO_PTES;
+
+    MiZeroPageLoop(FirstZeroingPte);
+}
 
-            MiInsertPageInList(&MmZeroedPageListHead, PageIndex);
+VOID
+NTAPI
+MmZeroPageThread(VOID)
+{
+    PVOID StartAddress, EndAddress;
+    HANDLE ThreadHandle;
+    NTSTATUS Status;
+    ULONG Processor;
+    KIRQL OldIrql;
+
+    /* Get the discardable sections to free them */
+    MiFindInitializationCode(&StartAddress, &EndAddress);
+    if (StartAddress) MiFreeInitializationCode(StartAddress, EndAddress);
+    DPRINT("Free non-cache pages: %lx\n", MmAvailablePages + MiMemoryConsumers[MC_CACHE].PagesUsed);
+
+    /*
+     * Keep an eighth of memory zeroed, between 1 and 64MB, so that demand zero
+     * faults rarely have to zero the page themselves
+     */
+    MmZeroedPageTarget = MmNumberOfPhysicalPages / 8;
+    MmZeroedPageTarget = max(MmZeroedPageTarget, _1MB / PAGE_SIZE);
+    MmZeroedPageTarget = min(MmZeroedPageTarget, (64 * _1MB) / PAGE_SIZE);
+
+    /* Every other processor gets its own zeroing thread */
+    for (Processor = 1; Processor < (ULONG)KeNumberProcessors; Processor++)
+    {
+        Status = PsCreateSystemThread(&ThreadHandle,
+                                      THREAD_ALL_ACCESS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      MiZeroPageWorkerThread,
+                                      UlongToPtr(Processor));
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Failed to create zero page thread for processor %lu: 0x%lx\n", Processor, Status);
+            continue;
         }
+        ObCloseHandle(ThreadHandle, KernelMode);
     }
+
+    /* This thread zeroes on the boot processor, with the zeroing PTEs reserved at boot */
+    KeSetSystemAffinityThread(AFFINITY_MASK(0));
+
+    /* Fill the pool right away if there is already work to do */
+    OldIrql = MiAcquirePfnLock();
+    MiSignalZeroPageThreads();
+    MiReleasePfnLock(OldIrql);
+
+    MiZeroPageLoop(MiFirstReservedZeroingPte);
 }
 
 /* EOF */
@@ -221,6 +221,13 @@ MmAccessFault(IN ULONG FaultCode,
 #endif
     }
 
+    /* Account the fault, to the process as well if it hit its address space */
+    KeGetCurrentPrcb()->MmPageFaultCount++;
+    if (Address <= MM_HIGHEST_USER_ADDRESS)
+    {
+        InterlockedIncrement((PLONG)&PsGetCurrentProcess()->Vm.PageFaultCount);
+    }
+
     /* Handle shared user page, which doesn't have a VAD / MemoryArea */
     if (PAGE_ALIGN(Address) == (PVOID)MM_SHARED_USER_DATA_VA)
     {
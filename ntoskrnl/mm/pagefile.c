@@ -196,18 +196,44 @@ MmReadFromSwapPage(SWAPENTRY SwapEntry, PFN_NUMBER Page)
     return MiReadPageFile(Page, FILE_FROM_ENTRY(SwapEntry), OFFSET_FROM_ENTRY(SwapEntry) - 1);
 }
 
+NTSTATUS
+NTAPI
+MmReadFromSwapPages(SWAPENTRY SwapEntry, PPFN_NUMBER Pages, ULONG PageCount)
+{
+    return MiReadPageFileRun(Pages, PageCount, FILE_FROM_ENTRY(SwapEntry), OFFSET_FROM_ENTRY(SwapEntry) - 1);
+}
+
+SWAPENTRY
+NTAPI
+MmGetAdjacentSwapEntry(SWAPENTRY SwapEntry, ULONG Distance)
+{
+    /* The entry for the slot Distance pages further in the same paging file */
+    return ENTRY_FROM_FILE_OFFSET(FILE_FROM_ENTRY(SwapEntry), OFFSET_FROM_ENTRY(SwapEntry) + Distance);
+}
+
 NTSTATUS
 NTAPI
 MiReadPageFile(
     _In_ PFN_NUMBER Page,
     _In_ ULONG PageFileIndex,
     _In_ ULONG_PTR PageFileOffset)
+{
+    return MiReadPageFileRun(&Page, 1, PageFileIndex, PageFileOffset);
+}
+
+NTSTATUS
+NTAPI
+MiReadPageFileRun(
+    _In_reads_(PageCount) PPFN_NUMBER Pages,
+    _In_ ULONG PageCount,
+    _In_ ULONG PageFileIndex,
+    _In_ ULONG_PTR PageFileOffset)
 {
     LARGE_INTEGER file_offset;
     IO_STATUS_BLOCK Iosb;
     NTSTATUS Status;
     KEVENT Event;
-    UCHAR MdlBase[sizeof(MDL) + sizeof(ULONG)];
+    UCHAR MdlBase[sizeof(MDL) + MM_PAGE_IN_CLUSTER_PAGES * sizeof(PFN_NUMBER)];
     PMDL Mdl = (PMDL)MdlBase;
     PMMPAGING_FILE PagingFile;
 
@@ -220,6 +246,7 @@ MiReadPageFile(
     }
 
     ASSERT(PageFileIndex < MAX_PAGING_FILES);
+    ASSERT((PageCount != 0) && (PageCount <= MM_PAGE_IN_CLUSTER_PAGES));
 
     PagingFile = MmPagingFile[PageFileIndex];
 
@@ -229,8 +256,9 @@ MiReadPageFile(
         KeBugCheck(MEMORY_MANAGEMENT);
     }
 
-    MmInitializeMdl(Mdl, NULL, PAGE_SIZE);
-    MmBuildMdlFromPages(Mdl, &Page);
+    /* The pages are read with a single paging I/O */
+    MmInitializeMdl(Mdl, NULL, PageCount * PAGE_SIZE);
+    MmBuildMdlFromPages(Mdl, Pages);
     Mdl->MdlFlags |= MDL_PAGES_LOCKED;
 
     file_offset.QuadPart = PageFileOffset * PAGE_SIZE;
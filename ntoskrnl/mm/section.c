@@ -1359,6 +1359,166 @@ MmAlterViewAttributes(PMMSUPPORT AddressSpace,
     MmUnlockSectionSegment(Segment);
 }
 
+/*
+ * Returns how many pages, starting with the faulting one, can be brought in
+ * together. The following pages must be in the same view and region, not be
+ * mapped nor have a private page, and be in the same state in the segment:
+ * not loaded when SwapEntry is 0, otherwise in the paging file right after
+ * SwapEntry so that they can all be read at once.
+ */
+static
+ULONG
+MmGetSectionFaultCluster(PEPROCESS Process,
+                         PMEMORY_AREA MemoryArea,
+                         PMM_REGION Region,
+                         PVOID PAddress,
+                         PLARGE_INTEGER Offset,
+                         SWAPENTRY SwapEntry)
+{
+    PMM_SECTION_SEGMENT Segment = MemoryArea->Data.SectionData.Segment;
+    LARGE_INTEGER NextOffset;
+    LONGLONG EndOffset;
+    ULONG_PTR Entry;
+    PVOID NextAddress;
+    ULONG Count;
+
+    /* Don't read ahead when memory is short */
+    if (MmAvailablePages < MmLowMemoryThreshold)
+    {
+        return 1;
+    }
+
+    /* Pages past the file data are zero filled, not read */
+    EndOffset = Segment->Length.QuadPart;
+    if (SwapEntry == 0)
+    {
+        EndOffset = min(EndOffset, (LONGLONG)PAGE_ROUND_UP(Segment->RawLength.QuadPart));
+    }
+
+    for (Count = 1; Count < MM_PAGE_IN_CLUSTER_PAGES; Count++)
+    {
+        NextAddress = (PVOID)((ULONG_PTR)PAddress + Count * PAGE_SIZE);
+        NextOffset.QuadPart = Offset->QuadPart + Count * PAGE_SIZE;
+        if (((ULONG_PTR)NextAddress >= MA_GetEndingAddress(MemoryArea)) ||
+            (NextOffset.QuadPart >= EndOffset))
+        {
+            break;
+        }
+
+        if ((MmFindRegion((PVOID)MA_GetStartingAddress(MemoryArea),
+                          &MemoryArea->Data.SectionData.RegionListHead,
+                          NextAddress, NULL) != Region) ||
+            MmIsPagePresent(Process, NextAddress) ||
+            MmIsDisabledPage(Process, NextAddress) ||
+            MmIsPageSwapEntry(Process, NextAddress))
+        {
+            break;
+        }
+
+        Entry = MmGetPageEntrySectionSegment(Segment, &NextOffset);
+        if (SwapEntry == 0)
+        {
+            if (Entry != 0)
+                break;
+        }
+        else if (!IS_SWAP_FROM_SSE(Entry) || MM_IS_WAIT_PTE(Entry) ||
+                 (SWAPENTRY_FROM_SSE(Entry) != MmGetAdjacentSwapEntry(SwapEntry, Count)))
+        {
+            break;
+        }
+    }
+
+    return Count;
+}
+
+/*
+ * Maps the pages read along with a faulting one, the first entry of Pages
+ * being the faulting page itself. The address space and segment are locked.
+ * Pages from the paging file are only mapped if nobody loaded them meanwhile,
+ * pages from the file were marked as being waited for and are always mapped.
+ */
+static
+VOID
+MmMapSectionFaultCluster(PEPROCESS Process,
+                         PMM_SECTION_SEGMENT Segment,
+                         PVOID PAddress,
+                         PLARGE_INTEGER Offset,
+                         ULONG Protect,
+                         PPFN_NUMBER Pages,
+                         ULONG PageCount,
+                         SWAPENTRY SwapEntry)
+{
+    LARGE_INTEGER NextOffset;
+    SWAPENTRY NextSwapEntry = 0;
+    SWAPENTRY FakeSwapEntry;
+    PVOID NextAddress;
+    NTSTATUS Status;
+    ULONG i;
+
+    for (i = 1; i < PageCount; i++)
+    {
+        NextAddress = (PVOID)((ULONG_PTR)PAddress + i * PAGE_SIZE);
+        NextOffset.QuadPart = Offset->QuadPart + i * PAGE_SIZE;
+
+        if (SwapEntry != 0)
+        {
+            NextSwapEntry = MmGetAdjacentSwapEntry(SwapEntry, i);
+            if ((MmGetPageEntrySectionSegment(Segment, &NextOffset) != MAKE_SWAP_SSE(NextSwapEntry)) ||
+                MmIsPagePresent(Process, NextAddress) ||
+                MmIsPageSwapEntry(Process, NextAddress))
+            {
+                MmReleasePageMemoryConsumer(MC_USER, Pages[i]);
+                continue;
+            }
+            MmSetSavedSwapEntryPage(Pages[i], NextSwapEntry);
+        }
+        else
+        {
+            MmDeletePageFileMapping(Process, NextAddress, &FakeSwapEntry);
+        }
+
+        Status = MmCreateVirtualMapping(Process,
+                                        NextAddress,
+                                        Protect,
+                                        &Pages[i],
+                                        1);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Unable to create virtual mapping\n");
+            KeBugCheck(MEMORY_MANAGEMENT);
+        }
+        MmInsertRmap(Pages[i], Process, NextAddress);
+        MmSetPageEntrySectionSegment(Segment, &NextOffset, MAKE_SSE(Pages[i] << PAGE_SHIFT, 1));
+    }
+}
+
+/*
+ * Gives up on file pages which were marked as being waited for, but could
+ * not be read. The address space and segment are locked.
+ */
+static
+VOID
+MmAbortSectionFaultCluster(PEPROCESS Process,
+                           PMM_SECTION_SEGMENT Segment,
+                           PVOID PAddress,
+                           PLARGE_INTEGER Offset,
+                           ULONG FirstPage,
+                           ULONG PageCount)
+{
+    LARGE_INTEGER NextOffset;
+    SWAPENTRY FakeSwapEntry;
+    PVOID NextAddress;
+    ULONG i;
+
+    for (i = FirstPage; i < PageCount; i++)
+    {
+        NextAddress = (PVOID)((ULONG_PTR)PAddress + i * PAGE_SIZE);
+        NextOffset.QuadPart = Offset->QuadPart + i * PAGE_SIZE;
+        MmDeletePageFileMapping(Process, NextAddress, &FakeSwapEntry);
+        MmSetPageEntrySectionSegment(Segment, &NextOffset, 0);
+    }
+}
+
 NTSTATUS
 NTAPI
 MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
@@ -1602,23 +1762,48 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
     if (Entry == 0)
     {
         SWAPENTRY FakeSwapEntry;
+        PFN_NUMBER Pages[MM_PAGE_IN_CLUSTER_PAGES];
+        ULONG ClusterPages = 1, PagesRead, i;
+        BOOLEAN ZeroFill;
+        LARGE_INTEGER NextOffset;
+        PVOID NextAddress;
 
         /*
          * If the entry is zero (and it can't change because we have
          * locked the segment) then we need to load the page.
          */
+        ZeroFill = (Segment->Flags & MM_PAGEFILE_SEGMENT) ||
+                   ((Offset.QuadPart >= (LONGLONG)PAGE_ROUND_UP(Segment->RawLength.QuadPart) &&
+                     (Section->AllocationAttributes & SEC_IMAGE)));
+
+        /*
+         * Pages read from the file are likely to be followed by the next
+         * ones, so bring those in too while we are at it.
+         */
+        if (!ZeroFill)
+        {
+            ClusterPages = MmGetSectionFaultCluster(Process, MemoryArea, Region, PAddress, &Offset, 0);
+        }
 
         /*
          * Release all our locks and read in the page from disk
          */
         MmSetPageEntrySectionSegment(Segment, &Offset, MAKE_SWAP_SSE(MM_WAIT_ENTRY));
+        for (i = 1; i < ClusterPages; i++)
+        {
+            NextOffset.QuadPart = Offset.QuadPart + i * PAGE_SIZE;
+            MmSetPageEntrySectionSegment(Segment, &NextOffset, MAKE_SWAP_SSE(MM_WAIT_ENTRY));
+        }
         MmUnlockSectionSegment(Segment);
         MmCreatePageFileMapping(Process, PAddress, MM_WAIT_ENTRY);
+        for (i = 1; i < ClusterPages; i++)
+        {
+            NextAddress = (PVOID)((ULONG_PTR)PAddress + i * PAGE_SIZE);
+            MmCreatePageFileMapping(Process, NextAddress, MM_WAIT_ENTRY);
+        }
         MmUnlockAddressSpace(AddressSpace);
 
-        if ((Segment->Flags & MM_PAGEFILE_SEGMENT) ||
-                ((Offset.QuadPart >= (LONGLONG)PAGE_ROUND_UP(Segment->RawLength.QuadPart) &&
-                  (Section->AllocationAttributes & SEC_IMAGE))))
+        if (ZeroFill)
         {
             MI_SET_USAGE(MI_USAGE_SECTION);
             if (Process) MI_SET_PROCESS2(Process->ImageFileName);
@@ -1638,6 +1823,24 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
                 DPRINT1("MiReadPage failed (Status %x)\n", Status);
             }
         }
+
+        /*
+         * The following pages come from the same cache views, which the
+         * faulting page read in. Stop at the first one which fails.
+         */
+        PagesRead = 1;
+        if (NT_SUCCESS(Status))
+        {
+            Pages[0] = Page;
+            while (PagesRead < ClusterPages)
+            {
+                NextOffset.QuadPart = Offset.QuadPart + PagesRead * PAGE_SIZE;
+                if (!NT_SUCCESS(MiReadPage(MemoryArea, NextOffset.QuadPart, &Pages[PagesRead])))
+                    break;
+                PagesRead++;
+            }
+        }
+
         if (!NT_SUCCESS(Status))
         {
             /*
@@ -1647,6 +1850,12 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
              * Cleanup and release locks
              */
             MmLockAddressSpace(AddressSpace);
+            if (ClusterPages > 1)
+            {
+                MmLockSectionSegment(Segment);
+                MmAbortSectionFaultCluster(Process, Segment, PAddress, &Offset, 1, ClusterPages);
+                MmUnlockSectionSegment(Segment);
+            }
             MiSetPageEvent(Process, Address);
             DPRINT("Address 0x%p\n", Address);
             return(Status);
@@ -1675,6 +1884,10 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
         /* Set this section offset has being backed by our new page. */
         Entry = MAKE_SSE(Page << PAGE_SHIFT, 1);
         MmSetPageEntrySectionSegment(Segment, &Offset, Entry);
+
+        /* Map the pages read along, and let the next fault retry the others */
+        MmMapSectionFaultCluster(Process, Segment, PAddress, &Offset, Attributes, Pages, PagesRead, 0);
+        MmAbortSectionFaultCluster(Process, Segment, PAddress, &Offset, PagesRead, ClusterPages);
         MmUnlockSectionSegment(Segment);
 
         MiSetPageEvent(Process, Address);
@@ -1684,6 +1897,8 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
     else if (IS_SWAP_FROM_SSE(Entry))
     {
         SWAPENTRY SwapEntry;
+        PFN_NUMBER Pages[MM_PAGE_IN_CLUSTER_PAGES];
+        ULONG ClusterPages, PageCount;
 
         SwapEntry = SWAPENTRY_FROM_SSE(Entry);
 
@@ -1697,6 +1912,9 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
             return STATUS_MM_RESTART_OPERATION;
         }
 
+        /* Read the following pages too if they sit right after this one in the paging file */
+        ClusterPages = MmGetSectionFaultCluster(Process, MemoryArea, Region, PAddress, &Offset, SwapEntry);
+
         /*
         * Release all our locks and read in the page from disk
         */
@@ -1712,7 +1930,15 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
             KeBugCheck(MEMORY_MANAGEMENT);
         }
 
-        Status = MmReadFromSwapPage(SwapEntry, Page);
+        /* Don't wait for memory for the pages we were not asked for */
+        Pages[0] = Page;
+        for (PageCount = 1; PageCount < ClusterPages; PageCount++)
+        {
+            if (!NT_SUCCESS(MmRequestPageMemoryConsumer(MC_USER, FALSE, &Pages[PageCount])))
+                break;
+        }
+
+        Status = MmReadFromSwapPages(SwapEntry, Pages, PageCount);
         if (!NT_SUCCESS(Status))
         {
             KeBugCheck(MEMORY_MANAGEMENT);
@@ -1759,6 +1985,9 @@ MmNotPresentFaultSectionView(PMMSUPPORT AddressSpace,
          */
         Entry = MAKE_SSE(Page << PAGE_SHIFT, 1);
         MmSetPageEntrySectionSegment(Segment, &Offset, Entry);
+
+        /* Map the pages read along, unless someone else loaded them meanwhile */
+        MmMapSectionFaultCluster(Process, Segment, PAddress, &Offset, Region->Protect, Pages, PageCount, SwapEntry);
         MmUnlockSectionSegment(Segment);
 
         MiSetPageEvent(Process, Address);
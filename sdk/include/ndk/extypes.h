@@ -313,6 +313,15 @@ typedef enum _SYSTEM_INFORMATION_CLASS
     SystemPrefetchPathInformation,
     SystemVerifierFaultsInformation,
     MaxSystemInfoClass,
+#ifdef __REACTOS__
+    //
+    // ReactOS specific classes, kept well clear of the NT ones
+    //
+    MinRosSystemInfoClass = 0x1000,
+    SystemPoolTagProfileInformation = MinRosSystemInfoClass,
+    SystemSchedulerInformation,
+    MaxRosSystemInfoClass,
+#endif
 } SYSTEM_INFORMATION_CLASS;
 
 //
@@ -1140,6 +1149,45 @@ typedef struct _SYSTEM_POOLTAG_INFORMATION
     SYSTEM_POOLTAG TagInfo[1];
 } SYSTEM_POOLTAG_INFORMATION, *PSYSTEM_POOLTAG_INFORMATION;
 
+#ifdef __REACTOS__
+//
+// ReactOS specific: pool tag profiler
+//
+#define POOLTAG_PROFILE_CALLERS 4
+
+typedef struct _SYSTEM_POOLTAG_PROFILE
+{
+    union
+    {
+        UCHAR Tag[4];
+        ULONG TagUlong;
+    };
+    ULONG Allocs;
+    ULONG Frees;
+    SIZE_T AllocatedBytes;
+    SIZE_T FreedBytes;
+    SIZE_T Used;
+    SIZE_T PeakUsed;
+    PVOID Callers[POOLTAG_PROFILE_CALLERS];
+    ULONG CallerHits[POOLTAG_PROFILE_CALLERS];
+} SYSTEM_POOLTAG_PROFILE, *PSYSTEM_POOLTAG_PROFILE;
+
+typedef struct _SYSTEM_POOLTAG_PROFILE_INFORMATION
+{
+    ULONG Enabled;
+    ULONG SampleRate;
+    ULONG WindowSeconds;
+    ULONG Count;
+    SYSTEM_POOLTAG_PROFILE TagInfo[1];
+} SYSTEM_POOLTAG_PROFILE_INFORMATION, *PSYSTEM_POOLTAG_PROFILE_INFORMATION;
+
+typedef struct _SYSTEM_POOLTAG_PROFILE_CONTROL
+{
+    ULONG Enable;
+    ULONG SampleRate;
+} SYSTEM_POOLTAG_PROFILE_CONTROL, *PSYSTEM_POOLTAG_PROFILE_CONTROL;
+#endif
+
 // Class 23
 typedef struct _SYSTEM_INTERRUPT_INFORMATION
 {
@@ -1151,6 +1199,19 @@ typedef struct _SYSTEM_INTERRUPT_INFORMATION
     ULONG ApcBypassCount;
 } SYSTEM_INTERRUPT_INFORMATION, *PSYSTEM_INTERRUPT_INFORMATION;
 
+#ifdef __REACTOS__
+//
+// ReactOS specific: per processor scheduler statistics
+//
+typedef struct _SYSTEM_SCHEDULER_INFORMATION
+{
+    ULONG ReadyThreads;
+    ULONG Migrations;
+    ULONG Steals;
+    ULONG IdlePlacements;
+} SYSTEM_SCHEDULER_INFORMATION, *PSYSTEM_SCHEDULER_INFORMATION;
+#endif
+
 // Class 24
 typedef struct _SYSTEM_DPC_BEHAVIOR_INFORMATION
 {
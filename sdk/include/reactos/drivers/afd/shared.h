@@ -59,6 +59,33 @@ typedef struct _AFD_POLL_INFO {
     AFD_HANDLE			        Handles[1];
 } AFD_POLL_INFO, *PAFD_POLL_INFO;
 
+/* Persistent poll sets, held by a handle to AFD which isn't a socket */
+#define AFD_POLL_ADD			0
+#define AFD_POLL_MODIFY			1
+#define AFD_POLL_REMOVE			2
+
+/* Disarm the socket once it has been reported, until AFD_POLL_MODIFY */
+#define AFD_POLL_ONESHOT		0x1L
+
+typedef struct _AFD_POLL_CONTROL_INFO {
+    ULONG				Operation;
+    SOCKET				Handle;
+    ULONG				Events;
+    ULONG				Flags;
+    ULONG_PTR				Context;
+} AFD_POLL_CONTROL_INFO, *PAFD_POLL_CONTROL_INFO;
+
+typedef struct _AFD_POLL_EVENT {
+    ULONG_PTR				Context;
+    ULONG				Events;
+} AFD_POLL_EVENT, *PAFD_POLL_EVENT;
+
+typedef struct _AFD_POLL_WAIT_INFO {
+    LARGE_INTEGER			Timeout;
+    ULONG				EventCount;
+    AFD_POLL_EVENT			Events[1];
+} AFD_POLL_WAIT_INFO, *PAFD_POLL_WAIT_INFO;
+
 typedef struct _AFD_ACCEPT_DATA {
     ULONG				UseSAN;
     ULONG				SequenceNumber;
@@ -261,6 +288,8 @@ typedef struct _AFD_TDI_HANDLE_DATA
 #define AFD_DEFER_ACCEPT		35
 #define AFD_GET_PENDING_CONNECT_DATA	41
 #define AFD_VALIDATE_GROUP		42
+#define AFD_POLL_CONTROL		43
+#define AFD_POLL_WAIT			44
 
 /* AFD IOCTLs */
 
@@ -336,6 +365,10 @@ typedef struct _AFD_TDI_HANDLE_DATA
   _AFD_CONTROL_CODE(AFD_ENUM_NETWORK_EVENTS, METHOD_NEITHER)
 #define IOCTL_AFD_VALIDATE_GROUP \
   _AFD_CONTROL_CODE(AFD_VALIDATE_GROUP, METHOD_NEITHER)
+#define IOCTL_AFD_POLL_CONTROL \
+  _AFD_CONTROL_CODE(AFD_POLL_CONTROL, METHOD_BUFFERED)
+#define IOCTL_AFD_POLL_WAIT \
+  _AFD_CONTROL_CODE(AFD_POLL_WAIT, METHOD_BUFFERED)
 
 typedef struct _AFD_SOCKET_INFORMATION {
     BOOL CommandChannel;
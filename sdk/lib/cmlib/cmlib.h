@@ -179,6 +179,13 @@
     #define _WINNLS_
 #endif
 
+/* Not in the kernel-mode headers, but exported by the RTL */
+ULONG NTAPI
+RtlFindNextForwardRunSet(
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG FromIndex,
+    OUT PULONG StartingRunIndex);
+
 
 //
 // These define the Debug Masks Supported
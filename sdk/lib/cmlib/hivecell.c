@@ -171,78 +171,142 @@ HvpComputeFreeListIndex(
     return Index;
 }
 
+/*
+ * Free cells are kept on doubly linked lists, one per size class, so that
+ * a cell can be unlinked without walking its list. The links are stored
+ * in the data of the free cell.
+ */
+typedef struct _HCELL_FREE_LINKS
+{
+    HCELL_INDEX Next;
+    HCELL_INDEX Prev;
+} HCELL_FREE_LINKS, *PHCELL_FREE_LINKS;
+
+/*
+ * Cells too small to hold the links can't be allocated anyway (allocations
+ * are rounded to 16 bytes), they are left out of the lists and only merged
+ * with their neighbors when those get freed.
+ */
+#define HvpIsFreeCellListed(Size) ((ULONG)(Size) >= sizeof(HCELL) + sizeof(HCELL_FREE_LINKS))
+
+static __inline PHCELL_FREE_LINKS CMAPI
+HvpGetFreeCellLinks(
+    PHHIVE RegistryHive,
+    HCELL_INDEX CellIndex)
+{
+    return (PHCELL_FREE_LINKS)HvGetCell(RegistryHive, CellIndex);
+}
+
 static NTSTATUS CMAPI
 HvpAddFree(
     PHHIVE RegistryHive,
     PHCELL FreeBlock,
     HCELL_INDEX FreeIndex)
 {
-    PHCELL_INDEX FreeBlockData;
-    HSTORAGE_TYPE Storage;
+    PHCELL_FREE_LINKS FreeLinks;
+    PDUAL Storage;
     ULONG Index;
 
     ASSERT(RegistryHive != NULL);
     ASSERT(FreeBlock != NULL);
 
-    Storage = HvGetCellType(FreeIndex);
+    if (!HvpIsFreeCellListed(FreeBlock->Size))
+        return STATUS_SUCCESS;
+
+    Storage = &RegistryHive->Storage[HvGetCellType(FreeIndex)];
     Index = HvpComputeFreeListIndex((ULONG)FreeBlock->Size);
 
-    FreeBlockData = (PHCELL_INDEX)(FreeBlock + 1);
-    *FreeBlockData = RegistryHive->Storage[Storage].FreeDisplay[Index];
-    RegistryHive->Storage[Storage].FreeDisplay[Index] = FreeIndex;
+    FreeLinks = (PHCELL_FREE_LINKS)(FreeBlock + 1);
+    FreeLinks->Next = Storage->FreeDisplay[Index];
+    FreeLinks->Prev = HCELL_NIL;
+    if (FreeLinks->Next != HCELL_NIL)
+        HvpGetFreeCellLinks(RegistryHive, FreeLinks->Next)->Prev = FreeIndex;
+    Storage->FreeDisplay[Index] = FreeIndex;
+    Storage->FreeSummary |= (1 << Index);
 
     /* FIXME: Eventually get rid of free bins. */
 
     return STATUS_SUCCESS;
 }
 
+static VOID CMAPI
+HvpUnlinkFree(
+    PHHIVE RegistryHive,
+    PHCELL_FREE_LINKS FreeLinks,
+    HSTORAGE_TYPE StorageType,
+    ULONG Index)
+{
+    PDUAL Storage = &RegistryHive->Storage[StorageType];
+
+    if (FreeLinks->Prev != HCELL_NIL)
+        HvpGetFreeCellLinks(RegistryHive, FreeLinks->Prev)->Next = FreeLinks->Next;
+    else
+        Storage->FreeDisplay[Index] = FreeLinks->Next;
+
+    if (FreeLinks->Next != HCELL_NIL)
+        HvpGetFreeCellLinks(RegistryHive, FreeLinks->Next)->Prev = FreeLinks->Prev;
+
+    if (Storage->FreeDisplay[Index] == HCELL_NIL)
+        Storage->FreeSummary &= ~(1 << Index);
+}
+
 static VOID CMAPI
 HvpRemoveFree(
     PHHIVE RegistryHive,
     PHCELL CellBlock,
     HCELL_INDEX CellIndex)
 {
-    PHCELL_INDEX FreeCellData;
-    PHCELL_INDEX pFreeCellOffset;
+    PHCELL_FREE_LINKS FreeLinks;
     HSTORAGE_TYPE Storage;
-    ULONG Index, FreeListIndex;
+    ULONG Index;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
 
+    if (!HvpIsFreeCellListed(CellBlock->Size))
+        return;
+
     Storage = HvGetCellType(CellIndex);
     Index = HvpComputeFreeListIndex((ULONG)CellBlock->Size);
+    FreeLinks = (PHCELL_FREE_LINKS)(CellBlock + 1);
 
-    pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[Index];
-    while (*pFreeCellOffset != HCELL_NIL)
-    {
-        FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-        if (*pFreeCellOffset == CellIndex)
-        {
-            *pFreeCellOffset = *FreeCellData;
-            return;
-        }
-        pFreeCellOffset = FreeCellData;
-    }
+    /* The cell must be on its list */
+    ASSERT((FreeLinks->Prev == HCELL_NIL) ?
+           (RegistryHive->Storage[Storage].FreeDisplay[Index] == CellIndex) :
+           (HvpGetFreeCellLinks(RegistryHive, FreeLinks->Prev)->Next == CellIndex));
 
-    /* Something bad happened, print a useful trace info and bugcheck */
-    CMLTRACE(CMLIB_HCELL_DEBUG, "-- beginning of HvpRemoveFree trace --\n");
-    CMLTRACE(CMLIB_HCELL_DEBUG, "block we are about to free: %08x\n", CellIndex);
-    CMLTRACE(CMLIB_HCELL_DEBUG, "chosen free list index: %u\n", Index);
-    for (FreeListIndex = 0; FreeListIndex < 24; FreeListIndex++)
+    HvpUnlinkFree(RegistryHive, FreeLinks, Storage, Index);
+}
+
+/* Cells of the list of a size class looked at before trying the larger ones */
+#define FREE_LIST_SCAN_LIMIT 16
+
+/*
+ * First fit in one free list, looking at no more than MaxCells cells.
+ */
+static HCELL_INDEX CMAPI
+HvpFindFreeInList(
+    PHHIVE RegistryHive,
+    ULONG Size,
+    HSTORAGE_TYPE Storage,
+    ULONG Index,
+    ULONG MaxCells)
+{
+    PHCELL_FREE_LINKS FreeLinks;
+    HCELL_INDEX FreeCellOffset;
+
+    FreeCellOffset = RegistryHive->Storage[Storage].FreeDisplay[Index];
+    while (FreeCellOffset != HCELL_NIL && MaxCells-- > 0)
     {
-        CMLTRACE(CMLIB_HCELL_DEBUG, "free list [%u]: ", FreeListIndex);
-        pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[FreeListIndex];
-        while (*pFreeCellOffset != HCELL_NIL)
+        FreeLinks = HvpGetFreeCellLinks(RegistryHive, FreeCellOffset);
+        if ((ULONG)HvpGetCellFullSize(RegistryHive, FreeLinks) >= Size)
         {
-            CMLTRACE(CMLIB_HCELL_DEBUG, "%08x ", *pFreeCellOffset);
-            FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-            pFreeCellOffset = FreeCellData;
+            HvpUnlinkFree(RegistryHive, FreeLinks, Storage, Index);
+            return FreeCellOffset;
         }
-        CMLTRACE(CMLIB_HCELL_DEBUG, "\n");
+        FreeCellOffset = FreeLinks->Next;
     }
-    CMLTRACE(CMLIB_HCELL_DEBUG, "-- end of HvpRemoveFree trace --\n");
 
-    ASSERT(FALSE);
+    return HCELL_NIL;
 }
 
 static HCELL_INDEX CMAPI
@@ -251,28 +315,29 @@ HvpFindFree(
     ULONG Size,
     HSTORAGE_TYPE Storage)
 {
-    PHCELL_INDEX FreeCellData;
     HCELL_INDEX FreeCellOffset;
-    PHCELL_INDEX pFreeCellOffset;
-    ULONG Index;
+    ULONG FirstIndex, Index;
+
+    /*
+     * The larger size classes are ranges of sizes, so the list of the class
+     * of Size may hold many cells too small for it: only look at a few of
+     * them, then take any cell of a larger class, all of them are big enough.
+     */
+    FirstIndex = HvpComputeFreeListIndex(Size);
+    FreeCellOffset = HvpFindFreeInList(RegistryHive, Size, Storage,
+                                       FirstIndex, FREE_LIST_SCAN_LIMIT);
+    if (FreeCellOffset != HCELL_NIL)
+        return FreeCellOffset;
 
-    for (Index = HvpComputeFreeListIndex(Size); Index < 24; Index++)
+    for (Index = FirstIndex + 1; Index < 24; Index++)
     {
-        pFreeCellOffset = &RegistryHive->Storage[Storage].FreeDisplay[Index];
-        while (*pFreeCellOffset != HCELL_NIL)
-        {
-            FreeCellData = (PHCELL_INDEX)HvGetCell(RegistryHive, *pFreeCellOffset);
-            if ((ULONG)HvpGetCellFullSize(RegistryHive, FreeCellData) >= Size)
-            {
-                FreeCellOffset = *pFreeCellOffset;
-                *pFreeCellOffset = *FreeCellData;
-                return FreeCellOffset;
-            }
-            pFreeCellOffset = FreeCellData;
-        }
+        /* Skip the empty lists */
+        if (RegistryHive->Storage[Storage].FreeSummary & (1 << Index))
+            return HvpFindFreeInList(RegistryHive, Size, Storage, Index, 1);
     }
 
-    return HCELL_NIL;
+    /* Nothing larger, look at the whole list */
+    return HvpFindFreeInList(RegistryHive, Size, Storage, FirstIndex, MAXULONG);
 }
 
 NTSTATUS CMAPI
@@ -293,6 +358,8 @@ HvpCreateHiveFreeCellList(
         Hive->Storage[Stable].FreeDisplay[Index] = HCELL_NIL;
         Hive->Storage[Volatile].FreeDisplay[Index] = HCELL_NIL;
     }
+    Hive->Storage[Stable].FreeSummary = 0;
+    Hive->Storage[Volatile].FreeSummary = 0;
 
     BlockOffset = 0;
     BlockIndex = 0;
@@ -9,26 +9,77 @@
 #define NDEBUG
 #include <debug.h>
 
+/*
+ * Finds the next run of blocks to write, starting at *BlockIndex: blocks
+ * that are dirty (or any block if OnlyDirty is FALSE) and contiguous in
+ * memory, so that the whole run can be written at once. Bins are allocated
+ * separately, so a run never spans more than one bin allocation.
+ * Returns the number of blocks of the run, 0 if there is none left.
+ */
+static ULONG CMAPI
+HvpFindWriteRun(
+    PHHIVE RegistryHive,
+    BOOLEAN OnlyDirty,
+    PULONG BlockIndex)
+{
+    PHMAP_ENTRY BlockList = RegistryHive->Storage[Stable].BlockList;
+    ULONG Length = RegistryHive->Storage[Stable].Length;
+    ULONG Index, Count;
+
+    Index = *BlockIndex;
+    if (Index >= Length)
+        return 0;
+
+    if (OnlyDirty)
+    {
+        Count = RtlFindNextForwardRunSet(&RegistryHive->DirtyVector, Index, &Index);
+        if (Count == 0 || Index >= Length)
+            return 0;
+        Count = min(Count, Length - Index);
+    }
+    else
+    {
+        Count = Length - Index;
+    }
+
+    /* Cut the run where the blocks stop being contiguous in memory */
+    *BlockIndex = Index;
+    for (Index = 1; Index < Count; Index++)
+    {
+        if (BlockList[*BlockIndex + Index].BlockAddress !=
+            BlockList[*BlockIndex].BlockAddress + Index * HBLOCK_SIZE)
+        {
+            break;
+        }
+    }
+
+    return Index;
+}
+
 static BOOLEAN CMAPI
 HvpWriteLog(
     PHHIVE RegistryHive)
 {
+#ifndef CMLIB_HOST
+    static ULONG PrintCount = 0;
+
+    /* Nothing reads the logs back when loading a hive yet, so only the
+       host tools write them */
+    if (PrintCount++ == 0)
+    {
+        UNIMPLEMENTED;
+    }
+    return TRUE;
+#else
     ULONG FileOffset;
     UINT32 BufferSize;
     UINT32 BitmapSize;
     PUCHAR Buffer;
     PUCHAR Ptr;
     ULONG BlockIndex;
-    ULONG LastIndex;
+    ULONG RunLength;
     PVOID BlockPtr;
     BOOLEAN Success;
-    static ULONG PrintCount = 0;
-
-    if (PrintCount++ == 0)
-    {
-        UNIMPLEMENTED;
-    }
-    return TRUE;
 
     ASSERT(RegistryHive->ReadOnly == FALSE);
     ASSERT(RegistryHive->BaseBlock->Length ==
@@ -42,7 +93,8 @@ HvpWriteLog(
         return FALSE;
     }
 
-    BitmapSize = RegistryHive->DirtyVector.SizeOfBitMap;
+    /* The bitmap is stored in bytes, the dirty vector size is in bits */
+    BitmapSize = ROUND_UP(RegistryHive->DirtyVector.SizeOfBitMap, sizeof(ULONG) * 8) / 8;
     BufferSize = HV_LOG_HEADER_SIZE + sizeof(ULONG) + BitmapSize;
     BufferSize = ROUND_UP(BufferSize, HBLOCK_SIZE);
 
@@ -78,30 +130,23 @@ HvpWriteLog(
         return FALSE;
     }
 
-    /* Write dirty blocks */
+    /* Write dirty blocks, a run at a time */
     FileOffset = BufferSize;
     BlockIndex = 0;
-    while (BlockIndex < RegistryHive->Storage[Stable].Length)
+    while ((RunLength = HvpFindWriteRun(RegistryHive, TRUE, &BlockIndex)) != 0)
     {
-        LastIndex = BlockIndex;
-        BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
-        if (BlockIndex == ~0U || BlockIndex < LastIndex)
-        {
-            break;
-        }
-
         BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
 
-        /* Write hive block */
+        /* Write hive blocks */
         Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_LOG,
-                                         &FileOffset, BlockPtr, HBLOCK_SIZE);
+                                         &FileOffset, BlockPtr, RunLength * HBLOCK_SIZE);
         if (!Success)
         {
             return FALSE;
         }
 
-        BlockIndex++;
-        FileOffset += HBLOCK_SIZE;
+        BlockIndex += RunLength;
+        FileOffset += RunLength * HBLOCK_SIZE;
     }
 
     Success = RegistryHive->FileSetSize(RegistryHive, HFILE_TYPE_LOG, FileOffset, FileOffset);
@@ -141,6 +186,7 @@ HvpWriteLog(
     }
 
     return TRUE;
+#endif
 }
 
 static BOOLEAN CMAPI
@@ -150,7 +196,7 @@ HvpWriteHive(
 {
     ULONG FileOffset;
     ULONG BlockIndex;
-    ULONG LastIndex;
+    ULONG RunLength;
     PVOID BlockPtr;
     BOOLEAN Success;
 
@@ -182,31 +228,22 @@ HvpWriteHive(
         return FALSE;
     }
 
+    /* Write the blocks, a run at a time */
     BlockIndex = 0;
-    while (BlockIndex < RegistryHive->Storage[Stable].Length)
+    while ((RunLength = HvpFindWriteRun(RegistryHive, OnlyDirty, &BlockIndex)) != 0)
     {
-        if (OnlyDirty)
-        {
-            LastIndex = BlockIndex;
-            BlockIndex = RtlFindSetBits(&RegistryHive->DirtyVector, 1, BlockIndex);
-            if (BlockIndex == ~0U || BlockIndex < LastIndex)
-            {
-                break;
-            }
-        }
-
         BlockPtr = (PVOID)RegistryHive->Storage[Stable].BlockList[BlockIndex].BlockAddress;
         FileOffset = (BlockIndex + 1) * HBLOCK_SIZE;
 
-        /* Write hive block */
+        /* Write hive blocks */
         Success = RegistryHive->FileWrite(RegistryHive, HFILE_TYPE_PRIMARY,
-                                          &FileOffset, BlockPtr, HBLOCK_SIZE);
+                                          &FileOffset, BlockPtr, RunLength * HBLOCK_SIZE);
         if (!Success)
         {
             return FALSE;
         }
 
-        BlockIndex++;
+        BlockIndex += RunLength;
     }
 
     Success = RegistryHive->FileFlush(RegistryHive, HFILE_TYPE_PRIMARY, NULL, 0);
@@ -253,8 +290,12 @@ HvSyncHive(
     /* Update hive header modification time */
     KeQuerySystemTime(&RegistryHive->BaseBlock->TimeStamp);
 
-    /* Update log file */
+    /* Update log file, if the hive has one */
+#if (NTDDI_VERSION < NTDDI_VISTA)
+    if (RegistryHive->Log && !HvpWriteLog(RegistryHive))
+#else
     if (!HvpWriteLog(RegistryHive))
+#endif
     {
         return FALSE;
     }
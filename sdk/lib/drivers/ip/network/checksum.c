@@ -11,6 +11,10 @@
 
 #include "precomp.h"
 
+#if defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
+
 
 ULONG ChecksumFold(
   ULONG Sum)
@@ -24,6 +28,55 @@ ULONG ChecksumFold(
   return Sum;
 }
 
+#if defined(_M_AMD64)
+static ULONGLONG ChecksumComputeSse2(
+  PUCHAR *Data,
+  UINT *Count)
+/*
+ * FUNCTION: Sums the bulk of a buffer, 16 bytes at a time
+ * ARGUMENTS:
+ *     Data  = Address of pointer to buffer, advanced past the summed data
+ *     Count = Address of number of bytes in buffer, decreased accordingly
+ * RETURNS:
+ *     Sum of the 32-bit words of the data, before folding
+ * NOTES:
+ *     Every 32-bit word is widened into a 64-bit lane, so the lanes can't
+ *     overflow and the carries are folded only once at the end
+ */
+{
+  __m128i Zero = _mm_setzero_si128();
+  __m128i Sum1 = Zero, Sum2 = Zero, Value;
+  ULONGLONG Lanes[2];
+
+  while (*Count >= 32)
+    {
+      Value = _mm_loadu_si128((const __m128i *)*Data);
+      Sum1 = _mm_add_epi64(Sum1, _mm_unpacklo_epi32(Value, Zero));
+      Sum2 = _mm_add_epi64(Sum2, _mm_unpackhi_epi32(Value, Zero));
+
+      Value = _mm_loadu_si128((const __m128i *)(*Data + 16));
+      Sum1 = _mm_add_epi64(Sum1, _mm_unpacklo_epi32(Value, Zero));
+      Sum2 = _mm_add_epi64(Sum2, _mm_unpackhi_epi32(Value, Zero));
+
+      *Data += 32;
+      *Count -= 32;
+    }
+
+  _mm_storeu_si128((__m128i *)Lanes, _mm_add_epi64(Sum1, Sum2));
+  return Lanes[0] + Lanes[1];
+}
+#endif
+
+static __inline ULONG ChecksumFold64(
+  ULONGLONG Sum)
+{
+  /* Fold 64-bit sum to 32 bits, keeping the end around carries */
+  Sum = (Sum & 0xFFFFFFFF) + (Sum >> 32);
+  Sum = (Sum & 0xFFFFFFFF) + (Sum >> 32);
+
+  return (ULONG)Sum;
+}
+
 ULONG ChecksumCompute(
   PVOID Data,
   UINT Count,
@@ -36,24 +89,124 @@ ULONG ChecksumCompute(
  *     Seed  = Previously calculated checksum (if any)
  * RETURNS:
  *     Checksum of buffer
+ * NOTES:
+ *     The one's complement sum doesn't depend on the word size, so the
+ *     data is summed 32 bits at a time. The result is in memory order
+ *     and must be folded with ChecksumFold
  */
 {
-  register ULONG Sum = Seed;
+#if defined(_M_IX86)
+  /* The assembly version is already unrolled and carry-chained */
+  return csum_partial(Data, Count, Seed);
+#else
+  PUCHAR Buffer = Data;
+  ULONGLONG Sum = Seed;
+
+#if defined(_M_AMD64)
+  if (Count >= 128)
+    Sum += ChecksumComputeSse2(&Buffer, &Count);
+#endif
+
+  while (Count >= 16)
+    {
+      Sum += *(ULONG UNALIGNED *)Buffer;
+      Sum += *(ULONG UNALIGNED *)(Buffer + 4);
+      Sum += *(ULONG UNALIGNED *)(Buffer + 8);
+      Sum += *(ULONG UNALIGNED *)(Buffer + 12);
+      Buffer += 16;
+      Count -= 16;
+    }
+
+  while (Count >= 4)
+    {
+      Sum += *(ULONG UNALIGNED *)Buffer;
+      Buffer += 4;
+      Count -= 4;
+    }
 
-  while (Count > 1)
+  if (Count >= 2)
     {
-      Sum += *(PUSHORT)Data;
+      Sum += *(USHORT UNALIGNED *)Buffer;
+      Buffer += 2;
       Count -= 2;
-      Data = (PVOID)((ULONG_PTR) Data + 2);
     }
 
   /* Add left-over byte, if any */
   if (Count > 0)
     {
-      Sum += *(PUCHAR)Data;
+      Sum += *Buffer;
     }
 
-  return Sum;
+  return ChecksumFold64(Sum);
+#endif
+}
+
+ULONG ChecksumCopyCompute(
+  PVOID Destination,
+  PVOID Source,
+  UINT Count,
+  ULONG Seed)
+/*
+ * FUNCTION: Copy a buffer and calculate its checksum in the same pass
+ * ARGUMENTS:
+ *     Destination = Pointer to destination buffer
+ *     Source      = Pointer to buffer with data
+ *     Count       = Number of bytes to copy
+ *     Seed        = Previously calculated checksum (if any)
+ * RETURNS:
+ *     Checksum of buffer, as returned by ChecksumCompute
+ * NOTES:
+ *     The buffers must not overlap
+ */
+{
+  PUCHAR Dst = Destination;
+  PUCHAR Src = Source;
+  ULONGLONG Sum = Seed;
+  ULONG Value;
+
+  while (Count >= 8)
+    {
+      Value = *(ULONG UNALIGNED *)Src;
+      *(ULONG UNALIGNED *)Dst = Value;
+      Sum += Value;
+
+      Value = *(ULONG UNALIGNED *)(Src + 4);
+      *(ULONG UNALIGNED *)(Dst + 4) = Value;
+      Sum += Value;
+
+      Src += 8;
+      Dst += 8;
+      Count -= 8;
+    }
+
+  if (Count >= 4)
+    {
+      Value = *(ULONG UNALIGNED *)Src;
+      *(ULONG UNALIGNED *)Dst = Value;
+      Sum += Value;
+      Src += 4;
+      Dst += 4;
+      Count -= 4;
+    }
+
+  if (Count >= 2)
+    {
+      Value = *(USHORT UNALIGNED *)Src;
+      *(USHORT UNALIGNED *)Dst = (USHORT)Value;
+      Sum += Value;
+      Src += 2;
+      Dst += 2;
+      Count -= 2;
+    }
+
+  /* Add left-over byte, if any */
+  if (Count > 0)
+    {
+      *Dst = *Src;
+      Sum += *Src;
+    }
+
+  return ChecksumFold64(Sum);
 }
 
 ULONG
@@ -62,44 +215,18 @@ UDPv4ChecksumCalculate(
   PUCHAR PacketBuffer,
   ULONG DataLength)
 {
-  ULONG Sum = 0;
-  USHORT TmpSum;
-  ULONG i;
-  BOOLEAN Pad;
-
-  /* Pad the data if needed */
-  Pad = (DataLength & 1);
-  if (Pad)
-      DataLength++;
-
-  /* Add from the UDP header and data */
-  for (i = 0; i < DataLength; i += 2)
-  {
-       TmpSum = ((PacketBuffer[i] << 8) & 0xFF00) +
-                ((Pad && i == DataLength - 2) ? 0 : (PacketBuffer[i+1] & 0x00FF));
-       Sum += TmpSum;
-  }
-
-  /* Add the source address */
-  for (i = 0; i < sizeof(IPv4_RAW_ADDRESS); i += 2)
-  {
-       TmpSum = ((((PUCHAR)&IPHeader->SrcAddr)[i] << 8) & 0xFF00) +
-                (((PUCHAR)&IPHeader->SrcAddr)[i+1] & 0x00FF);
-       Sum += TmpSum;
-  }
-
-  /* Add the destination address */
-  for (i = 0; i < sizeof(IPv4_RAW_ADDRESS); i += 2)
-  {
-       TmpSum = ((((PUCHAR)&IPHeader->DstAddr)[i] << 8) & 0xFF00) +
-                (((PUCHAR)&IPHeader->DstAddr)[i+1] & 0x00FF);
-       Sum += TmpSum;
-  }
-
-  /* Add the proto number and length */
-  Sum += IPPROTO_UDP + (DataLength - (Pad ? 1 : 0));
-
-  /* Fold the checksum and return the one's complement */
-  return ~ChecksumFold(Sum);
-}
+  ULONG Sum;
+
+  /* Add the source and destination addresses */
+  Sum = ChecksumCompute(&IPHeader->SrcAddr, sizeof(IPv4_RAW_ADDRESS), 0);
+  Sum = ChecksumCompute(&IPHeader->DstAddr, sizeof(IPv4_RAW_ADDRESS), Sum);
 
+  /* Add the proto number and length, in network order like the data */
+  Sum = ChecksumFold(Sum) + WH2N(IPPROTO_UDP) + WH2N((USHORT)DataLength);
+
+  /* Add from the UDP header and data, padding an odd byte with zero */
+  Sum = ChecksumCompute(PacketBuffer, DataLength, Sum);
+
+  /* Fold the checksum and return the one's complement, in host order */
+  return ~(ULONG)WN2H((USHORT)ChecksumFold(Sum));
+}
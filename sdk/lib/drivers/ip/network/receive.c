@@ -469,6 +469,11 @@ VOID ProcessFragment(
       /* Not enough free resources, discard the packet */
       return;
 
+    /* Adapters only verify the transport checksum of whole datagrams */
+    if (FragFirst == 0 && !MoreFragments)
+      Datagram.Flags |= IPPacket->Flags & (IP_PACKET_FLAG_TCP_CHECKSUM_OK |
+                                           IP_PACKET_FLAG_UDP_CHECKSUM_OK);
+
     DISPLAY_IP_PACKET(&Datagram);
 
     /* Give the packet to the protocol dispatcher */
@@ -611,8 +616,9 @@ VOID IPv4Receive(PIP_INTERFACE IF, PIP_PACKET IPPacket)
         return;
     }
 
-    /* Checksum IPv4 header */
-    if (!IPv4CorrectChecksum(IPPacket->Header, IPPacket->HeaderSize)) {
+    /* Checksum IPv4 header, unless the adapter did it already */
+    if (!(IPPacket->Flags & IP_PACKET_FLAG_IP_CHECKSUM_OK) &&
+        !IPv4CorrectChecksum(IPPacket->Header, IPPacket->HeaderSize)) {
         TI_DbgPrint(MIN_TRACE, ("Datagram received with bad checksum. Checksum field (0x%X)\n",
 	      WN2H(((PIPv4_HEADER)IPPacket->Header)->Checksum)));
         /* Discard packet */
@@ -17,6 +17,14 @@
 LIST_ENTRY FIBListHead;
 KSPIN_LOCK FIBLock;
 
+/* Prefix tries indexing the FIB, one per address family */
+PROUTE_NODE RouteTrieIPv4;
+PROUTE_NODE RouteTrieIPv6;
+
+/* Per destination route cache, flushed by bumping the FIB generation */
+ROUTE_CACHE_ENTRY RouteCache[ROUTE_CACHE_SIZE];
+ULONG FIBGeneration;
+
 void RouterDumpRoutes() {
     PLIST_ENTRY CurrentEntry;
     PLIST_ENTRY NextEntry;
@@ -54,6 +62,288 @@ VOID FreeFIB(
 }
 
 
+static PROUTE_NODE *RouteTrieForType(
+    UCHAR Type)
+/*
+ * FUNCTION: Returns the root of the prefix trie for an address family
+ * ARGUMENTS:
+ *     Type = Address type (IP_ADDRESS_V4 or IP_ADDRESS_V6)
+ */
+{
+    return (Type == IP_ADDRESS_V4) ? &RouteTrieIPv4 : &RouteTrieIPv6;
+}
+
+
+static UINT RouteAddressBits(
+    PIP_ADDRESS Address)
+/*
+ * FUNCTION: Returns the number of bits in an address
+ * ARGUMENTS:
+ *     Address = Pointer to address
+ */
+{
+    if (Address->Type == IP_ADDRESS_V4)
+        return sizeof(IPv4_RAW_ADDRESS) * 8;
+    else
+        return sizeof(IPv6_RAW_ADDRESS) * 8;
+}
+
+
+static UINT RoutePrefixLength(
+    PIP_ADDRESS Netmask)
+/*
+ * FUNCTION: Counts the leading one bits of a netmask
+ * ARGUMENTS:
+ *     Netmask = Pointer to netmask, of any address family
+ * RETURNS:
+ *     Length of the prefix described by the netmask
+ */
+{
+    PUCHAR Mask = (PUCHAR)&Netmask->Address;
+    UINT Bits = RouteAddressBits(Netmask);
+    UINT Length = 0;
+
+    while (Length < Bits && (Mask[Length / 8] & (0x80 >> (Length % 8))))
+        Length++;
+
+    return Length;
+}
+
+
+static __inline UINT RouteKeyBit(
+    PUCHAR Key,
+    UINT Bit)
+{
+    return (Key[Bit / 8] >> (7 - (Bit % 8))) & 1;
+}
+
+
+static UINT RouteKeyMatch(
+    PUCHAR Key1,
+    PUCHAR Key2,
+    UINT Length)
+/*
+ * FUNCTION: Computes the number of leading bits two keys have in common
+ * ARGUMENTS:
+ *     Key1   = Pointer to first key
+ *     Key2   = Pointer to second key
+ *     Length = Maximum number of bits to compare
+ * RETURNS:
+ *     Length of the common prefix, at most Length
+ */
+{
+    UINT i = 0;
+    UCHAR Diff;
+
+    /* Skip the matching bytes first */
+    while (i + 8 <= Length && Key1[i / 8] == Key2[i / 8])
+        i += 8;
+
+    if (i >= Length)
+        return Length;
+
+    /* Then find the first bit that differs */
+    Diff = Key1[i / 8] ^ Key2[i / 8];
+    while (i < Length && !(Diff & (0x80 >> (i % 8))))
+        i++;
+
+    return i;
+}
+
+
+static PROUTE_NODE RouteCreateNode(
+    PUCHAR Key,
+    UINT PrefixLength,
+    PROUTE_NODE Parent)
+/*
+ * FUNCTION: Allocates a trie node for a prefix
+ * ARGUMENTS:
+ *     Key          = Pointer to raw network address
+ *     PrefixLength = Number of significant bits in Key
+ *     Parent       = Parent of the new node
+ * RETURNS:
+ *     Pointer to the node, NULL if out of resources
+ */
+{
+    PROUTE_NODE Node;
+    UINT i;
+
+    Node = ExAllocatePoolWithTag(NonPagedPool, sizeof(ROUTE_NODE), ROUTE_NODE_TAG);
+    if (!Node)
+        return NULL;
+
+    RtlZeroMemory(Node, sizeof(ROUTE_NODE));
+    InitializeListHead(&Node->RouteListHead);
+    Node->Parent = Parent;
+    Node->PrefixLength = PrefixLength;
+
+    /* Only keep the significant bits, so that nodes compare bytewise */
+    for (i = 0; i < PrefixLength; i++)
+        Node->Prefix[i / 8] |= Key[i / 8] & (0x80 >> (i % 8));
+
+    return Node;
+}
+
+
+static PROUTE_NODE RouteTrieInsert(
+    PIP_ADDRESS NetworkAddress,
+    UINT PrefixLength)
+/*
+ * FUNCTION: Finds or creates the trie node for a prefix
+ * ARGUMENTS:
+ *     NetworkAddress = Pointer to address of network
+ *     PrefixLength   = Length of the network prefix
+ * RETURNS:
+ *     Pointer to the node, NULL if out of resources
+ * NOTES:
+ *     The forward information base lock must be held when called.
+ *     The trie is path compressed: a node only exists where routes
+ *     are attached or where two subtrees branch off
+ */
+{
+    PUCHAR Key = (PUCHAR)&NetworkAddress->Address;
+    PROUTE_NODE *Link = RouteTrieForType(NetworkAddress->Type);
+    PROUTE_NODE Parent = NULL, Node, NewNode, Branch;
+    UINT Common;
+
+    while ((Node = *Link) != NULL) {
+        Common = RouteKeyMatch(Key, Node->Prefix, min(PrefixLength, Node->PrefixLength));
+
+        if (Common < Node->PrefixLength) {
+            /* The new prefix diverges from, or is shorter than, this node */
+            NewNode = RouteCreateNode(Key, PrefixLength, Parent);
+            if (!NewNode)
+                return NULL;
+
+            if (Common == PrefixLength) {
+                /* The new prefix covers the node: insert it above */
+                NewNode->Child[RouteKeyBit(Node->Prefix, Common)] = Node;
+                Node->Parent = NewNode;
+                *Link = NewNode;
+                return NewNode;
+            }
+
+            /* Both hang off a new branching node */
+            Branch = RouteCreateNode(Key, Common, Parent);
+            if (!Branch) {
+                ExFreePoolWithTag(NewNode, ROUTE_NODE_TAG);
+                return NULL;
+            }
+
+            Branch->Child[RouteKeyBit(Node->Prefix, Common)] = Node;
+            Branch->Child[RouteKeyBit(Key, Common)] = NewNode;
+            Node->Parent = Branch;
+            NewNode->Parent = Branch;
+            *Link = Branch;
+            return NewNode;
+        }
+
+        if (Node->PrefixLength == PrefixLength)
+            return Node;
+
+        Parent = Node;
+        Link = &Node->Child[RouteKeyBit(Key, Node->PrefixLength)];
+    }
+
+    *Link = RouteCreateNode(Key, PrefixLength, Parent);
+    return *Link;
+}
+
+
+static VOID RouteTrieRemove(
+    PROUTE_NODE Node,
+    UCHAR Type)
+/*
+ * FUNCTION: Prunes a trie node which no longer holds any route
+ * ARGUMENTS:
+ *     Node = Pointer to trie node
+ *     Type = Address type of the trie
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PROUTE_NODE *Link, Child, Parent;
+
+    while (Node && IsListEmpty(&Node->RouteListHead)) {
+        /* Nodes where two subtrees branch off must stay */
+        if (Node->Child[0] && Node->Child[1])
+            return;
+
+        Parent = Node->Parent;
+        Child = Node->Child[0] ? Node->Child[0] : Node->Child[1];
+
+        if (Parent)
+            Link = &Parent->Child[Parent->Child[0] == Node ? 0 : 1];
+        else
+            Link = RouteTrieForType(Type);
+
+        *Link = Child;
+        if (Child)
+            Child->Parent = Parent;
+
+        ExFreePoolWithTag(Node, ROUTE_NODE_TAG);
+
+        /* The parent may now be a useless branching node */
+        Node = Parent;
+    }
+}
+
+
+static PROUTE_NODE RouteTrieLookup(
+    PIP_ADDRESS Destination)
+/*
+ * FUNCTION: Finds the longest prefix matching a destination
+ * ARGUMENTS:
+ *     Destination = Pointer to destination address
+ * RETURNS:
+ *     Pointer to the deepest node holding routes to Destination,
+ *     NULL if there is none
+ * NOTES:
+ *     The forward information base lock must be held when called
+ */
+{
+    PUCHAR Key = (PUCHAR)&Destination->Address;
+    PROUTE_NODE Node = *RouteTrieForType(Destination->Type);
+    PROUTE_NODE Best = NULL;
+    UINT Bits = RouteAddressBits(Destination);
+
+    while (Node) {
+        if (RouteKeyMatch(Key, Node->Prefix, Node->PrefixLength) < Node->PrefixLength)
+            break;
+
+        if (!IsListEmpty(&Node->RouteListHead))
+            Best = Node;
+
+        if (Node->PrefixLength >= Bits)
+            break;
+
+        Node = Node->Child[RouteKeyBit(Key, Node->PrefixLength)];
+    }
+
+    return Best;
+}
+
+
+static PROUTE_CACHE_ENTRY RouteCacheSlot(
+    PIP_ADDRESS Destination)
+/*
+ * FUNCTION: Returns the route cache entry a destination hashes to
+ * ARGUMENTS:
+ *     Destination = Pointer to destination address
+ */
+{
+    PUCHAR Key = (PUCHAR)&Destination->Address;
+    UINT Size = RouteAddressBits(Destination) / 8;
+    ULONG Hash = 0;
+    UINT i;
+
+    for (i = 0; i < Size; i++)
+        Hash = Hash * 31 + Key[i];
+
+    return &RouteCache[(Hash ^ (Hash >> 16)) & (ROUTE_CACHE_SIZE - 1)];
+}
+
+
 VOID DestroyFIBE(
     PFIB_ENTRY FIBE)
 /*
@@ -66,8 +356,13 @@ VOID DestroyFIBE(
 {
     TI_DbgPrint(DEBUG_ROUTER, ("Called. FIBE (0x%X).\n", FIBE));
 
-    /* Unlink the FIB entry from the list */
+    /* Unlink the FIB entry from the list and the trie */
     RemoveEntryList(&FIBE->ListEntry);
+    RemoveEntryList(&FIBE->NodeListEntry);
+    RouteTrieRemove(FIBE->Node, FIBE->NetworkAddress.Type);
+
+    /* Cached routes may have used it */
+    FIBGeneration++;
 
     /* And free the FIB entry */
     FreeFIB(FIBE);
@@ -206,6 +501,7 @@ PFIB_ENTRY RouterAddRoute(
  *     these references
  */
 {
+    KIRQL OldIrql;
     PFIB_ENTRY FIBE;
 
     TI_DbgPrint(DEBUG_ROUTER, ("Called. NetworkAddress (0x%X)  Netmask (0x%X) "
@@ -229,8 +525,25 @@ PFIB_ENTRY RouterAddRoute(
     FIBE->Router         = Router;
     FIBE->Metric         = Metric;
 
+    TcpipAcquireSpinLock(&FIBLock, &OldIrql);
+
+    /* Index it by prefix, for the lookups */
+    FIBE->Node = RouteTrieInsert(NetworkAddress, RoutePrefixLength(Netmask));
+    if (!FIBE->Node) {
+        TcpipReleaseSpinLock(&FIBLock, OldIrql);
+        TI_DbgPrint(MIN_TRACE, ("Insufficient resources.\n"));
+        FreeFIB(FIBE);
+        return NULL;
+    }
+
     /* Add FIB to the forward information base */
-    TcpipInterlockedInsertTailList(&FIBListHead, &FIBE->ListEntry, &FIBLock);
+    InsertTailList(&FIBListHead, &FIBE->ListEntry);
+    InsertTailList(&FIBE->Node->RouteListHead, &FIBE->NodeListEntry);
+
+    /* The new route may be better for destinations already cached */
+    FIBGeneration++;
+
+    TcpipReleaseSpinLock(&FIBLock, OldIrql);
 
     return FIBE;
 }
@@ -249,10 +562,12 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
 {
     KIRQL OldIrql;
     PLIST_ENTRY CurrentEntry;
-    PLIST_ENTRY NextEntry;
     PFIB_ENTRY Current;
+    PROUTE_NODE Node;
+    PROUTE_CACHE_ENTRY CacheEntry;
     UCHAR State;
-    UINT Length, BestLength = 0, MaskLength;
+    BOOLEAN BestUsable = FALSE, Usable;
+    UINT BestMetric = 0;
     PNEIGHBOR_CACHE_ENTRY NCE, BestNCE = NULL;
 
     TI_DbgPrint(DEBUG_ROUTER, ("Called. Destination (0x%X)\n", Destination));
@@ -261,29 +576,55 @@ PNEIGHBOR_CACHE_ENTRY RouterGetRoute(PIP_ADDRESS Destination)
 
     TcpipAcquireSpinLock(&FIBLock, &OldIrql);
 
-    CurrentEntry = FIBListHead.Flink;
-    while (CurrentEntry != &FIBListHead) {
-        NextEntry = CurrentEntry->Flink;
-	    Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, ListEntry);
-
-        NCE   = Current->Router;
-        State = NCE->State;
-
-	Length = CommonPrefixLength(Destination, &Current->NetworkAddress);
-	MaskLength = AddrCountPrefixBits(&Current->Netmask);
+    /* Try the route cache first */
+    CacheEntry = RouteCacheSlot(Destination);
+    if (CacheEntry->Router &&
+        CacheEntry->Generation == FIBGeneration &&
+        AddrIsEqual(&CacheEntry->Destination, Destination)) {
+        State = CacheEntry->Router->State;
+        if (!(State & NUD_STALE) && !(State & NUD_INCOMPLETE)) {
+            BestNCE = CacheEntry->Router;
+            TcpipReleaseSpinLock(&FIBLock, OldIrql);
+            TI_DbgPrint(DEBUG_ROUTER,("Routing to %s (cached)\n", A2S(&BestNCE->Address)));
+            return BestNCE;
+        }
 
-	TI_DbgPrint(DEBUG_ROUTER,("This-Route: %s (Sharing %d bits)\n",
-				  A2S(&NCE->Address), Length));
+        /* The router went stale since, look for a better one */
+        CacheEntry->Router = NULL;
+    }
 
-	if(Length >= MaskLength && (Length > BestLength || !BestNCE) &&
-           ((!(State & NUD_STALE) && !(State & NUD_INCOMPLETE)) || !BestNCE)) {
-	    /* This seems to be a better router */
-	    BestNCE    = NCE;
-	    BestLength = Length;
-	    TI_DbgPrint(DEBUG_ROUTER,("Route selected\n"));
-	}
+    /* Find the longest prefix, then pick the best router for it */
+    Node = RouteTrieLookup(Destination);
+    if (Node) {
+        CurrentEntry = Node->RouteListHead.Flink;
+        while (CurrentEntry != &Node->RouteListHead) {
+            Current = CONTAINING_RECORD(CurrentEntry, FIB_ENTRY, NodeListEntry);
+
+            NCE   = Current->Router;
+            State = NCE->State;
+            Usable = !(State & NUD_STALE) && !(State & NUD_INCOMPLETE);
+
+            TI_DbgPrint(DEBUG_ROUTER,("This-Route: %s (Sharing %d bits)\n",
+                                      A2S(&NCE->Address), Node->PrefixLength));
+
+            /* Prefer routers known to be reachable, then the cheapest */
+            if (!BestNCE || (Usable && !BestUsable) ||
+                (Usable == BestUsable && Current->Metric < BestMetric)) {
+                BestNCE    = NCE;
+                BestUsable = Usable;
+                BestMetric = Current->Metric;
+                TI_DbgPrint(DEBUG_ROUTER,("Route selected\n"));
+            }
+
+            CurrentEntry = CurrentEntry->Flink;
+        }
+    }
 
-        CurrentEntry = NextEntry;
+    /* Only remember good choices, a stale router may be replaced soon */
+    if (BestNCE && BestUsable) {
+        CacheEntry->Destination = *Destination;
+        CacheEntry->Router      = BestNCE;
+        CacheEntry->Generation  = FIBGeneration;
     }
 
     TcpipReleaseSpinLock(&FIBLock, OldIrql);
@@ -492,6 +833,10 @@ NTSTATUS RouterStartup(
     /* Initialize the Forward Information Base */
     InitializeListHead(&FIBListHead);
     TcpipInitializeSpinLock(&FIBLock);
+    RouteTrieIPv4 = NULL;
+    RouteTrieIPv6 = NULL;
+    RtlZeroMemory(RouteCache, sizeof(RouteCache));
+    FIBGeneration = 0;
 
     return STATUS_SUCCESS;
 }
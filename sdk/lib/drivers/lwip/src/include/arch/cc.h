@@ -43,8 +43,12 @@ typedef ULONG_PTR mem_ptr_t;
 /* Endianness */
 #define BYTE_ORDER LITTLE_ENDIAN
 
-/* Checksum calculation algorithm choice */
-#define LWIP_CHKSUM_ALGORITHM 3
+/* Checksum calculation, done by the wide routines of the IP library */
+u16_t LibIPChecksum(void *dataptr, int len);
+u16_t LibIPChecksumCopy(void *dst, const void *src, u16_t len);
+
+#define LWIP_CHKSUM LibIPChecksum
+#define LWIP_CHKSUM_COPY LibIPChecksumCopy
 
 /* Diagnostics */
 #define LWIP_PLATFORM_DIAG(x) (DbgPrint x)
@@ -75,6 +75,9 @@ typedef enum {
 #define PBUF_FLAG_LLMCAST   0x10U
 /** indicates this pbuf includes a TCP FIN flag */
 #define PBUF_FLAG_TCP_FIN   0x20U
+/** indicates the transport checksum of this pbuf was already verified,
+    either by the adapter or while copying it in (ReactOS specific) */
+#define PBUF_FLAG_CHKSUM_OK 0x40U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -96,6 +96,13 @@
 
 #define PPPOS_SUPPORT                   0
 
+/* The IP header was already verified by the IP library before the
+ * packet is handed to us */
+#define CHECKSUM_CHECK_IP               0
+
+/* Checksum user data while copying it into segments */
+#define LWIP_CHECKSUM_ON_COPY           1
+
 /*
    ---------------------------------------
    ---------- Debugging options ----------
@@ -2,16 +2,67 @@
 #include "lwip/netif.h"
 #include "lwip/tcpip.h"
 
+#include "lwip/ip.h"
+
 #include "rosip.h"
 
+#include <checksum.h>
+
 #include <debug.h>
 
 typedef struct netif* PNETIF;
 
+u16_t
+LibIPChecksum(void *dataptr, int len)
+{
+    return (u16_t)ChecksumFold(ChecksumCompute(dataptr, len, 0));
+}
+
+u16_t
+LibIPChecksumCopy(void *dst, const void *src, u16_t len)
+{
+    return (u16_t)ChecksumFold(ChecksumCopyCompute(dst, (PVOID)src, len, 0));
+}
+
+static
+BOOLEAN
+LibIPCopyAndVerifyPacket(void *dst, const void *const data, const u32_t size)
+{
+    const struct ip_hdr *iphdr = data;
+    const u8_t *src = data;
+    u32_t hlen, len;
+    ULONG sum;
+
+    /* Only IPv4 TCP segments are checked here, anything else is copied
+     * and left to lwIP */
+    hlen = IPH_HL(iphdr) * 4;
+    len = ntohs(IPH_LEN(iphdr));
+    if (size < sizeof(*iphdr) || IPH_V(iphdr) != 4 || IPH_PROTO(iphdr) != IP_PROTO_TCP ||
+        hlen < sizeof(*iphdr) || hlen > len || len > size)
+    {
+        RtlCopyMemory(dst, data, size);
+        return FALSE;
+    }
+
+    /* Pseudo header, in network order like the segment */
+    sum = ChecksumCompute((PVOID)&iphdr->src, sizeof(iphdr->src), 0);
+    sum = ChecksumCompute((PVOID)&iphdr->dest, sizeof(iphdr->dest), sum);
+    sum = ChecksumFold(sum) + htons(IP_PROTO_TCP) + htons((u16_t)(len - hlen));
+
+    /* The segment is summed in the same pass as it is copied */
+    RtlCopyMemory(dst, data, hlen);
+    sum = ChecksumCopyCompute((u8_t *)dst + hlen, (PVOID)(src + hlen), len - hlen, sum);
+    if (size > len)
+        RtlCopyMemory((u8_t *)dst + len, src + len, size - len);
+
+    return (ChecksumFold(sum) == 0xFFFF);
+}
+
 void
 LibIPInsertPacket(void *ifarg,
                   const void *const data,
-                  const u32_t size)
+                  const u32_t size,
+                  const BOOLEAN checksum_ok)
 {
     struct pbuf *p;
 
@@ -25,7 +76,16 @@ LibIPInsertPacket(void *ifarg,
         ASSERT(p->tot_len == p->len);
         ASSERT(p->len == size);
 
-        RtlCopyMemory(p->payload, data, p->len);
+        if (checksum_ok)
+        {
+            /* The adapter did the work already */
+            RtlCopyMemory(p->payload, data, p->len);
+            p->flags |= PBUF_FLAG_CHKSUM_OK;
+        }
+        else if (LibIPCopyAndVerifyPacket(p->payload, data, p->len))
+        {
+            p->flags |= PBUF_FLAG_CHKSUM_OK;
+        }
 
         ((PNETIF)ifarg)->input(p, (PNETIF)ifarg);
     }
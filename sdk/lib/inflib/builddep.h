@@ -69,8 +69,10 @@ BOOLEAN NTAPI RtlIsTextUnicode( PVOID buf, INT len, INT *pf );
 
 extern PVOID InfpHeap;
 
+PVOID InfpAllocate(SIZE_T Size);
+
 #define FREE(Area) RtlFreeHeap(InfpHeap, 0, (Area))
-#define MALLOC(Size) RtlAllocateHeap(InfpHeap, 0, (Size))
+#define MALLOC(Size) InfpAllocate(Size)
 #define ZEROMEMORY(Area, Size) RtlZeroMemory((Area), (Size))
 #define MEMCPY(Dest, Src, Size) RtlCopyMemory((Dest), (Src), (Size))
 
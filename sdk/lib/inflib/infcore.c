@@ -19,6 +19,11 @@
 /* actual string limit is MAX_INF_STRING_LENGTH+1 (plus terminating null) under Windows */
 #define MAX_STRING_LEN        (MAX_INF_STRING_LENGTH+1)
 
+/* hash indexes of the sections and keys */
+#define INITIAL_SECTION_BUCKETS  16
+#define INITIAL_KEY_BUCKETS      16
+#define MIN_HASHED_KEYS          16  /* smaller sections are just scanned */
+
 
 /* parser definitions */
 
@@ -51,6 +56,9 @@ struct parser
   INFSTATUS        error;         /* error code */
   unsigned int     token_len;     /* current token len */
   WCHAR token[MAX_FIELD_LEN+1];   /* current token */
+  const WCHAR      *buffer;       /* start of buffer */
+  int              in_place;      /* the tokens are written in the buffer */
+  WCHAR            *token_dst;    /* where the current token is written in place, if not NULL */
 };
 
 typedef const WCHAR * (*parser_state_func)( struct parser *parser, const WCHAR *pos );
@@ -94,11 +102,11 @@ InfpFreeLine (PINFCACHELINE Line)
     }
 
   Next = Line->Next;
-  if (Line->Key != NULL)
+  if (Line->Key != NULL && !Line->KeyInFileBuffer)
     {
       FREE (Line->Key);
-      Line->Key = NULL;
     }
+  Line->Key = NULL;
 
   /* Remove data fields */
   while (Line->FirstField != NULL)
@@ -133,12 +141,181 @@ InfpFreeSection (PINFCACHESECTION Section)
     }
   Section->LastLine = NULL;
 
+  if (Section->Lines != NULL)
+    {
+      FREE (Section->Lines);
+    }
+  if (Section->KeyBuckets != NULL)
+    {
+      FREE (Section->KeyBuckets);
+    }
+
   FREE (Section);
 
   return Next;
 }
 
 
+VOID
+InfpFreeCache(PINFCACHE Cache)
+{
+  while (Cache->FirstSection != NULL)
+    {
+      Cache->FirstSection = InfpFreeSection(Cache->FirstSection);
+    }
+  Cache->LastSection = NULL;
+
+  if (Cache->Sections != NULL)
+    {
+      FREE(Cache->Sections);
+    }
+  if (Cache->SectionBuckets != NULL)
+    {
+      FREE(Cache->SectionBuckets);
+    }
+  if (Cache->FileBuffer != NULL)
+    {
+      FREE(Cache->FileBuffer);
+    }
+
+  FREE(Cache);
+}
+
+
+/* case insensitive hash, equal for names that strcmpiW finds equal */
+static ULONG
+InfpHashName(PCWSTR Name)
+{
+  ULONG Hash = 0;
+
+  while (*Name != 0)
+    {
+      Hash = (Hash * 31) + tolowerW(*Name);
+      Name++;
+    }
+
+  return Hash;
+}
+
+
+/* make room for one more entry in a table indexed by id */
+static BOOLEAN
+InfpGrowIdTable(PVOID **Table,
+                UINT *Size,
+                UINT Count)
+{
+  PVOID *NewTable;
+  UINT NewSize;
+
+  if (Count < *Size)
+    {
+      return TRUE;
+    }
+
+  NewSize = (*Size != 0) ? *Size * 2 : 16;
+  NewTable = (PVOID *)MALLOC(NewSize * sizeof(PVOID));
+  if (NewTable == NULL)
+    {
+      DPRINT("MALLOC() failed\n");
+      return FALSE;
+    }
+
+  if (*Table != NULL)
+    {
+      MEMCPY(NewTable, *Table, *Size * sizeof(PVOID));
+      FREE(*Table);
+    }
+
+  *Table = NewTable;
+  *Size = NewSize;
+  return TRUE;
+}
+
+
+/* rehash the sections in twice as many buckets, on failure the old ones are kept */
+static BOOLEAN
+InfpGrowSectionBuckets(PINFCACHE Cache)
+{
+  PINFCACHESECTION *Buckets;
+  PINFCACHESECTION Section;
+  UINT BucketCount, i;
+
+  BucketCount = (Cache->SectionBucketCount != 0) ? Cache->SectionBucketCount * 2 : INITIAL_SECTION_BUCKETS;
+  Buckets = (PINFCACHESECTION *)MALLOC(BucketCount * sizeof(PINFCACHESECTION));
+  if (Buckets == NULL)
+    {
+      DPRINT("MALLOC() failed\n");
+      return FALSE;
+    }
+  ZEROMEMORY(Buckets, BucketCount * sizeof(PINFCACHESECTION));
+
+  for (Section = Cache->FirstSection; Section != NULL; Section = Section->Next)
+    {
+      i = InfpHashName(Section->Name) & (BucketCount - 1);
+      Section->HashNext = Buckets[i];
+      Buckets[i] = Section;
+    }
+
+  if (Cache->SectionBuckets != NULL)
+    {
+      FREE(Cache->SectionBuckets);
+    }
+  Cache->SectionBuckets = Buckets;
+  Cache->SectionBucketCount = BucketCount;
+  return TRUE;
+}
+
+
+/* rehash the first line of each key in twice as many buckets, on failure the old ones are kept */
+static BOOLEAN
+InfpGrowKeyBuckets(PINFCACHESECTION Section)
+{
+  PINFCACHELINE *Buckets;
+  PINFCACHELINE Line, Other;
+  UINT BucketCount, i;
+
+  BucketCount = (Section->KeyBucketCount != 0) ? Section->KeyBucketCount * 2 : INITIAL_KEY_BUCKETS;
+  Buckets = (PINFCACHELINE *)MALLOC(BucketCount * sizeof(PINFCACHELINE));
+  if (Buckets == NULL)
+    {
+      DPRINT("MALLOC() failed\n");
+      return FALSE;
+    }
+  ZEROMEMORY(Buckets, BucketCount * sizeof(PINFCACHELINE));
+
+  for (Line = Section->FirstLine; Line != NULL; Line = Line->Next)
+    {
+      if (Line->Key == NULL)
+        {
+          continue;
+        }
+
+      /* only the first line of a key is looked up */
+      i = InfpHashName(Line->Key) & (BucketCount - 1);
+      for (Other = Buckets[i]; Other != NULL; Other = Other->KeyHashNext)
+        {
+          if (strcmpiW(Other->Key, Line->Key) == 0)
+            {
+              break;
+            }
+        }
+      if (Other == NULL)
+        {
+          Line->KeyHashNext = Buckets[i];
+          Buckets[i] = Line;
+        }
+    }
+
+  if (Section->KeyBuckets != NULL)
+    {
+      FREE(Section->KeyBuckets);
+    }
+  Section->KeyBuckets = Buckets;
+  Section->KeyBucketCount = BucketCount;
+  return TRUE;
+}
+
+
 PINFCACHESECTION
 InfpFindSection(PINFCACHE Cache,
                 PCWSTR Name)
@@ -150,6 +327,23 @@ InfpFindSection(PINFCACHE Cache,
       return NULL;
     }
 
+  if (Cache->SectionBuckets != NULL)
+    {
+      /* iterate through the sections of the same hash */
+      Section = Cache->SectionBuckets[InfpHashName(Name) & (Cache->SectionBucketCount - 1)];
+      while (Section != NULL)
+        {
+          if (strcmpiW(Section->Name, Name) == 0)
+            {
+              return Section;
+            }
+
+          Section = Section->HashNext;
+        }
+
+      return NULL;
+    }
+
   /* iterate through list of sections */
   Section = Cache->FirstSection;
   while (Section != NULL)
@@ -173,6 +367,7 @@ InfpAddSection(PINFCACHE Cache,
 {
   PINFCACHESECTION Section = NULL;
   ULONG Size;
+  UINT i;
 
   if (Cache == NULL || Name == NULL)
     {
@@ -180,6 +375,11 @@ InfpAddSection(PINFCACHE Cache,
       return NULL;
     }
 
+  if (!InfpGrowIdTable((PVOID **)&Cache->Sections, &Cache->SectionsSize, Cache->NextSectionId))
+    {
+      return NULL;
+    }
+
   /* Allocate and initialize the new section */
   Size = (ULONG)FIELD_OFFSET(INFCACHESECTION,
                              Name[strlenW(Name) + 1]);
@@ -208,6 +408,22 @@ InfpAddSection(PINFCACHE Cache,
       Section->Prev = Cache->LastSection;
       Cache->LastSection = Section;
     }
+  Cache->Sections[Section->Id - 1] = Section;
+
+  /* Index it, growing the buckets rehashes the new section too */
+  if (Cache->NextSectionId > 2 * Cache->SectionBucketCount &&
+      InfpGrowSectionBuckets(Cache))
+    {
+      return Section;
+    }
+
+  /* without buckets the sections are searched in the list */
+  if (Cache->SectionBuckets != NULL)
+    {
+      i = InfpHashName(Section->Name) & (Cache->SectionBucketCount - 1);
+      Section->HashNext = Cache->SectionBuckets[i];
+      Cache->SectionBuckets[i] = Section;
+    }
 
   return Section;
 }
@@ -224,6 +440,11 @@ InfpAddLine(PINFCACHESECTION Section)
       return NULL;
     }
 
+  if (!InfpGrowIdTable((PVOID **)&Section->Lines, &Section->LinesSize, Section->NextLineId))
+    {
+      return NULL;
+    }
+
   Line = (PINFCACHELINE)MALLOC(sizeof(INFCACHELINE));
   if (Line == NULL)
     {
@@ -246,6 +467,7 @@ InfpAddLine(PINFCACHESECTION Section)
       Line->Prev = Section->LastLine;
       Section->LastLine = Line;
     }
+  Section->Lines[Line->Id - 1] = Line;
   Section->LineCount++;
 
   return Line;
@@ -254,19 +476,12 @@ InfpAddLine(PINFCACHESECTION Section)
 PINFCACHESECTION
 InfpFindSectionById(PINFCACHE Cache, UINT Id)
 {
-    PINFCACHESECTION Section;
-
-    for (Section = Cache->FirstSection;
-         Section != NULL;
-         Section = Section->Next)
+    if (Id == 0 || Id > Cache->NextSectionId)
     {
-        if (Section->Id == Id)
-        {
-            return Section;
-        }
+        return NULL;
     }
 
-    return NULL;
+    return Cache->Sections[Id - 1];
 }
 
 PINFCACHESECTION
@@ -291,19 +506,12 @@ InfpGetSectionForContext(PINFCONTEXT Context)
 PINFCACHELINE
 InfpFindLineById(PINFCACHESECTION Section, UINT Id)
 {
-    PINFCACHELINE Line;
-
-    for (Line = Section->FirstLine;
-         Line != NULL;
-         Line = Line->Next)
+    if (Id == 0 || Id > Section->NextLineId)
     {
-        if (Line->Id == Id)
-        {
-            return Line;
-        }
+        return NULL;
     }
 
-    return NULL;
+    return Section->Lines[Id - 1];
 }
 
 PINFCACHELINE
@@ -320,8 +528,54 @@ InfpGetLineForContext(PINFCONTEXT Context)
     return InfpFindLineById(Section, Context->Line);
 }
 
+/* record the key of a line of the section in its index */
+static VOID
+InfpIndexKey(PINFCACHESECTION Section,
+             PINFCACHELINE Line)
+{
+  PINFCACHELINE Other;
+  UINT i;
+
+  Section->KeyCount++;
+  if (Section->KeyCount < MIN_HASHED_KEYS)
+    {
+      return;
+    }
+
+  if (Section->KeyBuckets == NULL || Section->KeyCount > 2 * Section->KeyBucketCount)
+    {
+      /* this indexes the new line too */
+      if (InfpGrowKeyBuckets(Section))
+        {
+          return;
+        }
+
+      /* without buckets the keys are searched in the list */
+      if (Section->KeyBuckets == NULL)
+        {
+          return;
+        }
+    }
+
+  /* only the first line of a key is looked up */
+  i = InfpHashName(Line->Key) & (Section->KeyBucketCount - 1);
+  for (Other = Section->KeyBuckets[i]; Other != NULL; Other = Other->KeyHashNext)
+    {
+      if (strcmpiW(Other->Key, Line->Key) == 0)
+        {
+          return;
+        }
+    }
+
+  Line->KeyHashNext = Section->KeyBuckets[i];
+  Section->KeyBuckets[i] = Line;
+}
+
+
+/* the line must be the last one of the section */
 PVOID
-InfpAddKeyToLine(PINFCACHELINE Line,
+InfpAddKeyToLine(PINFCACHESECTION Section,
+                 PINFCACHELINE Line,
                  PCWSTR Key)
 {
   if (Line == NULL)
@@ -344,11 +598,31 @@ InfpAddKeyToLine(PINFCACHELINE Line,
     }
 
   strcpyW(Line->Key, Key);
+  InfpIndexKey(Section, Line);
 
   return (PVOID)Line->Key;
 }
 
 
+static VOID
+InfpAppendField(PINFCACHELINE Line,
+                PINFCACHEFIELD Field)
+{
+  if (Line->FirstField == NULL)
+    {
+      Line->FirstField = Field;
+      Line->LastField = Field;
+    }
+  else
+    {
+      Line->LastField->Next = Field;
+      Field->Prev = Line->LastField;
+      Line->LastField = Field;
+    }
+  Line->FieldCount++;
+}
+
+
 PVOID
 InfpAddFieldToLine(PINFCACHELINE Line,
                    PCWSTR Data)
@@ -357,7 +631,7 @@ InfpAddFieldToLine(PINFCACHELINE Line,
   ULONG Size;
 
   Size = (ULONG)FIELD_OFFSET(INFCACHEFIELD,
-                             Data[strlenW(Data) + 1]);
+                             Buffer[strlenW(Data) + 1]);
   Field = (PINFCACHEFIELD)MALLOC(Size);
   if (Field == NULL)
     {
@@ -366,21 +640,11 @@ InfpAddFieldToLine(PINFCACHELINE Line,
     }
   ZEROMEMORY (Field,
               Size);
+  Field->Data = Field->Buffer;
   strcpyW(Field->Data, Data);
 
   /* Append key */
-  if (Line->FirstField == NULL)
-    {
-      Line->FirstField = Field;
-      Line->LastField = Field;
-    }
-  else
-    {
-      Line->LastField->Next = Field;
-      Field->Prev = Line->LastField;
-      Line->LastField = Field;
-    }
-  Line->FieldCount++;
+  InfpAppendField(Line, Field);
 
   return (PVOID)Field;
 }
@@ -392,6 +656,22 @@ InfpFindKeyLine(PINFCACHESECTION Section,
 {
   PINFCACHELINE Line;
 
+  if (Section->KeyBuckets != NULL)
+    {
+      Line = Section->KeyBuckets[InfpHashName(Key) & (Section->KeyBucketCount - 1)];
+      while (Line != NULL)
+        {
+          if (strcmpiW(Line->Key, Key) == 0)
+            {
+              return Line;
+            }
+
+          Line = Line->KeyHashNext;
+        }
+
+      return NULL;
+    }
+
   Line = Section->FirstLine;
   while (Line != NULL)
     {
@@ -455,7 +735,19 @@ static int push_token( struct parser *parser, const WCHAR *pos )
 {
   UINT len = (UINT)(pos - parser->start);
   const WCHAR *src = parser->start;
-  WCHAR *dst = parser->token + parser->token_len;
+  WCHAR *dst;
+
+  /*
+   * In place, a token is written from the character before its first one:
+   * every character of the token comes from at least one character of the
+   * buffer, so it only overwrites characters that were already parsed, as
+   * does its terminating null.
+   */
+  if (parser->in_place && parser->token_len == 0 && parser->token_dst == NULL &&
+      parser->start > parser->buffer)
+    parser->token_dst = (WCHAR *)parser->start - 1;
+
+  dst = (parser->token_dst ? parser->token_dst : parser->token) + parser->token_len;
 
   if (len > MAX_FIELD_LEN - parser->token_len)
     len = MAX_FIELD_LEN - parser->token_len;
@@ -473,13 +765,34 @@ static int push_token( struct parser *parser, const WCHAR *pos )
     }
   }
 
-  *dst = 0;
+  /* In place, the null would overwrite the next character to parse */
+  if (!parser->token_dst)
+    *dst = 0;
   parser->start = pos;
 
   return 0;
 }
 
 
+/* terminate the current token and return it */
+static WCHAR *get_token( struct parser *parser )
+{
+  if (!parser->token_dst)
+    return parser->token;
+
+  parser->token_dst[parser->token_len] = 0;
+  return parser->token_dst;
+}
+
+
+/* forget the current token */
+static void reset_token( struct parser *parser )
+{
+  parser->token_len = 0;
+  parser->token_dst = NULL;
+}
+
+
 
 /* add a section with the current token as name */
 static PVOID add_section_from_token( struct parser *parser )
@@ -493,12 +806,12 @@ static PVOID add_section_from_token( struct parser *parser )
     }
 
   Section = InfpFindSection(parser->file,
-                            parser->token);
+                            get_token(parser));
   if (Section == NULL)
     {
       /* need to create a new one */
       Section= InfpAddSection(parser->file,
-                              parser->token);
+                              get_token(parser));
       if (Section == NULL)
         {
           parser->error = INF_STATUS_NOT_ENOUGH_MEMORY;
@@ -506,13 +819,40 @@ static PVOID add_section_from_token( struct parser *parser )
         }
     }
 
-  parser->token_len = 0;
+  reset_token(parser);
   parser->cur_section = Section;
 
   return (PVOID)Section;
 }
 
 
+/* add the current token, written in place, to the current line */
+static PVOID add_field_in_place( struct parser *parser, int is_key )
+{
+  PINFCACHEFIELD field;
+
+  if (is_key)
+    {
+      if (parser->line->Key != NULL)
+        return NULL;
+
+      parser->line->Key = get_token(parser);
+      parser->line->KeyInFileBuffer = TRUE;
+      InfpIndexKey(parser->cur_section, parser->line);
+      return parser->line->Key;
+    }
+
+  field = (PINFCACHEFIELD)MALLOC(sizeof(INFCACHEFIELD));
+  if (field == NULL)
+    return NULL;
+
+  ZEROMEMORY(field, sizeof(INFCACHEFIELD));
+  field->Data = get_token(parser);
+  InfpAppendField(parser->line, field);
+  return field;
+}
+
+
 /* add a field containing the current token to the current line */
 static struct field *add_field_from_token( struct parser *parser, int is_key )
 {
@@ -535,9 +875,13 @@ static struct field *add_field_from_token( struct parser *parser, int is_key )
 //      assert(!is_key);
     }
 
-  if (is_key)
+  if (parser->token_dst)
+    {
+      field = add_field_in_place(parser, is_key);
+    }
+  else if (is_key)
     {
-      field = InfpAddKeyToLine(parser->line, parser->token);
+      field = InfpAddKeyToLine(parser->cur_section, parser->line, parser->token);
     }
   else
     {
@@ -546,7 +890,7 @@ static struct field *add_field_from_token( struct parser *parser, int is_key )
 
   if (field != NULL)
     {
-      parser->token_len = 0;
+      reset_token(parser);
       return field;
     }
 
@@ -861,15 +1205,19 @@ static const WCHAR *comment_state( struct parser *parser, const WCHAR *pos )
 
 
 /* parse a complete buffer */
-INFSTATUS
-InfpParseBuffer (PINFCACHE file,
-                 const WCHAR *buffer,
-                 const WCHAR *end,
-                 PULONG error_line)
+static INFSTATUS
+InfpParse (PINFCACHE file,
+           const WCHAR *buffer,
+           const WCHAR *end,
+           int in_place,
+           PULONG error_line)
 {
   struct parser parser;
   const WCHAR *pos = buffer;
 
+  parser.buffer      = buffer;
+  parser.in_place    = in_place;
+  parser.token_dst   = NULL;
   parser.start       = buffer;
   parser.end         = end;
   parser.file        = file;
@@ -899,4 +1247,32 @@ InfpParseBuffer (PINFCACHE file,
   return INF_STATUS_SUCCESS;
 }
 
+
+/* parse a complete buffer, copying the strings to the cache */
+INFSTATUS
+InfpParseBuffer (PINFCACHE file,
+                 const WCHAR *buffer,
+                 const WCHAR *end,
+                 PULONG error_line)
+{
+  return InfpParse(file, buffer, end, 0, error_line);
+}
+
+
+/*
+ * parse a complete buffer, without copying the strings: they are tokenised
+ * in place in the buffer, which must be writable. The cache takes ownership
+ * of the block allocated for the buffer, even on failure.
+ */
+INFSTATUS
+InfpParseBufferInPlace (PINFCACHE file,
+                        PVOID allocation,
+                        WCHAR *buffer,
+                        WCHAR *end,
+                        PULONG error_line)
+{
+  file->FileBuffer = allocation;
+  return InfpParse(file, buffer, end, 1, error_line);
+}
+
 /* EOF */
@@ -85,11 +85,12 @@ InfHostOpenBufferedFile(PHINF InfHandle,
                                             (char *)FileBuffer + offset,
                                             FileBufferSize - offset);
 
-            Status = InfpParseBuffer(Cache,
-                                     new_buff,
-                                     new_buff + len / sizeof(WCHAR),
-                                     ErrorLine);
-            FREE(new_buff);
+            /* The cache keeps the converted buffer for its strings */
+            Status = InfpParseBufferInPlace(Cache,
+                                            new_buff,
+                                            new_buff,
+                                            new_buff + len / sizeof(WCHAR),
+                                            ErrorLine);
         }
         else
             Status = INF_STATUS_INSUFFICIENT_RESOURCES;
@@ -103,20 +104,24 @@ InfHostOpenBufferedFile(PHINF InfHandle,
             new_buff++;
             FileBufferSize -= sizeof(WCHAR);
         }
-        Status = InfpParseBuffer(Cache,
-                                 new_buff,
-                                 (WCHAR*)((char*)new_buff + FileBufferSize),
-                                 ErrorLine);
+        /* The cache keeps the file buffer for its strings */
+        Status = InfpParseBufferInPlace(Cache,
+                                        FileBuffer,
+                                        new_buff,
+                                        (WCHAR*)((char*)new_buff + FileBufferSize),
+                                        ErrorLine);
+        FileBuffer = NULL;
     }
 
   if (!INF_SUCCESS(Status))
     {
-      FREE(Cache);
+      InfpFreeCache(Cache);
       Cache = NULL;
     }
 
-  /* Free file buffer */
-  FREE(FileBuffer);
+  /* Free file buffer, unless the cache keeps it */
+  if (FileBuffer != NULL)
+    FREE(FileBuffer);
 
   *InfHandle = (HINF)Cache;
 
@@ -239,12 +244,12 @@ InfHostOpenFile(PHINF InfHandle,
                                             (char *)FileBuffer + offset,
                                             FileBufferLength - offset);
 
-            Status = InfpParseBuffer(Cache,
-                                     new_buff,
-                                     new_buff + len / sizeof(WCHAR),
-                                     ErrorLine);
-
-            FREE(new_buff);
+            /* The cache keeps the converted buffer for its strings */
+            Status = InfpParseBufferInPlace(Cache,
+                                            new_buff,
+                                            new_buff,
+                                            new_buff + len / sizeof(WCHAR),
+                                            ErrorLine);
         }
         else
             Status = INF_STATUS_INSUFFICIENT_RESOURCES;
@@ -258,20 +263,24 @@ InfHostOpenFile(PHINF InfHandle,
             new_buff++;
             FileBufferLength -= sizeof(WCHAR);
         }
-        Status = InfpParseBuffer(Cache,
-                                 new_buff,
-                                 (WCHAR*)((char*)new_buff + FileBufferLength),
-                                 ErrorLine);
+        /* The cache keeps the file buffer for its strings */
+        Status = InfpParseBufferInPlace(Cache,
+                                        FileBuffer,
+                                        new_buff,
+                                        (WCHAR*)((char*)new_buff + FileBufferLength),
+                                        ErrorLine);
+        FileBuffer = NULL;
     }
 
   if (!INF_SUCCESS(Status))
     {
-      FREE(Cache);
+      InfpFreeCache(Cache);
       Cache = NULL;
     }
 
-  /* Free file buffer */
-  FREE(FileBuffer);
+  /* Free file buffer, unless the cache keeps it */
+  if (FileBuffer != NULL)
+    FREE(FileBuffer);
 
   *InfHandle = (HINF)Cache;
 
@@ -291,13 +300,7 @@ InfHostCloseFile(HINF InfHandle)
       return;
     }
 
-  while (Cache->FirstSection != NULL)
-    {
-      Cache->FirstSection = InfpFreeSection(Cache->FirstSection);
-    }
-  Cache->LastSection = NULL;
-
-  FREE(Cache);
+  InfpFreeCache(Cache);
 }
 
 /* EOF */
@@ -23,7 +23,8 @@ typedef struct _INFCACHEFIELD
   struct _INFCACHEFIELD *Next;
   struct _INFCACHEFIELD *Prev;
 
-  WCHAR Data[1];
+  PWCHAR Data;      /* Buffer, or the string in the file buffer of the cache */
+  WCHAR Buffer[1];
 } INFCACHEFIELD, *PINFCACHEFIELD;
 
 typedef struct _INFCACHELINE
@@ -35,6 +36,8 @@ typedef struct _INFCACHELINE
   LONG FieldCount;
 
   PWCHAR Key;
+  BOOLEAN KeyInFileBuffer;
+  struct _INFCACHELINE *KeyHashNext;
 
   PINFCACHEFIELD FirstField;
   PINFCACHEFIELD LastField;
@@ -45,6 +48,7 @@ typedef struct _INFCACHESECTION
 {
   struct _INFCACHESECTION *Next;
   struct _INFCACHESECTION *Prev;
+  struct _INFCACHESECTION *HashNext;
 
   PINFCACHELINE FirstLine;
   PINFCACHELINE LastLine;
@@ -53,6 +57,15 @@ typedef struct _INFCACHESECTION
   LONG LineCount;
   UINT NextLineId;
 
+  /* Lines[Id - 1] is the line Id */
+  PINFCACHELINE *Lines;
+  UINT LinesSize;
+
+  /* First line of each key, once the section has enough keys */
+  PINFCACHELINE *KeyBuckets;
+  UINT KeyBucketCount;
+  UINT KeyCount;
+
   WCHAR Name[1];
 } INFCACHESECTION, *PINFCACHESECTION;
 
@@ -64,6 +77,17 @@ typedef struct _INFCACHE
   UINT NextSectionId;
 
   PINFCACHESECTION StringsSection;
+
+  /* Sections[Id - 1] is the section Id */
+  PINFCACHESECTION *Sections;
+  UINT SectionsSize;
+
+  /* Sections by name */
+  PINFCACHESECTION *SectionBuckets;
+  UINT SectionBucketCount;
+
+  /* Holds the strings of a cache parsed in place */
+  PVOID FileBuffer;
 } INFCACHE, *PINFCACHE;
 
 typedef struct _INFCONTEXT
@@ -82,11 +106,18 @@ extern INFSTATUS InfpParseBuffer(PINFCACHE file,
                                  const WCHAR *buffer,
                                  const WCHAR *end,
                                  PULONG error_line);
+extern INFSTATUS InfpParseBufferInPlace(PINFCACHE file,
+                                        PVOID allocation,
+                                        WCHAR *buffer,
+                                        WCHAR *end,
+                                        PULONG error_line);
+extern VOID InfpFreeCache(PINFCACHE Cache);
 extern PINFCACHESECTION InfpFreeSection(PINFCACHESECTION Section);
 extern PINFCACHESECTION InfpAddSection(PINFCACHE Cache,
                                        PCWSTR Name);
 extern PINFCACHELINE InfpAddLine(PINFCACHESECTION Section);
-extern PVOID InfpAddKeyToLine(PINFCACHELINE Line,
+extern PVOID InfpAddKeyToLine(PINFCACHESECTION Section,
+                              PINFCACHELINE Line,
                               PCWSTR Key);
 extern PVOID InfpAddFieldToLine(PINFCACHELINE Line,
                                 PCWSTR Data);
@@ -15,6 +15,9 @@ extern "C" {
 #include <infcommon.h>
 
 extern VOID InfSetHeap(PVOID Heap);
+/* Makes the Count-th allocation from now on fail, 0 cancels. Returns the
+   allocations that were still left before the failure. For tests only */
+extern ULONG InfSetAllocationFailure(ULONG Count);
 extern NTSTATUS InfOpenBufferedFile(PHINF InfHandle,
                                     PVOID Buffer,
                                     ULONG BufferSize,
@@ -17,6 +17,7 @@
 /* PRIVATE FUNCTIONS ********************************************************/
 
 static int InfpHeapRefCount;
+static ULONG InfpFailAllocation;
 
 static VOID
 CheckHeap(VOID)
@@ -32,6 +33,20 @@ CheckHeap(VOID)
 }
 
 
+PVOID
+InfpAllocate(SIZE_T Size)
+{
+  /* Fail the allocation that InfSetAllocationFailure asked for */
+  if (0 != InfpFailAllocation && 0 == --InfpFailAllocation)
+    {
+      DPRINT1("Failing an allocation of %lu bytes on request\n", (ULONG)Size);
+      return NULL;
+    }
+
+  return RtlAllocateHeap(InfpHeap, 0, Size);
+}
+
+
 /* PUBLIC FUNCTIONS *********************************************************/
 
 PVOID InfpHeap;
@@ -46,6 +61,15 @@ InfSetHeap(PVOID Heap)
     }
 }
 
+ULONG
+InfSetAllocationFailure(ULONG Count)
+{
+  ULONG Pending = InfpFailAllocation;
+
+  InfpFailAllocation = Count;
+  return Pending;
+}
+
 
 NTSTATUS
 InfOpenBufferedFile(PHINF InfHandle,
@@ -118,11 +142,12 @@ InfOpenBufferedFile(PHINF InfHandle,
                                             (char *)FileBuffer + offset,
                                             FileBufferSize - offset);
 
-            Status = InfpParseBuffer(Cache,
-                                     new_buff,
-                                     new_buff + len / sizeof(WCHAR),
-                                     ErrorLine);
-            FREE(new_buff);
+            /* The cache keeps the converted buffer for its strings */
+            Status = InfpParseBufferInPlace(Cache,
+                                            new_buff,
+                                            new_buff,
+                                            new_buff + len / sizeof(WCHAR),
+                                            ErrorLine);
         }
         else
             Status = INF_STATUS_INSUFFICIENT_RESOURCES;
@@ -136,20 +161,24 @@ InfOpenBufferedFile(PHINF InfHandle,
             new_buff++;
             FileBufferSize -= sizeof(WCHAR);
         }
-        Status = InfpParseBuffer(Cache,
-                                 new_buff,
-                                 (WCHAR*)((char*)new_buff + FileBufferSize),
-                                 ErrorLine);
+        /* The cache keeps the file buffer for its strings */
+        Status = InfpParseBufferInPlace(Cache,
+                                        FileBuffer,
+                                        new_buff,
+                                        (WCHAR*)((char*)new_buff + FileBufferSize),
+                                        ErrorLine);
+        FileBuffer = NULL;
     }
 
   if (!INF_SUCCESS(Status))
     {
-      FREE(Cache);
+      InfpFreeCache(Cache);
       Cache = NULL;
     }
 
-  /* Free file buffer */
-  FREE(FileBuffer);
+  /* Free file buffer, unless the cache keeps it */
+  if (FileBuffer != NULL)
+    FREE(FileBuffer);
 
   *InfHandle = (HINF)Cache;
 
@@ -291,11 +320,12 @@ InfOpenFile(PHINF InfHandle,
                                             (char *)FileBuffer + offset,
                                             FileBufferLength - offset);
 
-            Status = InfpParseBuffer(Cache,
-                                     new_buff,
-                                     new_buff + len / sizeof(WCHAR),
-                                     ErrorLine);
-            FREE(new_buff);
+            /* The cache keeps the converted buffer for its strings */
+            Status = InfpParseBufferInPlace(Cache,
+                                            new_buff,
+                                            new_buff,
+                                            new_buff + len / sizeof(WCHAR),
+                                            ErrorLine);
         }
         else
             Status = INF_STATUS_INSUFFICIENT_RESOURCES;
@@ -309,20 +339,24 @@ InfOpenFile(PHINF InfHandle,
             new_buff++;
             FileBufferLength -= sizeof(WCHAR);
         }
-        Status = InfpParseBuffer(Cache,
-                                 new_buff,
-                                 (WCHAR*)((char*)new_buff + FileBufferLength),
-                                 ErrorLine);
+        /* The cache keeps the file buffer for its strings */
+        Status = InfpParseBufferInPlace(Cache,
+                                        FileBuffer,
+                                        new_buff,
+                                        (WCHAR*)((char*)new_buff + FileBufferLength),
+                                        ErrorLine);
+        FileBuffer = NULL;
     }
 
   if (!INF_SUCCESS(Status))
     {
-      FREE(Cache);
+      InfpFreeCache(Cache);
       Cache = NULL;
     }
 
-  /* Free file buffer */
-  FREE(FileBuffer);
+  /* Free file buffer, unless the cache keeps it */
+  if (FileBuffer != NULL)
+    FREE(FileBuffer);
 
   *InfHandle = (HINF)Cache;
 
@@ -342,13 +376,7 @@ InfCloseFile(HINF InfHandle)
       return;
     }
 
-  while (Cache->FirstSection != NULL)
-    {
-      Cache->FirstSection = InfpFreeSection(Cache->FirstSection);
-    }
-  Cache->LastSection = NULL;
-
-  FREE(Cache);
+  InfpFreeCache(Cache);
 
   if (0 < InfpHeapRefCount)
     {
@@ -117,13 +117,13 @@ InfFindOrAddSection(HINF InfHandle,
 }
 
 BOOLEAN
-InfHostAddLine(PINFCONTEXT Context, PCWSTR Key)
+InfAddLine(PINFCONTEXT Context, PCWSTR Key)
 {
   return INF_SUCCESS(InfpAddLineWithKey(Context, Key));
 }
 
 BOOLEAN
-InfHostAddField(PINFCONTEXT Context, PCWSTR Data)
+InfAddField(PINFCONTEXT Context, PCWSTR Data)
 {
   return INF_SUCCESS(InfpAddField(Context, Data));
 }
@@ -169,6 +169,10 @@ RtlpInitializeHeap(OUT PHEAP Heap,
     }
     Heap->LockVariable = Lock;
 
+    /* No front end until it gets enabled */
+    Heap->FrontEndHeap = NULL;
+    Heap->FrontEndHeapType = 0;
+
     /* Initialise the Heap alignment info */
     if (Flags & HEAP_CREATE_ALIGN_16)
     {
@@ -1951,6 +1955,16 @@ RtlAllocateHeap(IN PVOID HeapPtr,
         DPRINT1("HEAP: RtlAllocateHeap is called with unsupported flags %x, ignoring\n", Flags);
     }
 
+    /* Small blocks without extra stuff go to the low fragmentation heap, if enabled.
+       If it can't satisfy the request, let the back end try */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_LOWFRAGHEAP &&
+        Size <= HEAP_LFH_MAX_BLOCK_SIZE &&
+        !(Flags & (HEAP_EXTRA_FLAGS_MASK | HEAP_SETTABLE_USER_FLAGS)))
+    {
+        InUseEntry = RtlpLfhAllocate(Heap, Flags, Size);
+        if (InUseEntry) return InUseEntry;
+    }
+
     //DPRINT("RtlAllocateHeap(%p %x %x)\n", Heap, Flags, Size);
 
     /* Calculate allocation size and index */
@@ -2190,7 +2204,7 @@ BOOLEAN NTAPI RtlFreeHeap(
         /* Check this entry, fail if it's invalid */
         if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY) ||
             (((ULONG_PTR)Ptr & 0x7) != 0) ||
-            (HeapEntry->SegmentOffset >= HEAP_SEGMENTS))
+            (HeapEntry->SegmentOffset >= HEAP_SEGMENTS && !RtlpIsLfhEntry(HeapEntry)))
         {
             /* This is an invalid block */
             DPRINT1("HEAP: Trying to free an invalid address %p!\n", Ptr);
@@ -2207,6 +2221,10 @@ BOOLEAN NTAPI RtlFreeHeap(
     }
     _SEH2_END;
 
+    /* Blocks of the low fragmentation heap go back to their subsegment, lock free */
+    if (RtlpIsLfhEntry(HeapEntry))
+        return RtlpLfhFree(Heap, Flags, HeapEntry);
+
     /* Lock if necessary */
     if (!(Flags & HEAP_NO_SERIALIZE))
     {
@@ -2600,6 +2618,10 @@ RtlReAllocateHeap(HANDLE HeapPtr,
         return NULL;
     }
 
+    /* Blocks of the low fragmentation heap are handled by the front end */
+    if (RtlpIsLfhEntry((PHEAP_ENTRY)Ptr - 1))
+        return RtlpLfhReAllocate(Heap, Flags, Ptr, Size);
+
     /* Calculate allocation size and index */
     if (Size)
         AllocationSize = Size;
@@ -3164,6 +3186,13 @@ RtlpValidateHeapEntry(
     if ((ULONG_PTR)HeapEntry & (HEAP_ENTRY_SIZE - 1)) goto invalid_entry;
     if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY)) goto invalid_entry;
 
+    /* Blocks of the low fragmentation heap live in a back end block of their own */
+    if (RtlpIsLfhEntry(HeapEntry))
+    {
+        if (!RtlpLfhValidateEntry(Heap, HeapEntry)) goto invalid_entry;
+        return TRUE;
+    }
+
     BigAllocation = HeapEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC;
     Segment = Heap->Segments[HeapEntry->SegmentOffset];
 
@@ -3928,13 +3957,16 @@ RtlSetHeapInformation(IN HANDLE HeapHandle OPTIONAL,
         }
 
         /* Check for a special magic value for enabling LFH */
-        if (*(PULONG)HeapInformation != 2)
+        if (*(PULONG)HeapInformation != HEAP_FRONT_LOWFRAGHEAP)
         {
             return STATUS_UNSUCCESSFUL;
         }
 
-        DPRINT1("RtlSetHeapInformation() needs to enable LFH\n");
-        return STATUS_SUCCESS;
+        /* Enable it on the given heap, or the process heap */
+        if (!HeapHandle)
+            HeapHandle = RtlGetProcessHeap();
+
+        return RtlpActivateLowFragmentationHeap((PHEAP)HeapHandle);
     }
 
     return STATUS_SUCCESS;
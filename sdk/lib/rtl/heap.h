@@ -55,6 +55,22 @@
 /* Segment flags */
 #define HEAP_USER_ALLOCATED    0x1
 
+/* Front end heap types */
+#define HEAP_FRONT_LOWFRAGHEAP 2
+
+/* Low fragmentation heap: one bucket per HEAP_ENTRY granular size,
+   blocks are carved out of subsegments allocated from the back end */
+#define HEAP_LFH_BUCKETS        128
+#define HEAP_LFH_MAX_BLOCK_SIZE (HEAP_LFH_BUCKETS << HEAP_ENTRY_SHIFT)
+#define HEAP_LFH_AFFINITY_SLOTS 8
+#define HEAP_LFH_SUBSEGMENT_SIZE 0x4000
+#define HEAP_LFH_MIN_BLOCK_COUNT 8
+
+/* SegmentOffset of the blocks owned by the LFH, never a valid segment index */
+#define HEAP_LFH_SEGMENT_OFFSET 0xFE
+
+#define HEAP_LFH_SIGNATURE      'HFLR'
+
 /* A handy inline to distinguis normal heap, special "debug heap" and special "page heap" */
 FORCEINLINE BOOLEAN
 RtlpHeapIsSpecial(ULONG Flags)
@@ -327,6 +343,42 @@ typedef struct _HEAP_VIRTUAL_ALLOC_ENTRY
     HEAP_ENTRY BusyBlock;
 } HEAP_VIRTUAL_ALLOC_ENTRY, *PHEAP_VIRTUAL_ALLOC_ENTRY;
 
+typedef struct _HEAP_LFH_SUBSEGMENT
+{
+    SLIST_HEADER FreeSlots;
+    LIST_ENTRY ListEntry;
+    struct _HEAP_LFH_BUCKET *Bucket;
+    ULONG Signature;
+    USHORT BlockUnits;
+    USHORT BlockCount;
+} HEAP_LFH_SUBSEGMENT, *PHEAP_LFH_SUBSEGMENT;
+
+/* First slot of a subsegment, keep it aligned on a heap entry */
+#define HEAP_LFH_FIRST_SLOT_OFFSET ROUND_UP(sizeof(HEAP_LFH_SUBSEGMENT), sizeof(HEAP_ENTRY))
+
+typedef struct _HEAP_LFH_BUCKET
+{
+    PHEAP_LFH_SUBSEGMENT volatile ActiveSubSegment[HEAP_LFH_AFFINITY_SLOTS];
+    LIST_ENTRY SubSegmentList;
+    USHORT BlockUnits;
+    USHORT BlockCount;
+} HEAP_LFH_BUCKET, *PHEAP_LFH_BUCKET;
+
+typedef struct _HEAP_LFH
+{
+    PHEAP Heap;
+    ULONG SubSegmentCount;
+    HEAP_LFH_BUCKET Buckets[HEAP_LFH_BUCKETS];
+} HEAP_LFH, *PHEAP_LFH;
+
+/* Tells whether a busy block belongs to the low fragmentation heap */
+FORCEINLINE BOOLEAN
+RtlpIsLfhEntry(PHEAP_ENTRY HeapEntry)
+{
+    return !(HeapEntry->Flags & HEAP_ENTRY_VIRTUAL_ALLOC) &&
+           HeapEntry->SegmentOffset == HEAP_LFH_SEGMENT_OFFSET;
+}
+
 /* Global variables */
 extern RTL_CRITICAL_SECTION RtlpProcessHeapsListLock;
 extern BOOLEAN RtlpPageHeapEnabled;
@@ -352,6 +404,30 @@ RtlpValidateHeapEntry(PHEAP Heap, PHEAP_ENTRY HeapEntry);
 BOOLEAN NTAPI
 RtlpValidateHeapHeaders(PHEAP Heap, BOOLEAN Recalculate);
 
+/* heaplfh.c */
+NTSTATUS NTAPI
+RtlpActivateLowFragmentationHeap(PHEAP Heap);
+
+PVOID NTAPI
+RtlpLfhAllocate(PHEAP Heap,
+                ULONG Flags,
+                SIZE_T Size);
+
+BOOLEAN NTAPI
+RtlpLfhFree(PHEAP Heap,
+            ULONG Flags,
+            PHEAP_ENTRY HeapEntry);
+
+PVOID NTAPI
+RtlpLfhReAllocate(PHEAP Heap,
+                  ULONG Flags,
+                  PVOID Ptr,
+                  SIZE_T Size);
+
+BOOLEAN NTAPI
+RtlpLfhValidateEntry(PHEAP Heap,
+                     PHEAP_ENTRY HeapEntry);
+
 /* heapdbg.c */
 HANDLE NTAPI
 RtlDebugCreateHeap(ULONG Flags,
@@ -0,0 +1,344 @@
+/*
+ * COPYRIGHT:       See COPYING in the top level directory
+ * PROJECT:         ReactOS system libraries
+ * FILE:            lib/rtl/heaplfh.c
+ * PURPOSE:         RTL Heap low fragmentation front end
+ */
+
+/* Useful references:
+   http://illmatics.com/Understanding_the_LFH.pdf
+
+   Small blocks are served from per-size buckets. Each bucket owns
+   subsegments, which are plain busy blocks of the back end heap cut into
+   equally sized slots. Free slots are kept in an interlocked SList per
+   subsegment, so allocating and freeing a block doesn't take the heap lock:
+   it is only acquired when a bucket has to switch to another subsegment.
+
+   Subsegments are never given back to the back end before the heap is
+   destroyed: a thread may still be popping from a subsegment another thread
+   just retired, and the SList pop reads the slot it is about to take.
+*/
+
+/* INCLUDES *****************************************************************/
+
+#include <rtl.h>
+#include <heap.h>
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS *****************************************************************/
+
+FORCEINLINE
+ULONG
+RtlpLfhGetAffinitySlot(VOID)
+{
+    ULONG_PTR StackAddress = (ULONG_PTR)&StackAddress;
+
+    /* Threads stacks are far away from each other, so hashing the current
+       stack address gives every thread a slot of its own, mostly stable,
+       without having to ask the kernel for the current processor */
+    return (ULONG)((StackAddress >> 16) ^ (StackAddress >> 20)) % HEAP_LFH_AFFINITY_SLOTS;
+}
+
+FORCEINLINE
+PHEAP_LFH_SUBSEGMENT
+RtlpLfhGetSubSegment(PHEAP_ENTRY HeapEntry)
+{
+    /* The slot index is stored in place of the previous size */
+    return (PHEAP_LFH_SUBSEGMENT)((ULONG_PTR)HeapEntry -
+                                  ((SIZE_T)HeapEntry->PreviousSize * HeapEntry->Size << HEAP_ENTRY_SHIFT) -
+                                  HEAP_LFH_FIRST_SLOT_OFFSET);
+}
+
+static
+PHEAP_LFH_SUBSEGMENT
+RtlpLfhCreateSubSegment(PHEAP_LFH Lfh,
+                        PHEAP_LFH_BUCKET Bucket)
+{
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    PHEAP_ENTRY HeapEntry;
+    ULONG Index;
+
+    /* The heap lock is held by the caller */
+    SubSegment = RtlAllocateHeap(Lfh->Heap,
+                                 HEAP_NO_SERIALIZE,
+                                 HEAP_LFH_FIRST_SLOT_OFFSET +
+                                 ((SIZE_T)Bucket->BlockCount * Bucket->BlockUnits << HEAP_ENTRY_SHIFT));
+    if (!SubSegment) return NULL;
+
+    RtlInitializeSListHead(&SubSegment->FreeSlots);
+    SubSegment->Bucket = Bucket;
+    SubSegment->Signature = HEAP_LFH_SIGNATURE;
+    SubSegment->BlockUnits = Bucket->BlockUnits;
+    SubSegment->BlockCount = Bucket->BlockCount;
+
+    /* Set up all the slots headers once for all, and link them.
+       Push them backwards so that they are handed out in address order */
+    for (Index = SubSegment->BlockCount; Index > 0; Index--)
+    {
+        HeapEntry = (PHEAP_ENTRY)((ULONG_PTR)SubSegment + HEAP_LFH_FIRST_SLOT_OFFSET) +
+                    (Index - 1) * SubSegment->BlockUnits;
+
+        RtlZeroMemory(HeapEntry, sizeof(HEAP_ENTRY));
+        HeapEntry->Size = SubSegment->BlockUnits;
+        HeapEntry->PreviousSize = (USHORT)(Index - 1);
+        HeapEntry->SegmentOffset = HEAP_LFH_SEGMENT_OFFSET;
+
+        RtlInterlockedPushEntrySList(&SubSegment->FreeSlots, (PSLIST_ENTRY)(HeapEntry + 1));
+    }
+
+    InsertHeadList(&Bucket->SubSegmentList, &SubSegment->ListEntry);
+    Lfh->SubSegmentCount++;
+
+    return SubSegment;
+}
+
+static
+PSLIST_ENTRY
+RtlpLfhRefillBucket(PHEAP_LFH Lfh,
+                    PHEAP_LFH_BUCKET Bucket,
+                    ULONG AffinitySlot)
+{
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    PLIST_ENTRY ListEntry;
+    PSLIST_ENTRY Slot = NULL;
+
+    RtlEnterHeapLock(Lfh->Heap->LockVariable, TRUE);
+
+    /* Another thread may have done the job while we were waiting */
+    SubSegment = Bucket->ActiveSubSegment[AffinitySlot];
+    if (SubSegment)
+        Slot = RtlInterlockedPopEntrySList(&SubSegment->FreeSlots);
+
+    if (!Slot)
+    {
+        /* Reuse a subsegment which got blocks freed */
+        for (ListEntry = Bucket->SubSegmentList.Flink;
+             ListEntry != &Bucket->SubSegmentList;
+             ListEntry = ListEntry->Flink)
+        {
+            SubSegment = CONTAINING_RECORD(ListEntry, HEAP_LFH_SUBSEGMENT, ListEntry);
+            if (RtlQueryDepthSList(&SubSegment->FreeSlots) == 0) continue;
+
+            Slot = RtlInterlockedPopEntrySList(&SubSegment->FreeSlots);
+            if (Slot) break;
+        }
+
+        /* None, get a new one from the back end */
+        if (!Slot)
+        {
+            SubSegment = RtlpLfhCreateSubSegment(Lfh, Bucket);
+            if (SubSegment)
+                Slot = RtlInterlockedPopEntrySList(&SubSegment->FreeSlots);
+        }
+
+        if (Slot)
+            Bucket->ActiveSubSegment[AffinitySlot] = SubSegment;
+    }
+
+    RtlLeaveHeapLock(Lfh->Heap->LockVariable);
+
+    return Slot;
+}
+
+NTSTATUS NTAPI
+RtlpActivateLowFragmentationHeap(PHEAP Heap)
+{
+    PHEAP_LFH Lfh;
+    ULONG Index;
+
+    /* The LFH relies on the heap lock for its slow path, and can't honour
+       the debugging features of the back end */
+    if ((Heap->Flags & (HEAP_NO_SERIALIZE |
+                        HEAP_TAIL_CHECKING_ENABLED |
+                        HEAP_FREE_CHECKING_ENABLED)) ||
+        RtlpHeapIsSpecial(Heap->Flags) ||
+        Heap->PseudoTagEntries)
+    {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    /* Slots are only aligned on a heap entry */
+    if ((Heap->Flags & HEAP_CREATE_ALIGN_16) && HEAP_ENTRY_SIZE < 16)
+        return STATUS_UNSUCCESSFUL;
+
+    /* Already enabled, nothing to do */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_LOWFRAGHEAP)
+        return STATUS_SUCCESS;
+
+    Lfh = RtlAllocateHeap(Heap, HEAP_ZERO_MEMORY, sizeof(HEAP_LFH));
+    if (!Lfh) return STATUS_NO_MEMORY;
+
+    Lfh->Heap = Heap;
+    for (Index = 0; Index < HEAP_LFH_BUCKETS; Index++)
+    {
+        /* Bucket N holds blocks of N + 1 entries, plus their header */
+        InitializeListHead(&Lfh->Buckets[Index].SubSegmentList);
+        Lfh->Buckets[Index].BlockUnits = (USHORT)(Index + 2);
+        Lfh->Buckets[Index].BlockCount =
+            (USHORT)max(HEAP_LFH_SUBSEGMENT_SIZE / ((Index + 2) << HEAP_ENTRY_SHIFT),
+                        HEAP_LFH_MIN_BLOCK_COUNT);
+    }
+
+    RtlEnterHeapLock(Heap->LockVariable, TRUE);
+
+    /* Somebody may have been faster */
+    if (Heap->FrontEndHeapType == HEAP_FRONT_LOWFRAGHEAP)
+    {
+        RtlLeaveHeapLock(Heap->LockVariable);
+        RtlFreeHeap(Heap, 0, Lfh);
+        return STATUS_SUCCESS;
+    }
+
+    /* Publish the front end before switching allocations to it */
+    InterlockedExchangePointer(&Heap->FrontEndHeap, Lfh);
+    Heap->FrontEndHeapType = HEAP_FRONT_LOWFRAGHEAP;
+
+    RtlLeaveHeapLock(Heap->LockVariable);
+
+    DPRINT("Low fragmentation heap enabled for heap %p\n", Heap);
+    return STATUS_SUCCESS;
+}
+
+PVOID NTAPI
+RtlpLfhAllocate(PHEAP Heap,
+                ULONG Flags,
+                SIZE_T Size)
+{
+    PHEAP_LFH Lfh = Heap->FrontEndHeap;
+    PHEAP_LFH_BUCKET Bucket;
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    PHEAP_ENTRY HeapEntry;
+    PSLIST_ENTRY Slot = NULL;
+    ULONG AffinitySlot;
+
+    ASSERT(Size <= HEAP_LFH_MAX_BLOCK_SIZE);
+
+    /* Pick the bucket, a zero sized block still needs an entry */
+    Bucket = &Lfh->Buckets[Size ? (Size - 1) >> HEAP_ENTRY_SHIFT : 0];
+
+    /* Fast path: take a slot from the subsegment active for this thread */
+    AffinitySlot = RtlpLfhGetAffinitySlot();
+    SubSegment = Bucket->ActiveSubSegment[AffinitySlot];
+    if (SubSegment)
+        Slot = RtlInterlockedPopEntrySList(&SubSegment->FreeSlots);
+
+    /* It's exhausted, find another one */
+    if (!Slot)
+    {
+        Slot = RtlpLfhRefillBucket(Lfh, Bucket, AffinitySlot);
+        if (!Slot) return NULL;
+    }
+
+    /* The header was set up with the subsegment, just mark it busy */
+    HeapEntry = (PHEAP_ENTRY)Slot - 1;
+    ASSERT(HeapEntry->Size == Bucket->BlockUnits);
+    HeapEntry->Flags = HEAP_ENTRY_BUSY;
+    HeapEntry->UnusedBytes = (UCHAR)(((SIZE_T)Bucket->BlockUnits << HEAP_ENTRY_SHIFT) - Size);
+
+    if (Flags & HEAP_ZERO_MEMORY)
+        RtlZeroMemory(HeapEntry + 1, Size);
+
+    return HeapEntry + 1;
+}
+
+BOOLEAN NTAPI
+RtlpLfhFree(PHEAP Heap,
+            ULONG Flags,
+            PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+
+    if (!RtlpLfhValidateEntry(Heap, HeapEntry))
+    {
+        DPRINT1("HEAP: Trying to free an invalid address %p!\n", HeapEntry + 1);
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    /* Give the slot back to its subsegment */
+    SubSegment = RtlpLfhGetSubSegment(HeapEntry);
+    HeapEntry->Flags = 0;
+    RtlInterlockedPushEntrySList(&SubSegment->FreeSlots, (PSLIST_ENTRY)(HeapEntry + 1));
+
+    return TRUE;
+}
+
+PVOID NTAPI
+RtlpLfhReAllocate(PHEAP Heap,
+                  ULONG Flags,
+                  PVOID Ptr,
+                  SIZE_T Size)
+{
+    PHEAP_ENTRY HeapEntry = (PHEAP_ENTRY)Ptr - 1;
+    SIZE_T OldSize;
+    PVOID NewPtr;
+
+    if (!RtlpLfhValidateEntry(Heap, HeapEntry))
+    {
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    OldSize = ((SIZE_T)HeapEntry->Size << HEAP_ENTRY_SHIFT) - HeapEntry->UnusedBytes;
+
+    /* If it still fits into the slot, that's all */
+    if (Size <= ((SIZE_T)(HeapEntry->Size - 1) << HEAP_ENTRY_SHIFT))
+    {
+        if ((Flags & HEAP_ZERO_MEMORY) && Size > OldSize)
+            RtlZeroMemory((PCHAR)Ptr + OldSize, Size - OldSize);
+
+        HeapEntry->UnusedBytes = (UCHAR)(((SIZE_T)HeapEntry->Size << HEAP_ENTRY_SHIFT) - Size);
+        return Ptr;
+    }
+
+    if (Flags & HEAP_REALLOC_IN_PLACE_ONLY)
+    {
+        RtlSetLastWin32ErrorAndNtStatusFromNtStatus(STATUS_NO_MEMORY);
+        return NULL;
+    }
+
+    /* Move it to a bigger block, from the LFH or the back end */
+    NewPtr = RtlAllocateHeap(Heap, Flags & ~HEAP_ZERO_MEMORY, Size);
+    if (!NewPtr) return NULL;
+
+    RtlCopyMemory(NewPtr, Ptr, OldSize);
+    if (Flags & HEAP_ZERO_MEMORY)
+        RtlZeroMemory((PCHAR)NewPtr + OldSize, Size - OldSize);
+
+    RtlpLfhFree(Heap, Flags, HeapEntry);
+
+    return NewPtr;
+}
+
+BOOLEAN NTAPI
+RtlpLfhValidateEntry(PHEAP Heap,
+                     PHEAP_ENTRY HeapEntry)
+{
+    PHEAP_LFH_SUBSEGMENT SubSegment;
+    BOOLEAN Valid = FALSE;
+
+    if (Heap->FrontEndHeapType != HEAP_FRONT_LOWFRAGHEAP) return FALSE;
+    if (!(HeapEntry->Flags & HEAP_ENTRY_BUSY)) return FALSE;
+
+    /* Protect with SEH in case the header is garbage */
+    _SEH2_TRY
+    {
+        SubSegment = RtlpLfhGetSubSegment(HeapEntry);
+        Valid = SubSegment->Signature == HEAP_LFH_SIGNATURE &&
+                SubSegment->BlockUnits == HeapEntry->Size &&
+                HeapEntry->PreviousSize < SubSegment->BlockCount &&
+                SubSegment->Bucket >= &((PHEAP_LFH)Heap->FrontEndHeap)->Buckets[0] &&
+                SubSegment->Bucket < &((PHEAP_LFH)Heap->FrontEndHeap)->Buckets[HEAP_LFH_BUCKETS];
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Valid = FALSE;
+    }
+    _SEH2_END;
+
+    return Valid;
+}
+
+/* EOF */
@@ -26,6 +26,8 @@
 #include "cabinet.h"
 #include "raw.h"
 #include "mszip.h"
+#include "lzx.h"
+#include <parallel.h>
 
 #ifndef CAB_READ_ONLY
 
@@ -94,6 +96,7 @@ CCabinet::CCabinet()
     Codec          = NULL;
     CodecId        = -1;
     CodecSelected  = false;
+    CodecDataNode  = NULL;
 
     OutputBuffer = NULL;
     InputBuffer  = NULL;
@@ -105,6 +108,11 @@ CCabinet::CCabinet()
     BytesLeftInBlock = 0;
     ReuseBlock       = false;
     CurrentDataNode  = NULL;
+
+    JobCount         = 1;
+    JobCodecs        = NULL;
+    QueuedBlocks     = NULL;
+    QueuedBlockCount = 0;
 }
 
 
@@ -122,6 +130,8 @@ CCabinet::~CCabinet()
 
     if (CodecSelected)
         delete Codec;
+
+    DestroyJobCodecs();
 }
 
 bool CCabinet::IsSeparator(char Char)
@@ -369,6 +379,8 @@ bool CCabinet::SetCompressionCodec(char* CodecName)
         SelectCodec(CAB_CODEC_RAW);
     else if( !strcasecmp(CodecName, "mszip") )
         SelectCodec(CAB_CODEC_MSZIP);
+    else if( !strcasecmp(CodecName, "lzx") )
+        SelectCodec(CAB_CODEC_LZX);
     else
     {
         printf("ERROR: Invalid codec specified!\n");
@@ -632,6 +644,9 @@ void CCabinet::Close()
         fclose(FileHandle);
         FileOpen = false;
     }
+
+    /* The data nodes are about to go away */
+    CodecDataNode = NULL;
 }
 
 
@@ -758,6 +773,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
     PUCHAR CurrentBuffer;
     FILE* DestFile;
     PCFFILE_NODE File;
+    PCFDATA_NODE DataNode;
     CFDATA CFData;
     ULONG Status;
     bool Skip;
@@ -786,6 +802,10 @@ ULONG CCabinet::ExtractFile(char* FileName)
             SelectCodec(CAB_CODEC_MSZIP);
             break;
 
+        case CAB_COMP_LZX:
+            SelectCodec(CAB_CODEC_LZX);
+            break;
+
         default:
             return CAB_STATUS_UNSUPPCOMP;
     }
@@ -836,7 +856,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
 
     SetAttributesOnFile(DestName, File->File.Attributes);
 
-    Buffer = (PUCHAR)malloc(CAB_BLOCKSIZE + 12); // This should be enough
+    Buffer = (PUCHAR)malloc(CAB_MAX_COMPSIZE);
     if (!Buffer)
     {
         fclose(DestFile);
@@ -844,6 +864,23 @@ ULONG CCabinet::ExtractFile(char* FileName)
         return CAB_STATUS_NOMEMORY;
     }
 
+    if (!Codec->IsBlockIndependent())
+    {
+        /* The codec has to go through the data blocks before the one of the
+           file, unless it is the last one it uncompressed: reuse that then */
+        if (CodecDataNode != File->DataBlock)
+        {
+            Status = ReplayDataBlocks(File->DataBlock, Buffer);
+            if (Status != CAB_STATUS_SUCCESS)
+            {
+                fclose(DestFile);
+                free(Buffer);
+                return Status;
+            }
+        }
+        CurrentDataNode = CodecDataNode;
+    }
+
     /* Call OnExtract event handler */
     OnExtract(&File->File, FileName);
 
@@ -863,6 +900,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
     Skip = true;
 
     ReuseBlock = (CurrentDataNode == File->DataBlock);
+    DataNode   = File->DataBlock;
     if (Size > 0)
     {
         do
@@ -895,7 +933,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
                         CFData.CompSize,
                         CFData.UncompSize));
 
-                    ASSERT(CFData.CompSize <= CAB_BLOCKSIZE + 12);
+                    ASSERT(CFData.CompSize <= CAB_MAX_COMPSIZE);
 
                     BytesToRead = CFData.CompSize;
 
@@ -988,6 +1026,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
                             (UINT)File->DataBlock->UncompOffset));
 
                         CurrentDataNode = File->DataBlock;
+                        DataNode = File->DataBlock;
                         ReuseBlock = true;
 
                         RestartSearch = true;
@@ -999,6 +1038,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
                 Status = Codec->Uncompress(OutputBuffer, Buffer, TotalBytesRead, &BytesToWrite);
                 if (Status != CS_SUCCESS)
                 {
+                    CodecDataNode = NULL;
                     fclose(DestFile);
                     free(Buffer);
                     DPRINT(MID_TRACE, ("Cannot uncompress block.\n"));
@@ -1017,6 +1057,10 @@ ULONG CCabinet::ExtractFile(char* FileName)
                 }
 
                 BytesLeftInBlock = BytesToWrite;
+
+                CodecDataNode = DataNode;
+                if (DataNode)
+                    DataNode = DataNode->Next;
             }
             else
             {
@@ -1049,6 +1093,7 @@ ULONG CCabinet::ExtractFile(char* FileName)
                     return CAB_STATUS_INVALID_CAB;
                 }
 
+                DataNode = CurrentDataNode->Next;
                 ReuseBlock = false;
             }
 
@@ -1096,6 +1141,86 @@ ULONG CCabinet::ExtractFile(char* FileName)
     return CAB_STATUS_SUCCESS;
 }
 
+
+ULONG CCabinet::ReplayDataBlocks(PCFDATA_NODE DataNode, PUCHAR Buffer)
+/*
+ * FUNCTION: Uncompresses the data blocks of the current folder that come
+ *           before a data block, for codecs whose state carries over from
+ *           a block to the next
+ * ARGUMENTS:
+ *     DataNode = Pointer to the data block to stop at
+ *     Buffer   = Pointer to a buffer for compressed data
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    PCFDATA_NODE Node;
+    CFDATA CFData;
+    ULONG BytesRead;
+    ULONG BytesToWrite;
+    ULONG Status;
+
+    /* Carry on from the last data block uncompressed if it comes before,
+       otherwise start over at the first data block of the folder */
+    for (Node = CodecDataNode; Node != NULL && Node != DataNode; Node = Node->Next);
+
+    if (CodecDataNode != NULL && Node != NULL)
+    {
+        Node = CodecDataNode->Next;
+    }
+    else
+    {
+        Codec->Reset(CurrentFolderNode->Folder.CompressionType);
+        CodecDataNode = NULL;
+        Node = CurrentFolderNode->DataListHead;
+    }
+
+    for (; Node != DataNode; Node = Node->Next)
+    {
+        if (Node == NULL)
+            return CAB_STATUS_INVALID_CAB;
+
+        DPRINT(MAX_TRACE, ("Replaying data block at (0x%X)  UO (0x%X).\n",
+            (UINT)Node->AbsoluteOffset, (UINT)Node->UncompOffset));
+
+        if (fseek(FileHandle, (off_t)Node->AbsoluteOffset, SEEK_SET) != 0)
+        {
+            DPRINT(MIN_TRACE, ("fseek() failed.\n"));
+            return CAB_STATUS_INVALID_CAB;
+        }
+
+        if (((Status = ReadBlock(&CFData, sizeof(CFDATA), &BytesRead)) !=
+            CAB_STATUS_SUCCESS) || (BytesRead != sizeof(CFDATA)) ||
+            (CFData.CompSize > CAB_MAX_COMPSIZE))
+        {
+            DPRINT(MIN_TRACE, ("Cannot read from file (%u).\n", (UINT)Status));
+            return CAB_STATUS_INVALID_CAB;
+        }
+
+        if (((Status = ReadBlock(Buffer, CFData.CompSize, &BytesRead)) !=
+            CAB_STATUS_SUCCESS) || (BytesRead != CFData.CompSize))
+        {
+            DPRINT(MIN_TRACE, ("Cannot read from file (%u).\n", (UINT)Status));
+            return CAB_STATUS_INVALID_CAB;
+        }
+
+        Status = Codec->Uncompress(OutputBuffer, Buffer, BytesRead, &BytesToWrite);
+        if (Status != CS_SUCCESS || BytesToWrite != CFData.UncompSize)
+        {
+            DPRINT(MID_TRACE, ("Cannot uncompress block.\n"));
+            CodecDataNode = NULL;
+            if (Status == CS_NOMEMORY)
+                return CAB_STATUS_NOMEMORY;
+            return CAB_STATUS_INVALID_CAB;
+        }
+
+        BytesLeftInBlock = BytesToWrite;
+        CodecDataNode = Node;
+    }
+
+    return CAB_STATUS_SUCCESS;
+}
+
 bool CCabinet::IsCodecSelected()
 /*
  * FUNCTION: Returns the value of CodecSelected
@@ -1113,36 +1238,106 @@ void CCabinet::SelectCodec(LONG Id)
  *     Id = Codec identifier
  */
 {
+    CCABCodec* NewCodec;
+
     if (CodecSelected)
     {
         if (Id == CodecId)
             return;
+    }
+
+    NewCodec = CreateCodec(Id);
+    if (!NewCodec)
+        return;
 
+    if (CodecSelected)
+    {
         CodecSelected = false;
         delete Codec;
+        DestroyJobCodecs();
     }
 
+    Codec         = NewCodec;
+    CodecId       = Id;
+    CodecSelected = true;
+    CodecDataNode = NULL;
+}
+
+
+CCABCodec* CCabinet::CreateCodec(LONG Id)
+/*
+ * FUNCTION: Creates a codec engine
+ * ARGUMENTS:
+ *     Id = Codec identifier
+ * RETURNS:
+ *     Pointer to the new codec, NULL if Id is not known
+ */
+{
     switch (Id)
     {
         case CAB_CODEC_RAW:
-            Codec = new CRawCodec();
-            break;
+            return new CRawCodec();
 
         case CAB_CODEC_MSZIP:
-            Codec = new CMSZipCodec();
-            break;
+            return new CMSZipCodec();
+
+        case CAB_CODEC_LZX:
+            return new CLZXCodec();
 
         default:
-            return;
+            return NULL;
     }
+}
 
-    CodecId       = Id;
-    CodecSelected = true;
+
+void CCabinet::DestroyJobCodecs()
+/*
+ * FUNCTION: Destroys the codecs of the compression jobs
+ */
+{
+    ULONG i;
+
+    if (!JobCodecs)
+        return;
+
+    for (i = 1; i < JobCount; i++)
+        delete JobCodecs[i];
+
+    free(JobCodecs);
+    JobCodecs = NULL;
 }
 
 
 #ifndef CAB_READ_ONLY
 
+/* Compression of queued data blocks */
+
+typedef struct _CAB_COMPRESS_JOB
+{
+    CCABCodec* Codec;
+    PCAB_QUEUED_BLOCK Blocks;
+    ULONG BlockCount;
+    ULONG First;            // Index of the first block of the job
+    ULONG Step;             // The job does every Step-th block from there
+} CAB_COMPRESS_JOB, *PCAB_COMPRESS_JOB;
+
+static void CompressJob(void* Context)
+{
+    PCAB_COMPRESS_JOB Job = (PCAB_COMPRESS_JOB)Context;
+    PCAB_QUEUED_BLOCK Block;
+    ULONG i;
+
+    for (i = Job->First; i < Job->BlockCount; i += Job->Step)
+    {
+        Block = &Job->Blocks[i];
+        Block->Status = Job->Codec->Compress(Block->OutputBuffer,
+            Block->InputBuffer,
+            Block->InputSize,
+            &Block->OutputSize);
+    }
+}
+
+
 /* CAB write methods */
 
 ULONG CCabinet::NewCabinet()
@@ -1156,8 +1351,9 @@ ULONG CCabinet::NewCabinet()
 
     CurrentDiskNumber = 0;
 
-    OutputBuffer = malloc(CAB_BLOCKSIZE + 12); // This should be enough
-    InputBuffer  = malloc(CAB_BLOCKSIZE + 12); // This should be enough
+    /* InputBuffer also holds compressed data in CommitDataBlocks() */
+    OutputBuffer = malloc(CAB_MAX_COMPSIZE);
+    InputBuffer  = malloc(CAB_MAX_COMPSIZE);
     if ((!OutputBuffer) || (!InputBuffer))
     {
         DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
@@ -1247,8 +1443,15 @@ ULONG CCabinet::NewFolder()
  *     Status of operation
  */
 {
+    ULONG Status;
+
     DPRINT(MAX_TRACE, ("Creating new folder.\n"));
 
+    /* The queued data blocks belong to the current folder */
+    Status = FlushDataBlocks();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
     CurrentFolderNode = NewFolderNode();
     if (!CurrentFolderNode)
     {
@@ -1265,10 +1468,17 @@ ULONG CCabinet::NewFolder()
             CurrentFolderNode->Folder.CompressionType = CAB_COMP_MSZIP;
             break;
 
+        case CAB_CODEC_LZX:
+            CurrentFolderNode->Folder.CompressionType = CAB_COMP_LZX |
+                (LZX_WINDOW_BITS << CAB_COMP_LZX_WINDOW_SHIFT);
+            break;
+
         default:
             return CAB_STATUS_UNSUPPCOMP;
     }
 
+    Codec->Reset(CurrentFolderNode->Folder.CompressionType);
+
     /* FIXME: This won't work if no files are added to the new folder */
 
     DiskSize += sizeof(CFFOLDER);
@@ -1479,6 +1689,11 @@ ULONG CCabinet::WriteDisk(ULONG MoreDisks)
             }
         } while (CreateNewDisk);
     }
+
+    Status = FlushDataBlocks();
+    if (Status != CAB_STATUS_SUCCESS)
+        return Status;
+
     CommitDisk(MoreDisks);
 
     return CAB_STATUS_SUCCESS;
@@ -1597,6 +1812,18 @@ ULONG CCabinet::CloseCabinet()
         OutputBuffer = NULL;
     }
 
+    if (QueuedBlocks)
+    {
+        for (ULONG i = 0; i < JobCount * CAB_BLOCKS_PER_JOB; i++)
+        {
+            free(QueuedBlocks[i].InputBuffer);
+            free(QueuedBlocks[i].OutputBuffer);
+        }
+        free(QueuedBlocks);
+        QueuedBlocks = NULL;
+        QueuedBlockCount = 0;
+    }
+
     Close();
 
     if (ScratchFile)
@@ -1839,6 +2066,30 @@ void CCabinet::SetMaxDiskSize(ULONG Size)
     MaxDiskSize = Size;
 }
 
+void CCabinet::SetJobCount(ULONG Count)
+/*
+ * FUNCTION: Sets the number of data blocks to compress at the same time,
+ *           each in its own thread
+ * ARGUMENTS:
+ *     Count = Number of jobs (1 compresses the data blocks one by one)
+ * NOTES:
+ *     Only codecs that compress each data block on its own, and only
+ *     cabinets without a maximum disk size, make use of more than one job
+ */
+{
+    /* The queue is sized for the job count of the cabinet being created */
+    if (QueuedBlocks)
+        return;
+
+    DestroyJobCodecs();
+
+    if (Count < 1)
+        Count = 1;
+    if (Count > CAB_MAX_JOBS)
+        Count = CAB_MAX_JOBS;
+    JobCount = Count;
+}
+
 #endif /* CAB_READ_ONLY */
 
 
@@ -2983,15 +3234,23 @@ ULONG CCabinet::WriteDataBlock()
  */
 {
     ULONG Status;
-    ULONG BytesWritten;
-    PCFDATA_NODE DataNode;
 
     if (!BlockIsSplit)
     {
+        /* Data blocks that don't depend on each other are compressed in
+           batches, unless they may have to be split over disks */
+        if ((JobCount > 1) && (MaxDiskSize == 0) && Codec->IsBlockIndependent())
+            return QueueDataBlock();
+
         Status = Codec->Compress(OutputBuffer,
             InputBuffer,
             CurrentIBufferSize,
             &TotalCompSize);
+        if (Status != CS_SUCCESS)
+        {
+            DPRINT(MIN_TRACE, ("Cannot compress block (%u).\n", (UINT)Status));
+            return (Status == CS_NOMEMORY) ? CAB_STATUS_NOMEMORY : CAB_STATUS_FAILURE;
+        }
 
         DPRINT(MAX_TRACE, ("Block compressed. CurrentIBufferSize (%u)  TotalCompSize(%u).\n",
             (UINT)CurrentIBufferSize, (UINT)TotalCompSize));
@@ -3000,6 +3259,153 @@ ULONG CCabinet::WriteDataBlock()
         CurrentOBufferSize = TotalCompSize;
     }
 
+    return StoreDataBlock();
+}
+
+
+ULONG CCabinet::QueueDataBlock()
+/*
+ * FUNCTION: Queues the current data block, to be compressed together with the next ones
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    PCAB_QUEUED_BLOCK Block;
+    ULONG QueueSize = JobCount * CAB_BLOCKS_PER_JOB;
+    void* Buffer;
+
+    if (!QueuedBlocks)
+    {
+        QueuedBlocks = (PCAB_QUEUED_BLOCK)calloc(QueueSize, sizeof(CAB_QUEUED_BLOCK));
+        if (!QueuedBlocks)
+        {
+            DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+            return CAB_STATUS_NOMEMORY;
+        }
+    }
+
+    Block = &QueuedBlocks[QueuedBlockCount];
+    if (!Block->InputBuffer)
+        Block->InputBuffer = malloc(CAB_MAX_COMPSIZE);
+    if (!Block->OutputBuffer)
+        Block->OutputBuffer = malloc(CAB_MAX_COMPSIZE);
+    if ((!Block->InputBuffer) || (!Block->OutputBuffer))
+    {
+        DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+        return CAB_STATUS_NOMEMORY;
+    }
+
+    /* The block takes the input buffer, and gives its own in exchange */
+    Buffer             = Block->InputBuffer;
+    Block->InputBuffer = InputBuffer;
+    Block->InputSize   = CurrentIBufferSize;
+    InputBuffer        = Buffer;
+    QueuedBlockCount++;
+
+    CurrentIBufferSize = 0;
+    CurrentIBuffer     = InputBuffer;
+
+    if (QueuedBlockCount == QueueSize)
+        return FlushDataBlocks();
+
+    return CAB_STATUS_SUCCESS;
+}
+
+
+ULONG CCabinet::FlushDataBlocks()
+/*
+ * FUNCTION: Compresses the queued data blocks in parallel, then writes
+ *           them to the scratch file in order
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    CAB_COMPRESS_JOB Jobs[CAB_MAX_JOBS];
+    void* Contexts[CAB_MAX_JOBS];
+    PCAB_QUEUED_BLOCK Block;
+    ULONG Count;
+    ULONG Status;
+    ULONG i;
+
+    if (QueuedBlockCount == 0)
+        return CAB_STATUS_SUCCESS;
+
+    if (!JobCodecs)
+    {
+        JobCodecs = (CCABCodec**)calloc(JobCount, sizeof(CCABCodec*));
+        if (!JobCodecs)
+        {
+            DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+            return CAB_STATUS_NOMEMORY;
+        }
+    }
+
+    Count = (QueuedBlockCount < JobCount) ? QueuedBlockCount : JobCount;
+    for (i = 0; i < Count; i++)
+    {
+        if ((i > 0) && (!JobCodecs[i]))
+        {
+            JobCodecs[i] = CreateCodec(CodecId);
+            if (!JobCodecs[i])
+            {
+                DPRINT(MIN_TRACE, ("Insufficient memory.\n"));
+                return CAB_STATUS_NOMEMORY;
+            }
+        }
+
+        Jobs[i].Codec      = (i == 0) ? Codec : JobCodecs[i];
+        Jobs[i].Blocks     = QueuedBlocks;
+        Jobs[i].BlockCount = QueuedBlockCount;
+        Jobs[i].First      = i;
+        Jobs[i].Step       = Count;
+        Contexts[i]        = &Jobs[i];
+    }
+
+    RunInParallel(Count, CompressJob, Contexts);
+
+    for (i = 0; i < QueuedBlockCount; i++)
+    {
+        Block = &QueuedBlocks[i];
+        if (Block->Status != CS_SUCCESS)
+        {
+            DPRINT(MIN_TRACE, ("Cannot compress block (%u).\n", (UINT)Block->Status));
+            QueuedBlockCount = 0;
+            return (Block->Status == CS_NOMEMORY) ? CAB_STATUS_NOMEMORY : CAB_STATUS_FAILURE;
+        }
+
+        DPRINT(MAX_TRACE, ("Block compressed. InputSize (%u)  OutputSize(%u).\n",
+            (UINT)Block->InputSize, (UINT)Block->OutputSize));
+
+        CurrentIBufferSize = Block->InputSize;
+        TotalCompSize      = Block->OutputSize;
+        CurrentOBuffer     = Block->OutputBuffer;
+        CurrentOBufferSize = TotalCompSize;
+
+        Status = StoreDataBlock();
+        if (Status != CAB_STATUS_SUCCESS)
+        {
+            QueuedBlockCount = 0;
+            return Status;
+        }
+    }
+
+    QueuedBlockCount = 0;
+
+    return CAB_STATUS_SUCCESS;
+}
+
+
+ULONG CCabinet::StoreDataBlock()
+/*
+ * FUNCTION: Writes the compressed data of the current data block to the scratch file
+ * RETURNS:
+ *     Status of operation
+ */
+{
+    ULONG Status;
+    ULONG BytesWritten;
+    PCFDATA_NODE DataNode;
+
     DataNode = NewDataNode(CurrentFolderNode);
     if (!DataNode)
     {
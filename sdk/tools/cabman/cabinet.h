@@ -102,6 +102,7 @@ extern ULONG DebugTraceLevel;
 #define CAB_SIGNATURE        0x4643534D // "MSCF"
 #define CAB_VERSION          0x0103
 #define CAB_BLOCKSIZE        32768
+#define CAB_MAX_COMPSIZE     (CAB_BLOCKSIZE + 6144) // Largest compressed data block
 
 #define CAB_COMP_MASK        0x00FF
 #define CAB_COMP_NONE        0x0000
@@ -109,6 +110,9 @@ extern ULONG DebugTraceLevel;
 #define CAB_COMP_QUANTUM     0x0002
 #define CAB_COMP_LZX         0x0003
 
+#define CAB_COMP_LZX_WINDOW_MASK  0x1F00 // LZX window size, as a power of two
+#define CAB_COMP_LZX_WINDOW_SHIFT 8
+
 #define CAB_FLAG_HASPREV     0x0001
 #define CAB_FLAG_HASNEXT     0x0002
 #define CAB_FLAG_RESERVE     0x0004
@@ -227,6 +231,15 @@ typedef struct _CFFILE_NODE
     PCFFOLDER_NODE      FolderNode;     // Folder this file belong to
 } CFFILE_NODE, *PCFFILE_NODE;
 
+typedef struct _CAB_QUEUED_BLOCK
+{
+    void*       InputBuffer;        // Uncompressed data
+    ULONG       InputSize;
+    void*       OutputBuffer;       // Compressed data
+    ULONG       OutputSize;
+    ULONG       Status;             // Codec status code (CS_*)
+} CAB_QUEUED_BLOCK, *PCAB_QUEUED_BLOCK;
+
 typedef struct _SEARCH_CRITERIA
 {
     struct _SEARCH_CRITERIA  *Next;   // Pointer to next search criteria
@@ -278,6 +291,10 @@ public:
                              void* InputBuffer,
                              ULONG InputLength,
                              PULONG OutputLength) = 0;
+    /* Starts a new folder */
+    virtual void Reset(USHORT CompressionType) {};
+    /* Returns whether each data block can be compressed and uncompressed on its own */
+    virtual bool IsBlockIndependent() { return true; };
 };
 
 
@@ -293,6 +310,11 @@ public:
 #define CAB_CODEC_MSZIP 0x02
 
 
+/* Data blocks queued per job before they are compressed in parallel */
+#define CAB_BLOCKS_PER_JOB 4
+#define CAB_MAX_JOBS       64
+
+
 
 /* Classes */
 
@@ -396,6 +418,8 @@ public:
     ULONG AddFile(char* FileName);
     /* Sets the maximum size of the current disk */
     void SetMaxDiskSize(ULONG Size);
+    /* Sets the number of data blocks to compress at the same time */
+    void SetJobCount(ULONG Count);
 #endif /* CAB_READ_ONLY */
 
     /* Default event handlers */
@@ -432,6 +456,9 @@ private:
     ULONG ComputeChecksum(void* Buffer, ULONG Size, ULONG Seed);
     ULONG ReadBlock(void* Buffer, ULONG Size, PULONG BytesRead);
     bool MatchFileNamePattern(char* FileName, char* Pattern);
+    CCABCodec* CreateCodec(LONG Id);
+    void DestroyJobCodecs();
+    ULONG ReplayDataBlocks(PCFDATA_NODE DataNode, PUCHAR Buffer);
 #ifndef CAB_READ_ONLY
     ULONG InitCabinetHeader();
     ULONG WriteCabinetHeader(bool MoreDisks);
@@ -439,6 +466,9 @@ private:
     ULONG WriteFileEntries();
     ULONG CommitDataBlocks(PCFFOLDER_NODE FolderNode);
     ULONG WriteDataBlock();
+    ULONG QueueDataBlock();
+    ULONG FlushDataBlocks();
+    ULONG StoreDataBlock();
     ULONG GetAttributesOnFile(PCFFILE_NODE File);
     ULONG SetAttributesOnFile(char* FileName, USHORT FileAttributes);
     ULONG GetFileTimes(FILE* FileHandle, PCFFILE_NODE File);
@@ -480,6 +510,11 @@ private:
     CCABCodec *Codec;
     LONG CodecId;
     bool CodecSelected;
+    PCFDATA_NODE CodecDataNode;         // Last data block uncompressed by a codec that is not block independent
+    ULONG JobCount;                     // Number of data blocks compressed at the same time
+    CCABCodec** JobCodecs;              // Codec of each job but the first, which uses Codec
+    PCAB_QUEUED_BLOCK QueuedBlocks;
+    ULONG QueuedBlockCount;
     void* InputBuffer;
     void* CurrentIBuffer;               // Current offset in input buffer
     ULONG CurrentIBufferSize;   // Bytes left in input buffer
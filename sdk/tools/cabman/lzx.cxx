@@ -0,0 +1,1290 @@
+/*
+ * PROJECT:     ReactOS cabinet manager
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     CAB codec for LZX compressed data
+ * NOTES:       The data blocks of a folder are the 32KB frames of a single
+ *              LZX stream: the window, the repeated offsets and the tree
+ *              lengths carry over from a block to the next, so the blocks of
+ *              a folder are compressed and uncompressed in order, after a
+ *              Reset() at the start of the folder.
+ */
+#include <stdio.h>
+#include "lzx.h"
+
+#define LZX_MIN_MATCH               2
+#define LZX_MAX_MATCH               257
+#define LZX_NUM_PRIMARY_LENGTHS     7
+#define LZX_PRETREE_NUM_ELEMENTS    20
+#define LZX_PRETREE_MAX_LENGTH      15
+#define LZX_ALIGNED_MAX_LENGTH      7
+#define LZX_FRAME_SIZE              CAB_BLOCKSIZE
+
+#define LZX_MIN(a, b)               ((a) < (b) ? (a) : (b))
+
+#define LZX_BLOCKTYPE_VERBATIM      1
+#define LZX_BLOCKTYPE_ALIGNED       2
+#define LZX_BLOCKTYPE_UNCOMPRESSED  3
+
+/* Translation of the targets of x86 calls, with the same size as MAKECAB */
+#define LZX_E8_FILE_SIZE            12000000
+#define LZX_E8_MAX_FRAMES           32768
+
+/* Match finder */
+#define LZX_HASH_BITS               16
+#define LZX_MAX_CHAIN               48
+#define LZX_NICE_MATCH              96
+
+/* Largest compressed frame: 16-bit codes for all the literals, and the trees */
+#define LZX_FRAME_BUFFER_SIZE       (2 * LZX_FRAME_SIZE + 4096)
+
+
+/* Position slots */
+
+static inline ULONG ExtraBits(ULONG Slot)
+{
+    if (Slot < 4)
+        return 0;
+    if (Slot >= 36)
+        return 17;
+    return (Slot - 2) / 2;
+}
+
+static inline ULONG PositionBase(ULONG Slot)
+{
+    if (Slot < 4)
+        return Slot;
+    if (Slot >= 36)
+        return 0x40000 + ((Slot - 36) << 17);
+    return (2 | (Slot & 1)) << ((Slot - 2) / 2);
+}
+
+static inline ULONG PositionSlot(ULONG FormattedOffset)
+{
+    ULONG Bit;
+
+    if (FormattedOffset < 4)
+        return FormattedOffset;
+    if (FormattedOffset >= 0x40000)
+        return 36 + ((FormattedOffset - 0x40000) >> 17);
+
+    for (Bit = 2; (FormattedOffset >> (Bit + 1)) != 0; Bit++);
+    return 2 * Bit + ((FormattedOffset >> (Bit - 1)) & 1);
+}
+
+
+/* Huffman trees */
+
+typedef struct _LZX_HUFFNODE
+{
+    ULONG Weight;
+    ULONG Symbol;
+} LZX_HUFFNODE, *PLZX_HUFFNODE;
+
+static int CompareNodes(const void* A, const void* B)
+{
+    const LZX_HUFFNODE* NodeA = (const LZX_HUFFNODE*)A;
+    const LZX_HUFFNODE* NodeB = (const LZX_HUFFNODE*)B;
+
+    if (NodeA->Weight != NodeB->Weight)
+        return (NodeA->Weight < NodeB->Weight) ? -1 : 1;
+    return (NodeA->Symbol < NodeB->Symbol) ? -1 : 1;
+}
+
+static void BuildLengths(const ULONG* Frequencies,
+                         ULONG Count,
+                         PUCHAR Lengths,
+                         ULONG MaxLength)
+/*
+ * FUNCTION: Computes the code lengths of a Huffman tree
+ * ARGUMENTS:
+ *     Frequencies = Number of occurences of each symbol
+ *     Count       = Number of symbols
+ *     Lengths     = Address of buffer to place the code lengths
+ *     MaxLength   = Longest code length allowed
+ * NOTES:
+ *     At least two symbols get a code, so that the tree is always complete
+ */
+{
+    LZX_HUFFNODE Leaves[LZX_MAINTREE_MAXSYMBOLS];
+    ULONG Weights[2 * LZX_MAINTREE_MAXSYMBOLS];
+    ULONG Parents[2 * LZX_MAINTREE_MAXSYMBOLS];
+    ULONG Depths[2 * LZX_MAINTREE_MAXSYMBOLS];
+    ULONG Used, Leaf, Node, Next, Child, Longest, i, j;
+    ULONG Shift = 0;
+
+    memset(Lengths, 0, Count);
+
+    for (;;)
+    {
+        Used = 0;
+        for (i = 0; i < Count; i++)
+        {
+            if (Frequencies[i] != 0)
+            {
+                Leaves[Used].Weight = ((Frequencies[i] - 1) >> Shift) + 1;
+                Leaves[Used].Symbol = i;
+                Used++;
+            }
+        }
+
+        /* Give codes to dummy symbols if needed */
+        for (i = 0; Used < 2 && i < Count; i++)
+        {
+            if (Frequencies[i] == 0)
+            {
+                Leaves[Used].Weight = 1;
+                Leaves[Used].Symbol = i;
+                Used++;
+            }
+        }
+
+        qsort(Leaves, Used, sizeof(Leaves[0]), CompareNodes);
+
+        /* The leaves and the nodes made from them are both in increasing
+           weight order, so the two lightest are always at their heads */
+        for (i = 0; i < Used; i++)
+            Weights[i] = Leaves[i].Weight;
+
+        Leaf = 0;
+        Node = Used;
+        for (Next = Used; Next < 2 * Used - 1; Next++)
+        {
+            Weights[Next] = 0;
+            for (j = 0; j < 2; j++)
+            {
+                if (Leaf < Used && (Node >= Next || Weights[Leaf] <= Weights[Node]))
+                    Child = Leaf++;
+                else
+                    Child = Node++;
+                Weights[Next] += Weights[Child];
+                Parents[Child] = Next;
+            }
+        }
+
+        /* The root is the last node, and parents come after their children */
+        Depths[2 * Used - 2] = 0;
+        Longest = 0;
+        for (i = 2 * Used - 2; i-- > 0;)
+        {
+            Depths[i] = Depths[Parents[i]] + 1;
+            if (Depths[i] > Longest)
+                Longest = Depths[i];
+        }
+
+        if (Longest <= MaxLength)
+            break;
+
+        /* Flatten the frequencies and try again */
+        Shift++;
+    }
+
+    for (i = 0; i < Used; i++)
+        Lengths[Leaves[i].Symbol] = (UCHAR)Depths[i];
+}
+
+static void BuildCodes(const UCHAR* Lengths,
+                       ULONG Count,
+                       PUSHORT Codes)
+/*
+ * FUNCTION: Computes the canonical codes of a Huffman tree from its code lengths
+ */
+{
+    ULONG Code = 0;
+    ULONG Length;
+    ULONG i;
+
+    for (Length = 1; Length <= LZX_MAX_CODE_LENGTH; Length++)
+    {
+        for (i = 0; i < Count; i++)
+        {
+            if (Lengths[i] == Length)
+                Codes[i] = (USHORT)Code++;
+        }
+        Code <<= 1;
+    }
+}
+
+static bool BuildTree(PLZX_TREE Tree,
+                      const UCHAR* Lengths,
+                      ULONG Count)
+/*
+ * FUNCTION: Builds a canonical Huffman tree for decoding, from its code lengths
+ * RETURNS:
+ *     false if the lengths are not those of a valid tree
+ */
+{
+    USHORT Offsets[LZX_MAX_CODE_LENGTH + 1];
+    LONG Left = 1;
+    ULONG i;
+
+    memset(Tree->Count, 0, sizeof(Tree->Count));
+    for (i = 0; i < Count; i++)
+    {
+        if (Lengths[i] > LZX_MAX_CODE_LENGTH)
+            return false;
+        Tree->Count[Lengths[i]]++;
+    }
+
+    /* Codes may be left unused, but not over-subscribed */
+    for (i = 1; i <= LZX_MAX_CODE_LENGTH; i++)
+    {
+        Left = (Left << 1) - Tree->Count[i];
+        if (Left < 0)
+            return false;
+    }
+
+    Offsets[1] = 0;
+    for (i = 1; i < LZX_MAX_CODE_LENGTH; i++)
+        Offsets[i + 1] = Offsets[i] + Tree->Count[i];
+
+    for (i = 0; i < Count; i++)
+    {
+        if (Lengths[i] != 0)
+            Tree->Symbols[Offsets[Lengths[i]]++] = (USHORT)i;
+    }
+
+    return true;
+}
+
+
+/* Bitstreams */
+
+typedef struct _LZX_OUTPUT
+{
+    PUCHAR Data;
+    ULONG Position;
+    ULONG Buffer;
+    ULONG Bits;
+} LZX_OUTPUT, *PLZX_OUTPUT;
+
+static inline void PutBits(PLZX_OUTPUT Output, ULONG Value, ULONG Count)
+{
+    /* Count is at most 17, so that the buffer never holds more than 32 bits */
+    Output->Buffer = (Output->Buffer << Count) | (Value & ((1 << Count) - 1));
+    Output->Bits += Count;
+    while (Output->Bits >= 16)
+    {
+        Output->Bits -= 16;
+        Output->Data[Output->Position++] = (UCHAR)(Output->Buffer >> Output->Bits);
+        Output->Data[Output->Position++] = (UCHAR)(Output->Buffer >> (Output->Bits + 8));
+    }
+}
+
+static inline void AlignOutput(PLZX_OUTPUT Output)
+{
+    if (Output->Bits != 0)
+        PutBits(Output, 0, 16 - Output->Bits);
+}
+
+static inline void EnsureBits(PLZX_BITS Bits, ULONG Count)
+{
+    ULONG Word;
+
+    while (Bits->BitsLeft < Count)
+    {
+        Word = 0;
+        if (Bits->Position < Bits->Length)
+            Word = Bits->Data[Bits->Position];
+        if (Bits->Position + 1 < Bits->Length)
+            Word |= Bits->Data[Bits->Position + 1] << 8;
+        Bits->Position += 2;
+
+        Bits->Buffer |= Word << (16 - Bits->BitsLeft);
+        Bits->BitsLeft += 16;
+    }
+}
+
+static inline ULONG GetBits(PLZX_BITS Bits, ULONG Count)
+{
+    ULONG Value;
+
+    if (Count == 0)
+        return 0;
+
+    EnsureBits(Bits, Count);
+    Value = Bits->Buffer >> (32 - Count);
+    Bits->Buffer <<= Count;
+    Bits->BitsLeft -= Count;
+    return Value;
+}
+
+/* Number of bits read so far */
+static inline ULONG BitsRead(PLZX_BITS Bits)
+{
+    return Bits->Position * 8 - Bits->BitsLeft;
+}
+
+static LONG DecodeSymbol(PLZX_BITS Bits, PLZX_TREE Tree)
+{
+    ULONG Peek, Code, First = 0, Index = 0, Length;
+
+    EnsureBits(Bits, LZX_MAX_CODE_LENGTH);
+    Peek = Bits->Buffer >> (32 - LZX_MAX_CODE_LENGTH);
+
+    for (Length = 1; Length <= LZX_MAX_CODE_LENGTH; Length++)
+    {
+        Code = Peek >> (LZX_MAX_CODE_LENGTH - Length);
+        if (Code - First < Tree->Count[Length])
+        {
+            Bits->Buffer <<= Length;
+            Bits->BitsLeft -= Length;
+            return Tree->Symbols[Index + Code - First];
+        }
+        Index += Tree->Count[Length];
+        First = (First + Tree->Count[Length]) << 1;
+    }
+
+    return -1;
+}
+
+
+/* CLZXCodec */
+
+CLZXCodec::CLZXCodec()
+/*
+ * FUNCTION: Default constructor
+ */
+{
+    Window      = NULL;
+    HashHead    = NULL;
+    HashPrev    = NULL;
+    Tokens      = NULL;
+    FrameBuffer = NULL;
+
+    Reset(CAB_COMP_LZX | (LZX_WINDOW_BITS << CAB_COMP_LZX_WINDOW_SHIFT));
+}
+
+
+CLZXCodec::~CLZXCodec()
+/*
+ * FUNCTION: Default destructor
+ */
+{
+    free(Window);
+    free(HashHead);
+    free(HashPrev);
+    free(Tokens);
+    free(FrameBuffer);
+}
+
+
+void CLZXCodec::Reset(USHORT CompressionType)
+/*
+ * FUNCTION: Starts a new stream, for a new folder
+ * ARGUMENTS:
+ *     CompressionType = Compression type of the folder, with the window size
+ */
+{
+    WindowBits = (CompressionType & CAB_COMP_LZX_WINDOW_MASK) >> CAB_COMP_LZX_WINDOW_SHIFT;
+    Corrupted  = (WindowBits < LZX_MIN_WINDOW_BITS) || (WindowBits > LZX_MAX_WINDOW_BITS);
+    if (Corrupted)
+    {
+        DPRINT(MIN_TRACE, ("Bad LZX window size (%u).\n", (UINT)WindowBits));
+        WindowBits = LZX_MAX_WINDOW_BITS;
+    }
+
+    WindowSize  = 1 << WindowBits;
+    MainSymbols = LZX_NUM_CHARS + (PositionSlot(WindowSize - 1) + 1) * 8;
+
+    R0 = R1 = R2 = 1;
+    FrameCount     = 0;
+    StreamPosition = 0;
+    E8FileSize     = LZX_E8_FILE_SIZE;
+    memset(MainLengths, 0, sizeof(MainLengths));
+    memset(LengthLengths, 0, sizeof(LengthLengths));
+
+    WindowBase = 0;
+    NextHash   = 0;
+    if (HashHead)
+        memset(HashHead, 0, sizeof(ULONG) << LZX_HASH_BITS);
+
+    HeaderRead     = false;
+    BlockType      = 0;
+    BlockLength    = 0;
+    BlockRemaining = 0;
+}
+
+
+void CLZXCodec::TranslateE8(PUCHAR Data, ULONG Length, bool Encode)
+/*
+ * FUNCTION: Translates the relative targets of x86 calls in a frame to
+ *           absolute ones before compression, and back after decompression
+ * ARGUMENTS:
+ *     Data   = Pointer to the frame
+ *     Length = Length of the frame
+ *     Encode = true to translate to absolute targets, false to translate back
+ */
+{
+    LONG Current, Value, FileSize;
+    ULONG i;
+
+    if (E8FileSize == 0 || FrameCount >= LZX_E8_MAX_FRAMES || Length <= 10)
+        return;
+
+    FileSize = (LONG)E8FileSize;
+    for (i = 0; i < Length - 10;)
+    {
+        if (Data[i] != 0xE8)
+        {
+            i++;
+            continue;
+        }
+
+        Current = (LONG)(StreamPosition + i);
+        Value = (LONG)(Data[i + 1] | (Data[i + 2] << 8) | (Data[i + 3] << 16) | ((ULONG)Data[i + 4] << 24));
+
+        if (Value >= -Current && Value < FileSize)
+        {
+            if (Encode)
+                Value = (Value < FileSize - Current) ? Value + Current : Value - FileSize;
+            else
+                Value = (Value >= 0) ? Value - Current : Value + FileSize;
+
+            Data[i + 1] = (UCHAR)Value;
+            Data[i + 2] = (UCHAR)(Value >> 8);
+            Data[i + 3] = (UCHAR)(Value >> 16);
+            Data[i + 4] = (UCHAR)(Value >> 24);
+        }
+
+        i += 5;
+    }
+}
+
+
+/* Compression */
+
+void CLZXCodec::HashUpTo(ULONG Position, ULONG End)
+/*
+ * FUNCTION: Adds the positions before Position to the hash chains
+ * ARGUMENTS:
+ *     Position = First position not to add
+ *     End      = End of the data available in the window
+ */
+{
+    PUCHAR Data;
+    ULONG Hash;
+
+    while (NextHash < Position && NextHash + 3 <= End)
+    {
+        Data = Window + (NextHash - WindowBase);
+        Hash = ((Data[0] << 16) | (Data[1] << 8) | Data[2]) * 2654435761U >> (32 - LZX_HASH_BITS);
+
+        HashPrev[NextHash & (WindowSize - 1)] = HashHead[Hash];
+        HashHead[Hash] = NextHash + 1;
+        NextHash++;
+    }
+}
+
+
+/* Estimates the bits saved by a match, compared to literals */
+static inline LONG MatchGain(ULONG Length, ULONG Offset)
+{
+    if (Offset < 3)
+        return Length * 8 - 8;
+    return Length * 8 - 9 - ExtraBits(PositionSlot(Offset));
+}
+
+ULONG CLZXCodec::FindMatch(ULONG Position, ULONG End, PULONG Offset)
+/*
+ * FUNCTION: Finds the best match at a position
+ * ARGUMENTS:
+ *     Position = Stream position to find a match for
+ *     End      = End of the data available in the window
+ *     Offset   = Address of buffer to place the formatted offset of the match
+ * RETURNS:
+ *     Length of the match, 0 if none is worth it
+ */
+{
+    PUCHAR Current = Window + (Position - WindowBase);
+    PUCHAR Match;
+    ULONG MaxLength, Length, BestLength = 0;
+    ULONG Repeated[3] = { R0, R1, R2 };
+    ULONG Candidate, Distance, Hash, Chain, i;
+    LONG Gain, BestGain = 0;
+
+    MaxLength = LZX_MIN(End - Position, LZX_MAX_MATCH);
+    if (MaxLength < LZX_MIN_MATCH)
+        return 0;
+
+    /* Repeated offsets are the cheapest */
+    for (i = 0; i < 3; i++)
+    {
+        if (Repeated[i] > Position)
+            continue;
+
+        Match = Current - Repeated[i];
+        for (Length = 0; Length < MaxLength && Match[Length] == Current[Length]; Length++);
+
+        Gain = MatchGain(Length, i);
+        if (Length >= LZX_MIN_MATCH && Gain > BestGain)
+        {
+            BestGain   = Gain;
+            BestLength = Length;
+            *Offset    = i;
+        }
+    }
+
+    if (MaxLength < 3 || BestLength == MaxLength)
+        return BestLength;
+
+    Hash = ((Current[0] << 16) | (Current[1] << 8) | Current[2]) * 2654435761U >> (32 - LZX_HASH_BITS);
+    Candidate = HashHead[Hash];
+
+    for (Chain = 0; Candidate != 0 && Chain < LZX_MAX_CHAIN; Chain++)
+    {
+        Distance = Position - (Candidate - 1);
+        if (Distance > WindowSize - 3)
+            break;
+
+        Match = Current - Distance;
+        if (Match[BestLength] == Current[BestLength] &&
+            Match[0] == Current[0] && Match[1] == Current[1] && Match[2] == Current[2])
+        {
+            for (Length = 3; Length < MaxLength && Match[Length] == Current[Length]; Length++);
+
+            Gain = MatchGain(Length, Distance + 2);
+            if (Length >= 3 && Gain > BestGain)
+            {
+                BestGain   = Gain;
+                BestLength = Length;
+                *Offset    = Distance + 2;
+
+                if (Length >= LZX_NICE_MATCH || Length == MaxLength)
+                    break;
+            }
+        }
+
+        Distance = HashPrev[(Candidate - 1) & (WindowSize - 1)];
+        if (Distance >= Candidate)
+            break;
+        Candidate = Distance;
+    }
+
+    return BestLength;
+}
+
+
+ULONG CLZXCodec::ParseFrame(ULONG Length)
+/*
+ * FUNCTION: Splits the frame at the current stream position into literals and matches
+ * ARGUMENTS:
+ *     Length = Length of the frame
+ * RETURNS:
+ *     Number of tokens
+ */
+{
+    ULONG Position = StreamPosition;
+    ULONG End = StreamPosition + Length;
+    ULONG MatchLength, MatchOffset;
+    ULONG NextLength = 0, NextOffset = 0;
+    bool HaveNext = false;
+    ULONG Count = 0;
+
+    while (Position < End)
+    {
+        if (HaveNext)
+        {
+            MatchLength = NextLength;
+            MatchOffset = NextOffset;
+            HaveNext = false;
+        }
+        else
+        {
+            HashUpTo(Position, End);
+            MatchLength = FindMatch(Position, End, &MatchOffset);
+        }
+
+        /* Lazy evaluation: a better match may start at the next position */
+        if (MatchLength != 0 && MatchLength < LZX_NICE_MATCH && Position + 1 < End)
+        {
+            HashUpTo(Position + 1, End);
+            NextLength = FindMatch(Position + 1, End, &NextOffset);
+            if (NextLength != 0 && MatchGain(NextLength, NextOffset) > MatchGain(MatchLength, MatchOffset))
+            {
+                HaveNext = true;
+                MatchLength = 0;
+            }
+        }
+
+        if (MatchLength == 0)
+        {
+            Tokens[Count].Offset = Window[Position - WindowBase];
+            Tokens[Count].Length = 0;
+            Count++;
+            Position++;
+            continue;
+        }
+
+        Tokens[Count].Offset = MatchOffset;
+        Tokens[Count].Length = MatchLength;
+        Count++;
+        Position += MatchLength;
+
+        switch (MatchOffset)
+        {
+            case 0:
+                break;
+
+            case 1:
+                MatchOffset = R1;
+                R1 = R0;
+                R0 = MatchOffset;
+                break;
+
+            case 2:
+                MatchOffset = R2;
+                R2 = R0;
+                R0 = MatchOffset;
+                break;
+
+            default:
+                R2 = R1;
+                R1 = R0;
+                R0 = MatchOffset - 2;
+                break;
+        }
+    }
+
+    return Count;
+}
+
+
+static void WriteLengths(PLZX_OUTPUT Output,
+                         const UCHAR* Lengths,
+                         const UCHAR* PreviousLengths,
+                         ULONG First,
+                         ULONG Last)
+/*
+ * FUNCTION: Writes code lengths of a tree, as deltas from the lengths of the previous block
+ * ARGUMENTS:
+ *     Output          = Pointer to the output bitstream
+ *     Lengths         = Code lengths of the tree
+ *     PreviousLengths = Code lengths of the tree in the previous block
+ *     First           = First symbol to write the length of
+ *     Last            = Symbol after the last one to write the length of
+ */
+{
+    UCHAR Symbols[LZX_MAINTREE_MAXSYMBOLS];
+    UCHAR Extra[LZX_MAINTREE_MAXSYMBOLS];
+    ULONG Frequencies[LZX_PRETREE_NUM_ELEMENTS];
+    UCHAR PreLengths[LZX_PRETREE_NUM_ELEMENTS];
+    USHORT PreCodes[LZX_PRETREE_NUM_ELEMENTS];
+    ULONG Count = 0, Run, i;
+
+    memset(Frequencies, 0, sizeof(Frequencies));
+
+    for (i = First; i < Last;)
+    {
+        for (Run = 1; i + Run < Last && Lengths[i + Run] == Lengths[i]; Run++);
+
+        if (Lengths[i] == 0 && Run >= 20)
+        {
+            /* 18: run of 20 to 51 zeros */
+            Run = LZX_MIN(Run, 51);
+            Symbols[Count] = 18;
+            Extra[Count++] = (UCHAR)(Run - 20);
+            Frequencies[18]++;
+            i += Run;
+        }
+        else if (Lengths[i] == 0 && Run >= 4)
+        {
+            /* 17: run of 4 to 19 zeros */
+            Symbols[Count] = 17;
+            Extra[Count++] = (UCHAR)(Run - 4);
+            Frequencies[17]++;
+            i += Run;
+        }
+        else if (Run >= 4)
+        {
+            /* 19: run of 4 or 5 same lengths, followed by the delta */
+            Run = LZX_MIN(Run, 5);
+            Symbols[Count] = 19;
+            Extra[Count++] = (UCHAR)(Run - 4);
+            Frequencies[19]++;
+            Symbols[Count] = (UCHAR)((PreviousLengths[i] - Lengths[i] + 17) % 17);
+            Frequencies[Symbols[Count++]]++;
+            i += Run;
+        }
+        else
+        {
+            Symbols[Count] = (UCHAR)((PreviousLengths[i] - Lengths[i] + 17) % 17);
+            Frequencies[Symbols[Count++]]++;
+            i++;
+        }
+    }
+
+    BuildLengths(Frequencies, LZX_PRETREE_NUM_ELEMENTS, PreLengths, LZX_PRETREE_MAX_LENGTH);
+    BuildCodes(PreLengths, LZX_PRETREE_NUM_ELEMENTS, PreCodes);
+
+    for (i = 0; i < LZX_PRETREE_NUM_ELEMENTS; i++)
+        PutBits(Output, PreLengths[i], 4);
+
+    for (i = 0; i < Count; i++)
+    {
+        PutBits(Output, PreCodes[Symbols[i]], PreLengths[Symbols[i]]);
+        switch (Symbols[i])
+        {
+            case 17:
+                PutBits(Output, Extra[i], 4);
+                break;
+
+            case 18:
+                PutBits(Output, Extra[i], 5);
+                break;
+
+            case 19:
+                PutBits(Output, Extra[i], 1);
+                i++;
+                PutBits(Output, PreCodes[Symbols[i]], PreLengths[Symbols[i]]);
+                break;
+        }
+    }
+}
+
+
+ULONG CLZXCodec::WriteFrame(PUCHAR OutputBuffer, ULONG Length, ULONG TokenCount)
+/*
+ * FUNCTION: Writes the tokens of a frame as a block, or the frame as an
+ *           uncompressed block if that is smaller
+ * ARGUMENTS:
+ *     OutputBuffer = Pointer to buffer to place compressed data
+ *     Length       = Length of the frame
+ *     TokenCount   = Number of tokens found in the frame
+ * RETURNS:
+ *     Size of compressed data
+ */
+{
+    ULONG MainFrequencies[LZX_MAINTREE_MAXSYMBOLS];
+    ULONG LengthFrequencies[LZX_NUM_SECONDARY_LENGTHS];
+    ULONG AlignedFrequencies[LZX_ALIGNED_NUM_ELEMENTS];
+    UCHAR NewMainLengths[LZX_MAINTREE_MAXSYMBOLS];
+    UCHAR NewLengthLengths[LZX_NUM_SECONDARY_LENGTHS];
+    UCHAR NewAlignedLengths[LZX_ALIGNED_NUM_ELEMENTS];
+    USHORT MainCodes[LZX_MAINTREE_MAXSYMBOLS];
+    USHORT LengthCodes[LZX_NUM_SECONDARY_LENGTHS];
+    USHORT AlignedCodes[LZX_ALIGNED_NUM_ELEMENTS];
+    ULONG VerbatimBits = 0, AlignedBits = LZX_ALIGNED_NUM_ELEMENTS * 3;
+    ULONG Type, Slot, Extra, Footer, Symbol, HeaderBits, i;
+    PLZX_TOKEN Token;
+    LZX_OUTPUT Output;
+
+    memset(MainFrequencies, 0, sizeof(MainFrequencies));
+    memset(LengthFrequencies, 0, sizeof(LengthFrequencies));
+    memset(AlignedFrequencies, 0, sizeof(AlignedFrequencies));
+
+    for (i = 0; i < TokenCount; i++)
+    {
+        Token = &Tokens[i];
+        if (Token->Length == 0)
+        {
+            MainFrequencies[Token->Offset]++;
+            continue;
+        }
+
+        Slot = PositionSlot(Token->Offset);
+        Footer = Token->Length - LZX_MIN_MATCH;
+        MainFrequencies[LZX_NUM_CHARS + Slot * 8 + LZX_MIN(Footer, LZX_NUM_PRIMARY_LENGTHS)]++;
+        if (Footer >= LZX_NUM_PRIMARY_LENGTHS)
+            LengthFrequencies[Footer - LZX_NUM_PRIMARY_LENGTHS]++;
+
+        /* The low 3 extra bits of far offsets may be Huffman coded instead */
+        Extra = ExtraBits(Slot);
+        VerbatimBits += Extra;
+        if (Extra >= 3)
+        {
+            AlignedFrequencies[(Token->Offset - PositionBase(Slot)) & 7]++;
+            AlignedBits += Extra - 3;
+        }
+        else
+        {
+            AlignedBits += Extra;
+        }
+    }
+
+    BuildLengths(MainFrequencies, MainSymbols, NewMainLengths, LZX_MAX_CODE_LENGTH);
+    BuildLengths(LengthFrequencies, LZX_NUM_SECONDARY_LENGTHS, NewLengthLengths, LZX_MAX_CODE_LENGTH);
+    BuildLengths(AlignedFrequencies, LZX_ALIGNED_NUM_ELEMENTS, NewAlignedLengths, LZX_ALIGNED_MAX_LENGTH);
+    BuildCodes(NewMainLengths, MainSymbols, MainCodes);
+    BuildCodes(NewLengthLengths, LZX_NUM_SECONDARY_LENGTHS, LengthCodes);
+    BuildCodes(NewAlignedLengths, LZX_ALIGNED_NUM_ELEMENTS, AlignedCodes);
+
+    for (i = 0; i < LZX_ALIGNED_NUM_ELEMENTS; i++)
+        AlignedBits += AlignedFrequencies[i] * NewAlignedLengths[i];
+    Type = (AlignedBits < VerbatimBits) ? LZX_BLOCKTYPE_ALIGNED : LZX_BLOCKTYPE_VERBATIM;
+
+    /* The stream header, with the E8 translation size, comes before the first block */
+    Output.Data     = FrameBuffer;
+    Output.Position = 0;
+    Output.Buffer   = 0;
+    Output.Bits     = 0;
+    if (FrameCount == 0)
+    {
+        PutBits(&Output, 1, 1);
+        PutBits(&Output, E8FileSize >> 16, 16);
+        PutBits(&Output, E8FileSize, 16);
+    }
+    HeaderBits = Output.Position * 8 + Output.Bits + 3 + 24;
+
+    PutBits(&Output, Type, 3);
+    PutBits(&Output, Length >> 8, 16);
+    PutBits(&Output, Length, 8);
+
+    if (Type == LZX_BLOCKTYPE_ALIGNED)
+    {
+        for (i = 0; i < LZX_ALIGNED_NUM_ELEMENTS; i++)
+            PutBits(&Output, NewAlignedLengths[i], 3);
+    }
+
+    WriteLengths(&Output, NewMainLengths, MainLengths, 0, LZX_NUM_CHARS);
+    WriteLengths(&Output, NewMainLengths, MainLengths, LZX_NUM_CHARS, MainSymbols);
+    WriteLengths(&Output, NewLengthLengths, LengthLengths, 0, LZX_NUM_SECONDARY_LENGTHS);
+
+    for (i = 0; i < TokenCount; i++)
+    {
+        Token = &Tokens[i];
+        if (Token->Length == 0)
+        {
+            PutBits(&Output, MainCodes[Token->Offset], NewMainLengths[Token->Offset]);
+            continue;
+        }
+
+        Slot = PositionSlot(Token->Offset);
+        Footer = Token->Length - LZX_MIN_MATCH;
+        Symbol = LZX_NUM_CHARS + Slot * 8 + LZX_MIN(Footer, LZX_NUM_PRIMARY_LENGTHS);
+        PutBits(&Output, MainCodes[Symbol], NewMainLengths[Symbol]);
+        if (Footer >= LZX_NUM_PRIMARY_LENGTHS)
+        {
+            Footer -= LZX_NUM_PRIMARY_LENGTHS;
+            PutBits(&Output, LengthCodes[Footer], NewLengthLengths[Footer]);
+        }
+
+        Extra = ExtraBits(Slot);
+        Footer = Token->Offset - PositionBase(Slot);
+        if (Type == LZX_BLOCKTYPE_ALIGNED && Extra >= 3)
+        {
+            PutBits(&Output, Footer >> 3, Extra - 3);
+            PutBits(&Output, AlignedCodes[Footer & 7], NewAlignedLengths[Footer & 7]);
+        }
+        else
+        {
+            PutBits(&Output, Footer, Extra);
+        }
+    }
+
+    AlignOutput(&Output);
+
+    /* Incompressible data: the stored block is aligned to 16 bits, with at
+       least one bit of padding, and followed by a padding byte if odd */
+    if (Output.Position > (HeaderBits / 16 + 1) * 2 + 12 + Length + (Length & 1))
+    {
+        Output.Data     = OutputBuffer;
+        Output.Position = 0;
+        Output.Buffer   = 0;
+        Output.Bits     = 0;
+        if (FrameCount == 0)
+        {
+            PutBits(&Output, 1, 1);
+            PutBits(&Output, E8FileSize >> 16, 16);
+            PutBits(&Output, E8FileSize, 16);
+        }
+
+        PutBits(&Output, LZX_BLOCKTYPE_UNCOMPRESSED, 3);
+        PutBits(&Output, Length >> 8, 16);
+        PutBits(&Output, Length, 8);
+        PutBits(&Output, 0, 16 - Output.Bits);
+
+        /* The repeated offsets at the end of the block, as the next one starts with them */
+        for (i = 0; i < 4; i++)
+            OutputBuffer[Output.Position + i] = (UCHAR)(R0 >> (i * 8));
+        for (i = 0; i < 4; i++)
+            OutputBuffer[Output.Position + 4 + i] = (UCHAR)(R1 >> (i * 8));
+        for (i = 0; i < 4; i++)
+            OutputBuffer[Output.Position + 8 + i] = (UCHAR)(R2 >> (i * 8));
+        Output.Position += 12;
+
+        memcpy(OutputBuffer + Output.Position, Window + (StreamPosition - WindowBase), Length);
+        Output.Position += Length;
+        if (Length & 1)
+            OutputBuffer[Output.Position++] = 0;
+
+        /* The decoder keeps the trees of the previous block */
+        return Output.Position;
+    }
+
+    memcpy(OutputBuffer, FrameBuffer, Output.Position);
+    memcpy(MainLengths, NewMainLengths, sizeof(MainLengths));
+    memcpy(LengthLengths, NewLengthLengths, sizeof(LengthLengths));
+    return Output.Position;
+}
+
+
+ULONG CLZXCodec::Compress(void* OutputBuffer,
+                          void* InputBuffer,
+                          ULONG InputLength,
+                          PULONG OutputLength)
+/*
+ * FUNCTION: Compresses data in a buffer
+ * ARGUMENTS:
+ *     OutputBuffer   = Pointer to buffer to place compressed data
+ *     InputBuffer    = Pointer to buffer with data to be compressed
+ *     InputLength    = Length of input buffer
+ *     OutputLength   = Address of buffer to place size of compressed data
+ */
+{
+    ULONG Offset;
+    ULONG Count;
+
+    DPRINT(MAX_TRACE, ("InputLength (%u).\n", (UINT)InputLength));
+
+    if (Corrupted || InputLength > LZX_FRAME_SIZE)
+        return CS_BADSTREAM;
+
+    if (Window == NULL)
+        Window = (PUCHAR)malloc(2 << LZX_MAX_WINDOW_BITS);
+    if (HashHead == NULL)
+        HashHead = (PULONG)calloc(1 << LZX_HASH_BITS, sizeof(ULONG));
+    if (HashPrev == NULL)
+        HashPrev = (PULONG)malloc(sizeof(ULONG) << LZX_MAX_WINDOW_BITS);
+    if (Tokens == NULL)
+        Tokens = (PLZX_TOKEN)malloc(LZX_FRAME_SIZE * sizeof(LZX_TOKEN));
+    if (FrameBuffer == NULL)
+        FrameBuffer = (PUCHAR)malloc(LZX_FRAME_BUFFER_SIZE);
+    if (!Window || !HashHead || !HashPrev || !Tokens || !FrameBuffer)
+        return CS_NOMEMORY;
+
+    /* Keep the last window of data before the frame, and make room for it */
+    Offset = StreamPosition - WindowBase;
+    if (Offset + InputLength > 2 * WindowSize)
+    {
+        memmove(Window, Window + Offset - WindowSize, WindowSize);
+        WindowBase += Offset - WindowSize;
+        Offset = WindowSize;
+    }
+
+    memcpy(Window + Offset, InputBuffer, InputLength);
+    TranslateE8(Window + Offset, InputLength, true);
+
+    Count = ParseFrame(InputLength);
+    *OutputLength = WriteFrame((PUCHAR)OutputBuffer, InputLength, Count);
+
+    StreamPosition += InputLength;
+    FrameCount++;
+
+    return CS_SUCCESS;
+}
+
+
+/* Decompression */
+
+ULONG CLZXCodec::ReadLengths(PLZX_BITS Bits, PUCHAR Lengths, ULONG First, ULONG Last)
+/*
+ * FUNCTION: Reads code lengths of a tree, as deltas from the lengths of the previous block
+ * ARGUMENTS:
+ *     Bits    = Pointer to the input bitstream
+ *     Lengths = Code lengths of the tree in the previous block, to update
+ *     First   = First symbol to read the length of
+ *     Last    = Symbol after the last one to read the length of
+ */
+{
+    UCHAR PreLengths[LZX_PRETREE_NUM_ELEMENTS];
+    LZX_TREE PreTree;
+    LONG Symbol;
+    ULONG Run, i;
+
+    for (i = 0; i < LZX_PRETREE_NUM_ELEMENTS; i++)
+        PreLengths[i] = (UCHAR)GetBits(Bits, 4);
+    if (!BuildTree(&PreTree, PreLengths, LZX_PRETREE_NUM_ELEMENTS))
+        return CS_BADSTREAM;
+
+    for (i = First; i < Last;)
+    {
+        Symbol = DecodeSymbol(Bits, &PreTree);
+        if (Symbol < 0)
+            return CS_BADSTREAM;
+
+        if (Symbol == 17 || Symbol == 18)
+        {
+            Run = (Symbol == 17) ? GetBits(Bits, 4) + 4 : GetBits(Bits, 5) + 20;
+            if (i + Run > Last)
+                return CS_BADSTREAM;
+            memset(&Lengths[i], 0, Run);
+            i += Run;
+        }
+        else if (Symbol == 19)
+        {
+            Run = GetBits(Bits, 1) + 4;
+            Symbol = DecodeSymbol(Bits, &PreTree);
+            if (Symbol < 0 || Symbol > 16 || i + Run > Last)
+                return CS_BADSTREAM;
+            memset(&Lengths[i], (Lengths[i] - Symbol + 17) % 17, Run);
+            i += Run;
+        }
+        else
+        {
+            Lengths[i] = (UCHAR)((Lengths[i] - Symbol + 17) % 17);
+            i++;
+        }
+    }
+
+    return CS_SUCCESS;
+}
+
+
+ULONG CLZXCodec::ReadBlockHeader(PLZX_BITS Bits)
+/*
+ * FUNCTION: Reads the header of a block, with its trees
+ * ARGUMENTS:
+ *     Bits = Pointer to the input bitstream
+ */
+{
+    ULONG i;
+
+    BlockType   = GetBits(Bits, 3);
+    BlockLength = GetBits(Bits, 16) << 8;
+    BlockLength |= GetBits(Bits, 8);
+    BlockRemaining = BlockLength;
+
+    switch (BlockType)
+    {
+        case LZX_BLOCKTYPE_ALIGNED:
+            for (i = 0; i < LZX_ALIGNED_NUM_ELEMENTS; i++)
+                AlignedLengths[i] = (UCHAR)GetBits(Bits, 3);
+            if (!BuildTree(&AlignedTree, AlignedLengths, LZX_ALIGNED_NUM_ELEMENTS))
+                return CS_BADSTREAM;
+            /* Fall through */
+
+        case LZX_BLOCKTYPE_VERBATIM:
+            if (ReadLengths(Bits, MainLengths, 0, LZX_NUM_CHARS) != CS_SUCCESS ||
+                ReadLengths(Bits, MainLengths, LZX_NUM_CHARS, MainSymbols) != CS_SUCCESS ||
+                !BuildTree(&MainTree, MainLengths, MainSymbols))
+            {
+                return CS_BADSTREAM;
+            }
+            if (ReadLengths(Bits, LengthLengths, 0, LZX_NUM_SECONDARY_LENGTHS) != CS_SUCCESS ||
+                !BuildTree(&LengthTree, LengthLengths, LZX_NUM_SECONDARY_LENGTHS))
+            {
+                return CS_BADSTREAM;
+            }
+            break;
+
+        case LZX_BLOCKTYPE_UNCOMPRESSED:
+            /* Skip 1 to 16 bits to the next 16-bit boundary, then go bytewise */
+            Bits->Position = (BitsRead(Bits) / 16 + 1) * 2;
+            Bits->Buffer   = 0;
+            Bits->BitsLeft = 0;
+            if (Bits->Position + 12 > Bits->Length)
+                return CS_BADSTREAM;
+
+            R0 = Bits->Data[Bits->Position] | (Bits->Data[Bits->Position + 1] << 8) |
+                 (Bits->Data[Bits->Position + 2] << 16) | ((ULONG)Bits->Data[Bits->Position + 3] << 24);
+            R1 = Bits->Data[Bits->Position + 4] | (Bits->Data[Bits->Position + 5] << 8) |
+                 (Bits->Data[Bits->Position + 6] << 16) | ((ULONG)Bits->Data[Bits->Position + 7] << 24);
+            R2 = Bits->Data[Bits->Position + 8] | (Bits->Data[Bits->Position + 9] << 8) |
+                 (Bits->Data[Bits->Position + 10] << 16) | ((ULONG)Bits->Data[Bits->Position + 11] << 24);
+            Bits->Position += 12;
+            break;
+
+        default:
+            DPRINT(MID_TRACE, ("Bad LZX block type (%u).\n", (UINT)BlockType));
+            return CS_BADSTREAM;
+    }
+
+    return CS_SUCCESS;
+}
+
+
+ULONG CLZXCodec::DecodeRun(PLZX_BITS Bits, ULONG WindowPosition, ULONG Length)
+/*
+ * FUNCTION: Decodes data of the current block into the window
+ * ARGUMENTS:
+ *     Bits           = Pointer to the input bitstream
+ *     WindowPosition = Stream position to place the data at
+ *     Length         = Number of bytes to decode, all of them in the current block and frame
+ */
+{
+    ULONG Mask = WindowSize - 1;
+    ULONG End = WindowPosition + Length;
+    ULONG MatchLength, MatchOffset, Slot, Extra;
+    LONG Symbol, Footer;
+
+    if (BlockType == LZX_BLOCKTYPE_UNCOMPRESSED)
+    {
+        if (Bits->Position + Length > Bits->Length)
+            return CS_BADSTREAM;
+        for (; WindowPosition < End; WindowPosition++)
+            Window[WindowPosition & Mask] = Bits->Data[Bits->Position++];
+        return CS_SUCCESS;
+    }
+
+    while (WindowPosition < End)
+    {
+        Symbol = DecodeSymbol(Bits, &MainTree);
+        if (Symbol < 0)
+            return CS_BADSTREAM;
+
+        if (Symbol < LZX_NUM_CHARS)
+        {
+            Window[WindowPosition++ & Mask] = (UCHAR)Symbol;
+            continue;
+        }
+
+        Symbol -= LZX_NUM_CHARS;
+        Slot = Symbol >> 3;
+        MatchLength = Symbol & 7;
+        if (MatchLength == LZX_NUM_PRIMARY_LENGTHS)
+        {
+            Footer = DecodeSymbol(Bits, &LengthTree);
+            if (Footer < 0)
+                return CS_BADSTREAM;
+            MatchLength += Footer;
+        }
+        MatchLength += LZX_MIN_MATCH;
+
+        switch (Slot)
+        {
+            case 0:
+                MatchOffset = R0;
+                break;
+
+            case 1:
+                MatchOffset = R1;
+                R1 = R0;
+                R0 = MatchOffset;
+                break;
+
+            case 2:
+                MatchOffset = R2;
+                R2 = R0;
+                R0 = MatchOffset;
+                break;
+
+            default:
+                Extra = ExtraBits(Slot);
+                MatchOffset = PositionBase(Slot);
+                if (BlockType == LZX_BLOCKTYPE_ALIGNED && Extra >= 3)
+                {
+                    MatchOffset += GetBits(Bits, Extra - 3) << 3;
+                    Footer = DecodeSymbol(Bits, &AlignedTree);
+                    if (Footer < 0)
+                        return CS_BADSTREAM;
+                    MatchOffset += Footer;
+                }
+                else
+                {
+                    MatchOffset += GetBits(Bits, Extra);
+                }
+                MatchOffset -= 2;
+
+                R2 = R1;
+                R1 = R0;
+                R0 = MatchOffset;
+                break;
+        }
+
+        if (MatchOffset == 0 || MatchOffset > WindowPosition || MatchOffset > WindowSize ||
+            MatchLength > End - WindowPosition)
+        {
+            return CS_BADSTREAM;
+        }
+
+        for (; MatchLength > 0; MatchLength--, WindowPosition++)
+            Window[WindowPosition & Mask] = Window[(WindowPosition - MatchOffset) & Mask];
+    }
+
+    return CS_SUCCESS;
+}
+
+
+ULONG CLZXCodec::Uncompress(void* OutputBuffer,
+                            void* InputBuffer,
+                            ULONG InputLength,
+                            PULONG OutputLength)
+/*
+ * FUNCTION: Uncompresses data in a buffer
+ * ARGUMENTS:
+ *     OutputBuffer   = Pointer to buffer to place uncompressed data
+ *     InputBuffer    = Pointer to buffer with data to be uncompressed
+ *     InputLength    = Length of input buffer
+ *     OutputLength   = Address of buffer to place size of uncompressed data
+ */
+{
+    PUCHAR Output = (PUCHAR)OutputBuffer;
+    ULONG Mask = WindowSize - 1;
+    ULONG Done = 0;
+    ULONG Run, i;
+    LZX_BITS Bits;
+
+    DPRINT(MAX_TRACE, ("InputLength (%u).\n", (UINT)InputLength));
+
+    if (Corrupted)
+        return CS_BADSTREAM;
+
+    if (Window == NULL)
+        Window = (PUCHAR)malloc(2 << LZX_MAX_WINDOW_BITS);
+    if (Window == NULL)
+        return CS_NOMEMORY;
+
+    Bits.Data     = (PUCHAR)InputBuffer;
+    Bits.Length   = InputLength;
+    Bits.Position = 0;
+    Bits.Buffer   = 0;
+    Bits.BitsLeft = 0;
+
+    if (!HeaderRead)
+    {
+        E8FileSize = 0;
+        if (GetBits(&Bits, 1))
+        {
+            E8FileSize = GetBits(&Bits, 16) << 16;
+            E8FileSize |= GetBits(&Bits, 16);
+        }
+        HeaderRead = true;
+    }
+
+    /* Every frame is 32KB, except the last one which ends with the input */
+    while (Done < LZX_FRAME_SIZE)
+    {
+        if (BlockRemaining == 0)
+        {
+            if (Done != 0 && ((BitsRead(&Bits) + 15) / 16) * 2 >= InputLength)
+                break;
+
+            if (ReadBlockHeader(&Bits) != CS_SUCCESS || BlockLength == 0)
+            {
+                Corrupted = true;
+                return CS_BADSTREAM;
+            }
+        }
+
+        Run = LZX_MIN(BlockRemaining, LZX_FRAME_SIZE - Done);
+        if (DecodeRun(&Bits, StreamPosition + Done, Run) != CS_SUCCESS)
+        {
+            Corrupted = true;
+            return CS_BADSTREAM;
+        }
+        Done += Run;
+        BlockRemaining -= Run;
+
+        /* Uncompressed blocks are padded to an even length */
+        if (BlockRemaining == 0 && BlockType == LZX_BLOCKTYPE_UNCOMPRESSED && (BlockLength & 1))
+            Bits.Position++;
+    }
+
+    if (BitsRead(&Bits) > InputLength * 8)
+    {
+        Corrupted = true;
+        return CS_BADSTREAM;
+    }
+
+    for (i = 0; i < Done; i++)
+        Output[i] = Window[(StreamPosition + i) & Mask];
+    TranslateE8(Output, Done, false);
+
+    StreamPosition += Done;
+    FrameCount++;
+
+    *OutputLength = Done;
+    return CS_SUCCESS;
+}
+
+/* EOF */
@@ -0,0 +1,118 @@
+/*
+ * PROJECT:     ReactOS cabinet manager
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     CAB codec for LZX compressed data
+ */
+
+#pragma once
+
+#include "cabinet.h"
+
+/* Window sizes allowed in cabinets, as a power of two */
+#define LZX_MIN_WINDOW_BITS       15
+#define LZX_MAX_WINDOW_BITS       21
+
+/* Window size used for compression */
+#define LZX_WINDOW_BITS           21
+
+#define LZX_NUM_CHARS             256
+#define LZX_MAX_POSITION_SLOTS    50
+#define LZX_MAINTREE_MAXSYMBOLS   (LZX_NUM_CHARS + LZX_MAX_POSITION_SLOTS * 8)
+#define LZX_NUM_SECONDARY_LENGTHS 249
+#define LZX_ALIGNED_NUM_ELEMENTS  8
+#define LZX_MAX_CODE_LENGTH       16
+
+/* A literal or a match, as found when compressing a frame */
+typedef struct _LZX_TOKEN
+{
+    ULONG Offset;           // Formatted offset (0 to 2 for R0 to R2), or the literal
+    ULONG Length;           // Match length, 0 for a literal
+} LZX_TOKEN, *PLZX_TOKEN;
+
+/* Canonical Huffman tree, for decoding */
+typedef struct _LZX_TREE
+{
+    USHORT Count[LZX_MAX_CODE_LENGTH + 1];      // Number of codes of each length
+    USHORT Symbols[LZX_MAINTREE_MAXSYMBOLS];    // Symbols ordered by code
+} LZX_TREE, *PLZX_TREE;
+
+/* Input bitstream, read as 16-bit little endian words */
+typedef struct _LZX_BITS
+{
+    PUCHAR Data;
+    ULONG Length;
+    ULONG Position;         // Offset of the next word to load
+    ULONG Buffer;           // Bits loaded but not read yet, from the top
+    ULONG BitsLeft;
+} LZX_BITS, *PLZX_BITS;
+
+
+/* Classes */
+
+class CLZXCodec : public CCABCodec
+{
+public:
+    /* Default constructor */
+    CLZXCodec();
+    /* Default destructor */
+    virtual ~CLZXCodec();
+    /* Compresses a data block */
+    virtual ULONG Compress(void* OutputBuffer,
+                           void* InputBuffer,
+                           ULONG InputLength,
+                           PULONG OutputLength);
+    /* Uncompresses a data block */
+    virtual ULONG Uncompress(void* OutputBuffer,
+                             void* InputBuffer,
+                             ULONG InputLength,
+                             PULONG OutputLength);
+    /* Starts a new folder */
+    virtual void Reset(USHORT CompressionType);
+    /* The data blocks of a folder form a single LZX stream */
+    virtual bool IsBlockIndependent() { return false; };
+private:
+    void TranslateE8(PUCHAR Data, ULONG Length, bool Encode);
+    /* Compression */
+    void HashUpTo(ULONG Position, ULONG End);
+    ULONG FindMatch(ULONG Position, ULONG End, PULONG Offset);
+    ULONG ParseFrame(ULONG Length);
+    ULONG WriteFrame(PUCHAR OutputBuffer, ULONG Length, ULONG TokenCount);
+    /* Decompression */
+    ULONG ReadLengths(PLZX_BITS Bits, PUCHAR Lengths, ULONG First, ULONG Last);
+    ULONG ReadBlockHeader(PLZX_BITS Bits);
+    ULONG DecodeRun(PLZX_BITS Bits, ULONG WindowPosition, ULONG Length);
+
+    ULONG WindowBits;
+    ULONG WindowSize;
+    ULONG MainSymbols;          // Number of symbols of the main tree
+    bool Corrupted;             // Bad window size or bad stream, until the next reset
+
+    /* State of the stream, carried over from a block to the next */
+    ULONG R0, R1, R2;           // Repeated offsets
+    ULONG FrameCount;           // Frames (data blocks) done since the last reset
+    ULONG StreamPosition;       // Uncompressed bytes done since the last reset
+    ULONG E8FileSize;           // Translation size for E8 calls, 0 if not translated
+    UCHAR MainLengths[LZX_MAINTREE_MAXSYMBOLS];
+    UCHAR LengthLengths[LZX_NUM_SECONDARY_LENGTHS];
+    PUCHAR Window;
+
+    /* Compression */
+    ULONG WindowBase;           // Stream position of Window[0]
+    ULONG NextHash;             // First position not in the hash chains yet
+    PULONG HashHead;
+    PULONG HashPrev;
+    PLZX_TOKEN Tokens;
+    PUCHAR FrameBuffer;         // Compressed frame, before we know if it pays off
+
+    /* Decompression */
+    bool HeaderRead;
+    ULONG BlockType;
+    ULONG BlockLength;
+    ULONG BlockRemaining;
+    UCHAR AlignedLengths[LZX_ALIGNED_NUM_ELEMENTS];
+    LZX_TREE MainTree;
+    LZX_TREE LengthTree;
+    LZX_TREE AlignedTree;
+};
+
+/* EOF */
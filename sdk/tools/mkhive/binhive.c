@@ -38,8 +38,6 @@ ExportBinaryHive(
     FILE *File;
     BOOL ret;
 
-    printf("  Creating binary hive: %s\n", FileName);
-
     /* Create new hive file */
     File = fopen(FileName, "wb");
     if (File == NULL)
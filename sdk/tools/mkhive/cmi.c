@@ -30,6 +30,13 @@
 #define NDEBUG
 #include "mkhive.h"
 
+#ifdef _MSC_VER
+#include <io.h>
+#define ftruncate _chsize
+#else
+#include <unistd.h>
+#endif
+
 /* FUNCTIONS ****************************************************************/
 
 PVOID
@@ -61,7 +68,7 @@ CmpFileRead(
     IN SIZE_T BufferLength)
 {
     PCMHIVE CmHive = (PCMHIVE)RegistryHive;
-    FILE *File = CmHive->FileHandles[HFILE_TYPE_PRIMARY];
+    FILE *File = CmHive->FileHandles[FileType];
     if (fseek(File, *FileOffset, SEEK_SET) != 0)
         return FALSE;
 
@@ -78,7 +85,12 @@ CmpFileWrite(
     IN SIZE_T BufferLength)
 {
     PCMHIVE CmHive = (PCMHIVE)RegistryHive;
-    FILE *File = CmHive->FileHandles[HFILE_TYPE_PRIMARY];
+    FILE *File = CmHive->FileHandles[FileType];
+
+    /* Just return success if no file is associated with this hive */
+    if (File == NULL)
+        return TRUE;
+
     if (fseek(File, *FileOffset, SEEK_SET) != 0)
         return FALSE;
 
@@ -93,8 +105,17 @@ CmpFileSetSize(
     IN ULONG FileSize,
     IN ULONG OldFileSize)
 {
-    DPRINT1("CmpFileSetSize() unimplemented\n");
-    return FALSE;
+    PCMHIVE CmHive = (PCMHIVE)RegistryHive;
+    FILE *File = CmHive->FileHandles[FileType];
+
+    /* Just return success if no file is associated with this hive */
+    if (File == NULL)
+        return TRUE;
+
+    if (fflush(File) != 0)
+        return FALSE;
+
+    return (ftruncate(fileno(File), FileSize) == 0);
 }
 
 static BOOLEAN
@@ -106,7 +127,12 @@ CmpFileFlush(
     ULONG Length)
 {
     PCMHIVE CmHive = (PCMHIVE)RegistryHive;
-    FILE *File = CmHive->FileHandles[HFILE_TYPE_PRIMARY];
+    FILE *File = CmHive->FileHandles[FileType];
+
+    /* Just return success if no file is associated with this hive */
+    if (File == NULL)
+        return TRUE;
+
     return (fflush(File) == 0);
 }
 
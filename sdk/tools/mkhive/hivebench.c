@@ -0,0 +1,326 @@
+/*
+ * PROJECT:     ReactOS hive maker
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Benchmark of building, modifying and flushing a large hive
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mkhive.h"
+
+#define VALUES_PER_KEY 4
+
+/* FUNCTIONS ****************************************************************/
+
+static
+void
+usage(void)
+{
+    printf("Usage: hivebench [-n keys] [-r rounds] [-l] <hivefile>\n\n"
+           "  -n keys   - Number of keys to create (default 20000).\n"
+           "  -r rounds - Number of modify and flush rounds (default 10).\n"
+           "  -l        - Write and check a <hivefile>.LOG log on each flush.\n"
+           "  hivefile  - The binary hive file to write.\n");
+}
+
+/* The tools are built with 16-bit wide characters, so no swprintf */
+static
+void
+MakeName(
+    OUT PWCHAR Name,
+    IN PCSTR Format,
+    IN ULONG Number)
+{
+    CHAR Buffer[32];
+    ULONG i;
+
+    sprintf(Buffer, Format, Number);
+    for (i = 0; Buffer[i]; i++)
+        Name[i] = (WCHAR)Buffer[i];
+    Name[i] = 0;
+}
+
+static
+ULONG
+ElapsedMs(
+    IN clock_t Start)
+{
+    return (ULONG)((clock() - Start) * 1000 / CLOCKS_PER_SEC);
+}
+
+/* Sets a value of the key, its size depends on the round so that cells move */
+static
+BOOL
+SetValue(
+    IN HKEY Key,
+    IN ULONG Value,
+    IN ULONG Round)
+{
+    UCHAR Data[512];
+    WCHAR ValueName[16];
+    ULONG Size;
+
+    Size = 16 + ((Value * 37 + Round * 101) % (sizeof(Data) - 16));
+    memset(Data, (UCHAR)(Value + Round), Size);
+    MakeName(ValueName, "Value%u", Value);
+    return RegSetValueExW(Key, ValueName, 0, REG_BINARY, Data, Size) == ERROR_SUCCESS;
+}
+
+/* Checks that the log holds the header, the dirty bitmap and then each dirty block */
+static
+BOOL
+CheckLog(
+    IN PCMHIVE CmHive,
+    IN FILE *LogFile,
+    IN ULONG Dirty)
+{
+    PHHIVE Hive = &CmHive->Hive;
+    PHBASE_BLOCK LogHeader;
+    PUCHAR Buffer, Bitmap;
+    ULONG BitmapSize, HeaderSize, LogSize;
+    ULONG BlockIndex, Logged = 0;
+    BOOL Success = FALSE;
+
+    BitmapSize = ROUND_UP(Hive->DirtyVector.SizeOfBitMap, sizeof(ULONG) * 8) / 8;
+    HeaderSize = ROUND_UP(HV_LOG_HEADER_SIZE + sizeof(ULONG) + BitmapSize, HBLOCK_SIZE);
+    LogSize = HeaderSize + Dirty * HBLOCK_SIZE;
+
+    Buffer = malloc(LogSize + 1);
+    if (Buffer == NULL)
+    {
+        printf("Out of memory\n");
+        return FALSE;
+    }
+
+    /* The log is exactly as long as the header and the dirty blocks */
+    if (fseek(LogFile, 0, SEEK_SET) != 0 ||
+        fread(Buffer, 1, LogSize + 1, LogFile) != LogSize)
+    {
+        printf("Log is not %u bytes long\n", (UINT)LogSize);
+        goto Quit;
+    }
+
+    LogHeader = (PHBASE_BLOCK)Buffer;
+    Bitmap = Buffer + HV_LOG_HEADER_SIZE + sizeof(ULONG);
+    if (LogHeader->Type != HFILE_TYPE_LOG ||
+        LogHeader->Sequence1 != LogHeader->Sequence2 ||
+        memcmp(Buffer + HV_LOG_HEADER_SIZE, "DIRT", 4) != 0)
+    {
+        printf("Bad log header\n");
+        goto Quit;
+    }
+
+    /* The dirty vector is cleared by then, the logged blocks are compared to memory */
+    for (BlockIndex = 0; BlockIndex < Hive->Storage[Stable].Length; BlockIndex++)
+    {
+        if (!(Bitmap[BlockIndex / 8] & (1 << (BlockIndex % 8))))
+            continue;
+
+        if (Logged >= Dirty ||
+            memcmp(Buffer + HeaderSize + Logged * HBLOCK_SIZE,
+                   (PVOID)Hive->Storage[Stable].BlockList[BlockIndex].BlockAddress,
+                   HBLOCK_SIZE) != 0)
+        {
+            printf("Log block %u does not match hive block %u\n", (UINT)Logged, (UINT)BlockIndex);
+            goto Quit;
+        }
+        Logged++;
+    }
+
+    if (Logged != Dirty)
+    {
+        printf("Log has %u dirty blocks, expected %u\n", (UINT)Logged, (UINT)Dirty);
+        goto Quit;
+    }
+    Success = TRUE;
+
+Quit:
+    free(Buffer);
+    return Success;
+}
+
+static
+BOOL
+SyncHive(
+    IN PCMHIVE CmHive,
+    IN PCSTR FileName,
+    IN BOOL WithLog)
+{
+    FILE *File, *LogFile = NULL;
+    CHAR LogName[260];
+    ULONG Dirty;
+    BOOL Success;
+
+    /* Write the dirty blocks over the file written before */
+    File = fopen(FileName, "r+b");
+    if (File == NULL)
+    {
+        printf("Error opening %s\n", FileName);
+        return FALSE;
+    }
+
+    if (WithLog)
+    {
+        snprintf(LogName, sizeof(LogName), "%s.LOG", FileName);
+        LogFile = fopen(LogName, "w+b");
+        if (LogFile == NULL)
+        {
+            printf("Error opening %s\n", LogName);
+            fclose(File);
+            return FALSE;
+        }
+    }
+
+    Dirty = RtlNumberOfSetBits(&CmHive->Hive.DirtyVector);
+
+    CmHive->Hive.Log = WithLog;
+    CmHive->FileHandles[HFILE_TYPE_PRIMARY] = (HANDLE)File;
+    CmHive->FileHandles[HFILE_TYPE_LOG] = (HANDLE)LogFile;
+    Success = HvSyncHive(&CmHive->Hive);
+    if (Success && WithLog && Dirty != 0)
+        Success = CheckLog(CmHive, LogFile, Dirty);
+
+    CmHive->FileHandles[HFILE_TYPE_PRIMARY] = NULL;
+    CmHive->FileHandles[HFILE_TYPE_LOG] = NULL;
+    CmHive->Hive.Log = FALSE;
+    if (LogFile)
+        fclose(LogFile);
+    fclose(File);
+    return Success;
+}
+
+int main(int argc, char *argv[])
+{
+    PCMHIVE CmHive = RegistryHives[2].CmHive; /* SOFTWARE */
+    PCSTR FileName = NULL;
+    HKEY BenchKey, *Keys;
+    WCHAR KeyName[16];
+    ULONG KeyCount = 20000, RoundCount = 10;
+    BOOL WithLog = FALSE;
+    ULONG i, j, Round, Dirty;
+    ULONG BuildTime, FlushTime, ModifyTime = 0, SyncTime = 0;
+    clock_t Start;
+    int ret = -1;
+
+    for (i = 1; i < (ULONG)argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < (ULONG)argc)
+            KeyCount = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < (ULONG)argc)
+            RoundCount = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-l") == 0)
+            WithLog = TRUE;
+        else if (argv[i][0] != '-' && FileName == NULL)
+            FileName = argv[i];
+        else
+            break;
+    }
+    if (i < (ULONG)argc || FileName == NULL || KeyCount == 0)
+    {
+        usage();
+        return -1;
+    }
+
+    Keys = calloc(KeyCount, sizeof(HKEY));
+    if (Keys == NULL)
+    {
+        printf("Out of memory\n");
+        return -1;
+    }
+
+    RegInitializeRegistry("SOFTWARE");
+    if (RegCreateKeyW(NULL, L"Registry\\Machine\\SOFTWARE\\Benchmark", &BenchKey) != ERROR_SUCCESS)
+    {
+        printf("Error creating the benchmark key\n");
+        goto Quit;
+    }
+
+    /* Build */
+    Start = clock();
+    for (i = 0; i < KeyCount; i++)
+    {
+        MakeName(KeyName, "Key%05u", i);
+        if (RegCreateKeyW(BenchKey, KeyName, &Keys[i]) != ERROR_SUCCESS)
+        {
+            printf("Error creating key %u\n", (UINT)i);
+            goto Quit;
+        }
+
+        for (j = 0; j < VALUES_PER_KEY; j++)
+        {
+            if (!SetValue(Keys[i], j, 0))
+            {
+                printf("Error setting value %u of key %u\n", (UINT)j, (UINT)i);
+                goto Quit;
+            }
+        }
+    }
+    BuildTime = ElapsedMs(Start);
+
+    /* Full flush */
+    Start = clock();
+    if (!ExportBinaryHive(FileName, CmHive))
+        goto Quit;
+    FlushTime = ElapsedMs(Start);
+
+    /* Clear the dirty vector */
+    if (!SyncHive(CmHive, FileName, FALSE))
+        goto Quit;
+
+    /* Resize the values of a tenth of the keys, freeing and allocating cells, then flush the dirty blocks */
+    for (Round = 1; Round <= RoundCount; Round++)
+    {
+        Start = clock();
+        for (i = Round % 10; i < KeyCount; i += 10)
+        {
+            for (j = 0; j < VALUES_PER_KEY; j++)
+            {
+                if (!SetValue(Keys[i], j, Round))
+                {
+                    printf("Error setting value %u of key %u\n", (UINT)j, (UINT)i);
+                    goto Quit;
+                }
+            }
+        }
+        ModifyTime += ElapsedMs(Start);
+
+        Dirty = RtlNumberOfSetBits(&CmHive->Hive.DirtyVector);
+
+        Start = clock();
+        if (!SyncHive(CmHive, FileName, WithLog))
+            goto Quit;
+        SyncTime += ElapsedMs(Start);
+
+        if (Round == 1)
+        {
+            printf("  %u dirty blocks out of %u after a round\n",
+                   (UINT)Dirty, (UINT)CmHive->Hive.Storage[Stable].Length);
+        }
+    }
+
+    printf("  %u keys, %u values, hive of %u KB\n",
+           (UINT)KeyCount, (UINT)(KeyCount * VALUES_PER_KEY),
+           (UINT)(CmHive->Hive.Storage[Stable].Length * HBLOCK_SIZE / 1024));
+    printf("  Build: %u ms, full flush: %u ms\n", (UINT)BuildTime, (UINT)FlushTime);
+    printf("  %u rounds: modify %u ms, incremental flush %u ms%s\n",
+           (UINT)RoundCount, (UINT)ModifyTime, (UINT)SyncTime,
+           WithLog ? " (with log)" : "");
+    ret = 0;
+
+Quit:
+    for (i = 0; i < KeyCount; i++)
+    {
+        if (Keys[i])
+            RegCloseKey(Keys[i]);
+    }
+    free(Keys);
+    RegShutdownRegistry();
+    return ret;
+}
+
+/* EOF */
@@ -54,10 +54,11 @@
 
 void usage(void)
 {
-    printf("Usage: mkhive [-?] -h:hive1[,hiveN...] [-u] -d:<dstdir> <inffiles>\n\n"
+    printf("Usage: mkhive [-?] -h:hive1[,hiveN...] [-u] [--stats] -d:<dstdir> <inffiles>\n\n"
            "  -h:hiveN  - Comma-separated list of hives to create. Possible values are:\n"
            "              SETUPREG, SYSTEM, SOFTWARE, DEFAULT, SAM, SECURITY, BCD.\n"
            "  -u        - Generate file names in uppercase (default: lowercase) (TEMPORARY FLAG!).\n"
+           "  --stats   - Display the time taken by each phase.\n"
            "  -d:dstdir - The binary hive files are created in this directory.\n"
            "  inffiles  - List of INF files with full path.\n"
            "  -?        - Displays this help screen.\n");
@@ -91,15 +92,49 @@ void convert_path(char *dst, char *src)
     dst[i] = 0;
 }
 
+typedef struct _EXPORT_JOB
+{
+    CHAR FileName[PATH_MAX];
+    PCSTR HiveName;
+    PCMHIVE CmHive;
+    BOOL Success;
+    ULONGLONG Time;
+} EXPORT_JOB, *PEXPORT_JOB;
+
+static VOID
+export_job(PVOID Parameter)
+{
+    PEXPORT_JOB Job = (PEXPORT_JOB)Parameter;
+    ULONGLONG Start = GetTimeMicroseconds();
+
+    Job->Success = ExportBinaryHive(Job->FileName, Job->CmHive);
+    Job->Time = GetTimeMicroseconds() - Start;
+}
+
+static VOID
+print_time(PCSTR Label, ULONGLONG Time)
+{
+    printf("    %-20s %6u.%03u ms\n", Label,
+           (UINT)(Time / 1000), (UINT)(Time % 1000));
+}
+
 int main(int argc, char *argv[])
 {
     INT ret;
     INT i;
-    PSTR ptr;
+    PSTR ptr, FileName;
     BOOL UpperCaseFileName = FALSE;
+    BOOL Stats = FALSE;
     PCSTR HiveList = NULL;
     CHAR DestPath[PATH_MAX] = "";
-    CHAR FileName[PATH_MAX];
+    ULONG FileCount, j;
+    PSTR *FileNames = NULL;
+    PREGISTRY_FILE *Files = NULL;
+    EXPORT_JOB ExportJobs[MAX_NUMBER_OF_REGISTRY_HIVES];
+    PVOID Contexts[MAX_NUMBER_OF_REGISTRY_HIVES];
+    ULONG ExportCount = 0;
+    IMPORT_STATS HiveStats[MAX_NUMBER_OF_REGISTRY_HIVES], RootStats;
+    ULONGLONG Start, LoadTime, ImportTime, ExportTime;
 
     if (argc < 4)
     {
@@ -123,6 +158,11 @@ int main(int argc, char *argv[])
             UpperCaseFileName = TRUE;
         }
         else
+        if (strcmp(argv[i], "--stats") == 0)
+        {
+            Stats = TRUE;
+        }
+        else
         if (argv[i][1] == 'h' && (argv[i][2] == ':' || argv[i][2] == '='))
         {
             HiveList = argv[i] + 3;
@@ -161,20 +201,45 @@ int main(int argc, char *argv[])
     /* Default to failure */
     ret = -1;
 
-    /* Now we should have the list of INF files: parse it */
-    for (; i < argc; ++i)
+    /* Now we should have the list of INF files */
+    FileCount = argc - i;
+    FileNames = calloc(FileCount, sizeof(PSTR));
+    Files = calloc(FileCount, sizeof(PREGISTRY_FILE));
+    if (!FileNames || !Files)
     {
-        convert_path(FileName, argv[i]);
-        if (!ImportRegistryFile(FileName))
+        fprintf(stderr, "Out of memory.\n");
+        goto Quit;
+    }
+    for (j = 0; j < FileCount; ++j)
+    {
+        FileNames[j] = malloc(strlen(argv[i + j]) + 1);
+        if (!FileNames[j])
+        {
+            fprintf(stderr, "Out of memory.\n");
             goto Quit;
+        }
+        convert_path(FileNames[j], argv[i + j]);
     }
 
+    /* Parse them, all at once */
+    Start = GetTimeMicroseconds();
+    if (!LoadRegistryFiles(FileCount, (PCSTR*)FileNames, Files))
+        goto Quit;
+    LoadTime = GetTimeMicroseconds() - Start;
+
+    /* Fill the hives, each in its own thread */
+    Start = GetTimeMicroseconds();
+    if (!ImportRegistryFiles(FileCount, Files, HiveStats, &RootStats))
+        goto Quit;
+    ImportTime = GetTimeMicroseconds() - Start;
+
     for (i = 0; i < MAX_NUMBER_OF_REGISTRY_HIVES; ++i)
     {
         /* Skip this registry hive if it's not in the list */
         if (!strstr(HiveList, RegistryHives[i].HiveName))
             continue;
 
+        FileName = ExportJobs[ExportCount].FileName;
         strcpy(FileName, DestPath);
         strcat(FileName, DIR_SEPARATOR_STRING);
 
@@ -199,8 +264,11 @@ int main(int argc, char *argv[])
                 *ptr = tolower(*ptr);
         }
 
-        if (!ExportBinaryHive(FileName, RegistryHives[i].CmHive))
-            goto Quit;
+        printf("  Creating binary hive: %s\n", FileName);
+        ExportJobs[ExportCount].HiveName = RegistryHives[i].HiveName;
+        ExportJobs[ExportCount].CmHive = RegistryHives[i].CmHive;
+        Contexts[ExportCount] = &ExportJobs[ExportCount];
+        ExportCount++;
 
         /* If we happen to deal with the special setup registry hive, stop there */
         // if (strcmp(RegistryHives[i].HiveName, "SETUPREG") == 0)
@@ -208,10 +276,57 @@ int main(int argc, char *argv[])
             break;
     }
 
+    /* The hives are independent, write them all at once */
+    Start = GetTimeMicroseconds();
+    RunInParallel(ExportCount, export_job, Contexts);
+    ExportTime = GetTimeMicroseconds() - Start;
+
+    for (j = 0; j < ExportCount; ++j)
+    {
+        if (!ExportJobs[j].Success)
+            goto Quit;
+    }
+
+    if (Stats)
+    {
+        printf("  Statistics:\n");
+        print_time("Parsing INF files", LoadTime);
+        print_time("Building hives", ImportTime);
+        print_time("Writing hives", ExportTime);
+        for (j = 0; j < ExportCount; ++j)
+        {
+            /* The statistics of a hive listed twice are in its first entry */
+            for (i = 0; RegistryHives[i].CmHive != ExportJobs[j].CmHive; ++i)
+                ;
+
+            printf("    %-10s %6u entries built in %u.%03u ms, %5u KB written in %u.%03u ms\n",
+                   ExportJobs[j].HiveName, (UINT)HiveStats[i].LineCount,
+                   (UINT)(HiveStats[i].Time / 1000), (UINT)(HiveStats[i].Time % 1000),
+                   (UINT)(ExportJobs[j].CmHive->Hive.BaseBlock->Length / 1024 + HBLOCK_SIZE / 1024),
+                   (UINT)(ExportJobs[j].Time / 1000), (UINT)(ExportJobs[j].Time % 1000));
+        }
+        if (RootStats.LineCount != 0)
+        {
+            printf("    %u entries outside of the hives, applied in %u.%03u ms\n",
+                   (UINT)RootStats.LineCount,
+                   (UINT)(RootStats.Time / 1000), (UINT)(RootStats.Time % 1000));
+        }
+    }
+
     /* Success */
     ret = 0;
 
 Quit:
+    if (Files)
+        CloseRegistryFiles(FileCount, Files);
+    free(Files);
+    if (FileNames)
+    {
+        for (j = 0; j < FileCount; ++j)
+            free(FileNames[j]);
+    }
+    free(FileNames);
+
     /* Shut down the registry */
     RegShutdownRegistry();
 
@@ -72,6 +72,10 @@ WCHAR NTAPI
 RtlUpcaseUnicodeChar(
     IN WCHAR Source);
 
+ULONG NTAPI
+RtlNumberOfSetBits(
+    IN PRTL_BITMAP BitMapHeader);
+
 LONG WINAPI
 RegQueryValueExW(
     IN HKEY hKey,
@@ -123,6 +127,7 @@ RegOpenKeyW(
 #include "cmi.h"
 #include "registry.h"
 #include "binhive.h"
+#include <parallel.h>
 
 #define OBJ_NAME_PATH_SEPARATOR           ((WCHAR)L'\\')
 
@@ -389,34 +389,114 @@ do_reg_operation(
     return TRUE;
 }
 
+/*
+ * An AddReg or DelReg entry, with the key it applies to.
+ */
+typedef struct _REG_LINE
+{
+    PINFCONTEXT Context;
+    PWCHAR KeyName;
+    ULONG Flags;
+    BOOL Delete;
+} REG_LINE, *PREG_LINE;
+
+typedef struct _REG_LINE_LIST
+{
+    PREG_LINE Lines;
+    ULONG Count;
+    ULONG MaxCount;
+} REG_LINE_LIST, *PREG_LINE_LIST;
+
+/*
+ * A parsed INF file. Its entries are sorted by hive: List[i] has those of the
+ * hive of RegistryHives[i] (only the first entry of a hive listed twice is
+ * used), List[MAX_NUMBER_OF_REGISTRY_HIVES] those of the root hive.
+ */
+typedef struct _REGISTRY_FILE
+{
+    PCSTR FileName;
+    HINF hInf;
+    BOOL Success;
+    REG_LINE_LIST List[MAX_NUMBER_OF_REGISTRY_HIVES + 1];
+} REGISTRY_FILE;
+
+#define ROOT_HIVE_LIST  MAX_NUMBER_OF_REGISTRY_HIVES
+
+static ULONG
+get_hive_list(PCMHIVE Hive)
+{
+    ULONG i;
+
+    if (Hive == NULL)
+        return ROOT_HIVE_LIST;
+
+    for (i = 0; i < MAX_NUMBER_OF_REGISTRY_HIVES; i++)
+    {
+        if (RegistryHives[i].CmHive == Hive)
+            break;
+    }
+    return i;
+}
+
+static BOOL
+add_line(PREG_LINE_LIST List, PINFCONTEXT Context, PCWSTR KeyName, ULONG Flags, BOOL Delete)
+{
+    PREG_LINE Lines;
+    size_t Length;
+
+    if (List->Count == List->MaxCount)
+    {
+        Lines = realloc(List->Lines, (List->MaxCount ? List->MaxCount * 2 : 64) * sizeof(REG_LINE));
+        if (!Lines)
+            return FALSE;
+        List->Lines = Lines;
+        List->MaxCount = List->MaxCount ? List->MaxCount * 2 : 64;
+    }
+
+    Length = (strlenW(KeyName) + 1) * sizeof(WCHAR);
+    List->Lines[List->Count].KeyName = malloc(Length);
+    if (!List->Lines[List->Count].KeyName)
+        return FALSE;
+    memcpy(List->Lines[List->Count].KeyName, KeyName, Length);
+
+    List->Lines[List->Count].Context = Context;
+    List->Lines[List->Count].Flags = Flags;
+    List->Lines[List->Count].Delete = Delete;
+    List->Count++;
+    return TRUE;
+}
+
 /***********************************************************************
  *            registry_callback
  *
  * Called once for each AddReg and DelReg entry in a given section.
+ * The entries are not applied yet, but sorted by the hive of their key:
+ * each entry keeps its own INF context.
  */
 static BOOL
-registry_callback(HINF hInf, PCWSTR Section, BOOL Delete)
+registry_callback(PREGISTRY_FILE File, PCWSTR Section, BOOL Delete)
 {
     WCHAR Buffer[MAX_INF_STRING_LENGTH];
-    PWCHAR ValuePtr;
     ULONG Flags;
     size_t Length;
 
     PINFCONTEXT Context = NULL;
-    HKEY KeyHandle;
-    BOOL Ok;
+    PINFCONTEXT NextContext;
+    BOOL Ok, Kept;
 
-    Ok = InfHostFindFirstLine(hInf, Section, NULL, &Context) == 0;
+    Ok = InfHostFindFirstLine(File->hInf, Section, NULL, &Context) == 0;
     if (!Ok)
         return TRUE; /* Don't fail if the section isn't present */
 
-    for (Ok = TRUE; Ok; Ok = (InfHostFindNextLine(Context, Context) == 0))
+    for (; Ok; Context = NextContext)
     {
+        Kept = FALSE;
+
         /* Get root */
         if (InfHostGetStringField(Context, 1, Buffer, sizeof(Buffer)/sizeof(WCHAR), NULL) != 0)
-            continue;
+            goto Next;
         if (!get_root_key(Buffer))
-            continue;
+            goto Next;
 
         /* Get key */
         Length = strlenW(Buffer);
@@ -434,88 +514,292 @@ registry_callback(HINF hInf, PCWSTR Section, BOOL Delete)
             if (!Flags)
                 Flags = FLG_ADDREG_DELREG_BIT;
             else if (!(Flags & FLG_ADDREG_DELREG_BIT))
-                continue; /* ignore this entry */
+                goto Next; /* ignore this entry */
         }
         else
         {
             if (Flags & FLG_ADDREG_DELREG_BIT)
-                continue; /* ignore this entry */
+                goto Next; /* ignore this entry */
         }
 
         DPRINT("Flags: 0x%x\n", Flags);
 
-        if (Delete || (Flags & FLG_ADDREG_OVERWRITEONLY))
+        if (!add_line(&File->List[get_hive_list(RegGetKeyHive(Buffer))], Context, Buffer, Flags, Delete))
         {
-            if (RegOpenKeyW(NULL, Buffer, &KeyHandle) != ERROR_SUCCESS)
-            {
-                DPRINT("RegOpenKey(%S) failed\n", Buffer);
-                continue;  /* ignore if it doesn't exist */
-            }
+            InfHostFreeContext(Context);
+            return FALSE;
         }
-        else
+        Kept = TRUE;
+
+Next:
+        /* The next entry gets a context of its own */
+        if (InfHostFindFirstLine(File->hInf, Section, NULL, &NextContext) != 0)
         {
-            if (RegCreateKeyW(NULL, Buffer, &KeyHandle) != ERROR_SUCCESS)
-            {
-                DPRINT("RegCreateKey(%S) failed\n", Buffer);
-                continue;
-            }
+            if (!Kept)
+                InfHostFreeContext(Context);
+            return FALSE;
         }
+        Ok = (InfHostFindNextLine(Context, NextContext) == 0);
+        if (!Kept)
+            InfHostFreeContext(Context);
+    }
+
+    InfHostFreeContext(Context);
+
+    return TRUE;
+}
+
+static BOOL
+apply_line(PREG_LINE Line)
+{
+    WCHAR Buffer[MAX_INF_STRING_LENGTH];
+    PWCHAR ValuePtr;
+    HKEY KeyHandle;
+    BOOL Ok;
 
-        /* Get value name */
-        if (InfHostGetStringField(Context, 3, Buffer, sizeof(Buffer)/sizeof(WCHAR), NULL) == 0)
+    if (Line->Delete || (Line->Flags & FLG_ADDREG_OVERWRITEONLY))
+    {
+        if (RegOpenKeyW(NULL, Line->KeyName, &KeyHandle) != ERROR_SUCCESS)
         {
-            ValuePtr = Buffer;
+            DPRINT("RegOpenKey(%S) failed\n", Line->KeyName);
+            return TRUE;  /* ignore if it doesn't exist */
         }
-        else
+    }
+    else
+    {
+        if (RegCreateKeyW(NULL, Line->KeyName, &KeyHandle) != ERROR_SUCCESS)
         {
-            ValuePtr = NULL;
+            DPRINT("RegCreateKey(%S) failed\n", Line->KeyName);
+            return TRUE;
         }
+    }
+
+    /* Get value name */
+    if (InfHostGetStringField(Line->Context, 3, Buffer, sizeof(Buffer)/sizeof(WCHAR), NULL) == 0)
+    {
+        ValuePtr = Buffer;
+    }
+    else
+    {
+        ValuePtr = NULL;
+    }
+
+    /* And now do it */
+    Ok = do_reg_operation(KeyHandle, ValuePtr, Line->Context, Line->Flags);
+
+    RegCloseKey(KeyHandle);
+    return Ok;
+}
+
+static VOID
+load_job(PVOID Parameter)
+{
+    PREGISTRY_FILE File = (PREGISTRY_FILE)Parameter;
+    ULONG ErrorLine;
+
+    File->Success = FALSE;
 
-        /* And now do it */
-        if (!do_reg_operation(KeyHandle, ValuePtr, Context, Flags))
+    /* Load inf file from install media. */
+    if (InfHostOpenFile(&File->hInf, File->FileName, 0, &ErrorLine) != 0)
+    {
+        DPRINT1("InfHostOpenFile(%s) failed\n", File->FileName);
+        File->hInf = NULL;
+        return;
+    }
+
+    if (!registry_callback(File, DelReg, TRUE))
+    {
+        DPRINT1("registry_callback() for DelReg failed\n");
+        return;
+    }
+
+    if (!registry_callback(File, AddReg, FALSE))
+    {
+        DPRINT1("registry_callback() for AddReg failed\n");
+        return;
+    }
+
+    File->Success = TRUE;
+}
+
+/*
+ * Parses the INF files and sorts their entries by hive, all the files at the
+ * same time. The hives must be connected already.
+ */
+BOOL
+LoadRegistryFiles(
+    IN ULONG FileCount,
+    IN PCSTR *FileNames,
+    OUT PREGISTRY_FILE *Files)
+{
+    PVOID *Contexts;
+    BOOL Success = TRUE;
+    ULONG i;
+
+    Contexts = malloc(FileCount * sizeof(PVOID));
+    if (!Contexts)
+        return FALSE;
+
+    for (i = 0; i < FileCount; i++)
+    {
+        Files[i] = calloc(1, sizeof(REGISTRY_FILE));
+        if (!Files[i])
         {
-            RegCloseKey(KeyHandle);
+            free(Contexts);
+            CloseRegistryFiles(i, Files);
             return FALSE;
         }
+        Files[i]->FileName = FileNames[i];
+        Contexts[i] = Files[i];
+    }
+
+    RunInParallel(FileCount, load_job, Contexts);
+    free(Contexts);
 
-        RegCloseKey(KeyHandle);
+    for (i = 0; i < FileCount; i++)
+    {
+        if (!Files[i]->Success)
+            Success = FALSE;
     }
 
-    InfHostFreeContext(Context);
+    if (!Success)
+        CloseRegistryFiles(FileCount, Files);
+    return Success;
+}
 
-    return TRUE;
+VOID
+CloseRegistryFiles(
+    IN ULONG FileCount,
+    IN PREGISTRY_FILE *Files)
+{
+    PREG_LINE_LIST List;
+    ULONG i, j, k;
+
+    for (i = 0; i < FileCount; i++)
+    {
+        if (Files[i] == NULL)
+            continue;
+
+        for (j = 0; j < _countof(Files[i]->List); j++)
+        {
+            List = &Files[i]->List[j];
+            for (k = 0; k < List->Count; k++)
+            {
+                InfHostFreeContext(List->Lines[k].Context);
+                free(List->Lines[k].KeyName);
+            }
+            free(List->Lines);
+        }
+
+        if (Files[i]->hInf != NULL)
+            InfHostCloseFile(Files[i]->hInf);
+        free(Files[i]);
+        Files[i] = NULL;
+    }
 }
 
 
+typedef struct _IMPORT_JOB
+{
+    ULONG List;
+    ULONG FileCount;
+    PREGISTRY_FILE *Files;
+    BOOL Success;
+    PIMPORT_STATS Stats;
+} IMPORT_JOB, *PIMPORT_JOB;
+
+/*
+ * Applies the entries of all the INF files for the keys of one hive, in the
+ * order of the files, so that the result doesn't depend on the other hives.
+ */
+static VOID
+import_job(PVOID Parameter)
+{
+    PIMPORT_JOB Job = (PIMPORT_JOB)Parameter;
+    ULONGLONG Start = GetTimeMicroseconds();
+    PREG_LINE_LIST List;
+    ULONG i, j;
+
+    Job->Success = TRUE;
+    for (i = 0; i < Job->FileCount && Job->Success; i++)
+    {
+        List = &Job->Files[i]->List[Job->List];
+        for (j = 0; j < List->Count; j++)
+        {
+            if (!apply_line(&List->Lines[j]))
+            {
+                DPRINT1("Failed to apply an entry of %s\n", Job->Files[i]->FileName);
+                Job->Success = FALSE;
+                break;
+            }
+        }
+        Job->Stats->LineCount += j;
+    }
+
+    Job->Stats->Time = GetTimeMicroseconds() - Start;
+}
+
+/*
+ * Applies the AddReg and DelReg entries of the INF files. Each hive has its
+ * own cells, so they are all built at the same time. The few keys of the root
+ * hive come last, as the others go through its cells to reach their hives.
+ * HiveStats receives the statistics of each hive, indexed like RegistryHives
+ * (the first entry of a hive listed twice), RootStats those of the root hive.
+ */
 BOOL
-ImportRegistryFile(PCHAR FileName)
+ImportRegistryFiles(
+    IN ULONG FileCount,
+    IN PREGISTRY_FILE *Files,
+    OUT PIMPORT_STATS HiveStats,
+    OUT PIMPORT_STATS RootStats)
 {
-    HINF hInf;
-    ULONG ErrorLine;
+    IMPORT_JOB Jobs[MAX_NUMBER_OF_REGISTRY_HIVES + 1];
+    PVOID Contexts[MAX_NUMBER_OF_REGISTRY_HIVES];
+    ULONG JobCount = 0;
+    BOOL Success = TRUE;
+    ULONG i, j;
 
-    /* Load inf file from install media. */
-    if (InfHostOpenFile(&hInf, FileName, 0, &ErrorLine) != 0)
+    memset(HiveStats, 0, MAX_NUMBER_OF_REGISTRY_HIVES * sizeof(IMPORT_STATS));
+    memset(RootStats, 0, sizeof(IMPORT_STATS));
+
+    /* One job per hive having entries */
+    for (i = 0; i < MAX_NUMBER_OF_REGISTRY_HIVES; i++)
     {
-        DPRINT1("InfHostOpenFile(%s) failed\n", FileName);
-        return FALSE;
+        for (j = 0; j < FileCount; j++)
+        {
+            if (Files[j]->List[i].Count != 0)
+                break;
+        }
+        if (j == FileCount)
+            continue;
+
+        Jobs[JobCount].List = i;
+        Jobs[JobCount].Stats = &HiveStats[i];
+        Contexts[JobCount] = &Jobs[JobCount];
+        JobCount++;
     }
 
-    if (!registry_callback(hInf, (PWCHAR)DelReg, TRUE))
+    Jobs[JobCount].List = ROOT_HIVE_LIST;
+    Jobs[JobCount].Stats = RootStats;
+
+    for (j = 0; j <= JobCount; j++)
     {
-        DPRINT1("registry_callback() for DelReg failed\n");
-        InfHostCloseFile(hInf);
-        return FALSE;
+        Jobs[j].FileCount = FileCount;
+        Jobs[j].Files = Files;
     }
 
-    if (!registry_callback(hInf, (PWCHAR)AddReg, FALSE))
+    RunInParallel(JobCount, import_job, Contexts);
+
+    /* The root hive */
+    import_job(&Jobs[JobCount]);
+
+    for (j = 0; j <= JobCount; j++)
     {
-        DPRINT1("registry_callback() for AddReg failed\n");
-        InfHostCloseFile(hInf);
-        return FALSE;
+        if (!Jobs[j].Success)
+            Success = FALSE;
     }
 
-    InfHostCloseFile(hInf);
-    return TRUE;
+    return Success;
 }
 
 /* EOF */
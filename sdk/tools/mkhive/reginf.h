@@ -26,7 +26,30 @@
 
 #pragma once
 
+typedef struct _REGISTRY_FILE *PREGISTRY_FILE;
+
+typedef struct _IMPORT_STATS
+{
+    ULONG LineCount;    /* Applied AddReg and DelReg entries */
+    ULONGLONG Time;     /* In microseconds */
+} IMPORT_STATS, *PIMPORT_STATS;
+
+BOOL
+LoadRegistryFiles(
+    IN ULONG FileCount,
+    IN PCSTR *FileNames,
+    OUT PREGISTRY_FILE *Files);
+
+VOID
+CloseRegistryFiles(
+    IN ULONG FileCount,
+    IN PREGISTRY_FILE *Files);
+
 BOOL
-ImportRegistryFile(PCHAR Filename);
+ImportRegistryFiles(
+    IN ULONG FileCount,
+    IN PREGISTRY_FILE *Files,
+    OUT PIMPORT_STATS HiveStats,
+    OUT PIMPORT_STATS RootStats);
 
 /* EOF */
@@ -751,7 +751,7 @@ RegSetValueExW(
         if (!DataCell)
             return ERROR_GEN_FAILURE; // STATUS_UNSUCCESSFUL;
 
-        DataCellSize = (ULONG)(-HvGetCellSize(Hive, DataCell));
+        DataCellSize = (ULONG)HvGetCellSize(Hive, DataCell);
     }
     else
     {
@@ -1007,6 +1007,40 @@ Quit:
 }
 
 
+/*
+ * Returns the connected hive that holds the key of the full path KeyName,
+ * or NULL if the key belongs to the root hive. This doesn't touch any hive,
+ * so it can be called while the hives are being modified.
+ */
+PCMHIVE
+RegGetKeyHive(
+    IN PCWSTR KeyName)
+{
+    PCWSTR HivePath;
+    size_t Length;
+    UINT i;
+
+    if (*KeyName == OBJ_NAME_PATH_SEPARATOR)
+        KeyName++;
+
+    for (i = 0; i < _countof(RegistryHives); ++i)
+    {
+        /* Skip the hives that are not connected */
+        if (RegistryHives[i].CmHive->Hive.BaseBlock == NULL)
+            continue;
+
+        HivePath = RegistryHives[i].HiveRegistryPath;
+        Length = strlenW(HivePath);
+        if (strncmpiW(KeyName, HivePath, (int)Length) == 0 &&
+            (KeyName[Length] == 0 || KeyName[Length] == OBJ_NAME_PATH_SEPARATOR))
+        {
+            return RegistryHives[i].CmHive;
+        }
+    }
+
+    return NULL;
+}
+
 static BOOL
 ConnectRegistry(
     IN HKEY RootKey,
@@ -53,4 +53,8 @@ RegInitializeRegistry(
 VOID
 RegShutdownRegistry(VOID);
 
+PCMHIVE
+RegGetKeyHive(
+    IN PCWSTR KeyName);
+
 /* EOF */
@@ -0,0 +1,116 @@
+/*
+ * PROJECT:     ReactOS host tools
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Running independent jobs in parallel, and timing them
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include "parallel.h"
+
+typedef struct _PARALLEL_JOB
+{
+    PARALLEL_ROUTINE Routine;
+    void *Context;
+#ifdef _WIN32
+    HANDLE Thread;
+#else
+    pthread_t Thread;
+#endif
+    int Started;
+} PARALLEL_JOB;
+
+/* FUNCTIONS ****************************************************************/
+
+#ifdef _WIN32
+static DWORD WINAPI
+ParallelJobThread(LPVOID Parameter)
+#else
+static void *
+ParallelJobThread(void *Parameter)
+#endif
+{
+    PARALLEL_JOB *Job = (PARALLEL_JOB *)Parameter;
+
+    Job->Routine(Job->Context);
+    return 0;
+}
+
+void
+RunInParallel(
+    unsigned int Count,
+    PARALLEL_ROUTINE Routine,
+    void **Contexts)
+{
+    PARALLEL_JOB *Jobs;
+    unsigned int i;
+
+    Jobs = (PARALLEL_JOB *)calloc(Count, sizeof(PARALLEL_JOB));
+    if (Jobs == NULL)
+    {
+        /* Just do it serially */
+        for (i = 0; i < Count; i++)
+            Routine(Contexts[i]);
+        return;
+    }
+
+    /* The last job runs in this thread, while the others run in theirs */
+    for (i = 0; i + 1 < Count; i++)
+    {
+        Jobs[i].Routine = Routine;
+        Jobs[i].Context = Contexts[i];
+#ifdef _WIN32
+        Jobs[i].Thread = CreateThread(NULL, 0, ParallelJobThread, &Jobs[i], 0, NULL);
+        Jobs[i].Started = (Jobs[i].Thread != NULL);
+#else
+        Jobs[i].Started = (pthread_create(&Jobs[i].Thread, NULL, ParallelJobThread, &Jobs[i]) == 0);
+#endif
+        if (!Jobs[i].Started)
+            Routine(Contexts[i]);
+    }
+    if (Count > 0)
+        Routine(Contexts[Count - 1]);
+
+    for (i = 0; i + 1 < Count; i++)
+    {
+        if (!Jobs[i].Started)
+            continue;
+#ifdef _WIN32
+        WaitForSingleObject(Jobs[i].Thread, INFINITE);
+        CloseHandle(Jobs[i].Thread);
+#else
+        pthread_join(Jobs[i].Thread, NULL);
+#endif
+    }
+
+    free(Jobs);
+}
+
+unsigned long long
+GetTimeMicroseconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER Counter, Frequency;
+
+    QueryPerformanceCounter(&Counter);
+    QueryPerformanceFrequency(&Frequency);
+    return (unsigned long long)(Counter.QuadPart / Frequency.QuadPart) * 1000000 +
+           (unsigned long long)(Counter.QuadPart % Frequency.QuadPart) * 1000000 / Frequency.QuadPart;
+#else
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return (unsigned long long)Now.tv_sec * 1000000 + Now.tv_nsec / 1000;
+#endif
+}
+
+/* EOF */
@@ -0,0 +1,39 @@
+/*
+ * PROJECT:     ReactOS host tools
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Running independent jobs in parallel, and timing them
+ */
+
+#pragma once
+
+/*
+ * Only plain C types here, the platform headers are included by parallel.c
+ * alone. The C++ tools link this library too, hence the guards.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*PARALLEL_ROUTINE)(void *Context);
+
+/*
+ * Calls Routine once for each of the Count contexts, each call in its own
+ * thread, and returns when all of them are done. A call whose thread could
+ * not be created is made in the calling thread instead.
+ */
+void
+RunInParallel(
+    unsigned int Count,
+    PARALLEL_ROUTINE Routine,
+    void **Contexts);
+
+/* Monotonic clock, in microseconds */
+unsigned long long
+GetTimeMicroseconds(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* EOF */
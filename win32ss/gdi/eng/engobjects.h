@@ -131,6 +131,8 @@ typedef struct _SHARED_FACE {
   PSHARED_MEM   Memory;
   SHARED_FACE_CACHE EnglishUS;
   SHARED_FACE_CACHE UserLanguage;
+  LIST_ENTRY    GlyphCacheListHead; /* Cached glyphs of this face */
+  FT_Long       FaceIndex;          /* Index in the font file, to open Face lazily */
 } SHARED_FACE, *PSHARED_FACE;
 
 typedef struct _FONTGDI {
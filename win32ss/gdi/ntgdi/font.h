@@ -1,6 +1,64 @@
 #pragma once
 
 
+/*
+ * FONT_META_FACE --- what the font list needs to know about a face
+ * until it is opened. It is kept in the font metadata cache file.
+ */
+typedef struct _FONT_META_FACE
+{
+    LONG    FaceIndex;                      /* Index of the face in the file */
+    BYTE    CharSet;
+    BYTE    OriginalItalic;
+    LONG    OriginalWeight;
+    LONG    tmHeight;                       /* FONTGDI metrics of the default size */
+    LONG    tmAscent;
+    LONG    tmDescent;
+    LONG    tmInternalLeading;
+    LONG    EmHeight;
+    BYTE    tmPitchAndFamily;               /* Text metrics that don't depend on the size */
+    BYTE    tmItalic;
+    LONG    tmWeight;
+    WCHAR   FaceName[LF_FULLFACESIZE];      /* FONT_ENTRY names */
+    WCHAR   StyleName[LF_FULLFACESIZE];
+    WCHAR   FamilyName[LF_FULLFACESIZE];    /* Localized names of the outline text metrics */
+    WCHAR   FullName[LF_FULLFACESIZE];
+} FONT_META_FACE, *PFONT_META_FACE;
+
+/* Keeps the FONT_META_FILE records that follow aligned */
+C_ASSERT(sizeof(FONT_META_FACE) % sizeof(LARGE_INTEGER) == 0);
+
+/*
+ * FONT_META_FILE --- a font file in the font metadata cache, followed by
+ * the FONT_META_FACE of each font entry it adds, in the font list order
+ */
+typedef struct _FONT_META_FILE
+{
+    WCHAR           PathName[MAX_PATH];
+    LARGE_INTEGER   FileSize;
+    LARGE_INTEGER   LastWriteTime;
+    ULONG           FaceCount;
+    WCHAR           RegValueName[MAX_PATH]; /* Name of the value in the Fonts key */
+} FONT_META_FILE, *PFONT_META_FILE;
+
+typedef struct _FONT_META_HEADER
+{
+    ULONG   Magic;
+    ULONG   LanguageID;                     /* Of the localized names */
+    ULONG   DataSize;                       /* Bytes of FONT_META_FILE records */
+    ULONG   Checksum;                       /* Of the records */
+} FONT_META_HEADER, *PFONT_META_HEADER;
+
+#define FONT_META_MAGIC     0x31434D46      /* "FMC1" */
+
+typedef struct _FONT_META_CACHE
+{
+    PBYTE   Buffer;                         /* Header, then the records */
+    ULONG   Size;                           /* Bytes used */
+    ULONG   MaxSize;                        /* Bytes allocated */
+    ULONG   Cursor;                         /* Where to look for the next file */
+} FONT_META_CACHE, *PFONT_META_CACHE;
+
 typedef struct _FONT_ENTRY
 {
     LIST_ENTRY ListEntry;
@@ -8,6 +66,7 @@ typedef struct _FONT_ENTRY
     UNICODE_STRING FaceName;
     UNICODE_STRING StyleName;
     BYTE NotEnum;
+    PFONT_META_FACE Meta;   /* If the entry was added from the font metadata cache */
 } FONT_ENTRY, *PFONT_ENTRY;
 
 typedef struct _FONT_ENTRY_MEM
@@ -25,7 +84,11 @@ typedef struct _FONT_ENTRY_COLL_MEM
 
 typedef struct _FONT_CACHE_ENTRY
 {
-    LIST_ENTRY ListEntry;
+    LIST_ENTRY ListEntry;       /* In the LRU list, most recently used first */
+    LIST_ENTRY HashEntry;       /* In the hash bucket of the entry */
+    LIST_ENTRY FaceEntry;       /* In the list of the cached glyphs of the face */
+    ULONG Hash;
+    SIZE_T Size;                /* Bytes charged to the cache */
     int GlyphIndex;
     FT_Face Face;
     FT_BitmapGlyph BitmapGlyph;
@@ -36,6 +99,15 @@ typedef struct _FONT_CACHE_ENTRY
     MATRIX mxWorldToDevice;
 } FONT_CACHE_ENTRY, *PFONT_CACHE_ENTRY;
 
+typedef struct _FONT_CACHE_STATS
+{
+    ULONGLONG Hits;
+    ULONGLONG Misses;
+    ULONGLONG Evictions;        /* Entries dropped to stay within the byte budget */
+    ULONG Entries;
+    SIZE_T Bytes;
+} FONT_CACHE_STATS, *PFONT_CACHE_STATS;
+
 
 /*
  * FONTSUBST_... --- constants for font substitutes
@@ -88,10 +88,29 @@ static BOOL             g_RenderingEnabled = TRUE;
 #define ASSERT_FREETYPE_LOCK_NOT_HELD() \
     ASSERT(g_FreeTypeLock->Owner != KeGetCurrentThread())
 
-#define MAX_FONT_CACHE 256
+/* The glyph cache is hashed for lookups, and holds up to
+   FONT_CACHE_MAX_BYTES of glyphs in its LRU list */
+#define FONT_CACHE_HASH_BITS    10
+#define FONT_CACHE_HASH_SIZE    (1 << FONT_CACHE_HASH_BITS)
+#define FONT_CACHE_MAX_BYTES    (2 * 1024 * 1024)
 
 static LIST_ENTRY g_FontCacheListHead;
-static UINT g_FontCacheNumEntries;
+static LIST_ENTRY g_FontCacheHashTable[FONT_CACHE_HASH_SIZE];
+static FONT_CACHE_STATS g_FontCacheStats;
+
+/* The font metadata cache, read and rebuilt while the startup fonts are added */
+#define FONT_META_MAX_SIZE      (16 * 1024 * 1024)
+
+static UNICODE_STRING g_FontMetaCachePath =
+    RTL_CONSTANT_STRING(L"\\SystemRoot\\System32\\FNTCACHE.DAT");
+static FONT_META_CACHE g_FontMetaCacheOld;
+static FONT_META_CACHE g_FontMetaCacheNew;
+static BOOL g_FontMetaCacheActive = FALSE;
+
+static VOID
+IntOpenFontMetaCache(VOID);
+static VOID
+IntCloseFontMetaCache(VOID);
 
 static PWCHAR g_ElfScripts[32] =   /* These are in the order of the fsCsb[0] bits */
 {
@@ -222,9 +241,16 @@ SharedFace_Create(FT_Face Face, PSHARED_MEM Memory)
         Ptr->Memory = Memory;
         SharedFaceCache_Init(&Ptr->EnglishUS);
         SharedFaceCache_Init(&Ptr->UserLanguage);
+        InitializeListHead(&Ptr->GlyphCacheListHead);
+        Ptr->FaceIndex = 0;
 
-        SharedMem_AddRef(Memory);
-        DPRINT("Creating SharedFace for %s\n", Face->family_name ? Face->family_name : "<NULL>");
+        /* The face of a font added from the metadata cache is opened later */
+        if (Face)
+        {
+            Ptr->FaceIndex = Face->face_index;
+            SharedMem_AddRef(Memory);
+        }
+        DPRINT("Creating SharedFace for %s\n", (Face && Face->family_name) ? Face->family_name : "<NULL>");
     }
     return Ptr;
 }
@@ -260,30 +286,28 @@ RemoveCachedEntry(PFONT_CACHE_ENTRY Entry)
 
     FT_Done_Glyph((FT_Glyph)Entry->BitmapGlyph);
     RemoveEntryList(&Entry->ListEntry);
+    RemoveEntryList(&Entry->HashEntry);
+    RemoveEntryList(&Entry->FaceEntry);
+    ASSERT(g_FontCacheStats.Entries > 0);
+    ASSERT(g_FontCacheStats.Bytes >= Entry->Size);
+    g_FontCacheStats.Entries--;
+    g_FontCacheStats.Bytes -= Entry->Size;
     ExFreePoolWithTag(Entry, TAG_FONT);
-    g_FontCacheNumEntries--;
-    ASSERT(g_FontCacheNumEntries <= MAX_FONT_CACHE);
 }
 
 static void
-RemoveCacheEntries(FT_Face Face)
+RemoveCacheEntries(PSHARED_FACE SharedFace)
 {
-    PLIST_ENTRY CurrentEntry, NextEntry;
+    PLIST_ENTRY CurrentEntry;
     PFONT_CACHE_ENTRY FontEntry;
 
     ASSERT_FREETYPE_LOCK_HELD();
 
-    for (CurrentEntry = g_FontCacheListHead.Flink;
-         CurrentEntry != &g_FontCacheListHead;
-         CurrentEntry = NextEntry)
+    while (!IsListEmpty(&SharedFace->GlyphCacheListHead))
     {
-        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, ListEntry);
-        NextEntry = CurrentEntry->Flink;
-
-        if (FontEntry->Face == Face)
-        {
-            RemoveCachedEntry(FontEntry);
-        }
+        CurrentEntry = SharedFace->GlyphCacheListHead.Flink;
+        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, FaceEntry);
+        RemoveCachedEntry(FontEntry);
     }
 }
 
@@ -326,10 +350,14 @@ SharedFace_Release(PSHARED_FACE Ptr)
     --Ptr->RefCount;
     if (Ptr->RefCount == 0)
     {
-        DPRINT("Releasing SharedFace for %s\n", Ptr->Face->family_name ? Ptr->Face->family_name : "<NULL>");
-        RemoveCacheEntries(Ptr->Face);
-        FT_Done_Face(Ptr->Face);
-        SharedMem_Release(Ptr->Memory);
+        DPRINT("Releasing SharedFace for %s\n",
+               (Ptr->Face && Ptr->Face->family_name) ? Ptr->Face->family_name : "<NULL>");
+        RemoveCacheEntries(Ptr);
+        if (Ptr->Face)
+        {
+            FT_Done_Face(Ptr->Face);
+            SharedMem_Release(Ptr->Memory);
+        }
         SharedFaceCache_Release(&Ptr->EnglishUS);
         SharedFaceCache_Release(&Ptr->UserLanguage);
         ExFreePoolWithTag(Ptr, TAG_FONT);
@@ -353,6 +381,9 @@ CleanupFontEntryEx(PFONT_ENTRY FontEntry, PFONTGDI FontGDI)
     if (FontEntry->FaceName.Buffer)
         RtlFreeUnicodeString(&FontEntry->FaceName);
 
+    if (FontEntry->Meta)
+        ExFreePoolWithTag(FontEntry->Meta, TAG_FONT);
+
     EngFreeMem(FontGDI);
     SharedFace_Release(SharedFace);
     ExFreePoolWithTag(FontEntry, TAG_FONT);
@@ -500,9 +531,27 @@ VOID DumpFontInfo(BOOL bDoLock)
     DumpGlobalFontList(bDoLock);
     DumpPrivateFontList(bDoLock);
     DumpFontSubstList();
+    ftGdiDumpGlyphCacheStats();
 }
 #endif
 
+/*
+ * Prints the glyph cache counters. It doesn't take the FreeType lock,
+ * so that the kernel debugger can call it too.
+ */
+VOID FASTCALL
+ftGdiDumpGlyphCacheStats(VOID)
+{
+    ULONGLONG Lookups = g_FontCacheStats.Hits + g_FontCacheStats.Misses;
+
+    DbgPrint("Glyph cache: %I64u hits, %I64u misses (%I64u%% hits), %I64u evictions\n",
+             g_FontCacheStats.Hits, g_FontCacheStats.Misses,
+             Lookups ? g_FontCacheStats.Hits * 100 / Lookups : 0,
+             g_FontCacheStats.Evictions);
+    DbgPrint("Glyph cache: %lu entries, %Iu of %lu bytes\n",
+             g_FontCacheStats.Entries, g_FontCacheStats.Bytes, (ULONG)FONT_CACHE_MAX_BYTES);
+}
+
 /*
  * IntLoadFontSubstList --- loads the list of font substitutes
  */
@@ -660,10 +709,13 @@ BOOL FASTCALL
 InitFontSupport(VOID)
 {
     ULONG ulError;
+    ULONG i;
 
     InitializeListHead(&g_FontListHead);
     InitializeListHead(&g_FontCacheListHead);
-    g_FontCacheNumEntries = 0;
+    for (i = 0; i < FONT_CACHE_HASH_SIZE; i++)
+        InitializeListHead(&g_FontCacheHashTable[i]);
+    RtlZeroMemory(&g_FontCacheStats, sizeof(g_FontCacheStats));
     /* Fast Mutexes must be allocated from non paged pool */
     g_FontListLock = ExAllocatePoolWithTag(NonPagedPool, sizeof(FAST_MUTEX), TAG_INTERNAL_SYNC);
     if (g_FontListLock == NULL)
@@ -686,6 +738,7 @@ InitFontSupport(VOID)
         return FALSE;
     }
 
+    IntOpenFontMetaCache();
     if (!IntLoadFontsInRegistry())
     {
         DPRINT1("Fonts registry is empty.\n");
@@ -693,6 +746,7 @@ InitFontSupport(VOID)
         /* Load font(s) with writing registry */
         IntLoadSystemFonts();
     }
+    IntCloseFontMetaCache();
 
     IntLoadFontSubstList(&g_FontSubstListHead);
 
@@ -934,6 +988,9 @@ SubstituteFontRecurse(LOGFONTW* pLogFont)
     return TRUE;    /* success */
 }
 
+static INT FASTCALL
+IntGdiAddStartupFontResource(PUNICODE_STRING FileName, DWORD dwFlags);
+
 /*
  * IntLoadSystemFonts
  *
@@ -1027,7 +1084,7 @@ IntLoadSystemFonts(VOID)
                         TempString.MaximumLength = DirInfo->FileNameLength;
                     RtlCopyUnicodeString(&FileName, &Directory);
                     RtlAppendUnicodeStringToString(&FileName, &TempString);
-                    IntGdiAddFontResourceEx(&FileName, 0, AFRX_WRITE_REGISTRY);
+                    IntGdiAddStartupFontResource(&FileName, AFRX_WRITE_REGISTRY);
                     if (DirInfo->NextEntryOffset == 0)
                         break;
                     DirInfo = (PFILE_DIRECTORY_INFORMATION)((ULONG_PTR)DirInfo + DirInfo->NextEntryOffset);
@@ -1145,6 +1202,7 @@ IntGdiLoadFontsFromMemory(PGDI_LOAD_FONT pLoadFont,
         EngSetLastError(ERROR_NOT_ENOUGH_MEMORY);
         return 0;   /* failure */
     }
+    Entry->Meta = NULL;
 
     /* allocate a FONTGDI */
     FontGDI = EngAllocMem(FL_ZERO_MEMORY, sizeof(FONTGDI), GDITAG_RFONT);
@@ -1446,54 +1504,44 @@ NameFromCharSet(BYTE CharSet)
     }
 }
 
-/*
- * IntGdiAddFontResource
- *
- * Adds the font resource from the specified file to the system.
- */
-
-INT FASTCALL
-IntGdiAddFontResourceEx(PUNICODE_STRING FileName, DWORD Characteristics,
-                        DWORD dwFlags)
+/* Makes the path of a font file to open, from the name given to IntGdiAddFontResourceEx */
+static NTSTATUS
+IntGetFontPathName(PUNICODE_STRING FileName, DWORD dwFlags, PUNICODE_STRING PathName)
 {
-    NTSTATUS Status;
-    HANDLE FileHandle;
-    PVOID Buffer = NULL;
-    IO_STATUS_BLOCK Iosb;
-    PVOID SectionObject;
-    SIZE_T ViewSize = 0, Length;
-    LARGE_INTEGER SectionSize;
-    OBJECT_ATTRIBUTES ObjectAttributes;
-    GDI_LOAD_FONT LoadFont;
-    INT FontCount;
-    HANDLE KeyHandle;
-    UNICODE_STRING PathName;
+    SIZE_T Length;
     LPWSTR pszBuffer;
-    PFILE_OBJECT FileObject;
-    static const UNICODE_STRING TrueTypePostfix = RTL_CONSTANT_STRING(L" (TrueType)");
     static const UNICODE_STRING DosPathPrefix = RTL_CONSTANT_STRING(L"\\??\\");
 
-    /* Build PathName */
     if (dwFlags & AFRX_DOS_DEVICE_PATH)
     {
         Length = DosPathPrefix.Length + FileName->Length + sizeof(UNICODE_NULL);
         pszBuffer = ExAllocatePoolWithTag(PagedPool, Length, TAG_USTR);
         if (!pszBuffer)
-            return 0;   /* failure */
+            return STATUS_NO_MEMORY;
 
-        RtlInitEmptyUnicodeString(&PathName, pszBuffer, Length);
-        RtlAppendUnicodeStringToString(&PathName, &DosPathPrefix);
-        RtlAppendUnicodeStringToString(&PathName, FileName);
-    }
-    else
-    {
-        Status = DuplicateUnicodeString(FileName, &PathName);
-        if (!NT_SUCCESS(Status))
-            return 0;   /* failure */
+        RtlInitEmptyUnicodeString(PathName, pszBuffer, Length);
+        RtlAppendUnicodeStringToString(PathName, &DosPathPrefix);
+        RtlAppendUnicodeStringToString(PathName, FileName);
+        return STATUS_SUCCESS;
     }
 
+    return DuplicateUnicodeString(FileName, PathName);
+}
+
+/* Maps a whole font file in system space */
+static NTSTATUS
+IntMapFontFile(PUNICODE_STRING PathName, PVOID *Buffer, PSIZE_T ViewSize)
+{
+    NTSTATUS Status;
+    HANDLE FileHandle;
+    IO_STATUS_BLOCK Iosb;
+    PVOID SectionObject;
+    LARGE_INTEGER SectionSize;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    PFILE_OBJECT FileObject;
+
     /* Open the font file */
-    InitializeObjectAttributes(&ObjectAttributes, &PathName,
+    InitializeObjectAttributes(&ObjectAttributes, PathName,
                                OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
     Status = ZwOpenFile(
                  &FileHandle,
@@ -1504,9 +1552,8 @@ IntGdiAddFontResourceEx(PUNICODE_STRING FileName, DWORD Characteristics,
                  FILE_SYNCHRONOUS_IO_NONALERT);
     if (!NT_SUCCESS(Status))
     {
-        DPRINT1("Could not load font file: %wZ\n", &PathName);
-        RtlFreeUnicodeString(&PathName);
-        return 0;
+        DPRINT1("Could not load font file: %wZ\n", PathName);
+        return Status;
     }
 
     Status = ObReferenceObjectByHandle(FileHandle, FILE_READ_DATA, NULL,
@@ -1515,8 +1562,7 @@ IntGdiAddFontResourceEx(PUNICODE_STRING FileName, DWORD Characteristics,
     {
         DPRINT1("ObReferenceObjectByHandle failed.\n");
         ZwClose(FileHandle);
-        RtlFreeUnicodeString(&PathName);
-        return 0;
+        return Status;
     }
 
     SectionSize.QuadPart = 0LL;
@@ -1526,20 +1572,94 @@ IntGdiAddFontResourceEx(PUNICODE_STRING FileName, DWORD Characteristics,
                              SEC_COMMIT, FileHandle, FileObject);
     if (!NT_SUCCESS(Status))
     {
-        DPRINT1("Could not map file: %wZ\n", &PathName);
+        DPRINT1("Could not map file: %wZ\n", PathName);
         ZwClose(FileHandle);
         ObDereferenceObject(FileObject);
-        RtlFreeUnicodeString(&PathName);
-        return 0;
+        return Status;
     }
     ZwClose(FileHandle);
 
-    Status = MmMapViewInSystemSpace(SectionObject, &Buffer, &ViewSize);
+    *Buffer = NULL;
+    *ViewSize = 0;
+    Status = MmMapViewInSystemSpace(SectionObject, Buffer, ViewSize);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Could not map file: %wZ\n", PathName);
+    }
+
+    /* The view keeps the section */
+    ObDereferenceObject(SectionObject);
+    ObDereferenceObject(FileObject);
+    return Status;
+}
+
+/* Saves a loaded font name into the registry */
+static VOID
+IntWriteFontRegistryValue(PUNICODE_STRING ValueName, PUNICODE_STRING PathName, DWORD dwFlags)
+{
+    NTSTATUS Status;
+    HANDLE KeyHandle;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    SIZE_T DataSize;
+    LPWSTR pFileName;
+
+    InitializeObjectAttributes(&ObjectAttributes, &g_FontRegPath,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                               NULL, NULL);
+    Status = ZwOpenKey(&KeyHandle, KEY_WRITE, &ObjectAttributes);
+    if (NT_SUCCESS(Status))
+    {
+        if (dwFlags & AFRX_ALTERNATIVE_PATH)
+        {
+            pFileName = PathName->Buffer;
+        }
+        else
+        {
+            pFileName = wcsrchr(PathName->Buffer, L'\\');
+        }
+
+        if (pFileName)
+        {
+            if (!(dwFlags & AFRX_ALTERNATIVE_PATH))
+            {
+                pFileName++;
+            }
+            DataSize = (wcslen(pFileName) + 1) * sizeof(WCHAR);
+            ZwSetValueKey(KeyHandle, ValueName, 0, REG_SZ,
+                          pFileName, DataSize);
+        }
+        ZwClose(KeyHandle);
+    }
+}
+
+/*
+ * IntGdiAddFontResource
+ *
+ * Adds the font resource from the specified file to the system.
+ * If RegValueName is given, it receives the name of the registry value
+ * of the fonts, even if it is not written.
+ */
+
+static INT FASTCALL
+IntGdiAddFontResourceWorker(PUNICODE_STRING FileName, DWORD Characteristics,
+                            DWORD dwFlags, PUNICODE_STRING RegValueName)
+{
+    NTSTATUS Status;
+    PVOID Buffer = NULL;
+    SIZE_T ViewSize = 0;
+    GDI_LOAD_FONT LoadFont;
+    INT FontCount;
+    UNICODE_STRING PathName;
+    static const UNICODE_STRING TrueTypePostfix = RTL_CONSTANT_STRING(L" (TrueType)");
+
+    /* Build PathName */
+    Status = IntGetFontPathName(FileName, dwFlags, &PathName);
+    if (!NT_SUCCESS(Status))
+        return 0;   /* failure */
+
+    Status = IntMapFontFile(&PathName, &Buffer, &ViewSize);
     if (!NT_SUCCESS(Status))
     {
-        DPRINT1("Could not map file: %wZ\n", &PathName);
-        ObDereferenceObject(SectionObject);
-        ObDereferenceObject(FileObject);
         RtlFreeUnicodeString(&PathName);
         return 0;
     }
@@ -1558,12 +1678,8 @@ IntGdiAddFontResourceEx(PUNICODE_STRING FileName, DWORD Characteristics,
     SharedMem_Release(LoadFont.Memory);
     IntUnLockFreeType();
 
-    ObDereferenceObject(SectionObject);
-
-    ObDereferenceObject(FileObject);
-
     /* Save the loaded font name into the registry */
-    if (FontCount > 0 && (dwFlags & AFRX_WRITE_REGISTRY))
+    if (FontCount > 0)
     {
         UNICODE_STRING NewString;
         SIZE_T Length;
@@ -1614,47 +1730,633 @@ IntGdiAddFontResourceEx(PUNICODE_STRING FileName, DWORD Characteristics,
             }
         }
 
-        InitializeObjectAttributes(&ObjectAttributes, &g_FontRegPath,
-                                   OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
-                                   NULL, NULL);
-        Status = ZwOpenKey(&KeyHandle, KEY_WRITE, &ObjectAttributes);
-        if (NT_SUCCESS(Status))
+        if (dwFlags & AFRX_WRITE_REGISTRY)
+            IntWriteFontRegistryValue(&LoadFont.RegValueName, &PathName, dwFlags);
+    }
+
+    if (RegValueName)
+        *RegValueName = LoadFont.RegValueName;
+    else
+        RtlFreeUnicodeString(&LoadFont.RegValueName);
+
+    RtlFreeUnicodeString(&PathName);
+    return FontCount;
+}
+
+INT FASTCALL
+IntGdiAddFontResourceEx(PUNICODE_STRING FileName, DWORD Characteristics,
+                        DWORD dwFlags)
+{
+    return IntGdiAddFontResourceWorker(FileName, Characteristics, dwFlags, NULL);
+}
+
+INT FASTCALL
+IntGdiAddFontResource(PUNICODE_STRING FileName, DWORD Characteristics)
+{
+    return IntGdiAddFontResourceEx(FileName, Characteristics, 0);
+}
+
+/* Checksum of the records of a font metadata cache */
+static ULONG
+IntFontMetaChecksum(const BYTE *Data, ULONG Size)
+{
+    ULONG Checksum = 0, i;
+
+    for (i = 0; i < Size; ++i)
+        Checksum = ((Checksum << 5) | (Checksum >> 27)) ^ Data[i];
+
+    return Checksum;
+}
+
+/* Appends Size zeroed bytes to a font metadata cache being built */
+static PVOID
+IntReserveFontMeta(PFONT_META_CACHE Cache, ULONG Size)
+{
+    PBYTE NewBuffer;
+    ULONG NewSize;
+
+    if (Cache->Size + Size > Cache->MaxSize)
+    {
+        NewSize = max(max(Cache->MaxSize * 2, Cache->Size + Size), 64 * 1024);
+        if (NewSize > FONT_META_MAX_SIZE)
+            return NULL;
+
+        NewBuffer = ExAllocatePoolWithTag(PagedPool, NewSize, TAG_FONT);
+        if (!NewBuffer)
+            return NULL;
+
+        if (Cache->Buffer)
         {
-            SIZE_T DataSize;
-            LPWSTR pFileName;
+            RtlCopyMemory(NewBuffer, Cache->Buffer, Cache->Size);
+            ExFreePoolWithTag(Cache->Buffer, TAG_FONT);
+        }
+        Cache->Buffer = NewBuffer;
+        Cache->MaxSize = NewSize;
+    }
+
+    RtlZeroMemory(Cache->Buffer + Cache->Size, Size);
+    Cache->Size += Size;
+    return Cache->Buffer + Cache->Size - Size;
+}
+
+/* Copies a name into a font metadata cache record, FALSE if it doesn't fit */
+static BOOL
+IntCopyFontMetaName(PWSTR Buffer, SIZE_T BufferSize, PCUNICODE_STRING Name)
+{
+    if (Name->Length >= BufferSize)
+        return FALSE;
+
+    RtlCopyMemory(Buffer, Name->Buffer, Name->Length);
+    Buffer[Name->Length / sizeof(WCHAR)] = UNICODE_NULL;
+    return TRUE;
+}
+
+/* Checks a font metadata cache read from disk, so that its records can be walked */
+static BOOL
+IntCheckFontMetaCache(PFONT_META_CACHE Cache)
+{
+    PFONT_META_HEADER Header = (PFONT_META_HEADER)Cache->Buffer;
+    PFONT_META_FILE MetaFile;
+    PFONT_META_FACE Meta;
+    ULONG Offset, i;
+
+    if (Header->Magic != FONT_META_MAGIC ||
+        Header->LanguageID != gusLanguageID ||
+        Header->DataSize != Cache->Size - sizeof(FONT_META_HEADER) ||
+        Header->Checksum != IntFontMetaChecksum(Cache->Buffer + sizeof(FONT_META_HEADER),
+                                                Header->DataSize))
+    {
+        return FALSE;
+    }
+
+    Offset = sizeof(FONT_META_HEADER);
+    while (Offset < Cache->Size)
+    {
+        if (Cache->Size - Offset < sizeof(FONT_META_FILE))
+            return FALSE;
+
+        MetaFile = (PFONT_META_FILE)(Cache->Buffer + Offset);
+        Offset += sizeof(FONT_META_FILE);
+        if (MetaFile->FaceCount == 0 ||
+            MetaFile->FaceCount > (Cache->Size - Offset) / sizeof(FONT_META_FACE))
+        {
+            return FALSE;
+        }
+        Offset += MetaFile->FaceCount * sizeof(FONT_META_FACE);
 
-            if (dwFlags & AFRX_ALTERNATIVE_PATH)
+        /* Don't trust the names to be terminated */
+        MetaFile->PathName[_countof(MetaFile->PathName) - 1] = UNICODE_NULL;
+        MetaFile->RegValueName[_countof(MetaFile->RegValueName) - 1] = UNICODE_NULL;
+        Meta = (PFONT_META_FACE)(MetaFile + 1);
+        for (i = 0; i < MetaFile->FaceCount; ++i, ++Meta)
+        {
+            Meta->FaceName[_countof(Meta->FaceName) - 1] = UNICODE_NULL;
+            Meta->StyleName[_countof(Meta->StyleName) - 1] = UNICODE_NULL;
+            Meta->FamilyName[_countof(Meta->FamilyName) - 1] = UNICODE_NULL;
+            Meta->FullName[_countof(Meta->FullName) - 1] = UNICODE_NULL;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Reads the font metadata cache, and starts a new one. The new cache gets
+ * the files added until IntCloseFontMetaCache, cached or not, so that the
+ * files that went away leave it.
+ */
+static VOID
+IntOpenFontMetaCache(VOID)
+{
+    NTSTATUS Status;
+    HANDLE FileHandle;
+    IO_STATUS_BLOCK Iosb;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    FILE_STANDARD_INFORMATION FileInfo;
+    PFONT_META_CACHE Cache = &g_FontMetaCacheOld;
+
+    RtlZeroMemory(&g_FontMetaCacheOld, sizeof(g_FontMetaCacheOld));
+    RtlZeroMemory(&g_FontMetaCacheNew, sizeof(g_FontMetaCacheNew));
+    Cache->Cursor = sizeof(FONT_META_HEADER);
+
+    if (!IntReserveFontMeta(&g_FontMetaCacheNew, sizeof(FONT_META_HEADER)))
+        return;
+    g_FontMetaCacheActive = TRUE;
+
+    InitializeObjectAttributes(&ObjectAttributes, &g_FontMetaCachePath,
+                               OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, NULL, NULL);
+    Status = ZwOpenFile(&FileHandle,
+                        FILE_GENERIC_READ | SYNCHRONIZE,
+                        &ObjectAttributes,
+                        &Iosb,
+                        FILE_SHARE_READ,
+                        FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT("No font metadata cache (Status 0x%lx)\n", Status);
+        return;
+    }
+
+    Status = ZwQueryInformationFile(FileHandle, &Iosb, &FileInfo, sizeof(FileInfo),
+                                    FileStandardInformation);
+    if (NT_SUCCESS(Status) &&
+        FileInfo.EndOfFile.QuadPart >= sizeof(FONT_META_HEADER) &&
+        FileInfo.EndOfFile.QuadPart <= FONT_META_MAX_SIZE)
+    {
+        Cache->Buffer = ExAllocatePoolWithTag(PagedPool, FileInfo.EndOfFile.LowPart, TAG_FONT);
+        if (Cache->Buffer)
+        {
+            Cache->Size = Cache->MaxSize = FileInfo.EndOfFile.LowPart;
+            Status = ZwReadFile(FileHandle, NULL, NULL, NULL, &Iosb,
+                                Cache->Buffer, Cache->Size, NULL, NULL);
+            if (!NT_SUCCESS(Status) || Iosb.Information != Cache->Size ||
+                !IntCheckFontMetaCache(Cache))
             {
-                pFileName = PathName.Buffer;
+                DPRINT1("Ignoring the font metadata cache\n");
+                ExFreePoolWithTag(Cache->Buffer, TAG_FONT);
+                Cache->Buffer = NULL;
+                Cache->Size = Cache->MaxSize = 0;
             }
-            else
+        }
+    }
+    ZwClose(FileHandle);
+}
+
+/* Writes the new font metadata cache if it differs from the old one, frees both */
+static VOID
+IntCloseFontMetaCache(VOID)
+{
+    NTSTATUS Status;
+    HANDLE FileHandle;
+    IO_STATUS_BLOCK Iosb;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    PFONT_META_CACHE Cache = &g_FontMetaCacheNew;
+    PFONT_META_HEADER Header;
+
+    if (!g_FontMetaCacheActive)
+        return;
+    g_FontMetaCacheActive = FALSE;
+
+    Header = (PFONT_META_HEADER)Cache->Buffer;
+    Header->Magic = FONT_META_MAGIC;
+    Header->LanguageID = gusLanguageID;
+    Header->DataSize = Cache->Size - sizeof(FONT_META_HEADER);
+    Header->Checksum = IntFontMetaChecksum(Cache->Buffer + sizeof(FONT_META_HEADER),
+                                           Header->DataSize);
+
+    if (Cache->Size != g_FontMetaCacheOld.Size ||
+        RtlCompareMemory(Cache->Buffer, g_FontMetaCacheOld.Buffer, Cache->Size) != Cache->Size)
+    {
+        InitializeObjectAttributes(&ObjectAttributes, &g_FontMetaCachePath,
+                                   OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE, NULL, NULL);
+        Status = ZwCreateFile(&FileHandle,
+                              FILE_GENERIC_WRITE | SYNCHRONIZE,
+                              &ObjectAttributes,
+                              &Iosb,
+                              NULL,
+                              FILE_ATTRIBUTE_NORMAL,
+                              0,
+                              FILE_OVERWRITE_IF,
+                              FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE,
+                              NULL,
+                              0);
+        if (NT_SUCCESS(Status))
+        {
+            Status = ZwWriteFile(FileHandle, NULL, NULL, NULL, &Iosb,
+                                 Cache->Buffer, Cache->Size, NULL, NULL);
+            ZwClose(FileHandle);
+        }
+
+        /* The system drive may be read-only, e.g. on the LiveCD */
+        if (!NT_SUCCESS(Status))
+            DPRINT("Could not write the font metadata cache (Status 0x%lx)\n", Status);
+    }
+
+    ExFreePoolWithTag(Cache->Buffer, TAG_FONT);
+    if (g_FontMetaCacheOld.Buffer)
+        ExFreePoolWithTag(g_FontMetaCacheOld.Buffer, TAG_FONT);
+    RtlZeroMemory(&g_FontMetaCacheOld, sizeof(g_FontMetaCacheOld));
+    RtlZeroMemory(&g_FontMetaCacheNew, sizeof(g_FontMetaCacheNew));
+}
+
+/* Finds the record of a font file, if the file didn't change since it was cached */
+static PFONT_META_FILE
+IntFindFontMetaFile(PFONT_META_CACHE Cache, PUNICODE_STRING PathName,
+                    PFILE_NETWORK_OPEN_INFORMATION FileInfo)
+{
+    PFONT_META_FILE MetaFile;
+    UNICODE_STRING CachedName;
+    ULONG Offset, Start;
+
+    if (Cache->Size <= sizeof(FONT_META_HEADER))
+        return NULL;
+
+    /* The files usually come in the order they were cached, go on from the last one */
+    Start = Offset = Cache->Cursor;
+    do
+    {
+        MetaFile = (PFONT_META_FILE)(Cache->Buffer + Offset);
+        Offset += sizeof(FONT_META_FILE) + MetaFile->FaceCount * sizeof(FONT_META_FACE);
+        if (Offset >= Cache->Size)
+            Offset = sizeof(FONT_META_HEADER);
+
+        RtlInitUnicodeString(&CachedName, MetaFile->PathName);
+        if (RtlEqualUnicodeString(&CachedName, PathName, TRUE))
+        {
+            Cache->Cursor = Offset;
+            if (MetaFile->FileSize.QuadPart != FileInfo->EndOfFile.QuadPart ||
+                MetaFile->LastWriteTime.QuadPart != FileInfo->LastWriteTime.QuadPart)
             {
-                pFileName = wcsrchr(PathName.Buffer, L'\\');
+                DPRINT("Font file changed: %wZ\n", PathName);
+                return NULL;
             }
+            return MetaFile;
+        }
+    } while (Offset != Start);
+
+    return NULL;
+}
+
+/*
+ * Adds the record of a font file to the new font metadata cache, from the
+ * font entries that follow LastEntry in the global list.
+ */
+static VOID
+IntRecordFontMetaFile(PUNICODE_STRING PathName, PFILE_NETWORK_OPEN_INFORMATION FileInfo,
+                      PLIST_ENTRY LastEntry, PUNICODE_STRING RegValueName)
+{
+    PFONT_META_CACHE Cache = &g_FontMetaCacheNew;
+    PFONT_META_FILE MetaFile;
+    PFONT_META_FACE Meta;
+    PLIST_ENTRY ListEntry;
+    PFONT_ENTRY Entry;
+    PFONTGDI FontGDI;
+    OUTLINETEXTMETRICW *Otm = NULL;
+    UINT OtmSize, OldOtmSize = 0;
+    UNICODE_STRING FamilyName, FullName;
+    ULONG Offset = Cache->Size, FaceCount = 0;
+    BOOL Success;
+
+    MetaFile = IntReserveFontMeta(Cache, sizeof(FONT_META_FILE));
+    if (!MetaFile)
+        return;
+
+    MetaFile->FileSize = FileInfo->EndOfFile;
+    MetaFile->LastWriteTime = FileInfo->LastWriteTime;
+    if (!IntCopyFontMetaName(MetaFile->PathName, sizeof(MetaFile->PathName), PathName) ||
+        !IntCopyFontMetaName(MetaFile->RegValueName, sizeof(MetaFile->RegValueName), RegValueName))
+    {
+        Cache->Size = Offset;
+        return;
+    }
+
+    IntLockGlobalFonts();
+    for (ListEntry = LastEntry->Flink; ListEntry != &g_FontListHead; ListEntry = ListEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, FONT_ENTRY, ListEntry);
+        FontGDI = Entry->Font;
+
+        OtmSize = IntGetOutlineTextMetrics(FontGDI, 0, NULL);
+        if (OtmSize > OldOtmSize)
+        {
+            if (Otm)
+                ExFreePoolWithTag(Otm, GDITAG_TEXT);
+            Otm = ExAllocatePoolWithTag(PagedPool, OtmSize, GDITAG_TEXT);
+            OldOtmSize = (Otm ? OtmSize : 0);
+        }
+        if (!Otm || !OtmSize || !IntGetOutlineTextMetrics(FontGDI, OtmSize, Otm))
+            break;
+
+        /* Raster fonts stay out, their matching needs the metrics of each size */
+        if (!(Otm->otmTextMetrics.tmPitchAndFamily & (TMPF_TRUETYPE | TMPF_VECTOR)))
+            break;
+
+        Meta = IntReserveFontMeta(Cache, sizeof(FONT_META_FACE));
+        if (!Meta)
+            break;
+
+        Meta->FaceIndex = FontGDI->SharedFace->FaceIndex;
+        Meta->CharSet = FontGDI->CharSet;
+        Meta->OriginalItalic = FontGDI->OriginalItalic;
+        Meta->OriginalWeight = FontGDI->OriginalWeight;
+        Meta->tmHeight = FontGDI->tmHeight;
+        Meta->tmAscent = FontGDI->tmAscent;
+        Meta->tmDescent = FontGDI->tmDescent;
+        Meta->tmInternalLeading = FontGDI->tmInternalLeading;
+        Meta->EmHeight = FontGDI->EmHeight;
+        Meta->tmPitchAndFamily = Otm->otmTextMetrics.tmPitchAndFamily;
+        Meta->tmItalic = Otm->otmTextMetrics.tmItalic;
+        Meta->tmWeight = Otm->otmTextMetrics.tmWeight;
+
+        RtlInitUnicodeString(&FamilyName, (PWSTR)((ULONG_PTR)Otm + (ULONG_PTR)Otm->otmpFamilyName));
+        RtlInitUnicodeString(&FullName, (PWSTR)((ULONG_PTR)Otm + (ULONG_PTR)Otm->otmpFaceName));
+        if (!IntCopyFontMetaName(Meta->FaceName, sizeof(Meta->FaceName), &Entry->FaceName) ||
+            !IntCopyFontMetaName(Meta->StyleName, sizeof(Meta->StyleName), &Entry->StyleName) ||
+            !IntCopyFontMetaName(Meta->FamilyName, sizeof(Meta->FamilyName), &FamilyName) ||
+            !IntCopyFontMetaName(Meta->FullName, sizeof(Meta->FullName), &FullName))
+        {
+            break;
+        }
+
+        ++FaceCount;
+    }
+    Success = (ListEntry == &g_FontListHead && FaceCount > 0);
+    IntUnLockGlobalFonts();
+
+    if (Otm)
+        ExFreePoolWithTag(Otm, GDITAG_TEXT);
 
-            if (pFileName)
+    /* The buffer may have moved */
+    if (Success)
+        ((PFONT_META_FILE)(Cache->Buffer + Offset))->FaceCount = FaceCount;
+    else
+        Cache->Size = Offset;
+}
+
+/*
+ * Adds the fonts of a file from its font metadata cache record, without
+ * opening the file. IntLoadFontFace opens the faces when they are needed.
+ */
+static INT FASTCALL
+IntGdiLoadFontsFromMetaFile(PFONT_META_FILE MetaFile, PUNICODE_STRING PathName)
+{
+    PFONT_META_FACE Meta = (PFONT_META_FACE)(MetaFile + 1);
+    PSHARED_FACE SharedFace;
+    PFONT_ENTRY Entry;
+    PFONTGDI FontGDI;
+    PLIST_ENTRY ListEntry;
+    LIST_ENTRY ListHead;
+    ULONG i;
+    INT FaceCount = 0;
+
+    InitializeListHead(&ListHead);
+    for (i = 0; i < MetaFile->FaceCount; ++i, ++Meta)
+    {
+        /* The entries of a face share it, as when the file is loaded */
+        SharedFace = NULL;
+        IntLockFreeType();
+        for (ListEntry = ListHead.Flink; ListEntry != &ListHead; ListEntry = ListEntry->Flink)
+        {
+            Entry = CONTAINING_RECORD(ListEntry, FONT_ENTRY, ListEntry);
+            if (Entry->Font->SharedFace->FaceIndex == Meta->FaceIndex)
             {
-                if (!(dwFlags & AFRX_ALTERNATIVE_PATH))
-                {
-                    pFileName++;
-                }
-                DataSize = (wcslen(pFileName) + 1) * sizeof(WCHAR);
-                ZwSetValueKey(KeyHandle, &LoadFont.RegValueName, 0, REG_SZ,
-                              pFileName, DataSize);
+                SharedFace = Entry->Font->SharedFace;
+                SharedFace_AddRef(SharedFace);
+                break;
             }
-            ZwClose(KeyHandle);
         }
+        if (!SharedFace)
+        {
+            SharedFace = SharedFace_Create(NULL, NULL);
+            if (SharedFace)
+            {
+                SharedFace->FaceIndex = Meta->FaceIndex;
+                ++FaceCount;
+            }
+        }
+        IntUnLockFreeType();
+        if (!SharedFace)
+            break;
+
+        Entry = ExAllocatePoolWithTag(PagedPool, sizeof(FONT_ENTRY), TAG_FONT);
+        FontGDI = EngAllocMem(FL_ZERO_MEMORY, sizeof(FONTGDI), GDITAG_RFONT);
+        if (!Entry || !FontGDI)
+        {
+            if (Entry)
+                ExFreePoolWithTag(Entry, TAG_FONT);
+            if (FontGDI)
+                EngFreeMem(FontGDI);
+            SharedFace_Release(SharedFace);
+            break;
+        }
+
+        /* From now on, CleanupFontEntry frees what the entry has */
+        RtlZeroMemory(Entry, sizeof(FONT_ENTRY));
+        Entry->Font = FontGDI;
+        FontGDI->SharedFace = SharedFace;
+        InsertTailList(&ListHead, &Entry->ListEntry);
+
+        FontGDI->Filename = ExAllocatePoolWithTag(PagedPool,
+                                                  PathName->Length + sizeof(UNICODE_NULL),
+                                                  GDITAG_PFF);
+        Entry->Meta = ExAllocatePoolWithTag(PagedPool, sizeof(FONT_META_FACE), TAG_FONT);
+        if (!FontGDI->Filename || !Entry->Meta ||
+            !RtlCreateUnicodeString(&Entry->FaceName, Meta->FaceName) ||
+            (Meta->StyleName[0] && !RtlCreateUnicodeString(&Entry->StyleName, Meta->StyleName)))
+        {
+            break;
+        }
+
+        RtlCopyMemory(FontGDI->Filename, PathName->Buffer, PathName->Length);
+        FontGDI->Filename[PathName->Length / sizeof(WCHAR)] = UNICODE_NULL;
+        RtlCopyMemory(Entry->Meta, Meta, sizeof(FONT_META_FACE));
+
+        FontGDI->CharSet = Meta->CharSet;
+        FontGDI->OriginalItalic = Meta->OriginalItalic;
+        FontGDI->OriginalWeight = Meta->OriginalWeight;
+        FontGDI->RequestItalic = FALSE;
+        FontGDI->RequestWeight = FW_NORMAL;
+        FontGDI->tmHeight = Meta->tmHeight;
+        FontGDI->tmAscent = Meta->tmAscent;
+        FontGDI->tmDescent = Meta->tmDescent;
+        FontGDI->tmInternalLeading = Meta->tmInternalLeading;
+        FontGDI->EmHeight = Meta->EmHeight;
+        FontGDI->Magic = FONTGDI_MAGIC;
     }
-    RtlFreeUnicodeString(&LoadFont.RegValueName);
 
-    RtlFreeUnicodeString(&PathName);
-    return FontCount;
+    if (i < MetaFile->FaceCount)
+    {
+        /* Let the caller load the file instead */
+        while (!IsListEmpty(&ListHead))
+        {
+            ListEntry = RemoveHeadList(&ListHead);
+            CleanupFontEntry(CONTAINING_RECORD(ListEntry, FONT_ENTRY, ListEntry));
+        }
+        return 0;
+    }
+
+    IntLockGlobalFonts();
+    while (!IsListEmpty(&ListHead))
+    {
+        ListEntry = RemoveHeadList(&ListHead);
+        InsertTailList(&g_FontListHead, ListEntry);
+    }
+    IntUnLockGlobalFonts();
+
+    return FaceCount;
 }
 
-INT FASTCALL
-IntGdiAddFontResource(PUNICODE_STRING FileName, DWORD Characteristics)
+/*
+ * Opens the face of a font that was added from the font metadata cache.
+ * Returns FALSE if it can't be opened anymore.
+ */
+static BOOL
+IntLoadFontFace(PFONTGDI FontGDI)
 {
-    return IntGdiAddFontResourceEx(FileName, Characteristics, 0);
+    PSHARED_FACE SharedFace = FontGDI->SharedFace;
+    UNICODE_STRING PathName;
+    PSHARED_MEM Memory;
+    PVOID Buffer;
+    SIZE_T ViewSize;
+    FT_Face Face;
+    FT_Error Error;
+    NTSTATUS Status;
+
+    ASSERT_FREETYPE_LOCK_NOT_HELD();
+
+    /* A face never closes once open */
+    if (SharedFace->Face)
+        return TRUE;
+
+    ASSERT(FontGDI->Filename);
+    RtlInitUnicodeString(&PathName, FontGDI->Filename);
+    Status = IntMapFontFile(&PathName, &Buffer, &ViewSize);
+    if (!NT_SUCCESS(Status))
+        return FALSE;
+
+    Memory = SharedMem_Create(Buffer, ViewSize, TRUE);
+    if (!Memory)
+    {
+        MmUnmapViewInSystemSpace(Buffer);
+        return FALSE;
+    }
+
+    IntLockFreeType();
+    if (!SharedFace->Face)
+    {
+        Error = FT_New_Memory_Face(g_FreeTypeLibrary, Buffer, ViewSize,
+                                   SharedFace->FaceIndex, &Face);
+        if (!Error)
+        {
+            SharedFace->Memory = Memory;
+            SharedFace->Face = Face;
+            SharedMem_AddRef(Memory);
+            DPRINT("Opened face %ld of %wZ\n", SharedFace->FaceIndex, &PathName);
+        }
+        else
+        {
+            DPRINT1("Error opening face %ld of %wZ (error code: %d)\n",
+                    SharedFace->FaceIndex, &PathName, Error);
+        }
+    }
+
+    /* Release our copy */
+    SharedMem_Release(Memory);
+    IntUnLockFreeType();
+
+    return (SharedFace->Face != NULL);
+}
+
+/*
+ * Adds the fonts of a file while win32k starts. If the file didn't change
+ * since it went to the font metadata cache, the fonts are added from there
+ * and their faces are opened lazily. Otherwise the file is loaded as usual,
+ * and it goes to the new cache.
+ */
+static INT FASTCALL
+IntGdiAddStartupFontResource(PUNICODE_STRING FileName, DWORD dwFlags)
+{
+    NTSTATUS Status;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    FILE_NETWORK_OPEN_INFORMATION FileInfo;
+    UNICODE_STRING PathName, RegValueName;
+    PFONT_META_FILE MetaFile, NewMetaFile;
+    PLIST_ENTRY LastEntry;
+    ULONG Size;
+    INT FontCount;
+
+    if (!g_FontMetaCacheActive)
+        return IntGdiAddFontResourceEx(FileName, 0, dwFlags);
+
+    Status = IntGetFontPathName(FileName, dwFlags, &PathName);
+    if (!NT_SUCCESS(Status))
+        return 0;
+
+    InitializeObjectAttributes(&ObjectAttributes, &PathName,
+                               OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = ZwQueryFullAttributesFile(&ObjectAttributes, &FileInfo);
+    if (!NT_SUCCESS(Status))
+    {
+        RtlFreeUnicodeString(&PathName);
+        return IntGdiAddFontResourceEx(FileName, 0, dwFlags);
+    }
+
+    MetaFile = IntFindFontMetaFile(&g_FontMetaCacheOld, &PathName, &FileInfo);
+    if (MetaFile)
+    {
+        FontCount = IntGdiLoadFontsFromMetaFile(MetaFile, &PathName);
+        if (FontCount > 0)
+        {
+            if (dwFlags & AFRX_WRITE_REGISTRY)
+            {
+                RtlInitUnicodeString(&RegValueName, MetaFile->RegValueName);
+                IntWriteFontRegistryValue(&RegValueName, &PathName, dwFlags);
+            }
+
+            /* Keep the record in the new cache */
+            Size = sizeof(FONT_META_FILE) + MetaFile->FaceCount * sizeof(FONT_META_FACE);
+            NewMetaFile = IntReserveFontMeta(&g_FontMetaCacheNew, Size);
+            if (NewMetaFile)
+                RtlCopyMemory(NewMetaFile, MetaFile, Size);
+
+            RtlFreeUnicodeString(&PathName);
+            return FontCount;
+        }
+    }
+
+    /* The fonts of the file will follow the current last one */
+    IntLockGlobalFonts();
+    LastEntry = g_FontListHead.Blink;
+    IntUnLockGlobalFonts();
+
+    RtlInitUnicodeString(&RegValueName, NULL);
+    FontCount = IntGdiAddFontResourceWorker(FileName, 0, dwFlags, &RegValueName);
+    if (FontCount > 0)
+        IntRecordFontMetaFile(&PathName, &FileInfo, LastEntry, &RegValueName);
+
+    RtlFreeUnicodeString(&RegValueName);
+    RtlFreeUnicodeString(&PathName);
+    return FontCount;
 }
 
 /* Borrowed from shlwapi!PathIsRelativeW */
@@ -1802,7 +2504,7 @@ IntLoadFontsInRegistry(VOID)
         if (NT_SUCCESS(Status))
         {
             RtlCreateUnicodeString(&FileNameW, szPath);
-            nFontCount += IntGdiAddFontResourceEx(&FileNameW, 0, dwFlags);
+            nFontCount += IntGdiAddStartupFontResource(&FileNameW, dwFlags);
             RtlFreeUnicodeString(&FileNameW);
         }
 
@@ -2811,11 +3513,16 @@ FontFamilyFillInfo(PFONTFAMILYINFO Info, LPCWSTR FaceName,
     DWORD fs0;
     NTSTATUS status;
     PSHARED_FACE SharedFace = FontGDI->SharedFace;
-    FT_Face Face = SharedFace->Face;
+    FT_Face Face;
     UNICODE_STRING NameW;
 
     RtlInitUnicodeString(&NameW, NULL);
     RtlZeroMemory(Info, sizeof(FONTFAMILYINFO));
+    if (!IntLoadFontFace(FontGDI))
+    {
+        return;
+    }
+    Face = SharedFace->Face;
     Size = IntGetOutlineTextMetrics(FontGDI, 0, NULL);
     Otm = ExAllocatePoolWithTag(PagedPool, Size, GDITAG_TEXT);
     if (!Otm)
@@ -2978,6 +3685,25 @@ FontFamilyFillInfo(PFONTFAMILYINFO Info, LPCWSTR FaceName,
     Info->NewTextMetricEx.ntmFontSig = fs;
 }
 
+/*
+ * Whether a font entry may have the face name asked for, without opening its
+ * face. Entries added from the font metadata cache are checked against their
+ * cached names; the other ones are open already, and may match.
+ */
+static BOOL
+IntFontEntryMayMatchName(PFONT_ENTRY FontEntry, LPCWSTR FaceName)
+{
+    PFONT_META_FACE Meta = FontEntry->Meta;
+    const SIZE_T Length = LF_FACESIZE - 1;
+
+    if (!Meta || FontEntry->Font->SharedFace->Face)
+        return TRUE;
+
+    return (_wcsnicmp(FaceName, FontEntry->FaceName.Buffer, Length) == 0 ||
+            _wcsnicmp(FaceName, Meta->FamilyName, Length) == 0 ||
+            _wcsnicmp(FaceName, Meta->FullName, Length) == 0);
+}
+
 static BOOLEAN FASTCALL
 GetFontFamilyInfoForList(const LOGFONTW *LogFont,
                          PFONTFAMILYINFO Info,
@@ -3004,6 +3730,17 @@ GetFontFamilyInfoForList(const LOGFONTW *LogFont,
             continue;   /* charset mismatch */
         }
 
+        if (LogFont->lfFaceName[0] != UNICODE_NULL &&
+            !IntFontEntryMayMatchName(CurrentEntry, LogFont->lfFaceName))
+        {
+            continue;   /* name mismatch, the face stays closed */
+        }
+
+        if (!IntLoadFontFace(FontGDI))
+        {
+            continue;   /* the file went away */
+        }
+
         /* get one info entry */
         FontFamilyFillInfo(&InfoEntry, NULL, NULL, FontGDI);
 
@@ -3130,24 +3867,44 @@ SameScaleMatrix(
             FLOATOBJ_Equal(&pmx1->efM22, &pmx2->efM22));
 }
 
+/* The transformation is not hashed, glyphs that only differ by it share a bucket */
+static
+ULONG
+GlyphCacheHash(
+    FT_Face Face,
+    INT GlyphIndex,
+    INT Height,
+    FT_Render_Mode RenderMode)
+{
+    ULONG Hash;
+
+    Hash = (ULONG)((ULONG_PTR)Face >> 4);
+    Hash = Hash * 31 + (ULONG)GlyphIndex;
+    Hash = Hash * 31 + (ULONG)Height;
+    Hash = Hash * 31 + (ULONG)RenderMode;
+    return (Hash * 2654435761U) >> (32 - FONT_CACHE_HASH_BITS);
+}
+
 FT_BitmapGlyph APIENTRY
 ftGdiGlyphCacheGet(
-    FT_Face Face,
+    PSHARED_FACE SharedFace,
     INT GlyphIndex,
     INT Height,
     FT_Render_Mode RenderMode,
     PMATRIX pmx)
 {
-    PLIST_ENTRY CurrentEntry;
+    PLIST_ENTRY CurrentEntry, BucketHead;
     PFONT_CACHE_ENTRY FontEntry;
+    FT_Face Face = SharedFace->Face;
 
     ASSERT_FREETYPE_LOCK_HELD();
 
-    for (CurrentEntry = g_FontCacheListHead.Flink;
-         CurrentEntry != &g_FontCacheListHead;
+    BucketHead = &g_FontCacheHashTable[GlyphCacheHash(Face, GlyphIndex, Height, RenderMode)];
+    for (CurrentEntry = BucketHead->Flink;
+         CurrentEntry != BucketHead;
          CurrentEntry = CurrentEntry->Flink)
     {
-        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, ListEntry);
+        FontEntry = CONTAINING_RECORD(CurrentEntry, FONT_CACHE_ENTRY, HashEntry);
         if ((FontEntry->Face == Face) &&
             (FontEntry->GlyphIndex == GlyphIndex) &&
             (FontEntry->Height == Height) &&
@@ -3156,13 +3913,15 @@ ftGdiGlyphCacheGet(
             break;
     }
 
-    if (CurrentEntry == &g_FontCacheListHead)
+    if (CurrentEntry == BucketHead)
     {
+        g_FontCacheStats.Misses++;
         return NULL;
     }
 
-    RemoveEntryList(CurrentEntry);
-    InsertHeadList(&g_FontCacheListHead, CurrentEntry);
+    g_FontCacheStats.Hits++;
+    RemoveEntryList(&FontEntry->ListEntry);
+    InsertHeadList(&g_FontCacheListHead, &FontEntry->ListEntry);
     return FontEntry->BitmapGlyph;
 }
 
@@ -3210,7 +3969,7 @@ ftGdiGlyphSet(
 
 FT_BitmapGlyph APIENTRY
 ftGdiGlyphCacheSet(
-    FT_Face Face,
+    PSHARED_FACE SharedFace,
     INT GlyphIndex,
     INT Height,
     PMATRIX pmx,
@@ -3263,17 +4022,27 @@ ftGdiGlyphCacheSet(
     BitmapGlyph->bitmap = AlignedBitmap;
 
     NewEntry->GlyphIndex = GlyphIndex;
-    NewEntry->Face = Face;
+    NewEntry->Face = SharedFace->Face;
     NewEntry->BitmapGlyph = BitmapGlyph;
     NewEntry->Height = Height;
     NewEntry->RenderMode = RenderMode;
     NewEntry->mxWorldToDevice = *pmx;
+    NewEntry->Hash = GlyphCacheHash(NewEntry->Face, GlyphIndex, Height, RenderMode);
+    NewEntry->Size = sizeof(FONT_CACHE_ENTRY) + sizeof(FT_BitmapGlyphRec) +
+                     (SIZE_T)abs(BitmapGlyph->bitmap.pitch) * BitmapGlyph->bitmap.rows;
 
     InsertHeadList(&g_FontCacheListHead, &NewEntry->ListEntry);
-    if (++g_FontCacheNumEntries > MAX_FONT_CACHE)
+    InsertHeadList(&g_FontCacheHashTable[NewEntry->Hash], &NewEntry->HashEntry);
+    InsertHeadList(&SharedFace->GlyphCacheListHead, &NewEntry->FaceEntry);
+    g_FontCacheStats.Entries++;
+    g_FontCacheStats.Bytes += NewEntry->Size;
+
+    /* Drop the least recently used glyphs, but never the new one */
+    while (g_FontCacheStats.Bytes > FONT_CACHE_MAX_BYTES &&
+           g_FontCacheListHead.Blink != &NewEntry->ListEntry)
     {
-        NewEntry = CONTAINING_RECORD(g_FontCacheListHead.Blink, FONT_CACHE_ENTRY, ListEntry);
-        RemoveCachedEntry(NewEntry);
+        RemoveCachedEntry(CONTAINING_RECORD(g_FontCacheListHead.Blink, FONT_CACHE_ENTRY, ListEntry));
+        g_FontCacheStats.Evictions++;
     }
 
     return BitmapGlyph;
@@ -4275,7 +5044,7 @@ TextIntGetTextExtentPoint(PDC dc,
         if (EmuBold || EmuItalic)
             realglyph = NULL;
         else
-            realglyph = ftGdiGlyphCacheGet(face, glyph_index, plf->lfHeight,
+            realglyph = ftGdiGlyphCacheGet(FontGDI->SharedFace, glyph_index, plf->lfHeight,
                                            RenderMode, pmxWorldToDevice);
 
         if (EmuBold || EmuItalic || !realglyph)
@@ -4301,7 +5070,7 @@ TextIntGetTextExtentPoint(PDC dc,
             }
             else
             {
-                realglyph = ftGdiGlyphCacheSet(face,
+                realglyph = ftGdiGlyphCacheSet(FontGDI->SharedFace,
                                                glyph_index,
                                                plf->lfHeight,
                                                pmxWorldToDevice,
@@ -5022,6 +5791,43 @@ GetFontPenalty(const LOGFONTW *               LogFont,
 
 #undef GOT_PENALTY
 
+/*
+ * The least GetFontPenalty can give for a face that is not open yet, from its
+ * font metadata cache record. The terms that depend on the size are left out.
+ */
+static UINT
+GetFontMetaPenalty(const LOGFONTW *LogFont, const FONT_META_FACE *Meta)
+{
+    typedef struct _META_OTM
+    {
+        OUTLINETEXTMETRICW Otm;
+        WCHAR FamilyName[LF_FULLFACESIZE];
+        WCHAR FullName[LF_FULLFACESIZE];
+    } META_OTM;
+    META_OTM MetaOtm;
+    TEXTMETRICW *TM = &MetaOtm.Otm.otmTextMetrics;
+    LOGFONTW SizeLessLogFont;
+
+    RtlZeroMemory(&MetaOtm, sizeof(MetaOtm));
+    MetaOtm.Otm.otmSize = sizeof(MetaOtm);
+    MetaOtm.Otm.otmpFamilyName = (PSTR)(ULONG_PTR)FIELD_OFFSET(META_OTM, FamilyName);
+    MetaOtm.Otm.otmpFaceName = (PSTR)(ULONG_PTR)FIELD_OFFSET(META_OTM, FullName);
+    RtlCopyMemory(MetaOtm.FamilyName, Meta->FamilyName, sizeof(MetaOtm.FamilyName));
+    RtlCopyMemory(MetaOtm.FullName, Meta->FullName, sizeof(MetaOtm.FullName));
+
+    /* No average width either, for the aspect ratio */
+    TM->tmCharSet = Meta->CharSet;
+    TM->tmPitchAndFamily = Meta->tmPitchAndFamily;
+    TM->tmItalic = Meta->tmItalic;
+    TM->tmWeight = Meta->tmWeight;
+
+    SizeLessLogFont = *LogFont;
+    SizeLessLogFont.lfHeight = 0;
+    SizeLessLogFont.lfWidth = 0;
+
+    return GetFontPenalty(&SizeLessLogFont, &MetaOtm.Otm, NULL);
+}
+
 static __inline VOID
 FindBestFontFromList(FONTOBJ **FontObj, ULONG *MatchPenalty,
                      const LOGFONTW *LogFont,
@@ -5034,6 +5840,7 @@ FindBestFontFromList(FONTOBJ **FontObj, ULONG *MatchPenalty,
     OUTLINETEXTMETRICW *Otm = NULL;
     UINT OtmSize, OldOtmSize = 0;
     FT_Face Face;
+    ULONG Pass, Index, BestIndex;
 
     ASSERT(FontObj);
     ASSERT(MatchPenalty);
@@ -5044,42 +5851,79 @@ FindBestFontFromList(FONTOBJ **FontObj, ULONG *MatchPenalty,
     OldOtmSize = 0x200;
     Otm = ExAllocatePoolWithTag(PagedPool, OldOtmSize, GDITAG_TEXT);
 
-    /* get the FontObj of lowest penalty */
-    for (Entry = Head->Flink; Entry != Head; Entry = Entry->Flink)
+    /*
+     * The faces added from the font metadata cache are not open until they
+     * are needed. The first pass scores the other entries, the second one
+     * scores the cached ones, and only opens the faces that may still have
+     * the lowest penalty. On equal penalties, the first entry of the list
+     * wins, as it would in a single pass. Index 0 stands for the lists
+     * searched before.
+     */
+    BestIndex = 0;
+    for (Pass = 0; Pass < 2; ++Pass)
     {
-        CurrentEntry = CONTAINING_RECORD(Entry, FONT_ENTRY, ListEntry);
+        Index = 0;
 
-        FontGDI = CurrentEntry->Font;
-        ASSERT(FontGDI);
-        Face = FontGDI->SharedFace->Face;
-
-        /* get text metrics */
-        OtmSize = IntGetOutlineTextMetrics(FontGDI, 0, NULL);
-        if (OtmSize > OldOtmSize)
+        /* get the FontObj of lowest penalty */
+        for (Entry = Head->Flink; Entry != Head; Entry = Entry->Flink)
         {
-            if (Otm)
-                ExFreePoolWithTag(Otm, GDITAG_TEXT);
-            Otm = ExAllocatePoolWithTag(PagedPool, OtmSize, GDITAG_TEXT);
-        }
+            ++Index;
+            CurrentEntry = CONTAINING_RECORD(Entry, FONT_ENTRY, ListEntry);
 
-        /* update FontObj if lowest penalty */
-        if (Otm)
-        {
-            IntLockFreeType();
-            IntRequestFontSize(NULL, FontGDI, LogFont->lfWidth, LogFont->lfHeight);
-            IntUnLockFreeType();
+            FontGDI = CurrentEntry->Font;
+            ASSERT(FontGDI);
 
-            OtmSize = IntGetOutlineTextMetrics(FontGDI, OtmSize, Otm);
-            if (!OtmSize)
+            /* Each entry is scored in one pass only */
+            if ((Pass == 0) != (CurrentEntry->Meta == NULL))
                 continue;
 
-            OldOtmSize = OtmSize;
+            if (Pass == 1 && FontGDI->SharedFace->Face == NULL)
+            {
+                if (*MatchPenalty != 0xFFFFFFFF)
+                {
+                    Penalty = GetFontMetaPenalty(LogFont, CurrentEntry->Meta);
+                    if (Penalty > *MatchPenalty ||
+                        (Penalty == *MatchPenalty && Index > BestIndex))
+                    {
+                        continue;
+                    }
+                }
+
+                if (!IntLoadFontFace(FontGDI))
+                    continue;
+            }
+            Face = FontGDI->SharedFace->Face;
+
+            /* get text metrics */
+            OtmSize = IntGetOutlineTextMetrics(FontGDI, 0, NULL);
+            if (OtmSize > OldOtmSize)
+            {
+                if (Otm)
+                    ExFreePoolWithTag(Otm, GDITAG_TEXT);
+                Otm = ExAllocatePoolWithTag(PagedPool, OtmSize, GDITAG_TEXT);
+            }
 
-            Penalty = GetFontPenalty(LogFont, Otm, Face->style_name);
-            if (*MatchPenalty == 0xFFFFFFFF || Penalty < *MatchPenalty)
+            /* update FontObj if lowest penalty */
+            if (Otm)
             {
-                *FontObj = GDIToObj(FontGDI, FONT);
-                *MatchPenalty = Penalty;
+                IntLockFreeType();
+                IntRequestFontSize(NULL, FontGDI, LogFont->lfWidth, LogFont->lfHeight);
+                IntUnLockFreeType();
+
+                OtmSize = IntGetOutlineTextMetrics(FontGDI, OtmSize, Otm);
+                if (!OtmSize)
+                    continue;
+
+                OldOtmSize = OtmSize;
+
+                Penalty = GetFontPenalty(LogFont, Otm, Face->style_name);
+                if (*MatchPenalty == 0xFFFFFFFF || Penalty < *MatchPenalty ||
+                    (Penalty == *MatchPenalty && Index < BestIndex))
+                {
+                    *FontObj = GDIToObj(FontGDI, FONT);
+                    *MatchPenalty = Penalty;
+                    BestIndex = Index;
+                }
             }
         }
     }
@@ -5239,6 +6083,9 @@ TextIntRealizeFont(HFONT FontHandle, PTEXTOBJ pTextObj)
         PFONTGDI FontGdi = ObjToGDI(TextObj->Font, FONT);
         PSHARED_FACE SharedFace = FontGdi->SharedFace;
 
+        /* FindBestFontFromList opened the face, if it came from the metadata cache */
+        ASSERT(SharedFace->Face != NULL);
+
         IntLockFreeType();
         IntRequestFontSize(NULL, FontGdi, pLogFont->lfWidth, pLogFont->lfHeight);
         IntUnLockFreeType();
@@ -5377,7 +6224,8 @@ IntGdiGetFontResourceInfo(
     PFONT_ENTRY FontEntry;
     ULONG Size, i, Count;
     LPBYTE pbBuffer;
-    BOOL IsEqual;
+    BOOL IsEqual, IsSameFile = FALSE;
+    PCWSTR LastFileName = NULL;
     FONTFAMILYINFO *FamInfo;
     const ULONG MaxFamInfo = 64;
     const ULONG MAX_FAM_INFO_BYTES = sizeof(FONTFAMILYINFO) * MaxFamInfo;
@@ -5428,11 +6276,17 @@ IntGdiGetFontResourceInfo(
         if (FontEntry->Font->Filename == NULL)
             continue;
 
-        RtlInitUnicodeString(&EntryFileName , FontEntry->Font->Filename);
-        if (!IntGetFullFileName(NameInfo2, NAMEINFO_SIZE, &EntryFileName))
-            continue;
+        /* The entries of a file follow each other, resolve its name once */
+        if (LastFileName == NULL || wcscmp(LastFileName, FontEntry->Font->Filename) != 0)
+        {
+            LastFileName = FontEntry->Font->Filename;
+            RtlInitUnicodeString(&EntryFileName , FontEntry->Font->Filename);
+            IsSameFile = IntGetFullFileName(NameInfo2, NAMEINFO_SIZE, &EntryFileName) &&
+                         RtlEqualUnicodeString(&NameInfo1->Name, &NameInfo2->Name, FALSE);
+        }
 
-        if (!RtlEqualUnicodeString(&NameInfo1->Name, &NameInfo2->Name, FALSE))
+        /* Only the faces of the file asked for are opened */
+        if (!IsSameFile)
             continue;
 
         IsEqual = FALSE;
@@ -6109,7 +6963,7 @@ IntExtTextOutW(
             if (EmuBold || EmuItalic)
                 realglyph = NULL;
             else
-                realglyph = ftGdiGlyphCacheGet(face, glyph_index, plf->lfHeight,
+                realglyph = ftGdiGlyphCacheGet(FontGDI->SharedFace, glyph_index, plf->lfHeight,
                                                RenderMode, pmxWorldToDevice);
             if (!realglyph)
             {
@@ -6133,7 +6987,7 @@ IntExtTextOutW(
                 }
                 else
                 {
-                    realglyph = ftGdiGlyphCacheSet(face,
+                    realglyph = ftGdiGlyphCacheSet(FontGDI->SharedFace,
                                                    glyph_index,
                                                    plf->lfHeight,
                                                    pmxWorldToDevice,
@@ -6332,7 +7186,7 @@ IntExtTextOutW(
         if (EmuBold || EmuItalic)
             realglyph = NULL;
         else
-            realglyph = ftGdiGlyphCacheGet(face, glyph_index, plf->lfHeight,
+            realglyph = ftGdiGlyphCacheGet(FontGDI->SharedFace, glyph_index, plf->lfHeight,
                                            RenderMode, pmxWorldToDevice);
         if (!realglyph)
         {
@@ -6358,7 +7212,7 @@ IntExtTextOutW(
             }
             else
             {
-                realglyph = ftGdiGlyphCacheSet(face,
+                realglyph = ftGdiGlyphCacheSet(FontGDI->SharedFace,
                                                glyph_index,
                                                plf->lfHeight,
                                                pmxWorldToDevice,